@@ -1,6 +1,7 @@
 /** @file */
 
 #include "array.h"
+#include "lockstat.h"
 
 #include <errno.h>
 #include <pthread.h>
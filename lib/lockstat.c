@@ -0,0 +1,238 @@
+/** @file */
+
+#include "lockstat.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAXSITES 10 /* The number of hottest call sites reported */
+
+static struct lockstat_site *_lockstat_sites = NULL;
+static pthread_once_t _lockstat_once = PTHREAD_ONCE_INIT;
+
+static void _lockstat_add(struct lockstat_site *site, int contended, uint64_t wait);
+static void _lockstat_atexit(void);
+static int _lockstat_compare_file(const void *a, const void *b);
+static int _lockstat_compare_wait(const void *a, const void *b);
+static void _lockstat_init(void);
+static uint64_t _lockstat_now(void);
+
+/**
+ * Locks a stream, and records the acquisition in the statistics of the
+ * call site, along with the time waited if the stream was locked.
+ *
+ * @param [in] stream The stream.
+ * @param [in] site The call site.
+ * @see flockfile
+ */
+void
+lockstat_flockfile(FILE *stream, struct lockstat_site *site)
+{
+	uint64_t begin;
+
+	if (ftrylockfile(stream) == 0) {
+		_lockstat_add(site, 0, 0);
+		return;
+	}
+
+	begin = _lockstat_now();
+	(flockfile)(stream);
+	_lockstat_add(site, 1, _lockstat_now() - begin);
+}
+
+/**
+ * Locks a mutex, and records the acquisition in the statistics of the
+ * call site, along with the time waited if the mutex was locked.
+ *
+ * @param [in] mutex The mutex.
+ * @param [in] site The call site.
+ * @return Zero, or an error number.
+ * @see pthread_mutex_lock
+ */
+int
+lockstat_lock(pthread_mutex_t *mutex, struct lockstat_site *site)
+{
+	uint64_t begin;
+	int retval;
+
+	if (pthread_mutex_trylock(mutex) == 0) {
+		_lockstat_add(site, 0, 0);
+		return 0;
+	}
+
+	begin = _lockstat_now();
+	retval = (pthread_mutex_lock)(mutex);
+	_lockstat_add(site, 1, _lockstat_now() - begin);
+
+	return retval;
+}
+
+/**
+ * Reports the statistics of the call sites that locked so far: the
+ * acquisitions, contended acquisitions, wait time and wait time histogram
+ * of every file, which each hold the locks of one type, such as random.c
+ * for random_t, then the call sites that waited the longest. The report is
+ * written to stderr at exit in builds with lock statistics.
+ *
+ * @param [in] stream The stream to write to.
+ */
+void
+lockstat_report(FILE *stream)
+{
+	struct lockstat_site **sites;
+	struct lockstat_site *head;
+	struct lockstat_site *site;
+	uint64_t histogram[LOCKSTAT_NUM_BUCKETS];
+	char name[PATH_MAX];
+	uint64_t acquisitions;
+	uint64_t contentions;
+	uint64_t wait;
+	size_t num_sites;
+	size_t i;
+	size_t j;
+	int k;
+
+	if (stream == NULL) {
+		errno = EINVAL;
+		return;
+	}
+
+	/*
+	 * Sites are only ever pushed on the head, so the list from a head
+	 * read once stays the same while it is counted and copied.
+	 */
+	head = __atomic_load_n(&_lockstat_sites, __ATOMIC_ACQUIRE);
+	num_sites = 0;
+	for (site = head; site != NULL; site = site->next)
+		num_sites++;
+
+	sites = malloc((num_sites + 1) * sizeof(*sites));
+	if (sites == NULL)
+		return;
+
+	for (i = 0, site = head; i < num_sites; i++, site = site->next)
+		sites[i] = site;
+
+	qsort(sites, num_sites, sizeof(*sites), _lockstat_compare_file);
+	fprintf(stream, "%-24s %14s %14s %8s %16s\n", "file", "acquisitions", "contentions", "percent", "wait");
+	for (i = 0; i < num_sites; i = j) {
+		acquisitions = 0;
+		contentions = 0;
+		wait = 0;
+		memset(histogram, 0, sizeof(histogram));
+		for (j = i; j < num_sites && strcmp(sites[j]->file, sites[i]->file) == 0; j++) {
+			acquisitions += sites[j]->acquisitions;
+			contentions += sites[j]->contentions;
+			wait += sites[j]->wait;
+			for (k = 0; k < LOCKSTAT_NUM_BUCKETS; k++)
+				histogram[k] += sites[j]->histogram[k];
+		}
+
+		fprintf(stream, "%-24s %14llu %14llu %7.2f%% %14.3fms\n", sites[i]->file,
+		    (unsigned long long)acquisitions, (unsigned long long)contentions,
+		    acquisitions != 0 ? 100.0 * contentions / acquisitions : 0.0, wait / 1e6);
+		if (contentions == 0)
+			continue;
+
+		/* Bucket k holds the waits shorter than 2^(k+1) nanoseconds */
+		fprintf(stream, "  wait");
+		for (k = 0; k < LOCKSTAT_NUM_BUCKETS; k++) {
+			if (histogram[k] != 0)
+				fprintf(stream, " <%lluns:%llu", 1ULL << (k + 1), (unsigned long long)histogram[k]);
+		}
+
+		fprintf(stream, "\n");
+	}
+
+	qsort(sites, num_sites, sizeof(*sites), _lockstat_compare_wait);
+	fprintf(stream, "%-24s %14s %14s %8s %16s\n", "site", "acquisitions", "contentions", "percent", "wait");
+	for (i = 0; i < num_sites && i < MAXSITES && sites[i]->contentions != 0; i++) {
+		snprintf(name, sizeof(name), "%s:%u", sites[i]->file, sites[i]->line);
+		fprintf(stream, "%-24s %14llu %14llu %7.2f%% %14.3fms\n", name,
+		    (unsigned long long)sites[i]->acquisitions, (unsigned long long)sites[i]->contentions,
+		    100.0 * sites[i]->contentions / sites[i]->acquisitions, sites[i]->wait / 1e6);
+	}
+
+	free(sites);
+}
+
+/*
+ * The counters of a call site are shared by the threads locking there, so
+ * they are updated atomically. Call sites register themselves by pushing
+ * onto a lock-free list, as a lock here would be instrumented too.
+ */
+static void
+_lockstat_add(struct lockstat_site *site, int contended, uint64_t wait)
+{
+	int bucket;
+
+	if (!site->registered && __sync_bool_compare_and_swap(&site->registered, 0, 1)) {
+		pthread_once(&_lockstat_once, _lockstat_init);
+		do
+			site->next = _lockstat_sites;
+		while (!__sync_bool_compare_and_swap(&_lockstat_sites, site->next, site));
+	}
+
+	__sync_fetch_and_add(&site->acquisitions, 1);
+	if (!contended)
+		return;
+
+	bucket = wait > 1 ? 63 - __builtin_clzll(wait) : 0;
+	if (bucket >= LOCKSTAT_NUM_BUCKETS)
+		bucket = LOCKSTAT_NUM_BUCKETS - 1;
+
+	__sync_fetch_and_add(&site->contentions, 1);
+	__sync_fetch_and_add(&site->wait, wait);
+	__sync_fetch_and_add(&site->histogram[bucket], 1);
+}
+
+static void
+_lockstat_atexit(void)
+{
+	lockstat_report(stderr);
+}
+
+static int
+_lockstat_compare_file(const void *a, const void *b)
+{
+	const struct lockstat_site *x = *(const struct lockstat_site * const *)a;
+	const struct lockstat_site *y = *(const struct lockstat_site * const *)b;
+	int retval;
+
+	retval = strcmp(x->file, y->file);
+	if (retval != 0)
+		return retval;
+
+	return (x->line > y->line) - (x->line < y->line);
+}
+
+static int
+_lockstat_compare_wait(const void *a, const void *b)
+{
+	const struct lockstat_site *x = *(const struct lockstat_site * const *)a;
+	const struct lockstat_site *y = *(const struct lockstat_site * const *)b;
+
+	return (x->wait < y->wait) - (x->wait > y->wait);
+}
+
+static void
+_lockstat_init(void)
+{
+	atexit(_lockstat_atexit);
+}
+
+static uint64_t
+_lockstat_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
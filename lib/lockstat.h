@@ -0,0 +1,51 @@
+/** @file */
+
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LOCKSTAT_NUM_BUCKETS 32 /**< Number of buckets of the wait time histograms. */
+
+/**
+ * Statistics of a call site locking a mutex or a stream. Every call site
+ * has its own statistics, registered the first time it locks.
+ */
+struct lockstat_site {
+	const char *file;                        /**< The file of the call site. */
+	unsigned int line;                       /**< The line of the call site. */
+	int registered;                          /**< Whether the call site was registered. */
+	uint64_t acquisitions;                   /**< The number of acquisitions. */
+	uint64_t contentions;                    /**< The number of acquisitions that waited. */
+	uint64_t wait;                           /**< The total wait time, in nanoseconds. */
+	uint64_t histogram[LOCKSTAT_NUM_BUCKETS]; /**< The wait times, by power of two of nanoseconds. */
+	struct lockstat_site *next;              /**< The next registered call site. */
+};
+
+#ifdef LOCKSTAT
+/*
+ * The locks of the library are instrumented at their call sites, which
+ * each get a static site, so counting takes no lookup and no lock.
+ */
+#define pthread_mutex_lock(mutex) \
+	__extension__ ({ static struct lockstat_site _lockstat_site = {__FILE__, __LINE__}; lockstat_lock((mutex), &_lockstat_site); })
+
+#define flockfile(stream) \
+	__extension__ ({ static struct lockstat_site _lockstat_site = {__FILE__, __LINE__}; lockstat_flockfile((stream), &_lockstat_site); })
+#endif
+
+void lockstat_flockfile(FILE *stream, struct lockstat_site *site);
+int lockstat_lock(pthread_mutex_t *mutex, struct lockstat_site *site);
+void lockstat_report(FILE *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOCKSTAT_H */
@@ -1,5 +1,6 @@
 /** @file */
 
+#include "lockstat.h"
 #include "random.h"
 
 #include <errno.h>
@@ -0,0 +1,554 @@
+/** @file */
+
+#include "array.h"
+#include "coverage.h"
+#include "iofuzzer.h"
+#include "model.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAXSIZE 256 /* Size of the buffers of strings and bursts */
+#define NUM_PORTS 65536
+
+#define usage() \
+	fprintf(stderr, "Usage: %s [options] -o output corpus\n", PROGRAM_NAME)
+
+#define version() \
+	fprintf(stderr, "%s (%s) %s\n", PROGRAM_NAME, PACKAGE_NAME, PROGRAM_VERSION)
+
+struct job {
+	pthread_t thread;
+	int retval;
+};
+
+struct rarity {
+	uint32_t feature;
+	uint32_t count;
+};
+
+static char *corpus = NULL;
+static array_t *_dictionary = NULL;
+static char **entries = NULL;
+static size_t num_entries = 0;
+static size_t next_entry = 0;
+static size_t num_funcs = 0;
+static size_t num_features = 0;
+static uint64_t *best = NULL; /* Number of features of the best entry, and its complement index */
+static uint32_t *counts = NULL;
+static char *model = NULL;
+static array_t *_ports = NULL;
+static int strategy = IOFUZZER_STRATEGY_UNIFORM;
+
+static int
+cmin_filter(const struct dirent *dirent)
+{
+	return dirent->d_name[0] != '.';
+}
+
+static int
+cmin_compare(const void *a, const void *b)
+{
+	const struct rarity *x = a;
+	const struct rarity *y = b;
+
+	if (x->count != y->count)
+		return x->count < y->count ? -1 : 1;
+
+	return x->feature < y->feature ? -1 : x->feature > y->feature;
+}
+
+static void
+cmin_add(uint64_t *seen, array_t *features, uint32_t feature)
+{
+	if (seen[feature / 64] & (1ULL << (feature % 64)))
+		return;
+
+	seen[feature / 64] |= 1ULL << (feature % 64);
+	array_append_val(features, &feature);
+}
+
+/*
+ * The features of an entry are the (port, operation, value class) tuples
+ * of its operations, as with the coverage map of the fuzzer. With a
+ * model, the tuples of the values the model returns are features too,
+ * and the model is reset first, so every entry starts from the same
+ * device state.
+ */
+static int
+cmin_replay(iofuzzer_t *fuzzer, model_t *_model, size_t entry, uint64_t *seen, array_t *features)
+{
+	char *path;
+	uint64_t *states;
+	uintptr_t *variates;
+	unsigned long mask;
+	unsigned long value;
+	const char *name;
+	struct stat st;
+	size_t num_states;
+	size_t length;
+	size_t width;
+	size_t n;
+	size_t i;
+	size_t j;
+	int multiple;
+	int fd;
+
+	path = malloc(strlen(corpus) + strlen(entries[entry]) + 2);
+	if (path == NULL)
+		return -1;
+
+	sprintf(path, "%s/%s", corpus, entries[entry]);
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd == -1)
+		return -1;
+
+	states = NULL;
+	if (fstat(fd, &st) == 0)
+		states = malloc(st.st_size + 1);
+
+	if (states == NULL || read(fd, states, st.st_size) != st.st_size) {
+		free(states);
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+	num_states = st.st_size / sizeof(*states);
+	array_set_length(features, 0);
+	model_reset(_model);
+	variates = &array_index(iofuzzer_get_variates(fuzzer), uintptr_t, 0);
+	for (i = 0; i < num_states; i++) {
+		if (iofuzzer_set_state(fuzzer, (const char *)&states[i], sizeof(states[i])) == NULL)
+			continue;
+
+		name = iofuzzer_get_func_name(variates[0]);
+		length = strlen(name);
+		width = name[length - 1] == 'b' ? 1 : name[length - 1] == 'w' ? 2 : 4;
+		cmin_add(seen, features, ((variates[4] % NUM_PORTS) * num_funcs + variates[0]) * COVERAGE_NUM_CLASSES + coverage_get_class(variates[1], width));
+		if (_model == NULL)
+			continue;
+
+		/* Strings and bursts perform count operations on their buffer */
+		multiple = strstr(name, "burst") != NULL || name[length - 2] == 's';
+		n = multiple ? variates[3] : 1;
+		for (j = 0; j < n; j++) {
+			if (name[0] == 'i') {
+				value = model_in(_model, variates[4], width, &mask);
+				cmin_add(seen, features, num_features / 2 + ((variates[4] % NUM_PORTS) * num_funcs + variates[0]) * COVERAGE_NUM_CLASSES + coverage_get_class(value, width));
+			} else {
+				value = variates[1];
+				if (multiple && (j + 1) * width <= MAXSIZE)
+					memcpy(&value, (const char *)variates[5] + j * width, width);
+
+				model_out(_model, variates[4], width, value);
+			}
+		}
+	}
+
+	free(states);
+	for (i = 0; i < array_get_length(features); i++) {
+		n = array_index(features, uint32_t, i);
+		seen[n / 64] &= ~(1ULL << (n % 64));
+	}
+
+	return 0;
+}
+
+static iofuzzer_t *
+cmin_new_fuzzer(void)
+{
+	iofuzzer_t *fuzzer;
+
+	fuzzer = iofuzzer_new();
+	if (fuzzer == NULL)
+		return NULL;
+
+	iofuzzer_set_backend(fuzzer, IOFUZZER_BACKEND_NONE);
+	iofuzzer_set_ports(fuzzer, _ports);
+	iofuzzer_set_strategy(fuzzer, strategy);
+	iofuzzer_set_dictionary(fuzzer, _dictionary);
+
+	return fuzzer;
+}
+
+/*
+ * Every job replays entries until there are none left. Every feature
+ * keeps the entry with the most features that has it, and the number of
+ * entries that have it.
+ */
+static void *
+thread_start(void *arg)
+{
+	struct job *job = arg;
+	iofuzzer_t *fuzzer;
+	model_t *_model = NULL;
+	array_t *features;
+	uint64_t *seen;
+	uint64_t score;
+	uint64_t old;
+	uint32_t feature;
+	size_t entry;
+	size_t i;
+
+	fuzzer = cmin_new_fuzzer();
+	features = array_new(sizeof(uint32_t));
+	seen = calloc((num_features + 63) / 64, sizeof(*seen));
+	if (model != NULL)
+		_model = model_new(model);
+
+	if (fuzzer == NULL || features == NULL || seen == NULL || (model != NULL && _model == NULL)) {
+		perror("cmin");
+		job->retval = -1;
+		goto out;
+	}
+
+	while ((entry = __sync_fetch_and_add(&next_entry, 1)) < num_entries) {
+		if (cmin_replay(fuzzer, _model, entry, seen, features) == -1) {
+			perror(entries[entry]);
+			continue;
+		}
+
+		score = ((uint64_t)array_get_length(features) << 32) | (UINT32_MAX - entry);
+		for (i = 0; i < array_get_length(features); i++) {
+			feature = array_index(features, uint32_t, i);
+			__sync_fetch_and_add(&counts[feature], 1);
+			old = best[feature];
+			while (old < score && !__sync_bool_compare_and_swap(&best[feature], old, score))
+				old = best[feature];
+		}
+	}
+
+out:
+	free(seen);
+	array_unref(features);
+	model_unref(_model);
+	iofuzzer_unref(fuzzer);
+
+	return NULL;
+}
+
+static int
+cmin_copy(const char *name, const char *output)
+{
+	char *source;
+	char *dest;
+	char buffer[65536];
+	ssize_t n;
+	int in;
+	int out;
+	int retval;
+
+	source = malloc(strlen(corpus) + strlen(name) + 2);
+	dest = malloc(strlen(output) + strlen(name) + 2);
+	if (source == NULL || dest == NULL) {
+		free(source);
+		free(dest);
+		return -1;
+	}
+
+	sprintf(source, "%s/%s", corpus, name);
+	sprintf(dest, "%s/%s", output, name);
+	/* Entries are immutable, so they are linked if possible */
+	retval = link(source, dest);
+	if (retval == -1 && errno == EEXIST)
+		retval = 0;
+
+	if (retval == -1) {
+		in = open(source, O_RDONLY);
+		out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		retval = in == -1 || out == -1 ? -1 : 0;
+		while (retval == 0 && (n = read(in, buffer, sizeof(buffer))) > 0)
+			retval = write(out, buffer, n) == n ? 0 : -1;
+
+		if (in != -1)
+			close(in);
+
+		if (out != -1 && close(out) == -1)
+			retval = -1;
+	}
+
+	free(source);
+	free(dest);
+
+	return retval;
+}
+
+/*
+ * Features are covered from the rarest to the most common. The entry kept
+ * by an uncovered feature is selected, and replayed to cover all of its
+ * features, so rare features pull in the richest entries first.
+ */
+static int
+cmin_select(const char *output, size_t *num_selected, size_t *num_observed)
+{
+	struct rarity *rarities;
+	array_t *features;
+	iofuzzer_t *fuzzer;
+	model_t *_model = NULL;
+	uint64_t *covered;
+	uint64_t *seen;
+	char *selected;
+	uint32_t feature;
+	size_t entry;
+	size_t n;
+	size_t i;
+	size_t j;
+
+	n = 0;
+	for (i = 0; i < num_features; i++)
+		n += counts[i] != 0;
+
+	rarities = malloc(n * sizeof(*rarities) + 1);
+	covered = calloc((num_features + 63) / 64, sizeof(*covered));
+	seen = calloc((num_features + 63) / 64, sizeof(*seen));
+	selected = calloc(num_entries + 1, 1);
+	features = array_new(sizeof(uint32_t));
+	fuzzer = cmin_new_fuzzer();
+	if (model != NULL)
+		_model = model_new(model);
+
+	if (rarities == NULL || covered == NULL || seen == NULL || selected == NULL || features == NULL || fuzzer == NULL || (model != NULL && _model == NULL)) {
+		perror("cmin");
+		return -1;
+	}
+
+	for (i = 0, j = 0; i < num_features; i++) {
+		if (counts[i] == 0)
+			continue;
+
+		rarities[j].feature = i;
+		rarities[j++].count = counts[i];
+	}
+
+	qsort(rarities, n, sizeof(*rarities), cmin_compare);
+	*num_observed = n;
+	*num_selected = 0;
+	for (i = 0; i < n; i++) {
+		feature = rarities[i].feature;
+		if (covered[feature / 64] & (1ULL << (feature % 64)))
+			continue;
+
+		entry = UINT32_MAX - (uint32_t)best[feature];
+		if (selected[entry] || cmin_replay(fuzzer, _model, entry, seen, features) == -1) {
+			covered[feature / 64] |= 1ULL << (feature % 64);
+			continue;
+		}
+
+		selected[entry] = 1;
+		(*num_selected)++;
+		for (j = 0; j < array_get_length(features); j++) {
+			feature = array_index(features, uint32_t, j);
+			covered[feature / 64] |= 1ULL << (feature % 64);
+		}
+
+		if (cmin_copy(entries[entry], output) == -1) {
+			perror(entries[entry]);
+			return -1;
+		}
+	}
+
+	free(rarities);
+	free(covered);
+	free(seen);
+	free(selected);
+	array_unref(features);
+	model_unref(_model);
+	iofuzzer_unref(fuzzer);
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	enum {
+		OPT_HELP = CHAR_MAX + 1,
+		OPT_JOBS,
+		OPT_MODEL,
+		OPT_OUTPUT,
+		OPT_PORTS,
+		OPT_STRATEGY,
+		OPT_VERSION,
+	};
+	static struct option longopts[] = {
+		{"help",     no_argument,       NULL, 'h'          },
+		{"jobs",     required_argument, NULL, 'j'          },
+		{"model",    required_argument, NULL, OPT_MODEL    },
+		{"output",   required_argument, NULL, 'o'          },
+		{"ports",    required_argument, NULL, 'p'          },
+		{"strategy", required_argument, NULL, OPT_STRATEGY },
+		{"version",  no_argument,       NULL, OPT_VERSION  },
+		{NULL,       0,                 NULL, 0            }
+	};
+	static int longindex = 0;
+	int c;
+	unsigned long num_jobs;
+	struct job *jobs;
+	struct dirent **dirents;
+	char *output = NULL;
+	char *ports = NULL;
+	char *path;
+	model_t *_model;
+	size_t num_selected;
+	size_t num_observed;
+	int retval;
+	int n;
+	int i;
+
+	num_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt_long(argc, argv, "hj:o:p:", longopts, &longindex)) != -1) {
+		switch (c) {
+		case 'h':
+			usage();
+			exit(EXIT_FAILURE);
+
+		case 'j':
+			num_jobs = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'o':
+			output = optarg;
+			break;
+
+		case 'p':
+			ports = optarg;
+			break;
+
+		case OPT_MODEL:
+			model = optarg;
+			break;
+
+		case OPT_STRATEGY:
+			if ((strategy = iofuzzer_get_strategy_by_name(optarg)) == -1) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+
+			break;
+
+		case OPT_VERSION:
+			version();
+			exit(EXIT_FAILURE);
+
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind != 1 || output == NULL || num_jobs == 0) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	corpus = argv[optind];
+	if (ports != NULL) {
+		_ports = iofuzzer_parse_ports(ports);
+		if (_ports == NULL) {
+			perror("iofuzzer_parse_ports");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (model != NULL) {
+		_model = model_new(model);
+		if (_model == NULL) {
+			perror("model_new");
+			exit(EXIT_FAILURE);
+		}
+
+		model_unref(_model);
+	}
+
+	/* The states drawn with learned tokens replay with the learned dictionary */
+	path = malloc(strlen(corpus) + sizeof("/.dictionary"));
+	if (path == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	sprintf(path, "%s/.dictionary", corpus);
+	_dictionary = iofuzzer_read_dictionary(path);
+	if (_dictionary == NULL && errno != ENOENT) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	free(path);
+
+	if (mkdir(output, 0755) == -1 && errno != EEXIST) {
+		perror(output);
+		exit(EXIT_FAILURE);
+	}
+
+	n = scandir(corpus, &dirents, cmin_filter, alphasort);
+	if (n == -1) {
+		perror(corpus);
+		exit(EXIT_FAILURE);
+	}
+
+	num_entries = n;
+	num_funcs = iofuzzer_get_num_funcs();
+	num_features = NUM_PORTS * num_funcs * COVERAGE_NUM_CLASSES * (model != NULL ? 2 : 1);
+	entries = calloc(num_entries + 1, sizeof(*entries));
+	best = calloc(num_features, sizeof(*best));
+	counts = calloc(num_features, sizeof(*counts));
+	jobs = calloc(num_jobs, sizeof(*jobs));
+	if (entries == NULL || best == NULL || counts == NULL || jobs == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < n; i++)
+		entries[i] = dirents[i]->d_name;
+
+	for (i = 0; i < num_jobs; i++) {
+		errno = pthread_create(&jobs[i].thread, NULL, &thread_start, &jobs[i]);
+		if (errno != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	retval = 0;
+	for (i = 0; i < num_jobs; i++) {
+		pthread_join(jobs[i].thread, NULL);
+		retval |= jobs[i].retval;
+	}
+
+	if (retval == 0) {
+		retval = cmin_select(output, &num_selected, &num_observed);
+		if (retval == 0 && _dictionary != NULL && cmin_copy(".dictionary", output) == -1) {
+			perror(".dictionary");
+			retval = -1;
+		}
+
+		if (retval == 0)
+			fprintf(stderr, "%zu of %zu entries selected, %zu features preserved\n", num_selected, num_entries, num_observed);
+	}
+
+	for (i = 0; i < n; i++)
+		free(dirents[i]);
+
+	array_unref(_ports);
+	array_unref(_dictionary);
+	free(dirents);
+	free(entries);
+	free(best);
+	free(counts);
+	free(jobs);
+
+	exit(retval == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,390 @@
+/** @file */
+
+#include "array.h"
+#include "iofuzzer.h"
+#include "log.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNKSIZE 8
+#define MAXLAG 65536  /* Maximum number of records a thread may be ahead in one log */
+#define MAXSCAN 65536 /* Maximum number of records scanned for context */
+
+#define usage() \
+	fprintf(stderr, "Usage: %s [options] log1 log2\n", PROGRAM_NAME)
+
+#define version() \
+	fprintf(stderr, "%s (%s) %s\n", PROGRAM_NAME, PACKAGE_NAME, PROGRAM_VERSION)
+
+struct entry {
+	struct log_record record;
+	size_t offset;
+};
+
+struct queue {
+	uint32_t thread;
+	array_t *entries;
+	size_t head;
+	int side;
+	int dropped;
+};
+
+static unsigned long context = 3;
+static log_t *logs[2] = {NULL};
+static unsigned long max_count = 1;
+static unsigned long num_divergences = 0;
+static unsigned long num_records = 0;
+static size_t num_pending = 0;
+static array_t *queues = NULL;
+
+static uint64_t
+diff_compare(const struct log_record *a, const struct log_record *b)
+{
+	return (a->thread ^ b->thread) | (a->iteration ^ b->iteration) |
+	    (a->state ^ b->state) | (a->func ^ b->func) | (a->port ^ b->port) |
+	    (a->data ^ b->data) | (a->extra ^ b->extra) | (a->count ^ b->count) |
+	    (a->value ^ b->value);
+}
+
+static void
+diff_print_record(const char *prefix, const struct log_record *record)
+{
+	fputs(prefix, stdout);
+	log_print_record(stdout, record);
+}
+
+static void
+diff_print_context(log_t *log, size_t offset, uint32_t thread)
+{
+	struct log_record record;
+	size_t *offsets;
+	size_t count;
+	size_t scanned;
+	size_t next;
+
+	offsets = calloc(context + 1, sizeof(*offsets));
+	if (offsets == NULL)
+		return;
+
+	count = 0;
+	for (scanned = 0; count < context && scanned < MAXSCAN && offset > log_get_start(log); scanned++) {
+		offset = log_previous(log, offset);
+		next = offset;
+		if (log_read(log, &next, &record) != NULL && record.thread == thread)
+			offsets[count++] = offset;
+	}
+
+	while (count-- > 0) {
+		next = offsets[count];
+		if (log_read(log, &next, &record) != NULL)
+			diff_print_record("  ", &record);
+	}
+
+	free(offsets);
+}
+
+static int
+diff_report(const struct entry *a, const struct entry *b)
+{
+	const struct entry *entry;
+
+	num_divergences++;
+	entry = a != NULL ? a : b;
+	printf("divergence at thread %u iteration %llu\n", entry->record.thread,
+	    (unsigned long long)entry->record.iteration);
+	diff_print_context(logs[a != NULL ? 0 : 1], entry->offset, entry->record.thread);
+	if (a != NULL)
+		diff_print_record("< ", &a->record);
+	else
+		printf("< (missing)\n");
+
+	if (b != NULL)
+		diff_print_record("> ", &b->record);
+	else
+		printf("> (missing)\n");
+
+	return num_divergences >= max_count;
+}
+
+static int
+diff_match(const struct entry *a, const struct entry *b)
+{
+	num_records++;
+	if (diff_compare(&a->record, &b->record) == 0)
+		return 0;
+
+	return diff_report(a, b);
+}
+
+/*
+ * Queues are kept sorted by thread, so a thread number costs one queue,
+ * however large it is.
+ */
+static struct queue *
+diff_get_queue(uint32_t thread)
+{
+	struct queue queue = {0};
+	size_t begin;
+	size_t end;
+	size_t mid;
+
+	begin = 0;
+	end = array_get_length(queues);
+	while (begin < end) {
+		mid = begin + (end - begin) / 2;
+		if (array_index(queues, struct queue, mid).thread < thread)
+			begin = mid + 1;
+		else
+			end = mid;
+	}
+
+	if (begin < array_get_length(queues) && array_index(queues, struct queue, begin).thread == thread)
+		return &array_index(queues, struct queue, begin);
+
+	queue.thread = thread;
+	queue.entries = array_new(sizeof(struct entry));
+	if (queue.entries == NULL)
+		return NULL;
+
+	/* Insertions are only made before an element */
+	if (begin == array_get_length(queues))
+		array_append_val(queues, &queue);
+	else
+		array_insert_val(queues, begin, &queue);
+
+	if (array_index(queues, struct queue, begin).entries != queue.entries) {
+		array_unref(queue.entries);
+		return NULL;
+	}
+
+	return &array_index(queues, struct queue, begin);
+}
+
+static void
+diff_pop(struct queue *queue)
+{
+	num_pending--;
+	if (++queue->head == array_get_length(queue->entries)) {
+		array_set_length(queue->entries, 0);
+		queue->head = 0;
+	}
+}
+
+/*
+ * Records are aligned by (thread, iteration). The records of a thread
+ * that are ahead in one log wait in the queue of the thread until the
+ * other log catches up. A record whose iteration the other log skipped
+ * is reported missing from it, and only its own log advances. A thread
+ * more than MAXLAG records ahead, such as a thread only one of the runs
+ * had, is reported unmatched, and its records are dropped from then on.
+ */
+static int
+diff_push(int side, const struct entry *entry)
+{
+	struct queue *queue;
+	struct entry *other;
+	size_t pending;
+	int done;
+
+	queue = diff_get_queue(entry->record.thread);
+	if (queue == NULL) {
+		perror("array_new");
+		exit(EXIT_FAILURE);
+	}
+
+	if (queue->dropped)
+		return 0;
+
+	/* Waiting records before the iteration are missing from this log */
+	while (queue->head < array_get_length(queue->entries) && queue->side != side) {
+		other = &array_index(queue->entries, struct entry, queue->head);
+		if (other->record.iteration >= entry->record.iteration)
+			break;
+
+		done = diff_report(queue->side == 0 ? other : NULL, queue->side == 1 ? other : NULL);
+		diff_pop(queue);
+		if (done)
+			return 1;
+	}
+
+	if (queue->head == array_get_length(queue->entries) || queue->side == side) {
+		pending = array_get_length(queue->entries) - queue->head;
+		if (pending < MAXLAG) {
+			queue->side = side;
+			array_append_val(queue->entries, entry);
+			num_pending++;
+			return 0;
+		}
+
+		other = &array_index(queue->entries, struct entry, queue->head);
+		done = diff_report(side == 0 ? other : NULL, side == 1 ? other : NULL);
+		printf("thread %u unmatched in %s after %zu records, dropped\n", entry->record.thread,
+		    side == 0 ? "log2" : "log1", pending);
+		num_pending -= pending;
+		queue->dropped = 1;
+		queue->head = 0;
+		array_set_length(queue->entries, 0);
+
+		return done;
+	}
+
+	/* The iteration is missing from the other log */
+	other = &array_index(queue->entries, struct entry, queue->head);
+	if (other->record.iteration > entry->record.iteration)
+		return diff_report(side == 0 ? entry : NULL, side == 1 ? entry : NULL);
+
+	done = side == 0 ? diff_match(entry, other) : diff_match(other, entry);
+	diff_pop(queue);
+
+	return done;
+}
+
+static int
+diff_flush(void)
+{
+	struct queue *queue;
+	struct entry *entry;
+	size_t i;
+
+	for (i = 0; i < array_get_length(queues); i++) {
+		queue = &array_index(queues, struct queue, i);
+		if (queue->head == array_get_length(queue->entries))
+			continue;
+
+		entry = &array_index(queue->entries, struct entry, queue->head);
+		if (diff_report(queue->side == 0 ? entry : NULL, queue->side == 1 ? entry : NULL))
+			return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	enum {
+		OPT_CONTEXT = CHAR_MAX + 1,
+		OPT_HELP,
+		OPT_MAX_COUNT,
+		OPT_VERSION,
+	};
+	static struct option longopts[] = {
+		{"context",   required_argument, NULL, 'C'         },
+		{"help",      no_argument,       NULL, 'h'         },
+		{"max-count", required_argument, NULL, 'n'         },
+		{"version",   no_argument,       NULL, OPT_VERSION },
+		{NULL,        0,                 NULL, 0           }
+	};
+	static int longindex = 0;
+	int c;
+	struct entry a[CHUNKSIZE];
+	struct entry b[CHUNKSIZE];
+	size_t offsets[2];
+	size_t m;
+	size_t n;
+	size_t i;
+	uint64_t diff;
+	int done;
+
+	while ((c = getopt_long(argc, argv, "C:hn:", longopts, &longindex)) != -1) {
+		switch (c) {
+		case 'C':
+			context = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'h':
+			usage();
+			exit(EXIT_FAILURE);
+
+		case 'n':
+			max_count = strtoul(optarg, NULL, 0);
+			break;
+
+		case OPT_VERSION:
+			version();
+			exit(EXIT_FAILURE);
+
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < 2; i++) {
+		logs[i] = log_new(argv[optind + i]);
+		if (logs[i] == NULL) {
+			perror(argv[optind + i]);
+			exit(EXIT_FAILURE);
+		}
+
+		offsets[i] = log_get_start(logs[i]);
+	}
+
+	queues = array_new(sizeof(struct queue));
+	if (queues == NULL) {
+		perror("array_new");
+		exit(EXIT_FAILURE);
+	}
+
+	done = 0;
+	while (!done) {
+		for (m = 0; m < CHUNKSIZE; m++) {
+			a[m].offset = offsets[0];
+			if (log_read(logs[0], &offsets[0], &a[m].record) == NULL)
+				break;
+		}
+
+		for (n = 0; n < CHUNKSIZE; n++) {
+			b[n].offset = offsets[1];
+			if (log_read(logs[1], &offsets[1], &b[n].record) == NULL)
+				break;
+		}
+
+		if (m == 0 && n == 0)
+			break;
+
+		/* Fast path: both logs are aligned for the whole chunk */
+		if (num_pending == 0 && m == CHUNKSIZE && n == CHUNKSIZE) {
+			diff = 0;
+			for (i = 0; i < CHUNKSIZE; i++)
+				diff |= diff_compare(&a[i].record, &b[i].record);
+
+			if (diff == 0) {
+				num_records += CHUNKSIZE;
+				continue;
+			}
+		}
+
+		for (i = 0; !done && i < (m > n ? m : n); i++) {
+			if (i < m)
+				done = diff_push(0, &a[i]);
+
+			if (!done && i < n)
+				done = diff_push(1, &b[i]);
+		}
+	}
+
+	if (!done)
+		diff_flush();
+
+	fprintf(stderr, "%lu records compared, %lu divergences\n", num_records, num_divergences);
+	for (i = 0; i < array_get_length(queues); i++)
+		array_unref(array_index(queues, struct queue, i).entries);
+
+	array_unref(queues);
+	log_unref(logs[0]);
+	log_unref(logs[1]);
+
+	exit(num_divergences == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
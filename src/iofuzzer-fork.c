@@ -0,0 +1,409 @@
+/** @file */
+
+#include "array.h"
+#include "coverage.h"
+#include "forkserver.h"
+#include "iofuzzer.h"
+#include "model.h"
+#include "random.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAXFUNCS 32
+
+#define usage() \
+	fprintf(stderr, "Usage: %s [options] --model NAME\n", PROGRAM_NAME)
+
+#define version() \
+	fprintf(stderr, "%s (%s) %s\n", PROGRAM_NAME, PACKAGE_NAME, PROGRAM_VERSION)
+
+struct header {
+	uint32_t num_tuples;
+	uint32_t num_states;
+};
+
+struct tuple {
+	uint32_t port;
+	uint16_t func;
+	uint16_t width;
+	uint32_t value;
+};
+
+static char *corpus = NULL;
+static coverage_t *_coverage = NULL;
+static iofuzzer_t *fuzzer = NULL;
+static int inputs[MAXFUNCS] = {0};
+static unsigned long num_batch = 1;
+static unsigned long num_iterations = 4096;
+static unsigned long num_sequences = 100000;
+
+/*
+ * Runs a batch of sequences in a child, from the snapshot of the devices
+ * taken after setup. The sequences of a batch run one after the other, so
+ * the batch is reproduced as a whole. The tuples the batch adds to the
+ * coverage of the snapshot are sent back, and its states too if it added
+ * any, so the parent can save it to the corpus.
+ */
+static size_t
+fork_run(void *data, void *result, size_t size)
+{
+	struct header *header = result;
+	struct tuple *tuples = (struct tuple *)(header + 1);
+	random_t *random;
+	uintptr_t *variates;
+	uint64_t *states;
+	uint64_t seed;
+	unsigned long value;
+	unsigned long func;
+	unsigned long port;
+	size_t count;
+	char state[8];
+	unsigned long i;
+	unsigned long j;
+
+	header->num_tuples = 0;
+	header->num_states = 0;
+	states = malloc(num_batch * num_iterations * sizeof(*states));
+	if (states == NULL)
+		return 0;
+
+	variates = &array_index(iofuzzer_get_variates(fuzzer), uintptr_t, 0);
+	for (i = 0; i < num_batch; i++) {
+		seed = *(uint64_t *)data + i;
+		random = random_new_with_state((const char *)&seed, sizeof(seed));
+		if (random == NULL)
+			return 0;
+
+		iofuzzer_set_random(fuzzer, random);
+		random_unref(random);
+		for (j = 0; j < num_iterations; j++) {
+			iofuzzer_get_state(fuzzer, state, sizeof(state));
+			memcpy(&states[i * num_iterations + j], state, sizeof(*states));
+			func = variates[0];
+			port = variates[4];
+			value = variates[1];
+			count = coverage_count(_coverage);
+			iofuzzer_iterate(fuzzer);
+			if (func < MAXFUNCS && inputs[func])
+				value = iofuzzer_get_value(fuzzer);
+
+			coverage_add(_coverage, port, func, value, 1UL << (func % 3));
+			if (coverage_count(_coverage) == count)
+				continue;
+
+			tuples[header->num_tuples].port = port;
+			tuples[header->num_tuples].func = func;
+			tuples[header->num_tuples].width = 1UL << (func % 3);
+			tuples[header->num_tuples++].value = value;
+		}
+	}
+
+	if (header->num_tuples != 0 && corpus != NULL) {
+		memcpy(&tuples[header->num_tuples], states, num_batch * num_iterations * sizeof(*states));
+		header->num_states = num_batch * num_iterations;
+	}
+
+	return sizeof(*header) + header->num_tuples * sizeof(*tuples) + header->num_states * sizeof(*states);
+}
+
+static int
+fork_save(const uint64_t *states, size_t num_states)
+{
+	char *name;
+	char *path;
+	uint64_t hash;
+	size_t i;
+	int fd;
+	int retval;
+
+	hash = 0xcbf29ce484222325ULL;
+	for (i = 0; i < num_states * sizeof(*states); i++)
+		hash = (hash ^ ((const unsigned char *)states)[i]) * 0x100000001b3ULL;
+
+	name = malloc(strlen(corpus) + sizeof("/.tmp-XXXXXX"));
+	path = malloc(strlen(corpus) + sizeof("/0123456789abcdef"));
+	if (name == NULL || path == NULL) {
+		free(name);
+		free(path);
+		return -1;
+	}
+
+	sprintf(name, "%s/.tmp-XXXXXX", corpus);
+	sprintf(path, "%s/%016llx", corpus, (unsigned long long)hash);
+	retval = -1;
+	fd = mkstemp(name);
+	if (fd != -1) {
+		if (write(fd, states, num_states * sizeof(*states)) == (ssize_t)(num_states * sizeof(*states)))
+			retval = rename(name, path);
+
+		close(fd);
+		if (retval == -1)
+			unlink(name);
+	}
+
+	free(name);
+	free(path);
+
+	return retval;
+}
+
+/*
+ * Adds the tuples of a sequence to the coverage of the parent, so the
+ * children forked next only report what is still new to them.
+ */
+static size_t
+fork_merge(const struct forkserver_result *result)
+{
+	const struct header *header = result->data;
+	const struct tuple *tuples = (const struct tuple *)(header + 1);
+	size_t count;
+	uint32_t i;
+
+	if (result->size < sizeof(*header) ||
+	    result->size < sizeof(*header) + header->num_tuples * sizeof(*tuples) + header->num_states * sizeof(uint64_t))
+		return 0;
+
+	count = coverage_count(_coverage);
+	for (i = 0; i < header->num_tuples; i++)
+		coverage_add(_coverage, tuples[i].port, tuples[i].func, tuples[i].value, tuples[i].width);
+
+	count = coverage_count(_coverage) - count;
+	if (count != 0 && header->num_states != 0 &&
+	    fork_save((const uint64_t *)&tuples[header->num_tuples], header->num_states) == -1)
+		perror("fork_save");
+
+	return count;
+}
+
+int
+main(int argc, char *argv[])
+{
+	enum {
+		OPT_BATCH = CHAR_MAX + 1,
+		OPT_CORPUS,
+		OPT_HELP,
+		OPT_ITERATIONS,
+		OPT_JOBS,
+		OPT_MODEL,
+		OPT_NORMALIZE,
+		OPT_PORTS,
+		OPT_SEQUENCES,
+		OPT_STATE,
+		OPT_STRATEGY,
+		OPT_VERSION,
+	};
+	static struct option longopts[] = {
+		{"batch",      required_argument, NULL, 'b'           },
+		{"corpus",     required_argument, NULL, OPT_CORPUS    },
+		{"help",       no_argument,       NULL, 'h'           },
+		{"iterations", required_argument, NULL, 'n'           },
+		{"jobs",       required_argument, NULL, 'j'           },
+		{"model",      required_argument, NULL, OPT_MODEL     },
+		{"normalize",  required_argument, NULL, OPT_NORMALIZE },
+		{"ports",      required_argument, NULL, 'p'           },
+		{"sequences",  required_argument, NULL, 's'           },
+		{"state",      required_argument, NULL, OPT_STATE     },
+		{"strategy",   required_argument, NULL, OPT_STRATEGY  },
+		{"version",    no_argument,       NULL, OPT_VERSION   },
+		{NULL,         0,                 NULL, 0             }
+	};
+	static int longindex = 0;
+	int c;
+	unsigned long long first_state = 0;
+	unsigned long num_jobs;
+	unsigned long num_crashes = 0;
+	forkserver_t *server;
+	struct forkserver_result result;
+	struct timeval begin;
+	struct timeval end;
+	model_t *_model;
+	array_t *_ports = NULL;
+	array_t *sequence;
+	char *model = NULL;
+	char *normalize = NULL;
+	char *ports = NULL;
+	const char *name;
+	uint64_t seed;
+	uint64_t n;
+	size_t count;
+	size_t size;
+	double seconds;
+	int strategy = IOFUZZER_STRATEGY_UNIFORM;
+	size_t i;
+
+	num_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt_long(argc, argv, "b:hj:n:p:s:", longopts, &longindex)) != -1) {
+		switch (c) {
+		case 'b':
+			num_batch = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'h':
+			usage();
+			exit(EXIT_FAILURE);
+
+		case 'j':
+			num_jobs = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'n':
+			num_iterations = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'p':
+			ports = optarg;
+			break;
+
+		case 's':
+			num_sequences = strtoul(optarg, NULL, 0);
+			break;
+
+		case OPT_CORPUS:
+			corpus = optarg;
+			break;
+
+		case OPT_MODEL:
+			model = optarg;
+			break;
+
+		case OPT_NORMALIZE:
+			normalize = optarg;
+			break;
+
+		case OPT_STATE:
+			first_state = strtoull(optarg, NULL, 0);
+			break;
+
+		case OPT_STRATEGY:
+			if ((strategy = iofuzzer_get_strategy_by_name(optarg)) == -1) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+
+			break;
+
+		case OPT_VERSION:
+			version();
+			exit(EXIT_FAILURE);
+
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind != 0 || model == NULL || num_batch == 0 || num_jobs == 0 || num_iterations == 0) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	if (corpus != NULL && mkdir(corpus, 0755) == -1 && errno != EEXIST) {
+		perror(corpus);
+		exit(EXIT_FAILURE);
+	}
+
+	if (ports != NULL) {
+		_ports = iofuzzer_parse_ports(ports);
+		if (_ports == NULL) {
+			perror("iofuzzer_parse_ports");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < iofuzzer_get_num_funcs() && i < MAXFUNCS; i++) {
+		name = iofuzzer_get_func_name(i);
+		inputs[i] = strncmp(name, "in", 2) == 0 && strlen(name) == 3;
+	}
+
+	fuzzer = iofuzzer_new();
+	_model = model_new(model);
+	_coverage = coverage_new(_ports, iofuzzer_get_num_funcs());
+	if (fuzzer == NULL || _model == NULL || _coverage == NULL) {
+		perror("iofuzzer_new");
+		exit(EXIT_FAILURE);
+	}
+
+	iofuzzer_set_backend(fuzzer, IOFUZZER_BACKEND_MODEL);
+	iofuzzer_set_model(fuzzer, _model);
+	iofuzzer_set_ports(fuzzer, _ports);
+	iofuzzer_set_strategy(fuzzer, strategy);
+	model_unref(_model);
+
+	/* The devices are set up once; every child starts from the result */
+	if (normalize != NULL) {
+		sequence = iofuzzer_parse_sequence(normalize);
+		if (sequence == NULL) {
+			perror("iofuzzer_parse_sequence");
+			exit(EXIT_FAILURE);
+		}
+
+		iofuzzer_set_sequence(fuzzer, sequence);
+		iofuzzer_normalize(fuzzer);
+		array_unref(sequence);
+	}
+
+	size = sizeof(struct header) + num_batch * num_iterations * (sizeof(struct tuple) + sizeof(uint64_t));
+	server = forkserver_new(num_jobs, size);
+	result.data = malloc(size);
+	if (server == NULL || result.data == NULL) {
+		perror("forkserver_new");
+		exit(EXIT_FAILURE);
+	}
+
+	/* The output of the parent is flushed so children do not inherit it */
+	printf("seed,tuples\n");
+	fflush(stdout);
+	gettimeofday(&begin, NULL);
+	for (n = 0; n < num_sequences || forkserver_get_num_running(server) != 0; ) {
+		if (n < num_sequences && forkserver_get_num_running(server) < num_jobs) {
+			seed = first_state + n;
+			if (forkserver_fork(server, seed, fork_run, &seed) == NULL) {
+				perror("forkserver_fork");
+				exit(EXIT_FAILURE);
+			}
+
+			n += num_batch;
+			continue;
+		}
+
+		if (forkserver_reap(server, &result) == NULL) {
+			perror("forkserver_reap");
+			exit(EXIT_FAILURE);
+		}
+
+		if (!result.complete || !WIFEXITED(result.status) || WEXITSTATUS(result.status) != 0) {
+			fprintf(stderr, "crash,%#llx,%d\n", (unsigned long long)result.id,
+			    WIFSIGNALED(result.status) ? WTERMSIG(result.status) : WEXITSTATUS(result.status));
+			num_crashes++;
+			continue;
+		}
+
+		count = fork_merge(&result);
+		if (count != 0) {
+			printf("%#llx,%zu\n", (unsigned long long)result.id, count);
+			fflush(stdout);
+		}
+	}
+
+	gettimeofday(&end, NULL);
+	seconds = (end.tv_sec - begin.tv_sec) + (end.tv_usec - begin.tv_usec) / 1e6;
+	fprintf(stderr, "%lu sequences, %zu tuples, %lu crashes, %.0f sequences/s\n", num_sequences,
+	    coverage_count(_coverage), num_crashes, seconds > 0 ? num_sequences / seconds : 0.0);
+	free(result.data);
+	forkserver_unref(server);
+	coverage_unref(_coverage);
+	iofuzzer_unref(fuzzer);
+	array_unref(_ports);
+
+	exit(num_crashes == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,255 @@
+/** @file */
+
+#include "array.h"
+#include "log.h"
+#include "log_index.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define usage() \
+	fprintf(stderr, "Usage: %s [options] log\n", PROGRAM_NAME)
+
+#define version() \
+	fprintf(stderr, "%s (%s) %s\n", PROGRAM_NAME, PACKAGE_NAME, PROGRAM_VERSION)
+
+struct job {
+	pthread_t thread;
+	size_t begin;
+	size_t end;
+	array_t *entries;
+};
+
+static unsigned long count = 10;
+static uint64_t interval = LOG_INDEX_INTERVAL;
+static log_t *_log = NULL;
+
+static void *
+thread_start(void *arg)
+{
+	struct job *job = arg;
+	struct log_record record;
+	struct log_index_entry entry;
+	size_t offset;
+
+	offset = job->begin;
+	while (offset < job->end) {
+		entry.offset = log_get_position(_log, offset);
+		if (log_read(_log, &offset, &record) == NULL)
+			break;
+
+		if (record.iteration % interval != 0)
+			continue;
+
+		entry.iteration = record.iteration;
+		entry.time = record.time;
+		entry.thread = record.thread;
+		array_append_val(job->entries, &entry);
+	}
+
+	return NULL;
+}
+
+static int
+index_build(const char *path, unsigned long num_jobs)
+{
+	struct job *jobs;
+	struct log_index_header header;
+	FILE *stream;
+	size_t size;
+	size_t i;
+
+	jobs = calloc(num_jobs, sizeof(*jobs));
+	if (jobs == NULL) {
+		perror("calloc");
+		return -1;
+	}
+
+	/* Split the log on record boundaries; every job indexes its own chunk */
+	size = log_get_size(_log);
+	for (i = 0; i < num_jobs; i++) {
+		jobs[i].begin = log_align(_log, size / num_jobs * i);
+		jobs[i].end = i == num_jobs - 1 ? size : log_align(_log, size / num_jobs * (i + 1));
+		jobs[i].entries = array_new(sizeof(struct log_index_entry));
+		if (jobs[i].entries == NULL) {
+			perror("array_new");
+			return -1;
+		}
+
+		errno = pthread_create(&jobs[i].thread, NULL, &thread_start, &jobs[i]);
+		if (errno != 0) {
+			perror("pthread_create");
+			return -1;
+		}
+	}
+
+	stream = fopen(path, "w");
+	if (stream == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	memcpy(header.magic, LOG_INDEX_MAGIC, sizeof(header.magic));
+	header.interval = interval;
+	fwrite(&header, sizeof(header), 1, stream);
+	for (i = 0; i < num_jobs; i++) {
+		pthread_join(jobs[i].thread, NULL);
+		fwrite(&array_index(jobs[i].entries, struct log_index_entry, 0), sizeof(struct log_index_entry), array_get_length(jobs[i].entries), stream);
+		array_unref(jobs[i].entries);
+	}
+
+	free(jobs);
+	if (fclose(stream) == EOF) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+index_lookup(const char *path, long thread, uint64_t iteration, long time)
+{
+	log_index_t *index;
+	struct log_record record;
+	size_t offset;
+	unsigned long n;
+
+	index = log_index_new(path);
+	if (index == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	if (time != -1)
+		offset = log_index_find_time(index, time);
+	else
+		offset = log_index_find_iteration(index, thread, iteration);
+
+	log_index_unref(index);
+	offset = log_seek(_log, offset);
+	for (n = 0; n < count && log_read(_log, &offset, &record) != NULL; ) {
+		if (time != -1) {
+			if (record.time < time)
+				continue;
+		} else if (record.thread != thread || record.iteration < iteration)
+			continue;
+
+		log_print_record(stdout, &record);
+		n++;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	enum {
+		OPT_COUNT = CHAR_MAX + 1,
+		OPT_HELP,
+		OPT_INTERVAL,
+		OPT_ITERATION,
+		OPT_JOBS,
+		OPT_THREAD,
+		OPT_TIME,
+		OPT_VERSION,
+	};
+	static struct option longopts[] = {
+		{"count",     required_argument, NULL, 'c'         },
+		{"help",      no_argument,       NULL, 'h'         },
+		{"interval",  required_argument, NULL, 'i'         },
+		{"iteration", required_argument, NULL, 'n'         },
+		{"jobs",      required_argument, NULL, 'j'         },
+		{"thread",    required_argument, NULL, 't'         },
+		{"time",      required_argument, NULL, 'T'         },
+		{"version",   no_argument,       NULL, OPT_VERSION },
+		{NULL,        0,                 NULL, 0           }
+	};
+	static int longindex = 0;
+	int c;
+	unsigned long num_jobs;
+	long thread = -1;
+	uint64_t iteration = 0;
+	long time = -1;
+	char *path;
+	int retval;
+
+	num_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt_long(argc, argv, "c:hi:j:n:t:T:", longopts, &longindex)) != -1) {
+		switch (c) {
+		case 'c':
+			count = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'h':
+			usage();
+			exit(EXIT_FAILURE);
+
+		case 'i':
+			interval = strtoull(optarg, NULL, 0);
+			break;
+
+		case 'j':
+			num_jobs = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'n':
+			iteration = strtoull(optarg, NULL, 0);
+			break;
+
+		case 't':
+			thread = strtol(optarg, NULL, 0);
+			break;
+
+		case 'T':
+			time = strtol(optarg, NULL, 0);
+			break;
+
+		case OPT_VERSION:
+			version();
+			exit(EXIT_FAILURE);
+
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind != 1 || interval == 0 || num_jobs == 0) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	_log = log_new(argv[optind]);
+	if (_log == NULL) {
+		perror(argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+
+	path = malloc(strlen(argv[optind]) + sizeof(".idx"));
+	if (path == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	sprintf(path, "%s.idx", argv[optind]);
+	if (thread != -1)
+		retval = index_lookup(path, thread, iteration, -1);
+	else if (time != -1)
+		retval = index_lookup(path, -1, 0, time);
+	else
+		retval = index_build(path, num_jobs);
+
+	free(path);
+	log_unref(_log);
+
+	exit(retval == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
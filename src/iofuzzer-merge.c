@@ -0,0 +1,354 @@
+/** @file */
+
+#include "log.h"
+#include "log_index.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAXFANIN 64
+#define MAXTHREADS 4096 /* Number of threads of an input whose records are deduplicated */
+
+#define usage() \
+	fprintf(stderr, "Usage: %s [options] -o archive log...\n", PROGRAM_NAME)
+
+#define version() \
+	fprintf(stderr, "%s (%s) %s\n", PROGRAM_NAME, PACKAGE_NAME, PROGRAM_VERSION)
+
+struct input {
+	log_t *log;
+	size_t offset;
+	struct log_record record;
+	uint64_t *marks; /* The last iteration of every thread plus one, if deduplicated */
+	int done;
+};
+
+static unsigned long fan_in = MAXFANIN;
+static uint64_t interval = LOG_INDEX_INTERVAL;
+static unsigned long num_duplicates = 0;
+static unsigned long num_records = 0;
+
+static int
+merge_less(const struct input *inputs, size_t num_inputs, size_t a, size_t b)
+{
+	/* Leaf num_inputs is a sentinel smaller than any record */
+	if (a == num_inputs)
+		return 1;
+
+	if (b == num_inputs)
+		return 0;
+
+	if (inputs[a].done)
+		return 0;
+
+	if (inputs[b].done)
+		return 1;
+
+	if (inputs[a].record.time != inputs[b].record.time)
+		return inputs[a].record.time < inputs[b].record.time;
+
+	return a < b;
+}
+
+/*
+ * Replays the matches from a leaf to the root of the tournament tree. The
+ * internal nodes keep the loser of every match and the root keeps the
+ * overall winner, so a replay takes log2(k) comparisons.
+ */
+static void
+merge_adjust(size_t *tree, const struct input *inputs, size_t num_inputs, size_t leaf)
+{
+	size_t node;
+	size_t winner;
+	size_t tmp;
+
+	winner = leaf;
+	for (node = (leaf + num_inputs) / 2; node > 0; node /= 2) {
+		if (merge_less(inputs, num_inputs, tree[node], winner)) {
+			tmp = winner;
+			winner = tree[node];
+			tree[node] = tmp;
+		}
+	}
+
+	tree[0] = winner;
+}
+
+/*
+ * A record is a duplicate if its input already had a record of the same
+ * thread and a later or the same iteration, as happens when a run is
+ * resumed from a checkpoint. The iterations of a thread only grow within
+ * a run, so a high-water mark per input and thread is enough, and inputs
+ * are only compared to themselves: runs on the same seed share their
+ * iterations, but are not duplicates of each other.
+ */
+static int
+merge_is_duplicate(struct input *input)
+{
+	const struct log_record *record = &input->record;
+
+	if (record->thread >= MAXTHREADS)
+		return 0;
+
+	if (record->iteration < input->marks[record->thread])
+		return 1;
+
+	input->marks[record->thread] = record->iteration + 1;
+
+	return 0;
+}
+
+/*
+ * Records are deduplicated as they are read from the logs given, before
+ * their inputs are merged into temporary archives, so every record is
+ * compared to those of its own log.
+ */
+static int
+merge_files(char **paths, size_t num_paths, const char *path, int original, int final)
+{
+	struct input *inputs;
+	struct log_index_header header;
+	struct log_index_entry entry;
+	struct input *input;
+	size_t *tree;
+	FILE *stream;
+	FILE *index;
+	char *name;
+	size_t i;
+
+	inputs = calloc(num_paths, sizeof(*inputs));
+	tree = calloc(num_paths, sizeof(*tree));
+	if (inputs == NULL || tree == NULL) {
+		perror("calloc");
+		return -1;
+	}
+
+	for (i = 0; i < num_paths; i++) {
+		inputs[i].log = log_new(paths[i]);
+		if (inputs[i].log == NULL) {
+			perror(paths[i]);
+			return -1;
+		}
+
+		if (original) {
+			inputs[i].marks = calloc(MAXTHREADS, sizeof(*inputs[i].marks));
+			if (inputs[i].marks == NULL) {
+				perror("calloc");
+				return -1;
+			}
+		}
+
+		inputs[i].offset = log_get_start(inputs[i].log);
+		inputs[i].done = log_read(inputs[i].log, &inputs[i].offset, &inputs[i].record) == NULL;
+		tree[i] = num_paths;
+	}
+
+	stream = fopen(path, "w");
+	if (stream == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	index = NULL;
+	if (final) {
+		name = malloc(strlen(path) + sizeof(".idx"));
+		if (name == NULL) {
+			perror("malloc");
+			return -1;
+		}
+
+		sprintf(name, "%s.idx", path);
+		index = fopen(name, "w");
+		if (index == NULL) {
+			perror(name);
+			return -1;
+		}
+
+		free(name);
+		memcpy(header.magic, LOG_INDEX_MAGIC, sizeof(header.magic));
+		header.interval = interval;
+		fwrite(&header, sizeof(header), 1, index);
+	}
+
+	fwrite(LOG_MAGIC, sizeof(LOG_MAGIC) - 1, 1, stream);
+	for (i = num_paths; i-- > 0; )
+		merge_adjust(tree, inputs, num_paths, i);
+
+	for (;;) {
+		input = &inputs[tree[0]];
+		if (input->done)
+			break;
+
+		if (!original || !merge_is_duplicate(input)) {
+			if (index != NULL && input->record.iteration % interval == 0) {
+				entry.offset = ftello(stream);
+				entry.iteration = input->record.iteration;
+				entry.time = input->record.time;
+				entry.thread = input->record.thread;
+				fwrite(&entry, sizeof(entry), 1, index);
+			}
+
+			fwrite(&input->record, sizeof(input->record), 1, stream);
+			num_records += final;
+		} else
+			num_duplicates++;
+
+		input->done = log_read(input->log, &input->offset, &input->record) == NULL;
+		merge_adjust(tree, inputs, num_paths, tree[0]);
+	}
+
+	for (i = 0; i < num_paths; i++) {
+		log_unref(inputs[i].log);
+		free(inputs[i].marks);
+	}
+
+	free(inputs);
+	free(tree);
+	if (index != NULL && fclose(index) == EOF) {
+		perror("fclose");
+		return -1;
+	}
+
+	if (fclose(stream) == EOF) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Inputs beyond the fan-in are merged into temporary archives first, so
+ * the number of open inputs, and memory use, does not depend on the
+ * number of inputs. Duplicates are dropped by the first pass, which
+ * reads the logs given.
+ */
+static int
+merge(char **paths, size_t num_paths, const char *path, int original)
+{
+	char **temps;
+	const char *tmpdir;
+	size_t num_temps;
+	size_t n;
+	size_t i;
+	int retval;
+	int fd;
+
+	if (num_paths <= fan_in)
+		return merge_files(paths, num_paths, path, original, 1);
+
+	tmpdir = getenv("TMPDIR");
+	if (tmpdir == NULL)
+		tmpdir = P_tmpdir;
+
+	num_temps = (num_paths + fan_in - 1) / fan_in;
+	temps = calloc(num_temps, sizeof(*temps));
+	if (temps == NULL) {
+		perror("calloc");
+		return -1;
+	}
+
+	retval = 0;
+	for (i = 0; retval == 0 && i < num_temps; i++) {
+		temps[i] = malloc(strlen(tmpdir) + sizeof("/iofuzzer-merge.XXXXXX"));
+		if (temps[i] == NULL) {
+			perror("malloc");
+			retval = -1;
+			break;
+		}
+
+		sprintf(temps[i], "%s/iofuzzer-merge.XXXXXX", tmpdir);
+		fd = mkstemp(temps[i]);
+		if (fd == -1) {
+			perror(temps[i]);
+			free(temps[i]);
+			temps[i] = NULL;
+			retval = -1;
+			break;
+		}
+
+		close(fd);
+		n = num_paths - i * fan_in < fan_in ? num_paths - i * fan_in : fan_in;
+		retval = merge_files(&paths[i * fan_in], n, temps[i], original, 0);
+	}
+
+	if (retval == 0)
+		retval = merge(temps, num_temps, path, 0);
+
+	for (i = 0; i < num_temps && temps[i] != NULL; i++) {
+		unlink(temps[i]);
+		free(temps[i]);
+	}
+
+	free(temps);
+
+	return retval;
+}
+
+int
+main(int argc, char *argv[])
+{
+	enum {
+		OPT_FAN_IN = CHAR_MAX + 1,
+		OPT_HELP,
+		OPT_INTERVAL,
+		OPT_OUTPUT,
+		OPT_VERSION,
+	};
+	static struct option longopts[] = {
+		{"fan-in",   required_argument, NULL, OPT_FAN_IN  },
+		{"help",     no_argument,       NULL, 'h'         },
+		{"interval", required_argument, NULL, 'i'         },
+		{"output",   required_argument, NULL, 'o'         },
+		{"version",  no_argument,       NULL, OPT_VERSION },
+		{NULL,       0,                 NULL, 0           }
+	};
+	static int longindex = 0;
+	int c;
+	char *output = NULL;
+	int retval;
+
+	while ((c = getopt_long(argc, argv, "hi:o:", longopts, &longindex)) != -1) {
+		switch (c) {
+		case 'h':
+			usage();
+			exit(EXIT_FAILURE);
+
+		case 'i':
+			interval = strtoull(optarg, NULL, 0);
+			break;
+
+		case 'o':
+			output = optarg;
+			break;
+
+		case OPT_FAN_IN:
+			fan_in = strtoul(optarg, NULL, 0);
+			break;
+
+		case OPT_VERSION:
+			version();
+			exit(EXIT_FAILURE);
+
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind < 1 || output == NULL || interval == 0 || fan_in < 2) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	retval = merge(&argv[optind], argc - optind, output, 1);
+	fprintf(stderr, "%lu records merged, %lu duplicates dropped\n", num_records, num_duplicates);
+
+	exit(retval == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,680 @@
+/** @file */
+
+#include "random.h"
+
+#include <errno.h>
+#include <float.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BIRTHDAYS 512       /* Birthdays per sample of the birthday spacing test */
+#define DAYS (1ULL << 24)   /* Days of the birthday spacing test, the top 24 bits */
+#define MAXBINS 16          /* Bins of the frequency test, and per axis of the serial test */
+#define MAXGAP 16           /* Gaps of the gap test at least this long share a category */
+#define MAXRANGE 65536      /* Domains up to this size are tested value by value */
+#define MAXSTRING 256       /* Characters drawn per string */
+#define NUM_TESTS 5
+
+#define usage() \
+	fprintf(stderr, "Usage: %s [options]\n", PROGRAM_NAME)
+
+#define version() \
+	fprintf(stderr, "%s (%s) %s\n", PROGRAM_NAME, PACKAGE_NAME, PROGRAM_VERSION)
+
+struct job {
+	pthread_t thread;
+	int retval;
+};
+
+/*
+ * A subject draws samples in [0,domain) from a generator, one per call of
+ * the function under test, so the tests and the time per draw apply to
+ * the function as the fuzzer calls it. The whole value returned is
+ * checked against the range the function documents; a draw outside it is
+ * counted, and sampled as 0 so the tests still run. A known defect of a
+ * function is kept, since fixing it would change what existing seeds
+ * draw and break their replay, and is reported as a finding.
+ */
+struct subject {
+	const char *name;
+	unsigned long (*draw)(random_t *random, uint32_t *samples, size_t count, unsigned long end);
+	unsigned long end;
+	uint64_t domain;
+	const char *finding;
+};
+
+struct result {
+	double ns;
+	unsigned long num_outside;
+	double p[NUM_TESTS];
+};
+
+static unsigned long prng_draw_double(random_t *random, uint32_t *samples, size_t count, unsigned long end);
+static unsigned long prng_draw_fermat(random_t *random, uint32_t *samples, size_t count, unsigned long end);
+static unsigned long prng_draw_mersenne(random_t *random, uint32_t *samples, size_t count, unsigned long end);
+static unsigned long prng_draw_range(random_t *random, uint32_t *samples, size_t count, unsigned long end);
+static unsigned long prng_draw_string(random_t *random, uint32_t *samples, size_t count, unsigned long end);
+static unsigned long prng_draw_ulong(random_t *random, uint32_t *samples, size_t count, unsigned long end);
+
+static const char *tests[NUM_TESTS] = {
+	"frequency",
+	"serial",
+	"birthday",
+	"gap",
+	"range"
+};
+
+/* Strings draw the 95 printable characters */
+static const struct subject subjects[] = {
+	{"random_double",                      prng_draw_double,   0,          1ULL << 32, NULL },
+	{"random_ulong",                       prng_draw_ulong,    0,          1ULL << 32, "jrand48 is sign-extended so half the draws are above 2^32" },
+	{"random_ulong_with_range:2",          prng_draw_range,    2,          3,          NULL },
+	{"random_ulong_with_range:6",          prng_draw_range,    6,          7,          NULL },
+	{"random_ulong_with_range:99",         prng_draw_range,    99,         100,        NULL },
+	{"random_ulong_with_range:65534",      prng_draw_range,    65534,      65535,      NULL },
+	{"random_ulong_with_range:3221225471", prng_draw_range,    3221225471, 3221225472, NULL },
+	{"random_string",                      prng_draw_string,   0,          95,         "'%' is drawn twice as often and the terminating NUL is drawn" },
+	{"random_fermat_number",               prng_draw_fermat,   0,          31,         NULL },
+	{"random_mersenne_number",             prng_draw_mersenne, 0,          32,         NULL }
+};
+
+#define NUM_SUBJECTS (sizeof(subjects) / sizeof(subjects[0]))
+
+static unsigned long long first_state = 0;
+static unsigned long num_draws = 1UL << 20;
+static unsigned long next_subject = 0;
+static struct result results[NUM_SUBJECTS];
+
+static int
+prng_compare(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Returns the regularized upper incomplete gamma function Q(a,x), by its
+ * series below a+1 and by its continued fraction above.
+ */
+static double
+prng_gamma_q(double a, double x)
+{
+	double sum;
+	double term;
+	double b;
+	double c;
+	double d;
+	double h;
+	double an;
+	double delta;
+	int i;
+
+	if (x <= 0)
+		return 1;
+
+	if (x < a + 1) {
+		term = 1 / a;
+		sum = term;
+		for (i = 1; i < 10000 && fabs(term) > fabs(sum) * 1e-15; i++) {
+			term *= x / (a + i);
+			sum += term;
+		}
+
+		return 1 - sum * exp(-x + a * log(x) - lgamma(a));
+	}
+
+	b = x + 1 - a;
+	c = 1 / DBL_MIN;
+	d = 1 / b;
+	h = d;
+	for (i = 1; i < 10000; i++) {
+		an = -i * (i - a);
+		b += 2;
+		d = an * d + b;
+		d = fabs(d) < DBL_MIN ? DBL_MIN : d;
+		c = b + an / c;
+		c = fabs(c) < DBL_MIN ? DBL_MIN : c;
+		d = 1 / d;
+		delta = d * c;
+		h *= delta;
+		if (fabs(delta - 1) < 1e-15)
+			break;
+	}
+
+	return exp(-x + a * log(x) - lgamma(a)) * h;
+}
+
+/*
+ * Returns the p-value of a chi-square statistic, the probability of a
+ * statistic at least as large from a uniform generator.
+ */
+static double
+prng_chi_square(const uint64_t *counts, const double *probabilities, size_t num_bins, uint64_t total)
+{
+	double expected;
+	double x;
+	size_t df;
+	size_t i;
+
+	x = 0;
+	df = 0;
+	for (i = 0; i < num_bins; i++) {
+		expected = probabilities[i] * total;
+		if (expected <= 0)
+			continue;
+
+		x += (counts[i] - expected) * (counts[i] - expected) / expected;
+		df++;
+	}
+
+	if (df < 2)
+		return NAN;
+
+	return prng_gamma_q((df - 1) / 2.0, x / 2);
+}
+
+/* Returns the probability of a bin when a domain is split in bins */
+static double
+prng_bin_probability(uint64_t domain, uint64_t num_bins, uint64_t bin)
+{
+	uint64_t begin = (bin * domain + num_bins - 1) / num_bins;
+	uint64_t end = ((bin + 1) * domain + num_bins - 1) / num_bins;
+
+	return (double)(end - begin) / domain;
+}
+
+static double
+prng_test_birthday(const uint32_t *samples, size_t count, uint64_t domain)
+{
+	uint32_t days[BIRTHDAYS];
+	uint64_t collisions;
+	double lambda;
+	double lower;
+	double upper;
+	size_t num_samples;
+	size_t i;
+	size_t j;
+
+	/* Spacings only repeat by chance among birthdays in a large year */
+	if (domain != 1ULL << 32 || count < BIRTHDAYS)
+		return NAN;
+
+	collisions = 0;
+	num_samples = count / BIRTHDAYS;
+	for (i = 0; i < num_samples; i++) {
+		for (j = 0; j < BIRTHDAYS; j++)
+			days[j] = samples[i * BIRTHDAYS + j] >> 8;
+
+		qsort(days, BIRTHDAYS, sizeof(*days), prng_compare);
+
+		/* The first spacing is the first birthday */
+		for (j = BIRTHDAYS - 1; j > 0; j--)
+			days[j] -= days[j - 1];
+
+		qsort(days, BIRTHDAYS, sizeof(*days), prng_compare);
+		for (j = 1; j < BIRTHDAYS; j++)
+			collisions += days[j] == days[j - 1];
+	}
+
+	/* Collisions are Poisson, with a mean of m^3/4n per sample */
+	lambda = (double)BIRTHDAYS * BIRTHDAYS * BIRTHDAYS / (4.0 * DAYS) * num_samples;
+	lower = prng_gamma_q(collisions + 1, lambda);
+	upper = collisions == 0 ? 1 : 1 - prng_gamma_q(collisions, lambda);
+
+	return fmin(1, 2 * fmin(lower, upper));
+}
+
+static double
+prng_test_frequency(const uint32_t *samples, size_t count, uint64_t domain)
+{
+	uint64_t counts[MAXBINS] = {0};
+	double probabilities[MAXBINS];
+	uint64_t num_bins;
+	size_t i;
+
+	num_bins = domain < MAXBINS ? domain : MAXBINS;
+	for (i = 0; i < num_bins; i++)
+		probabilities[i] = prng_bin_probability(domain, num_bins, i);
+
+	for (i = 0; i < count; i++)
+		counts[samples[i] * num_bins / domain]++;
+
+	return prng_chi_square(counts, probabilities, num_bins, count);
+}
+
+static double
+prng_test_gap(const uint32_t *samples, size_t count, uint64_t domain)
+{
+	uint64_t counts[MAXGAP + 1] = {0};
+	double probabilities[MAXGAP + 1];
+	uint64_t num_gaps;
+	uint64_t half;
+	double p;
+	size_t gap;
+	size_t i;
+
+	/* A gap is the number of samples between two in the lower half */
+	half = domain / 2;
+	p = (double)half / domain;
+	num_gaps = 0;
+	gap = 0;
+	for (i = 0; i < count; i++) {
+		if (samples[i] >= half) {
+			gap++;
+			continue;
+		}
+
+		counts[gap < MAXGAP ? gap : MAXGAP]++;
+		num_gaps++;
+		gap = 0;
+	}
+
+	for (i = 0; i < MAXGAP; i++)
+		probabilities[i] = p * pow(1 - p, i);
+
+	probabilities[MAXGAP] = pow(1 - p, MAXGAP);
+
+	return prng_chi_square(counts, probabilities, MAXGAP + 1, num_gaps);
+}
+
+/*
+ * Range reduction is tested value by value when the domain is small
+ * enough, and on the low byte otherwise, where a biased reduction of a
+ * large domain shows.
+ */
+static double
+prng_test_range(const uint32_t *samples, size_t count, uint64_t domain)
+{
+	uint64_t *counts;
+	double *probabilities;
+	uint64_t num_bins;
+	double retval;
+	size_t i;
+
+	/* The low bytes of a domain that is not a multiple of 256 are not uniform */
+	if (domain > MAXRANGE && domain % 256 != 0)
+		return NAN;
+
+	num_bins = domain <= MAXRANGE ? domain : 256;
+	counts = calloc(num_bins, sizeof(*counts));
+	probabilities = malloc(num_bins * sizeof(*probabilities));
+	if (counts == NULL || probabilities == NULL) {
+		free(counts);
+		free(probabilities);
+		return NAN;
+	}
+
+	for (i = 0; i < num_bins; i++)
+		probabilities[i] = 1.0 / num_bins;
+
+	for (i = 0; i < count; i++)
+		counts[domain <= MAXRANGE ? samples[i] : samples[i] & 0xff]++;
+
+	retval = prng_chi_square(counts, probabilities, num_bins, count);
+	free(counts);
+	free(probabilities);
+
+	return retval;
+}
+
+static double
+prng_test_serial(const uint32_t *samples, size_t count, uint64_t domain)
+{
+	uint64_t counts[MAXBINS * MAXBINS] = {0};
+	double probabilities[MAXBINS * MAXBINS];
+	uint64_t num_bins;
+	size_t i;
+	size_t j;
+
+	num_bins = domain < MAXBINS ? domain : MAXBINS;
+	for (i = 0; i < num_bins; i++) {
+		for (j = 0; j < num_bins; j++)
+			probabilities[i * num_bins + j] = prng_bin_probability(domain, num_bins, i) * prng_bin_probability(domain, num_bins, j);
+	}
+
+	/* Pairs do not overlap, so the cells are independent */
+	for (i = 0; i + 1 < count; i += 2)
+		counts[samples[i] * num_bins / domain * num_bins + samples[i + 1] * num_bins / domain]++;
+
+	return prng_chi_square(counts, probabilities, num_bins * num_bins, count / 2);
+}
+
+static unsigned long
+prng_draw_double(random_t *random, uint32_t *samples, size_t count, unsigned long end)
+{
+	unsigned long num_outside;
+	double value;
+	size_t i;
+
+	num_outside = 0;
+	for (i = 0; i < count; i++) {
+		value = random_double(random);
+		if (!(value >= 0 && value < 1)) {
+			num_outside++;
+			value = 0;
+		}
+
+		samples[i] = value * 4294967296.0;
+	}
+
+	return num_outside;
+}
+
+static unsigned long
+prng_draw_fermat(random_t *random, uint32_t *samples, size_t count, unsigned long end)
+{
+	unsigned long num_outside;
+	unsigned long value;
+	size_t i;
+
+	/* Fermat numbers are 2^n+1 for n in [1,31] */
+	num_outside = 0;
+	for (i = 0; i < count; i++) {
+		value = random_fermat_number(random);
+		if (value < 3 || value - 1 > 1UL << 31 || ((value - 1) & (value - 2)) != 0) {
+			num_outside++;
+			samples[i] = 0;
+			continue;
+		}
+
+		samples[i] = 63 - __builtin_clzll(value - 1) - 1;
+	}
+
+	return num_outside;
+}
+
+static unsigned long
+prng_draw_mersenne(random_t *random, uint32_t *samples, size_t count, unsigned long end)
+{
+	unsigned long num_outside;
+	unsigned long value;
+	size_t i;
+
+	/* Mersenne numbers are 2^n-1 for n in [1,32] */
+	num_outside = 0;
+	for (i = 0; i < count; i++) {
+		value = random_mersenne_number(random);
+		if (value == 0 || value > UINT32_MAX || (value & (value + 1)) != 0) {
+			num_outside++;
+			samples[i] = 0;
+			continue;
+		}
+
+		samples[i] = 63 - __builtin_clzll(value + 1) - 1;
+	}
+
+	return num_outside;
+}
+
+static unsigned long
+prng_draw_range(random_t *random, uint32_t *samples, size_t count, unsigned long end)
+{
+	unsigned long num_outside;
+	unsigned long value;
+	size_t i;
+
+	num_outside = 0;
+	for (i = 0; i < count; i++) {
+		value = random_ulong_with_range(random, 0, end);
+		if (value > end) {
+			num_outside++;
+			value = 0;
+		}
+
+		samples[i] = value;
+	}
+
+	return num_outside;
+}
+
+static unsigned long
+prng_draw_string(random_t *random, uint32_t *samples, size_t count, unsigned long end)
+{
+	char string[MAXSTRING + 2];
+	unsigned long num_outside;
+	size_t length;
+	size_t i;
+	size_t j;
+
+	/* Strings stop at their first NUL, so their whole buffer is sampled */
+	num_outside = 0;
+	for (i = 0; i < count; i += length) {
+		length = count - i < MAXSTRING ? count - i : MAXSTRING;
+		memset(string, 0xff, sizeof(string));
+		random_string(random, string, length + 2);
+		for (j = 0; j < length; j++) {
+			if (string[j] < ' ' || string[j] > '~') {
+				num_outside++;
+				samples[i + j] = 0;
+				continue;
+			}
+
+			samples[i + j] = string[j] - ' ';
+		}
+
+		num_outside += string[length] != '\0';
+	}
+
+	return num_outside;
+}
+
+static unsigned long
+prng_draw_ulong(random_t *random, uint32_t *samples, size_t count, unsigned long end)
+{
+	unsigned long num_outside;
+	unsigned long value;
+	size_t i;
+
+	num_outside = 0;
+	for (i = 0; i < count; i++) {
+		value = random_ulong(random);
+		if (value > UINT32_MAX) {
+			num_outside++;
+			value = 0;
+		}
+
+		samples[i] = value;
+	}
+
+	return num_outside;
+}
+
+/*
+ * Every job tests subjects until there are none left. The time per draw
+ * is the CPU time of the thread, so jobs sharing a CPU do not inflate it.
+ */
+static void *
+thread_start(void *arg)
+{
+	static double (*functions[NUM_TESTS])(const uint32_t *, size_t, uint64_t) = {
+		prng_test_frequency,
+		prng_test_serial,
+		prng_test_birthday,
+		prng_test_gap,
+		prng_test_range
+	};
+	struct job *job = arg;
+	const struct subject *subject;
+	random_t *random;
+	uint32_t *samples;
+	unsigned long long state;
+	struct timespec begin;
+	struct timespec end;
+	unsigned long n;
+	int i;
+
+	samples = malloc(num_draws * sizeof(*samples));
+	if (samples == NULL) {
+		perror("malloc");
+		job->retval = -1;
+		return NULL;
+	}
+
+	while ((n = __sync_fetch_and_add(&next_subject, 1)) < NUM_SUBJECTS) {
+		subject = &subjects[n];
+		state = first_state + n;
+		random = random_new_with_state((char *)&state, sizeof(state));
+		if (random == NULL) {
+			perror("random_new_with_state");
+			job->retval = -1;
+			break;
+		}
+
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+		results[n].num_outside = subject->draw(random, samples, num_draws, subject->end);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+		random_unref(random);
+		results[n].ns = ((end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec)) / num_draws;
+		for (i = 0; i < NUM_TESTS; i++)
+			results[n].p[i] = functions[i](samples, num_draws, subject->domain);
+	}
+
+	free(samples);
+
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	enum {
+		OPT_ALPHA = CHAR_MAX + 1,
+		OPT_DRAWS,
+		OPT_HELP,
+		OPT_JOBS,
+		OPT_STATE,
+		OPT_VERSION,
+	};
+	static struct option longopts[] = {
+		{"alpha",   required_argument, NULL, OPT_ALPHA   },
+		{"draws",   required_argument, NULL, 'n'         },
+		{"help",    no_argument,       NULL, 'h'         },
+		{"jobs",    required_argument, NULL, 'j'         },
+		{"state",   required_argument, NULL, OPT_STATE   },
+		{"version", no_argument,       NULL, OPT_VERSION },
+		{NULL,      0,                 NULL, 0           }
+	};
+	static int longindex = 0;
+	int c;
+	double alpha = 1e-4;
+	unsigned long num_failures;
+	unsigned long num_findings;
+	unsigned long n;
+	unsigned long num_jobs;
+	struct job *jobs;
+	int retval;
+	size_t i;
+	int j;
+
+	num_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt_long(argc, argv, "hj:n:", longopts, &longindex)) != -1) {
+		switch (c) {
+		case 'h':
+			usage();
+			exit(EXIT_FAILURE);
+
+		case 'j':
+			num_jobs = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'n':
+			num_draws = strtoul(optarg, NULL, 0);
+			break;
+
+		case OPT_ALPHA:
+			alpha = strtod(optarg, NULL);
+			break;
+
+		case OPT_STATE:
+			first_state = strtoull(optarg, NULL, 0);
+			break;
+
+		case OPT_VERSION:
+			version();
+			exit(EXIT_FAILURE);
+
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind != 0 || num_draws < 2 || num_jobs == 0) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	jobs = calloc(num_jobs, sizeof(*jobs));
+	if (jobs == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < num_jobs; i++) {
+		errno = pthread_create(&jobs[i].thread, NULL, &thread_start, &jobs[i]);
+		if (errno != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	retval = 0;
+	for (i = 0; i < num_jobs; i++) {
+		pthread_join(jobs[i].thread, NULL);
+		retval |= jobs[i].retval;
+	}
+
+	/*
+	 * Tests that do not apply to a subject are left empty. A subject with
+	 * draws outside its range fails, whatever its p-values. The failures
+	 * of a subject with a known defect are findings, and do not fail the
+	 * suite.
+	 */
+	num_failures = 0;
+	num_findings = 0;
+	if (retval == 0) {
+		printf("subject,ns,outside");
+		for (j = 0; j < NUM_TESTS; j++)
+			printf(",%s", tests[j]);
+
+		printf(",finding\n");
+		for (i = 0; i < NUM_SUBJECTS; i++) {
+			printf("%s,%.2f,%lu", subjects[i].name, results[i].ns, results[i].num_outside);
+			n = results[i].num_outside != 0;
+			for (j = 0; j < NUM_TESTS; j++) {
+				if (isnan(results[i].p[j])) {
+					printf(",");
+					continue;
+				}
+
+				printf(",%.6f", results[i].p[j]);
+				n += results[i].p[j] < alpha;
+			}
+
+			if (n != 0 && subjects[i].finding != NULL) {
+				printf(",%s\n", subjects[i].finding);
+				num_findings += n;
+				continue;
+			}
+
+			printf(",\n");
+			num_failures += n;
+		}
+
+		fprintf(stderr, "%zu subjects, %lu draws, %lu failures and %lu findings at %g\n", NUM_SUBJECTS, num_draws, num_failures, num_findings, alpha);
+	}
+
+	free(jobs);
+
+	exit(retval == 0 && num_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,259 @@
+/** @file */
+
+#include "array.h"
+#include "log.h"
+#include "sink.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define usage() \
+	fprintf(stderr, "Usage: %s [options] -o log address\n", PROGRAM_NAME)
+
+#define version() \
+	fprintf(stderr, "%s (%s) %s\n", PROGRAM_NAME, PACKAGE_NAME, PROGRAM_VERSION)
+
+struct pending {
+	struct log_record record;
+	int pending;
+};
+
+static array_t *_pending = NULL;
+static FILE *_stream = NULL;
+static unsigned long num_records = 0;
+static unsigned long num_incomplete = 0;
+static unsigned long num_skipped = 0;
+
+static struct pending *
+recv_get_pending(uint32_t thread)
+{
+	size_t length;
+
+	length = array_get_length(_pending);
+	if (thread >= length) {
+		if (array_set_length(_pending, thread + 1) == NULL)
+			return NULL;
+
+		memset(&array_index(_pending, struct pending, length), 0, (thread + 1 - length) * sizeof(struct pending));
+	}
+
+	return &array_index(_pending, struct pending, thread);
+}
+
+static int
+recv_write(struct pending *pending)
+{
+	if (fwrite(&pending->record, sizeof(pending->record), 1, _stream) != 1)
+		return -1;
+
+	pending->pending = 0;
+	num_records++;
+
+	return 0;
+}
+
+/*
+ * Heads are kept per thread until their value arrives. A head followed by
+ * another head of the same thread lost its value, and is written as is.
+ */
+static int
+recv_frame(const struct sink_frame *frame)
+{
+	struct log_record record;
+	struct sink_value value;
+	struct pending *pending;
+
+	switch (frame->type) {
+	case SINK_FRAME_HEAD:
+		if (frame->length != LOG_RECORD_HEAD_SIZE)
+			break;
+
+		memset(&record, 0, sizeof(record));
+		memcpy(&record, frame->data, LOG_RECORD_HEAD_SIZE);
+		pending = recv_get_pending(record.thread);
+		if (pending == NULL)
+			return -1;
+
+		if (pending->pending) {
+			num_incomplete++;
+			if (recv_write(pending) == -1)
+				return -1;
+		}
+
+		pending->record = record;
+		pending->pending = 1;
+		break;
+
+	case SINK_FRAME_VALUE:
+		if (frame->length != sizeof(value))
+			break;
+
+		memcpy(&value, frame->data, sizeof(value));
+		pending = recv_get_pending(value.thread);
+		if (pending == NULL)
+			return -1;
+
+		if (pending->pending) {
+			pending->record.value = value.value;
+			if (recv_write(pending) == -1)
+				return -1;
+		}
+
+		break;
+
+	default:
+		num_skipped += frame->length;
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Frames are read until the sending end is closed, or its guest crashes.
+ * The heads still pending then are the operations in flight, and are
+ * written last with a zero value.
+ */
+static int
+recv_stream(int fd)
+{
+	struct sink_frame frame;
+	char *buffer;
+	size_t capacity;
+	size_t size;
+	size_t offset;
+	size_t n;
+	ssize_t retval;
+	size_t i;
+
+	capacity = 2 * (sizeof(struct sink_frame_header) + SINK_MAXLENGTH);
+	buffer = malloc(capacity);
+	if (buffer == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	size = 0;
+	for (;;) {
+		retval = read(fd, buffer + size, capacity - size);
+		if (retval == -1 && errno == EINTR)
+			continue;
+
+		/* A pty or console whose other end hung up fails with EIO */
+		if (retval == -1 && errno != EIO)
+			perror("read");
+
+		if (retval <= 0)
+			break;
+
+		size += retval;
+		for (offset = 0; (n = sink_decode(buffer + offset, size - offset, &frame)) != 0; offset += n) {
+			if (recv_frame(&frame) == -1) {
+				perror("recv_frame");
+				free(buffer);
+				return -1;
+			}
+		}
+
+		size -= offset;
+		memmove(buffer, buffer + offset, size);
+	}
+
+	free(buffer);
+	num_skipped += size;
+	for (i = 0; i < array_get_length(_pending); i++) {
+		if (!array_index(_pending, struct pending, i).pending)
+			continue;
+
+		num_incomplete++;
+		if (recv_write(&array_index(_pending, struct pending, i)) == -1) {
+			perror("fwrite");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	enum {
+		OPT_HELP = CHAR_MAX + 1,
+		OPT_OUTPUT,
+		OPT_VERSION,
+	};
+	static struct option longopts[] = {
+		{"help",    no_argument,       NULL, 'h'         },
+		{"output",  required_argument, NULL, 'o'         },
+		{"version", no_argument,       NULL, OPT_VERSION },
+		{NULL,      0,                 NULL, 0           }
+	};
+	static int longindex = 0;
+	int c;
+	char *output = NULL;
+	int retval;
+	int fd;
+
+	while ((c = getopt_long(argc, argv, "ho:", longopts, &longindex)) != -1) {
+		switch (c) {
+		case 'h':
+			usage();
+			exit(EXIT_FAILURE);
+
+		case 'o':
+			output = optarg;
+			break;
+
+		case OPT_VERSION:
+			version();
+			exit(EXIT_FAILURE);
+
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind != 1 || output == NULL) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	_pending = array_new(sizeof(struct pending));
+	if (_pending == NULL) {
+		perror("array_new");
+		exit(EXIT_FAILURE);
+	}
+
+	_stream = fopen(output, "w");
+	if (_stream == NULL) {
+		perror(output);
+		exit(EXIT_FAILURE);
+	}
+
+	fd = sink_accept(argv[optind]);
+	if (fd == -1) {
+		perror(argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+
+	fwrite(LOG_MAGIC, sizeof(LOG_MAGIC) - 1, 1, _stream);
+	retval = recv_stream(fd);
+	close(fd);
+	array_unref(_pending);
+	if (fclose(_stream) == EOF) {
+		perror(output);
+		retval = -1;
+	}
+
+	fprintf(stderr, "%lu records received, %lu incomplete, %lu bytes skipped\n", num_records, num_incomplete, num_skipped);
+
+	exit(retval == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
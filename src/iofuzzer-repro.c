@@ -0,0 +1,498 @@
+/** @file */
+
+#include "array.h"
+#include "iofuzzer.h"
+#include "log.h"
+#include "log_index.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXSIZE 256 /* Size of the buffers of string operations */
+
+#define usage() \
+	fprintf(stderr, "Usage: %s [options] log\n", PROGRAM_NAME)
+
+#define version() \
+	fprintf(stderr, "%s (%s) %s\n", PROGRAM_NAME, PACKAGE_NAME, PROGRAM_VERSION)
+
+enum {
+	FORMAT_ASM,
+	FORMAT_C,
+};
+
+enum {
+	KIND_SINGLE,
+	KIND_STRING,
+	KIND_BURST,
+};
+
+struct op {
+	struct log_record record;
+	const char *name;
+	int kind;
+	int input;
+	size_t width;
+	unsigned char buffer[MAXSIZE];
+	size_t size; /* Zero if the operation reads no buffer */
+};
+
+static unsigned long count = 1000;
+static int format = FORMAT_C;
+static iofuzzer_t *fuzzer = NULL;
+static unsigned long num_unknown = 0;
+
+/*
+ * The buffer written by a string operation or an output burst is not
+ * logged, so it is regenerated from the state of the record. It is only
+ * the same if the generator draws the same operation, that is, with the
+ * ports and strategy of the run.
+ */
+static void
+repro_regenerate(struct op *op)
+{
+	uintptr_t *variates;
+	const struct log_record *record = &op->record;
+
+	memset(op->buffer, 0, sizeof(op->buffer));
+	op->size = 0;
+	if (op->input || op->kind == KIND_SINGLE)
+		return;
+
+	op->size = record->count * op->width;
+	if (op->size > MAXSIZE)
+		op->size = MAXSIZE;
+
+	variates = &array_index(iofuzzer_get_variates(fuzzer), uintptr_t, 0);
+	if (iofuzzer_set_state(fuzzer, (const char *)&record->state, sizeof(record->state)) == NULL ||
+	    variates[0] != record->func || (uint32_t)variates[1] != record->data ||
+	    (uint32_t)variates[2] != record->extra || variates[3] != record->count ||
+	    variates[4] != record->port) {
+		fprintf(stderr, "%s: iteration %llu of thread %u: buffer not regenerated\n", PROGRAM_NAME,
+		    (unsigned long long)record->iteration, record->thread);
+		num_unknown++;
+		return;
+	}
+
+	memcpy(op->buffer, (const void *)variates[5], op->size);
+}
+
+static int
+repro_op(struct op *op, const struct log_record *record)
+{
+	size_t length;
+
+	op->record = *record;
+	op->name = iofuzzer_get_func_name(record->func);
+	if (op->name == NULL)
+		return -1;
+
+	length = strlen(op->name);
+	op->input = op->name[0] == 'i';
+	op->width = op->name[length - 1] == 'b' ? 1 : op->name[length - 1] == 'w' ? 2 : 4;
+	if (strstr(op->name, "burst") != NULL)
+		op->kind = KIND_BURST;
+	else if (op->name[length - 2] == 's')
+		op->kind = KIND_STRING;
+	else
+		op->kind = KIND_SINGLE;
+
+	repro_regenerate(op);
+
+	return 0;
+}
+
+static const char *
+repro_register(size_t width)
+{
+	return width == 1 ? "al" : width == 2 ? "ax" : "eax";
+}
+
+static char
+repro_suffix(size_t width)
+{
+	return width == 1 ? 'b' : width == 2 ? 'w' : 'l';
+}
+
+static unsigned long
+repro_element(const struct op *op, size_t i)
+{
+	unsigned long value = 0;
+
+	memcpy(&value, &op->buffer[i * op->width], op->width);
+
+	return value;
+}
+
+static void
+repro_print_buffer(FILE *stream, const struct op *op, size_t n)
+{
+	size_t i;
+
+	if (format == FORMAT_ASM) {
+		fprintf(stream, "buffer%zu:", n);
+		for (i = 0; i < op->size; i++)
+			fprintf(stream, "%s%#x", i % 16 == 0 ? "\n\t.byte " : ", ", op->buffer[i]);
+
+		fprintf(stream, "\n");
+		return;
+	}
+
+	fprintf(stream, "static unsigned char buffer%zu[%d] = {", n, MAXSIZE);
+	for (i = 0; i < op->size; i++)
+		fprintf(stream, "%s%#x,", i % 16 == 0 ? "\n\t" : " ", op->buffer[i]);
+
+	fprintf(stream, "\n};\n\n");
+}
+
+/*
+ * Every operation sets the registers the fuzzer sets: the data, extra,
+ * count and port variates in the a, b, c and d registers, and the output
+ * and input buffers in the source and destination index registers.
+ * Bursts only use the a and d registers, as the unrolled kernels do.
+ */
+static void
+repro_print_asm(FILE *stream, const struct op *op, size_t n)
+{
+	const struct log_record *record = &op->record;
+	char suffix = repro_suffix(op->width);
+	size_t i;
+
+	fprintf(stream, "\t/* %llu,%u,%#llx,%s,%#x,%#x,%#x,%#x -> %#x */\n", (unsigned long long)record->iteration,
+	    record->thread, (unsigned long long)record->state, op->name, record->data, record->extra,
+	    record->count, record->port, record->value);
+	if (op->kind == KIND_BURST) {
+		fprintf(stream, "\tmov $%#x, %%edx\n", record->port);
+		for (i = 0; i < record->count; i++) {
+			if (op->input)
+				fprintf(stream, "\tin%c %%dx, %%%s\n", suffix, repro_register(op->width));
+			else
+				fprintf(stream, "\tmov $%#lx, %%eax\n\tout%c %%%s, %%dx\n", repro_element(op, i), suffix, repro_register(op->width));
+		}
+
+		return;
+	}
+
+	fprintf(stream, "\tmov $%#x, %%eax\n", record->data);
+	fprintf(stream, "\tmov $%#x, %%ebx\n", record->extra);
+	fprintf(stream, "\tmov $%#x, %%ecx\n", record->count);
+	fprintf(stream, "\tmov $%#x, %%edx\n", record->port);
+	if (op->size != 0)
+		fprintf(stream, "\tlea buffer%zu(%%rip), %%rsi\n", n);
+	else
+		fprintf(stream, "\tlea output(%%rip), %%rsi\n");
+
+	fprintf(stream, "\tlea input(%%rip), %%rdi\n");
+	if (op->kind == KIND_STRING)
+		fprintf(stream, "\trep %ss%c\n", op->input ? "in" : "out", suffix);
+	else if (op->input)
+		fprintf(stream, "\tin%c %%dx, %%%s\n", suffix, repro_register(op->width));
+	else
+		fprintf(stream, "\tout%c %%%s, %%dx\n", suffix, repro_register(op->width));
+}
+
+static void
+repro_print_c(FILE *stream, const struct op *op, size_t n)
+{
+	const struct log_record *record = &op->record;
+	char suffix = repro_suffix(op->width);
+	char source[32];
+	size_t i;
+
+	fprintf(stream, "\t/* %llu,%u,%#llx,%s,%#x,%#x,%#x,%#x -> %#x */\n", (unsigned long long)record->iteration,
+	    record->thread, (unsigned long long)record->state, op->name, record->data, record->extra,
+	    record->count, record->port, record->value);
+	if (op->kind == KIND_BURST) {
+		for (i = 0; i < record->count; i++) {
+			if (op->input)
+				fprintf(stream, "\tasm volatile(\"in%c %%%%dx, %%%%%s\" : \"=a\" (value) : \"d\" (%#x));\n",
+				    suffix, repro_register(op->width), record->port);
+			else
+				fprintf(stream, "\tasm volatile(\"out%c %%%%%s, %%%%dx\" :: \"a\" (%#lx), \"d\" (%#x));\n",
+				    suffix, repro_register(op->width), repro_element(op, i), record->port);
+		}
+
+		return;
+	}
+
+	if (op->size != 0)
+		sprintf(source, "buffer%zu", n);
+	else
+		strcpy(source, "output");
+
+	if (op->kind == KIND_STRING && op->input) {
+		fprintf(stream, "\tcount = %#x;\n\tpointer = input;\n", record->count);
+		fprintf(stream, "\tasm volatile(\"rep; ins%c\" : \"+c\" (count), \"+D\" (pointer) : \"a\" (%#x), \"b\" (%#x), \"d\" (%#x), \"S\" (%s) : \"memory\");\n",
+		    suffix, record->data, record->extra, record->port, source);
+	} else if (op->kind == KIND_STRING) {
+		fprintf(stream, "\tcount = %#x;\n\tpointer = %s;\n", record->count, source);
+		fprintf(stream, "\tasm volatile(\"rep; outs%c\" : \"+c\" (count), \"+S\" (pointer) : \"a\" (%#x), \"b\" (%#x), \"d\" (%#x), \"D\" (input) : \"memory\");\n",
+		    suffix, record->data, record->extra, record->port);
+	} else if (op->input) {
+		fprintf(stream, "\tvalue = %#x;\n", record->data);
+		fprintf(stream, "\tasm volatile(\"in%c %%%%dx, %%%%%s\" : \"+a\" (value) : \"b\" (%#x), \"c\" (%#x), \"d\" (%#x), \"S\" (%s), \"D\" (input));\n",
+		    suffix, repro_register(op->width), record->extra, record->count, record->port, source);
+	} else
+		fprintf(stream, "\tasm volatile(\"out%c %%%%%s, %%%%dx\" :: \"a\" (%#x), \"b\" (%#x), \"c\" (%#x), \"d\" (%#x), \"S\" (%s), \"D\" (input));\n",
+		    suffix, repro_register(op->width), record->data, record->extra, record->count, record->port, source);
+}
+
+static int
+repro_export(FILE *stream, const char *path, array_t *ops)
+{
+	struct op *op;
+	size_t i;
+
+	fprintf(stream, "/* Generated by %s from %s */\n\n", PROGRAM_NAME, path);
+	if (format == FORMAT_ASM) {
+		fprintf(stream, "\t.data\n");
+		for (i = 0; i < array_get_length(ops); i++) {
+			op = &array_index(ops, struct op, i);
+			if (op->kind == KIND_STRING && op->size != 0)
+				repro_print_buffer(stream, op, i);
+		}
+
+		fprintf(stream, "\n\t.bss\noutput:\n\t.zero %d\ninput:\n\t.zero %d\n\n", MAXSIZE, MAXSIZE);
+		fprintf(stream, "\t.text\n\t.globl _start\n_start:\n");
+		fprintf(stream, "\tmov $172, %%eax /* iopl(3) */\n\tmov $3, %%edi\n\tsyscall\n\ttest %%rax, %%rax\n\tjnz 1f\n\n");
+		for (i = 0; i < array_get_length(ops); i++)
+			repro_print_asm(stream, &array_index(ops, struct op, i), i);
+
+		fprintf(stream, "\n\txor %%edi, %%edi\n\tjmp 2f\n1:\n\tmov $1, %%edi\n2:\n\tmov $60, %%eax /* exit */\n\tsyscall\n");
+		return ferror(stream) ? -1 : 0;
+	}
+
+	fprintf(stream, "#include <stdio.h>\n#include <stdlib.h>\n#include <sys/io.h>\n\n");
+	for (i = 0; i < array_get_length(ops); i++) {
+		op = &array_index(ops, struct op, i);
+		if (op->kind == KIND_STRING && op->size != 0)
+			repro_print_buffer(stream, op, i);
+	}
+
+	fprintf(stream, "static unsigned char output[%d];\nstatic unsigned char input[%d];\n\n", MAXSIZE, MAXSIZE);
+	fprintf(stream, "int\nmain(void)\n{\n\tunsigned long value;\n\tunsigned long count;\n\tvoid *pointer;\n\n");
+	fprintf(stream, "\tif (iopl(3) == -1) {\n\t\tperror(\"iopl\");\n\t\texit(EXIT_FAILURE);\n\t}\n\n");
+	for (i = 0; i < array_get_length(ops); i++)
+		repro_print_c(stream, &array_index(ops, struct op, i), i);
+
+	fprintf(stream, "\n\t(void)value;\n\t(void)count;\n\t(void)pointer;\n\n\texit(EXIT_SUCCESS);\n}\n");
+
+	return ferror(stream) ? -1 : 0;
+}
+
+static array_t *
+repro_select(const char *path, long thread, uint64_t iteration)
+{
+	log_t *log;
+	log_index_t *index;
+	struct log_record record;
+	array_t *ops;
+	struct op op;
+	size_t offset;
+	char *name;
+
+	log = log_new(path);
+	if (log == NULL) {
+		perror(path);
+		return NULL;
+	}
+
+	ops = array_new(sizeof(struct op));
+	name = malloc(strlen(path) + sizeof(".idx"));
+	if (ops == NULL || name == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	/* The index, if any, locates the first record of the window */
+	offset = log_get_start(log);
+	sprintf(name, "%s.idx", path);
+	index = thread != -1 ? log_index_new(name) : NULL;
+	if (index != NULL) {
+		offset = log_seek(log, log_index_find_iteration(index, thread, iteration));
+		log_index_unref(index);
+	}
+
+	free(name);
+	while (array_get_length(ops) < count && log_read(log, &offset, &record) != NULL) {
+		if ((thread != -1 && record.thread != thread) || record.iteration < iteration)
+			continue;
+
+		if (repro_op(&op, &record) == -1)
+			continue;
+
+		array_append_val(ops, &op);
+	}
+
+	log_unref(log);
+
+	return ops;
+}
+
+int
+main(int argc, char *argv[])
+{
+	enum {
+		OPT_COUNT = CHAR_MAX + 1,
+		OPT_DICTIONARY,
+		OPT_FORMAT,
+		OPT_HELP,
+		OPT_ITERATION,
+		OPT_OUTPUT,
+		OPT_PORTS,
+		OPT_STRATEGY,
+		OPT_THREAD,
+		OPT_VERSION,
+	};
+	static struct option longopts[] = {
+		{"count",      required_argument, NULL, 'c'            },
+		{"dictionary", required_argument, NULL, OPT_DICTIONARY },
+		{"format",     required_argument, NULL, OPT_FORMAT     },
+		{"help",       no_argument,       NULL, 'h'            },
+		{"iteration",  required_argument, NULL, 'n'            },
+		{"output",     required_argument, NULL, 'o'            },
+		{"ports",      required_argument, NULL, 'p'            },
+		{"strategy",   required_argument, NULL, OPT_STRATEGY   },
+		{"thread",     required_argument, NULL, 't'            },
+		{"version",    no_argument,       NULL, OPT_VERSION    },
+		{NULL,         0,                 NULL, 0              }
+	};
+	static int longindex = 0;
+	int c;
+	long thread = -1;
+	uint64_t iteration = 0;
+	int strategy = IOFUZZER_STRATEGY_UNIFORM;
+	char *dictionary = NULL;
+	char *output = NULL;
+	char *ports = NULL;
+	array_t *tokens;
+	array_t *ops;
+	FILE *stream;
+	int retval;
+
+	while ((c = getopt_long(argc, argv, "c:hn:o:p:t:", longopts, &longindex)) != -1) {
+		switch (c) {
+		case 'c':
+			count = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'h':
+			usage();
+			exit(EXIT_FAILURE);
+
+		case 'n':
+			iteration = strtoull(optarg, NULL, 0);
+			break;
+
+		case 'o':
+			output = optarg;
+			break;
+
+		case 'p':
+			ports = optarg;
+			break;
+
+		case 't':
+			thread = strtol(optarg, NULL, 0);
+			break;
+
+		case OPT_DICTIONARY:
+			dictionary = optarg;
+			break;
+
+		case OPT_FORMAT:
+			if (strcmp(optarg, "asm") == 0)
+				format = FORMAT_ASM;
+			else if (strcmp(optarg, "c") == 0)
+				format = FORMAT_C;
+			else {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+
+			break;
+
+		case OPT_STRATEGY:
+			if ((strategy = iofuzzer_get_strategy_by_name(optarg)) == -1) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+
+			break;
+
+		case OPT_VERSION:
+			version();
+			exit(EXIT_FAILURE);
+
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind != 1 || count == 0) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	/* The generator regenerates buffers; it performs no operation */
+	fuzzer = iofuzzer_new();
+	if (fuzzer == NULL) {
+		perror("iofuzzer_new");
+		exit(EXIT_FAILURE);
+	}
+
+	iofuzzer_set_backend(fuzzer, IOFUZZER_BACKEND_NONE);
+	iofuzzer_set_strategy(fuzzer, strategy);
+	if (ports != NULL) {
+		iofuzzer_set_ports(fuzzer, iofuzzer_parse_ports(ports));
+		if (iofuzzer_get_ports(fuzzer) == NULL) {
+			perror("iofuzzer_parse_ports");
+			exit(EXIT_FAILURE);
+		}
+
+		array_unref(iofuzzer_get_ports(fuzzer));
+	}
+
+	/* States drawn with learned tokens replay with the corpus dictionary */
+	if (dictionary != NULL) {
+		tokens = iofuzzer_read_dictionary(dictionary);
+		if (tokens == NULL || iofuzzer_set_dictionary(fuzzer, tokens) == NULL) {
+			perror(dictionary);
+			exit(EXIT_FAILURE);
+		}
+
+		array_unref(tokens);
+	}
+
+	ops = repro_select(argv[optind], thread, iteration);
+	if (ops == NULL)
+		exit(EXIT_FAILURE);
+
+	stream = stdout;
+	if (output != NULL) {
+		stream = fopen(output, "w");
+		if (stream == NULL) {
+			perror(output);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	retval = repro_export(stream, argv[optind], ops);
+	if (stream != stdout && fclose(stream) == EOF)
+		retval = -1;
+
+	if (retval == -1)
+		perror(output != NULL ? output : "stdout");
+
+	fprintf(stderr, "%zu operations exported, %lu buffers not regenerated\n", array_get_length(ops), num_unknown);
+	array_unref(ops);
+	iofuzzer_unref(fuzzer);
+
+	exit(retval == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
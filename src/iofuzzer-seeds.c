@@ -0,0 +1,235 @@
+/** @file */
+
+#include "array.h"
+#include "coverage.h"
+#include "iofuzzer.h"
+#include "random.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define usage() \
+	fprintf(stderr, "Usage: %s [options]\n", PROGRAM_NAME)
+
+#define version() \
+	fprintf(stderr, "%s (%s) %s\n", PROGRAM_NAME, PACKAGE_NAME, PROGRAM_VERSION)
+
+struct score {
+	unsigned long long seed;
+	size_t count;
+};
+
+struct job {
+	pthread_t thread;
+	int retval;
+};
+
+static unsigned long long first_seed = 0;
+static unsigned long num_iterations = 100000;
+static unsigned long num_seeds = 1000;
+static unsigned long next_seed = 0;
+static array_t *_ports = NULL;
+static struct score *scores = NULL;
+
+static int
+seeds_compare(const void *a, const void *b)
+{
+	const struct score *x = a;
+	const struct score *y = b;
+
+	if (x->count != y->count)
+		return x->count < y->count ? 1 : -1;
+
+	return x->seed < y->seed ? -1 : x->seed > y->seed;
+}
+
+/*
+ * Every job screens seeds until there are none left. A seed is screened
+ * by running the generator with the backend disabled, so no operation is
+ * performed, and adding every generated operation to a coverage map.
+ */
+static void *
+thread_start(void *arg)
+{
+	struct job *job = arg;
+	iofuzzer_t *fuzzer;
+	coverage_t *coverage;
+	random_t *random;
+	uintptr_t *variates;
+	unsigned long long seed;
+	unsigned long n;
+	unsigned long i;
+
+	fuzzer = iofuzzer_new();
+	coverage = coverage_new(_ports, iofuzzer_get_num_funcs());
+	if (fuzzer == NULL || coverage == NULL) {
+		perror("iofuzzer_new");
+		job->retval = -1;
+		goto out;
+	}
+
+	iofuzzer_set_backend(fuzzer, IOFUZZER_BACKEND_NONE);
+	iofuzzer_set_ports(fuzzer, _ports);
+	variates = &array_index(iofuzzer_get_variates(fuzzer), uintptr_t, 0);
+	while ((n = __sync_fetch_and_add(&next_seed, 1)) < num_seeds) {
+		seed = first_seed + n;
+		random = random_new_with_state((char *)&seed, sizeof(seed));
+		if (random == NULL) {
+			perror("random_new_with_state");
+			job->retval = -1;
+			break;
+		}
+
+		iofuzzer_set_random(fuzzer, random);
+		random_unref(random);
+		coverage_clear(coverage);
+		for (i = 0; i < num_iterations; i++) {
+			coverage_add(coverage, variates[4], variates[0], variates[1], 1UL << (variates[0] % 3));
+			iofuzzer_iterate(fuzzer);
+		}
+
+		scores[n].seed = seed;
+		scores[n].count = coverage_count(coverage);
+	}
+
+out:
+	coverage_unref(coverage);
+	iofuzzer_unref(fuzzer);
+
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	enum {
+		OPT_COUNT = CHAR_MAX + 1,
+		OPT_HELP,
+		OPT_ITERATIONS,
+		OPT_JOBS,
+		OPT_PORTS,
+		OPT_SEEDS,
+		OPT_STATE,
+		OPT_VERSION,
+	};
+	static struct option longopts[] = {
+		{"count",      required_argument, NULL, 'c'         },
+		{"help",       no_argument,       NULL, 'h'         },
+		{"iterations", required_argument, NULL, 'n'         },
+		{"jobs",       required_argument, NULL, 'j'         },
+		{"ports",      required_argument, NULL, 'p'         },
+		{"seeds",      required_argument, NULL, 's'         },
+		{"state",      required_argument, NULL, OPT_STATE   },
+		{"version",    no_argument,       NULL, OPT_VERSION },
+		{NULL,         0,                 NULL, 0           }
+	};
+	static int longindex = 0;
+	int c;
+	unsigned long count = 0;
+	unsigned long num_jobs;
+	struct job *jobs;
+	coverage_t *coverage;
+	char *ports = NULL;
+	size_t size;
+	int retval;
+	size_t i;
+
+	num_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt_long(argc, argv, "c:hj:n:p:s:", longopts, &longindex)) != -1) {
+		switch (c) {
+		case 'c':
+			count = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'h':
+			usage();
+			exit(EXIT_FAILURE);
+
+		case 'j':
+			num_jobs = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'n':
+			num_iterations = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'p':
+			ports = optarg;
+			break;
+
+		case 's':
+			num_seeds = strtoul(optarg, NULL, 0);
+			break;
+
+		case OPT_STATE:
+			first_seed = strtoull(optarg, NULL, 0);
+			break;
+
+		case OPT_VERSION:
+			version();
+			exit(EXIT_FAILURE);
+
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind != 0 || num_seeds == 0 || num_jobs == 0) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	if (ports != NULL) {
+		_ports = iofuzzer_parse_ports(ports);
+		if (_ports == NULL) {
+			perror("iofuzzer_parse_ports");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	scores = calloc(num_seeds, sizeof(*scores));
+	jobs = calloc(num_jobs, sizeof(*jobs));
+	if (scores == NULL || jobs == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < num_jobs; i++) {
+		errno = pthread_create(&jobs[i].thread, NULL, &thread_start, &jobs[i]);
+		if (errno != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	retval = 0;
+	for (i = 0; i < num_jobs; i++) {
+		pthread_join(jobs[i].thread, NULL);
+		retval |= jobs[i].retval;
+	}
+
+	if (retval == 0) {
+		/* The size of the tuple space does not depend on the seed */
+		coverage = coverage_new(_ports, iofuzzer_get_num_funcs());
+		size = coverage_get_size(coverage);
+		coverage_unref(coverage);
+		qsort(scores, num_seeds, sizeof(*scores), seeds_compare);
+		printf("seed,tuples,fraction\n");
+		for (i = 0; i < num_seeds && (count == 0 || i < count); i++)
+			printf("%#llx,%zu,%f\n", scores[i].seed, scores[i].count, (double)scores[i].count / size);
+	}
+
+	array_unref(_ports);
+	free(scores);
+	free(jobs);
+
+	exit(retval == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,424 @@
+/** @file */
+
+#include "iofuzzer.h"
+#include "log.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAXBUCKETS (1 << 20) /* Maximum number of buckets of the rate table */
+#define MAXFUNCS 32
+#define NUM_PORTS 65536
+#define NUM_VALUES 33 /* Bit length of the value, from 0 to 32 */
+
+#define usage() \
+	fprintf(stderr, "Usage: %s [options] log\n", PROGRAM_NAME)
+
+#define version() \
+	fprintf(stderr, "%s (%s) %s\n", PROGRAM_NAME, PACKAGE_NAME, PROGRAM_VERSION)
+
+enum {
+	SECTION_FUNCS = 1 << 0,
+	SECTION_PORTS = 1 << 1,
+	SECTION_RATE = 1 << 2,
+	SECTION_VALUES = 1 << 3,
+	SECTION_ALL = SECTION_FUNCS | SECTION_PORTS | SECTION_RATE | SECTION_VALUES,
+};
+
+struct table {
+	uint64_t ports[NUM_PORTS][MAXFUNCS];
+	uint64_t reads[NUM_VALUES];
+	uint64_t writes[NUM_VALUES];
+	uint64_t *rate;
+	uint64_t num_records;
+};
+
+struct job {
+	pthread_t thread;
+	size_t begin;
+	size_t end;
+	struct table *table;
+};
+
+static uint32_t begin_time = 0;
+static size_t num_buckets = 1;
+static size_t num_funcs = 0;
+static int inputs[MAXFUNCS] = {0};
+static int strings[MAXFUNCS] = {0};
+static unsigned long interval = 1;
+static int json = 0;
+static log_t *_log = NULL;
+static int sections = 0;
+
+static unsigned int
+stats_bit_length(uint32_t value)
+{
+	return value == 0 ? 0 : 32 - __builtin_clz(value);
+}
+
+static void *
+thread_start(void *arg)
+{
+	struct job *job = arg;
+	struct table *table = job->table;
+	struct log_record record;
+	size_t offset;
+	size_t bucket;
+
+	offset = job->begin;
+	while (offset < job->end) {
+		if (log_read(_log, &offset, &record) == NULL)
+			break;
+
+		if (record.func >= num_funcs || record.func >= MAXFUNCS)
+			continue;
+
+		table->num_records++;
+		table->ports[record.port][record.func]++;
+
+		/* String ops move buffers, whose contents are not logged */
+		if (inputs[record.func])
+			table->reads[stats_bit_length(record.value)]++;
+		else if (!strings[record.func])
+			table->writes[stats_bit_length(record.data)]++;
+
+		bucket = record.time < begin_time ? 0 : (record.time - begin_time) / interval;
+		table->rate[bucket < num_buckets ? bucket : num_buckets - 1]++;
+	}
+
+	return NULL;
+}
+
+static void
+stats_merge(struct table *dest, const struct table *src)
+{
+	const uint64_t *s;
+	uint64_t *d;
+	size_t i;
+
+	d = &dest->ports[0][0];
+	s = &src->ports[0][0];
+	for (i = 0; i < NUM_PORTS * MAXFUNCS; i++)
+		d[i] += s[i];
+
+	for (i = 0; i < NUM_VALUES; i++) {
+		dest->reads[i] += src->reads[i];
+		dest->writes[i] += src->writes[i];
+	}
+
+	for (i = 0; i < num_buckets; i++)
+		dest->rate[i] += src->rate[i];
+
+	dest->num_records += src->num_records;
+}
+
+static void
+stats_print_funcs(const struct table *table)
+{
+	uint64_t count;
+	size_t port;
+	size_t i;
+
+	printf(json ? "  \"funcs\": {" : "func\tcount\n");
+	for (i = 0; i < num_funcs; i++) {
+		count = 0;
+		for (port = 0; port < NUM_PORTS; port++)
+			count += table->ports[port][i];
+
+		if (json)
+			printf("%s\n    \"%s\": %llu", i == 0 ? "" : ",", iofuzzer_get_func_name(i), (unsigned long long)count);
+		else
+			printf("%s\t%llu\n", iofuzzer_get_func_name(i), (unsigned long long)count);
+	}
+
+	printf(json ? "\n  }" : "");
+}
+
+static void
+stats_print_ports(const struct table *table)
+{
+	uint64_t count;
+	size_t port;
+	size_t i;
+	int first;
+
+	if (json)
+		printf("  \"ports\": {");
+	else {
+		printf("port\tcount");
+		for (i = 0; i < num_funcs; i++)
+			printf("\t%s", iofuzzer_get_func_name(i));
+
+		printf("\n");
+	}
+
+	first = 1;
+	for (port = 0; port < NUM_PORTS; port++) {
+		count = 0;
+		for (i = 0; i < num_funcs; i++)
+			count += table->ports[port][i];
+
+		if (count == 0)
+			continue;
+
+		if (json) {
+			printf("%s\n    \"%#zx\": { \"count\": %llu", first ? "" : ",", port, (unsigned long long)count);
+			for (i = 0; i < num_funcs; i++)
+				printf(", \"%s\": %llu", iofuzzer_get_func_name(i), (unsigned long long)table->ports[port][i]);
+
+			printf(" }");
+		} else {
+			printf("%#zx\t%llu", port, (unsigned long long)count);
+			for (i = 0; i < num_funcs; i++)
+				printf("\t%llu", (unsigned long long)table->ports[port][i]);
+
+			printf("\n");
+		}
+
+		first = 0;
+	}
+
+	printf(json ? "\n  }" : "");
+}
+
+static void
+stats_print_rate(const struct table *table)
+{
+	size_t i;
+
+	printf(json ? "  \"rate\": [" : "time\tops/s\n");
+	for (i = 0; i < num_buckets; i++) {
+		if (json)
+			printf("%s\n    [%llu, %.1f]", i == 0 ? "" : ",", (unsigned long long)begin_time + i * interval, (double)table->rate[i] / interval);
+		else
+			printf("%llu\t%.1f\n", (unsigned long long)begin_time + i * interval, (double)table->rate[i] / interval);
+	}
+
+	printf(json ? "\n  ]" : "");
+}
+
+static void
+stats_print_values(const struct table *table)
+{
+	size_t i;
+
+	printf(json ? "  \"values\": [" : "bits\tread\twritten\n");
+	for (i = 0; i < NUM_VALUES; i++) {
+		if (json)
+			printf("%s\n    [%zu, %llu, %llu]", i == 0 ? "" : ",", i, (unsigned long long)table->reads[i], (unsigned long long)table->writes[i]);
+		else
+			printf("%zu\t%llu\t%llu\n", i, (unsigned long long)table->reads[i], (unsigned long long)table->writes[i]);
+	}
+
+	printf(json ? "\n  ]" : "");
+}
+
+static void
+stats_print(const struct table *table)
+{
+	void (*funcs[])(const struct table *table) = { stats_print_funcs, stats_print_ports, stats_print_rate, stats_print_values };
+	size_t i;
+	int first;
+
+	if (json)
+		printf("{\n  \"records\": %llu", (unsigned long long)table->num_records);
+	else
+		printf("records\t%llu\n\n", (unsigned long long)table->num_records);
+
+	first = 1;
+	for (i = 0; i < sizeof(funcs) / sizeof(funcs[0]); i++) {
+		if (!(sections & (1 << i)))
+			continue;
+
+		printf(json ? ",\n" : first ? "" : "\n");
+		funcs[i](table);
+		first = 0;
+	}
+
+	printf(json ? "\n}\n" : "");
+}
+
+static int
+stats_set_interval(void)
+{
+	struct log_record first;
+	struct log_record last;
+	size_t offset;
+	size_t size;
+
+	/* Records are in time order; the first and the last bound the rate table */
+	offset = log_get_start(_log);
+	if (log_read(_log, &offset, &first) == NULL)
+		return 0;
+
+	size = log_get_size(_log);
+	last = first;
+	offset = log_align(_log, size > 4096 ? size - 4096 : 0);
+	while (log_read(_log, &offset, &last) != NULL)
+		;
+
+	begin_time = first.time;
+	while ((last.time - first.time) / interval + 1 > MAXBUCKETS)
+		interval *= 2;
+
+	num_buckets = (last.time - first.time) / interval + 1;
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	enum {
+		OPT_FUNCS = CHAR_MAX + 1,
+		OPT_HELP,
+		OPT_INTERVAL,
+		OPT_JOBS,
+		OPT_JSON,
+		OPT_PORTS,
+		OPT_RATE,
+		OPT_VALUES,
+		OPT_VERSION,
+	};
+	static struct option longopts[] = {
+		{"funcs",    no_argument,       NULL, OPT_FUNCS   },
+		{"help",     no_argument,       NULL, 'h'         },
+		{"interval", required_argument, NULL, 'i'         },
+		{"jobs",     required_argument, NULL, 'j'         },
+		{"json",     no_argument,       NULL, OPT_JSON    },
+		{"ports",    no_argument,       NULL, OPT_PORTS   },
+		{"rate",     no_argument,       NULL, OPT_RATE    },
+		{"values",   no_argument,       NULL, OPT_VALUES  },
+		{"version",  no_argument,       NULL, OPT_VERSION },
+		{NULL,       0,                 NULL, 0           }
+	};
+	static int longindex = 0;
+	int c;
+	unsigned long num_jobs;
+	const char *name;
+	struct job *jobs;
+	size_t size;
+	size_t i;
+
+	num_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt_long(argc, argv, "hi:j:", longopts, &longindex)) != -1) {
+		switch (c) {
+		case 'h':
+			usage();
+			exit(EXIT_FAILURE);
+
+		case 'i':
+			interval = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'j':
+			num_jobs = strtoul(optarg, NULL, 0);
+			break;
+
+		case OPT_FUNCS:
+			sections |= SECTION_FUNCS;
+			break;
+
+		case OPT_JSON:
+			json = 1;
+			break;
+
+		case OPT_PORTS:
+			sections |= SECTION_PORTS;
+			break;
+
+		case OPT_RATE:
+			sections |= SECTION_RATE;
+			break;
+
+		case OPT_VALUES:
+			sections |= SECTION_VALUES;
+			break;
+
+		case OPT_VERSION:
+			version();
+			exit(EXIT_FAILURE);
+
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind != 1 || interval == 0 || num_jobs == 0) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	if (sections == 0)
+		sections = SECTION_ALL;
+
+	num_funcs = iofuzzer_get_num_funcs();
+	for (i = 0; i < num_funcs && i < MAXFUNCS; i++) {
+		name = iofuzzer_get_func_name(i);
+		strings[i] = strncmp(name, "ins", 3) == 0 || strncmp(name, "outs", 4) == 0;
+		inputs[i] = strncmp(name, "in", 2) == 0 && !strings[i];
+	}
+
+	_log = log_new(argv[optind]);
+	if (_log == NULL) {
+		perror(argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+
+	stats_set_interval();
+	jobs = calloc(num_jobs, sizeof(*jobs));
+	if (jobs == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Split the log on record boundaries; every job fills its own table */
+	size = log_get_size(_log);
+	for (i = 0; i < num_jobs; i++) {
+		jobs[i].begin = log_align(_log, size / num_jobs * i);
+		jobs[i].end = i == num_jobs - 1 ? size : log_align(_log, size / num_jobs * (i + 1));
+		jobs[i].table = calloc(1, sizeof(*jobs[i].table));
+		if (jobs[i].table == NULL) {
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+
+		jobs[i].table->rate = calloc(num_buckets, sizeof(*jobs[i].table->rate));
+		if (jobs[i].table->rate == NULL) {
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+
+		errno = pthread_create(&jobs[i].thread, NULL, &thread_start, &jobs[i]);
+		if (errno != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < num_jobs; i++) {
+		pthread_join(jobs[i].thread, NULL);
+		if (i == 0)
+			continue;
+
+		stats_merge(jobs[0].table, jobs[i].table);
+		free(jobs[i].table->rate);
+		free(jobs[i].table);
+	}
+
+	stats_print(jobs[0].table);
+	free(jobs[0].table->rate);
+	free(jobs[0].table);
+	free(jobs);
+	log_unref(_log);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,177 @@
+/** @file */
+
+#include "trace.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUFSIZE 4096
+
+#define usage() \
+	fprintf(stderr, "Usage: %s [options] trace\n", PROGRAM_NAME)
+
+#define version() \
+	fprintf(stderr, "%s (%s) %s\n", PROGRAM_NAME, PACKAGE_NAME, PROGRAM_VERSION)
+
+static unsigned char *threads = NULL;
+static size_t num_threads = 0;
+
+/*
+ * Names every thread once, before its first event, so the timeline shows
+ * the threads of the fuzzer by number.
+ */
+static int
+trace_name_thread(FILE *stream, uint32_t thread, int *first)
+{
+	unsigned char *_threads;
+	size_t n;
+
+	if (thread < num_threads && threads[thread])
+		return 0;
+
+	if (thread >= num_threads) {
+		n = (size_t)thread + 1 > num_threads * 2 ? (size_t)thread + 1 : num_threads * 2;
+		_threads = realloc(threads, n);
+		if (_threads == NULL)
+			return -1;
+
+		memset(_threads + num_threads, 0, n - num_threads);
+		threads = _threads;
+		num_threads = n;
+	}
+
+	threads[thread] = 1;
+	fprintf(stream, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+	    *first ? "" : ",", (unsigned int)thread, (unsigned int)thread);
+	*first = 0;
+
+	return 0;
+}
+
+/*
+ * Converts a trace to the JSON trace event format, which both the Chrome
+ * trace viewer and Perfetto load. Phases are duration events, in
+ * microseconds since the trace was created.
+ */
+static int
+trace_convert(FILE *input, FILE *output)
+{
+	struct trace_header header;
+	struct trace_event *events;
+	const char *name;
+	size_t num_events;
+	size_t i;
+	int first;
+
+	if (fread(&header, sizeof(header), 1, input) != 1 ||
+	    memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 || header.frequency == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	events = malloc(BUFSIZE * sizeof(*events));
+	if (events == NULL)
+		return -1;
+
+	first = 1;
+	fprintf(output, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"time\":%llu,\"frequency\":%llu},\"traceEvents\":[",
+	    (unsigned long long)header.time, (unsigned long long)header.frequency);
+	while ((num_events = fread(events, sizeof(*events), BUFSIZE, input)) != 0) {
+		for (i = 0; i < num_events; i++) {
+			name = trace_get_phase_name(events[i].phase);
+			if (name == NULL || events[i].type > TRACE_TYPE_END)
+				continue;
+
+			if (trace_name_thread(output, events[i].thread, &first) == -1) {
+				free(events);
+				return -1;
+			}
+
+			fprintf(output, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", name,
+			    events[i].type == TRACE_TYPE_BEGIN ? 'B' : 'E',
+			    (double)(int64_t)(events[i].tsc - header.tsc) * 1e6 / header.frequency,
+			    (unsigned int)events[i].thread);
+		}
+	}
+
+	fprintf(output, "\n]}\n");
+	free(events);
+
+	return ferror(input) || ferror(output) ? -1 : 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	enum {
+		OPT_HELP = CHAR_MAX + 1,
+		OPT_OUTPUT,
+		OPT_VERSION,
+	};
+	static struct option longopts[] = {
+		{"help",    no_argument,       NULL, 'h'         },
+		{"output",  required_argument, NULL, 'o'         },
+		{"version", no_argument,       NULL, OPT_VERSION },
+		{NULL,      0,                 NULL, 0           }
+	};
+	static int longindex = 0;
+	int c;
+	char *output = NULL;
+	FILE *input;
+	FILE *stream;
+	int retval;
+
+	while ((c = getopt_long(argc, argv, "ho:", longopts, &longindex)) != -1) {
+		switch (c) {
+		case 'h':
+			usage();
+			exit(EXIT_FAILURE);
+
+		case 'o':
+			output = optarg;
+			break;
+
+		case OPT_VERSION:
+			version();
+			exit(EXIT_FAILURE);
+
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	input = fopen(argv[optind], "rb");
+	if (input == NULL) {
+		perror(argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+
+	stream = output != NULL ? fopen(output, "w") : stdout;
+	if (stream == NULL) {
+		perror(output);
+		exit(EXIT_FAILURE);
+	}
+
+	retval = trace_convert(input, stream);
+	if (retval == -1)
+		perror(argv[optind]);
+
+	fclose(input);
+	if (stream != stdout)
+		fclose(stream);
+
+	free(threads);
+
+	exit(retval == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
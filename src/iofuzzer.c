@@ -1,21 +1,50 @@
 /** @file */
 
 #include "array.h"
+#include "bloom.h"
+#include "coverage.h"
+#include "feedback.h"
 #include "iofuzzer.h"
+#include "lockstat.h"
+#include "log.h"
+#include "log_index.h"
+#include "model.h"
+#include "profile.h"
 #include "random.h"
+#include "scheduler.h"
+#include "segment.h"
+#include "share.h"
+#include "sink.h"
+#include "trace.h"
+#include "wheel.h"
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/io.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-#define MAXPORT 0xffff
+#define BATCHSIZE 4096 /* Number of operations of a scheduled batch */
+#define MAXFUNCS 32
+#define MAXIMPORTS 64 /* Maximum number of imported corpus entries waiting for replay */
+#define MAXTOKENS 4096 /* Maximum number of tokens of the learned dictionary */
+#define MAXVARIATES 8 /* Maximum number of variates of a record */
+#define NUM_PORTS 65536
+#define RECORDSIZE 256 /* Maximum size of a formatted record */
+#define RESOLUTION 1000 /* Resolution of the timing wheels in nanoseconds */
+#define SATURATION 16 /* Number of merges without new tuples to saturate */
+#define STALL 16 /* Number of batches without feedback to normalize */
+#define VALUE_WIDTH 10 /* Width of the value of a CSV record, as in 0xffffffff */
 
 #define usage() \
 	fprintf(stderr, "Usage: %s [options]\n", PROGRAM_NAME)
@@ -23,79 +52,558 @@
 #define version() \
 	fprintf(stderr, "%s (%s) %s\n", PROGRAM_NAME, PACKAGE_NAME, PROGRAM_VERSION)
 
+static char *corpus = NULL;
+static coverage_t *_coverage = NULL;
+static char *coverage = NULL;
+static unsigned long coverage_interval = 65536;
+static unsigned long coverage_stalls = 0;
+static unsigned long delays = 0;
+static array_t *_dictionary = NULL;
+static unsigned long dictionary_generation = 0;
+static pthread_mutex_t dictionary_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int _fd = -1;
+static unsigned long filter = 0;
+static feedback_t *_feedback = NULL;
+static int feedback_coverage = -1;
+static int feedback_divergence = -1;
+static unsigned long flush_interval = 1;
+static array_t *_imports = NULL;
+static pthread_mutex_t imports_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *_index = NULL;
+static size_t input_widths[MAXFUNCS] = {0};
+static FILE *_stream = NULL;
 static int debug = 0;
+static int format = LOG_FORMAT_CSV;
+static unsigned long index_interval = LOG_INDEX_INTERVAL;
+static model_t *_model = NULL;
+static char *model = NULL;
+static char *normalize = NULL;
+static unsigned long normalize_interval = 1048576;
+static off_t _offset = 0;
 static char *output = NULL;
+static pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;
 static char *ports = NULL;
+static unsigned char *port_map = NULL;
+static long profile = -1;
 static int quiet = 0;
 static random_t *_random = NULL;
+static scheduler_t *_scheduler = NULL;
+static segment_t *_segment = NULL;
+static array_t *_sequence = NULL;
+static share_t *_share = NULL;
+static char *share = NULL;
+static unsigned long share_interval = 10;
+static sigset_t signals;
+static sink_t *_sink = NULL;
+static char *sink = NULL;
 static char state[8] = {0};
+static int strategy = IOFUZZER_STRATEGY_UNIFORM;
+static double threshold = 1;
+static unsigned long num_threads = 1;
+static trace_t *_trace = NULL;
+static char *trace = NULL;
+static char *traverse = NULL;
 static int verbose = 0;
 
-static array_t *
-iofuzzer_parse_ports(char *string)
+/*
+ * Formats the part of a record known before the operation is performed,
+ * and returns its size.
+ */
+static size_t
+iofuzzer_format_head(char *buffer, const struct log_record *record, const uintptr_t *variates, size_t length)
 {
-	array_t *ports;
-	char *str;
-	char *ptr;
-	char *last;
+	size_t size;
+	size_t i;
 
-	if (string == NULL) {
-		errno = EINVAL;
+	if (format == LOG_FORMAT_BINARY) {
+		memcpy(buffer, record, LOG_RECORD_HEAD_SIZE);
+		return LOG_RECORD_HEAD_SIZE;
+	}
+
+	size = sprintf(buffer, "%d,%d,%llu,%#llx,%s,", (unsigned int)record->time, (unsigned int)record->thread,
+	    (unsigned long long)record->iteration, (unsigned long long)record->state,
+	    iofuzzer_get_func_name(record->func));
+	for (i = 1; i < length; i++)
+		size += sprintf(buffer + size, "%#x,", (unsigned int)variates[i]);
+
+	return size;
+}
+
+/*
+ * Formats the value of a record, or the room left for it until the
+ * operation completes if there is no record, and returns its size. Both
+ * have the same size, so values can be written in place.
+ */
+static size_t
+iofuzzer_format_value(char *buffer, const struct log_record *record)
+{
+	uint32_t value;
+
+	value = record != NULL ? record->value : 0;
+	if (format == LOG_FORMAT_BINARY) {
+		memcpy(buffer, &value, sizeof(value));
+		return sizeof(value);
+	}
+
+	if (record == NULL)
+		return sprintf(buffer, "%*s\n", VALUE_WIDTH, "");
+
+	return sprintf(buffer, "%#-*x\n", VALUE_WIDTH, (unsigned int)value);
+}
+
+static FILE *
+iofuzzer_open_output(const char *path, int format)
+{
+	FILE *stream;
+	struct segment_header header;
+	off_t offset;
+	off_t size;
+	char padding[sizeof(struct log_record)] = {0};
+
+	stream = stdout;
+	if (path != NULL) {
+		stream = fopen(path, "a+");
+		if (stream == NULL)
+			return NULL;
+	}
+
+	size = 0;
+	if (fseeko(stream, 0, SEEK_END) == 0)
+		size = ftello(stream);
+
+	/* Complete the last record, or drop the last segment, if the previous run did not complete it */
+	if (size == 0) {
+		if (format == LOG_FORMAT_BINARY)
+			fwrite(LOG_MAGIC, sizeof(LOG_MAGIC) - 1, 1, stream);
+		else if (format == LOG_FORMAT_SEGMENT)
+			fwrite(SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC) - 1, 1, stream);
+	} else if (format == LOG_FORMAT_SEGMENT) {
+		offset = sizeof(SEGMENT_MAGIC) - 1;
+		while (fseeko(stream, offset, SEEK_SET) == 0 && fread(&header, sizeof(header), 1, stream) == 1 &&
+		    offset + sizeof(header) + header.size <= size)
+			offset += sizeof(header) + header.size;
+
+		if (offset < size && ftruncate(fileno(stream), offset) == -1) {
+			fclose(stream);
+			return NULL;
+		}
+	} else if (format == LOG_FORMAT_BINARY) {
+		size = (size - (sizeof(LOG_MAGIC) - 1)) % sizeof(struct log_record);
+		if (size != 0)
+			fwrite(padding, sizeof(padding) - size, 1, stream);
+	} else if (format == LOG_FORMAT_CSV && fseeko(stream, -1, SEEK_END) == 0 && fgetc(stream) != '\n')
+		fputc('\n', stream);
+
+	fflush(stream);
+
+	return stream;
+}
+
+static FILE *
+iofuzzer_open_index(const char *path, unsigned long *interval)
+{
+	FILE *stream;
+	struct log_index_header header;
+	char *name;
+
+	name = malloc(strlen(path) + sizeof(".idx"));
+	if (name == NULL)
+		return NULL;
+
+	sprintf(name, "%s.idx", path);
+	stream = fopen(name, "a+");
+	free(name);
+	if (stream == NULL)
 		return NULL;
+
+	/* Keep the interval of an existing index */
+	rewind(stream);
+	if (fread(&header, sizeof(header), 1, stream) == 1) {
+		if (memcmp(header.magic, LOG_INDEX_MAGIC, sizeof(header.magic)) != 0 || header.interval == 0) {
+			fclose(stream);
+			errno = EINVAL;
+			return NULL;
+		}
+
+		*interval = header.interval;
+		return stream;
 	}
 
-	ports = array_new(sizeof(unsigned long));
-	if (ports == NULL)
-		goto err;
+	memcpy(header.magic, LOG_INDEX_MAGIC, sizeof(header.magic));
+	header.interval = *interval;
+	fwrite(&header, sizeof(header), 1, stream);
+	fflush(stream);
 
-	str = strdup(string);
-	ptr = str;
-	for (str = strtok_r(str, ",", &last); str != NULL; str = strtok_r(NULL, ",", &last)) {
-		char *substr;
-		char *ptr;
-		char *last;
-		unsigned long begin;
-		unsigned long end;
-		unsigned long port;
-
-		substr = strdup(str);
-		ptr = substr;
-		substr = strtok_r(substr, "-", &last);
-		if (substr != NULL) {
-			errno = 0;
-			begin = strtoul(substr, NULL, 0);
-			if (errno == EINVAL) {
-				free(ptr);
-				goto err;
-			}
+	return stream;
+}
 
-			end = begin;
-			substr = strtok_r(NULL, "-", &last);
-			if (substr != NULL) {
-				errno = 0;
-				end = strtoul(substr, NULL, 0);
-				if (errno == EINVAL) {
-					free(ptr);
-					goto err;
-				}
+/*
+ * Merges the coverage map of a thread into the coverage map of the
+ * campaign, and saves the latter if a file was given. The campaign is
+ * reported as saturated once SATURATION merges in a row added no tuples.
+ */
+static void
+iofuzzer_merge_coverage(unsigned long thread_num, coverage_t *coverage_thread)
+{
+	size_t count;
+	unsigned long stalls;
+	uint64_t ops;
+	int i;
 
-				if (end > MAXPORT)
-					end = MAXPORT;
-			}
+	count = coverage_merge(_coverage, coverage_thread);
+	if (count != 0) {
+		__atomic_store_n(&coverage_stalls, 0, __ATOMIC_SEQ_CST);
+		stalls = 0;
+	} else
+		stalls = __sync_add_and_fetch(&coverage_stalls, 1);
+
+	if (coverage != NULL && count != 0 && coverage_save(_coverage, coverage) == NULL)
+		perror("coverage_save");
+
+	if (verbose)
+		fprintf(stderr, "coverage,%d,%d,%zu,%zu,%zu\n", (unsigned int)time(NULL),
+		    (unsigned int)thread_num, coverage_count(_coverage),
+		    coverage_get_size(_coverage), count);
+
+	for (i = 0; verbose && _feedback != NULL && i < (int)feedback_get_num_sources(_feedback); i++)
+		fprintf(stderr, "feedback,%d,%d,%s,%llu\n", (unsigned int)time(NULL),
+		    (unsigned int)thread_num, feedback_get_source_name(_feedback, i),
+		    (unsigned long long)feedback_get_events(_feedback, i));
+
+	/* Yields are in scored feedback events per million operations */
+	for (i = 0; verbose && _scheduler != NULL && i < IOFUZZER_NUM_STRATEGIES; i++) {
+		ops = scheduler_get_ops(_scheduler, i);
+		fprintf(stderr, "strategy,%d,%d,%s,%llu,%.1f\n", (unsigned int)time(NULL),
+		    (unsigned int)thread_num, iofuzzer_get_strategy_name(i),
+		    (unsigned long long)ops,
+		    ops == 0 ? 0.0 : scheduler_get_events(_scheduler, i) * 1e6 / ops);
+	}
+
+	if (stalls == SATURATION)
+		fprintf(stderr, "Coverage saturated at %zu of %zu tuples\n",
+		    coverage_count(_coverage), coverage_get_size(_coverage));
+}
+
+/*
+ * Saves an interesting sequence of operations to the corpus. An entry is
+ * the states of its operations, so every operation can be performed
+ * again from its state, and is named after the hash of its contents.
+ */
+static int
+iofuzzer_save_corpus(const uint64_t *states, size_t num_states)
+{
+	char *name;
+	char *path;
+	uint64_t hash;
+	size_t i;
+	int fd;
+	int retval;
+
+	hash = 0xcbf29ce484222325ULL;
+	for (i = 0; i < num_states * sizeof(*states); i++)
+		hash = (hash ^ ((const unsigned char *)states)[i]) * 0x100000001b3ULL;
+
+	name = malloc(strlen(corpus) + sizeof("/.tmp-XXXXXX"));
+	path = malloc(strlen(corpus) + sizeof("/0123456789abcdef"));
+	if (name == NULL || path == NULL) {
+		free(name);
+		free(path);
+		return -1;
+	}
+
+	sprintf(name, "%s/.tmp-XXXXXX", corpus);
+	sprintf(path, "%s/%016llx", corpus, (unsigned long long)hash);
+	retval = -1;
+	fd = mkstemp(name);
+	if (fd != -1) {
+		if (write(fd, states, num_states * sizeof(*states)) == (ssize_t)(num_states * sizeof(*states)))
+			retval = rename(name, path);
+
+		close(fd);
+		if (retval == -1)
+			unlink(name);
+	}
+
+	free(name);
+	free(path);
+
+	return retval;
+}
+
+static int
+iofuzzer_compare_tokens(const void *a, const void *b)
+{
+	const struct iofuzzer_token *x = a;
+	const struct iofuzzer_token *y = b;
+
+	if (x->port != y->port)
+		return x->port < y->port ? -1 : 1;
+
+	return x->value < y->value ? -1 : x->value > y->value;
+}
+
+/*
+ * Saves the learned dictionary to the corpus, so the states drawn with its
+ * tokens replay with it after the fuzzer is gone.
+ */
+static int
+iofuzzer_save_dictionary(array_t *dictionary)
+{
+	char *name;
+	char *path;
+	size_t size;
+	int fd;
+	int retval;
+
+	name = malloc(strlen(corpus) + sizeof("/.tmp-XXXXXX"));
+	path = malloc(strlen(corpus) + sizeof("/.dictionary"));
+	if (name == NULL || path == NULL) {
+		free(name);
+		free(path);
+		return -1;
+	}
+
+	sprintf(name, "%s/.tmp-XXXXXX", corpus);
+	sprintf(path, "%s/.dictionary", corpus);
+	size = array_get_length(dictionary) * sizeof(struct iofuzzer_token);
+	retval = -1;
+	fd = mkstemp(name);
+	if (fd != -1) {
+		if (write(fd, &array_index(dictionary, struct iofuzzer_token, 0), size) == (ssize_t)size)
+			retval = rename(name, path);
+
+		close(fd);
+		if (retval == -1)
+			unlink(name);
+	}
+
+	free(name);
+	free(path);
+
+	return retval;
+}
+
+/*
+ * Adds tokens to the learned dictionary. The dictionary is copied on
+ * write, so threads keep drawing from the one they set until they pick up
+ * the new one by its generation, and nobody waits for them.
+ */
+static void
+iofuzzer_learn(struct iofuzzer_token *tokens, size_t num_tokens)
+{
+	array_t *dictionary;
+	struct iofuzzer_token *old;
+	size_t num_old;
+	size_t i;
+
+	qsort(tokens, num_tokens, sizeof(*tokens), iofuzzer_compare_tokens);
+	pthread_mutex_lock(&dictionary_mutex);
+	num_old = _dictionary != NULL ? array_get_length(_dictionary) : 0;
+	old = num_old != 0 ? &array_index(_dictionary, struct iofuzzer_token, 0) : NULL;
+	dictionary = array_new(sizeof(struct iofuzzer_token));
+	if (dictionary == NULL || (num_old != 0 && array_append_vals(dictionary, old, num_old) == NULL)) {
+		pthread_mutex_unlock(&dictionary_mutex);
+		array_unref(dictionary);
+		return;
+	}
+
+	for (i = 0; i < num_tokens && array_get_length(dictionary) < MAXTOKENS; i++) {
+		if ((i > 0 && iofuzzer_compare_tokens(&tokens[i - 1], &tokens[i]) == 0) ||
+		    (num_old != 0 && bsearch(&tokens[i], old, num_old, sizeof(*old), iofuzzer_compare_tokens) != NULL))
+			continue;
+
+		array_append_val(dictionary, &tokens[i]);
+	}
+
+	if (array_get_length(dictionary) == num_old) {
+		pthread_mutex_unlock(&dictionary_mutex);
+		array_unref(dictionary);
+		return;
+	}
+
+	qsort(&array_index(dictionary, struct iofuzzer_token, 0), array_get_length(dictionary),
+	    sizeof(struct iofuzzer_token), iofuzzer_compare_tokens);
+	array_unref(_dictionary);
+	_dictionary = dictionary;
+	dictionary_generation++;
+	if (iofuzzer_save_dictionary(dictionary) == -1)
+		perror("iofuzzer_save_dictionary");
+
+	pthread_mutex_unlock(&dictionary_mutex);
+}
+
+/*
+ * Publishes the corpus entries and the learned dictionary that are not in
+ * the shared directory yet. Corpus entries are named after their hash, so
+ * known entries are skipped without being read.
+ */
+static void
+iofuzzer_share_publish(void)
+{
+	DIR *dir;
+	struct dirent *dirent;
+	struct stat st;
+	array_t *dictionary;
+	char *path;
+	void *data;
+	int fd;
+
+	dir = opendir(corpus);
+	while (dir != NULL && (dirent = readdir(dir)) != NULL) {
+		if (dirent->d_name[0] == '.' || share_contains(_share, strtoull(dirent->d_name, NULL, 16)))
+			continue;
+
+		path = malloc(strlen(corpus) + strlen(dirent->d_name) + 2);
+		if (path == NULL)
+			break;
+
+		sprintf(path, "%s/%s", corpus, dirent->d_name);
+		fd = open(path, O_RDONLY);
+		free(path);
+		if (fd == -1)
+			continue;
+
+		data = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size != 0)
+			data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		close(fd);
+		if (data == MAP_FAILED)
+			continue;
+
+		if (share_publish(_share, SHARE_TYPE_CORPUS, data, st.st_size) == NULL)
+			perror("share_publish");
+
+		munmap(data, st.st_size);
+	}
+
+	if (dir != NULL)
+		closedir(dir);
 
-			for (port = begin; port <= end; port++)
-				array_append_val(ports, &port);
+	pthread_mutex_lock(&dictionary_mutex);
+	dictionary = _dictionary;
+	array_ref(dictionary);
+	pthread_mutex_unlock(&dictionary_mutex);
+	if (dictionary != NULL && array_get_length(dictionary) != 0 &&
+	    share_publish(_share, SHARE_TYPE_DICTIONARY, &array_index(dictionary, struct iofuzzer_token, 0),
+	    array_get_length(dictionary) * sizeof(struct iofuzzer_token)) == NULL)
+		perror("share_publish");
+
+	array_unref(dictionary);
+}
+
+/*
+ * Flushes the records buffered by the segment writer at every interval,
+ * and the records and trace events buffered on SIGINT and SIGTERM before
+ * exiting, so a stopped fuzzer loses neither. With lock statistics, the contention of the library locks is
+ * reported on SIGUSR1, and at exit. The signals are blocked in every
+ * thread and waited for here.
+ */
+static void *
+signal_thread_start(void *arg)
+{
+	struct timespec timeout;
+	unsigned long i;
+	int sig;
+
+	timeout.tv_sec = flush_interval;
+	timeout.tv_nsec = 0;
+	for (;;) {
+		sig = sigtimedwait(&signals, NULL, flush_interval != 0 ? &timeout : NULL);
+		if (sig == -1) {
+			if (errno == EAGAIN && _segment != NULL)
+				segment_flush(_segment);
+
+			continue;
 		}
 
-		free(ptr);
+#ifdef LOCKSTAT
+		if (sig == SIGUSR1) {
+			lockstat_report(stderr);
+			continue;
+		}
+#endif
+
+		if (_segment != NULL)
+			segment_flush(_segment);
+
+		for (i = 0; _trace != NULL && i < num_threads; i++)
+			trace_flush(_trace, i);
+
+		exit(128 + sig);
 	}
 
-	free(ptr);
+	return NULL;
+}
 
-	return ports;
+/*
+ * Synchronizes with the shared directory at every interval. Imported
+ * dictionaries are learned, for the ports being fuzzed, and imported
+ * corpus entries are saved to the corpus and queued, still mapped, for
+ * the threads to replay at their next batch.
+ */
+static void *
+share_thread_start(void *arg)
+{
+	array_t *items;
+	struct share_item *item;
+	struct iofuzzer_token *tokens;
+	size_t num_tokens;
+	size_t count;
+	size_t i;
+	size_t j;
 
-err:
-	free(ptr);
+	items = array_new(sizeof(struct share_item));
+	if (items == NULL) {
+		perror("array_new");
+		return NULL;
+	}
+
+	for (;;) {
+		iofuzzer_share_publish();
+		pthread_mutex_lock(&imports_mutex);
+		count = MAXIMPORTS - array_get_length(_imports);
+		pthread_mutex_unlock(&imports_mutex);
+		array_set_length(items, 0);
+		share_import(_share, items, count);
+		for (i = 0; i < array_get_length(items); i++) {
+			item = &array_index(items, struct share_item, i);
+			if (item->entry.type == SHARE_TYPE_DICTIONARY) {
+				tokens = malloc(item->entry.size);
+				num_tokens = 0;
+				for (j = 0; tokens != NULL && j < item->entry.size / sizeof(*tokens); j++) {
+					tokens[num_tokens] = ((const struct iofuzzer_token *)item->data)[j];
+					if (tokens[num_tokens].port < NUM_PORTS && (port_map == NULL || port_map[tokens[num_tokens].port]))
+						num_tokens++;
+				}
+
+				if (num_tokens != 0)
+					iofuzzer_learn(tokens, num_tokens);
+
+				free(tokens);
+				share_release(item);
+				continue;
+			}
+
+			if (item->entry.size < sizeof(uint64_t)) {
+				share_release(item);
+				continue;
+			}
+
+			if (iofuzzer_save_corpus(item->data, item->entry.size / sizeof(uint64_t)) == -1)
+				perror("iofuzzer_save_corpus");
+
+			pthread_mutex_lock(&imports_mutex);
+			array_append_val(_imports, item);
+			pthread_mutex_unlock(&imports_mutex);
+		}
+
+		if (verbose)
+			fprintf(stderr, "share,%d,%llu,%zu\n", (unsigned int)time(NULL),
+			    (unsigned long long)share_get_mark(_share), array_get_length(items));
+
+		sleep(share_interval);
+	}
 
 	return NULL;
 }
@@ -104,23 +612,46 @@ static void *
 thread_start(void *arg)
 {
 	unsigned long thread_num = (unsigned long)arg;
-	FILE *stream;
-	iofuzzer_t *fuzzer;
+	iofuzzer_t *fuzzer = NULL;
+	coverage_t *coverage_thread = NULL;
+	bloom_t *bloom;
+	wheel_t *wheel;
+	profile_t *_profile;
+	struct feedback_accumulator *accumulator;
+	uint64_t *states = NULL;
+	size_t num_states;
+	struct iofuzzer_token *tokens = NULL;
+	size_t num_tokens;
+	random_t *replay_random = NULL;
+	struct share_item replay;
+	size_t replay_index;
+	size_t num_imports;
+	unsigned long generation;
+	unsigned long result;
+	size_t events;
+	unsigned long stalls;
+	double score;
+	int interesting;
+	int input;
+	int arm;
 	uintptr_t *variates;
 	size_t length;
+	array_t *divergences;
+	struct iofuzzer_divergence *divergence;
+	struct log_record record;
+	struct log_index_entry entry;
+	struct sink_value value;
+	unsigned long long iteration;
+	uintptr_t operands[MAXVARIATES];
+	char buffer[RECORDSIZE];
+	size_t head;
+	size_t size;
+	off_t offset;
 	char state[8] = {0};
-	char *names[] = { "inb", "inw", "inl", "insb", "insw", "insl", "outb", "outw", "outl", "outsb", "outsw", "outsl" };
 	int i;
 
-	stream = stdout;
-	if (output != NULL) {
-		stream = fopen(output, "a+");
-		if (stream == NULL) {
-			perror("fopen");
-			goto err;
-		}
-	}
-
+	head = 0;
+	offset = 0;
 	fuzzer = iofuzzer_new();
 	if (fuzzer == NULL) {
 		perror("iofuzzer_new");
@@ -130,33 +661,312 @@ thread_start(void *arg)
 	iofuzzer_set_ports(fuzzer, iofuzzer_parse_ports(ports));
 	array_unref(iofuzzer_get_ports(fuzzer));
 	iofuzzer_set_random(fuzzer, _random);
+	iofuzzer_set_model(fuzzer, _model);
+	iofuzzer_set_sequence(fuzzer, _sequence);
+	/* Every thread filters the operations it performed recently */
+	if (filter != 0) {
+		bloom = bloom_new(filter);
+		if (bloom == NULL) {
+			perror("bloom_new");
+			goto err;
+		}
+
+		iofuzzer_set_filter(fuzzer, bloom);
+		bloom_unref(bloom);
+	}
+
+	/* Every thread profiles the ports on its own, after a profiling phase */
+	if (profile != -1) {
+		_profile = profile_new(iofuzzer_get_num_funcs(), profile);
+		if (_profile == NULL) {
+			perror("profile_new");
+			goto err;
+		}
+
+		iofuzzer_set_profile(fuzzer, _profile);
+		profile_unref(_profile);
+	}
+
+	/* Every thread interleaves its own delayed operations */
+	if (delays != 0) {
+		wheel = wheel_new(sizeof(struct iofuzzer_op), delays, RESOLUTION);
+		if (wheel == NULL) {
+			perror("wheel_new");
+			goto err;
+		}
+
+		iofuzzer_set_wheel(fuzzer, wheel);
+		wheel_unref(wheel);
+	}
+
+	if (_trace != NULL)
+		iofuzzer_set_trace(fuzzer, _trace, thread_num);
+
+	/* Threads walk disjoint parts of the same permutation */
+	if (traverse != NULL && iofuzzer_set_traversal(fuzzer, strtoul(traverse, NULL, 0), thread_num, num_threads) == NULL) {
+		perror("iofuzzer_set_traversal");
+		goto err;
+	}
+
+	coverage_thread = coverage_new_with_coverage(_coverage);
+	if (coverage_thread == NULL) {
+		perror("coverage_new_with_coverage");
+		goto err;
+	}
+
+	/* Sequences of operations are scored by batch */
+	if (_feedback != NULL) {
+		iofuzzer_set_feedback(fuzzer, _feedback);
+		states = calloc(BATCHSIZE, sizeof(*states));
+		if (states == NULL) {
+			perror("calloc");
+			goto err;
+		}
+	}
+
+	/*
+	 * With a shared directory, the values read by interesting batches are
+	 * learned, and shared corpus entries are replayed from a random of
+	 * the thread, so the shared random is left as is.
+	 */
+	if (_share != NULL) {
+		tokens = calloc(BATCHSIZE, sizeof(*tokens));
+		replay_random = random_new_with_state(state, sizeof(state));
+		if (tokens == NULL || replay_random == NULL) {
+			perror("calloc");
+			goto err;
+		}
+	}
+
+	memset(&replay, 0, sizeof(replay));
+	replay_index = 0;
+	num_states = 0;
+	num_tokens = 0;
+	generation = 0;
+	accumulator = iofuzzer_get_accumulator(fuzzer);
+	iofuzzer_set_strategy(fuzzer, strategy);
+	arm = strategy;
+	events = 0;
+	stalls = 0;
+	divergences = iofuzzer_get_divergences(fuzzer);
 	variates = &array_index(iofuzzer_get_variates(fuzzer), uintptr_t, 0);
 	length = array_get_length(iofuzzer_get_variates(fuzzer));
-	for (;;) {
-		flockfile(stream);
-		fprintf(stream, "%d,", (unsigned int)time(NULL));
-		fprintf(stream, "%d,", (unsigned int)thread_num);
+	if (length > MAXVARIATES) {
+		errno = EINVAL;
+		perror("iofuzzer_get_variates");
+		goto err;
+	}
+
+	for (iteration = 0; ; iteration++) {
+		if (replay.data != NULL)
+			iofuzzer_set_state(fuzzer, (const char *)replay.data + replay_index * sizeof(uint64_t), sizeof(uint64_t));
+
 		iofuzzer_get_state(fuzzer, state, sizeof(state));
-		fprintf(stream, "%#llx,", *((unsigned long long *)state));
-		fprintf(stream, "%s,", names[(unsigned int)variates[0]]);
-		for (i = 1; i < (length - 1); i++)
-			fprintf(stream, "%#x,", (unsigned int)variates[i]);
-
-		fprintf(stream, "%#x\n", (unsigned int)variates[i]);
-		fflush(stream);
-		fsync(fileno(stream));
+		memset(&record, 0, sizeof(record));
+		record.state = *((unsigned long long *)state);
+		record.iteration = iteration;
+		record.time = time(NULL);
+		record.thread = thread_num;
+		record.data = variates[1];
+		record.extra = variates[2];
+		record.port = variates[4];
+		record.count = variates[3];
+		record.func = variates[0];
+		if (_trace != NULL)
+			trace_begin(_trace, thread_num, TRACE_PHASE_LOG);
+
+		if (_sink != NULL) {
+			/*
+			 * The head is streamed before the operation is performed,
+			 * and the value after. Frames are batched by the sink, so
+			 * the operation only waits if the device falls behind.
+			 */
+			sink_write(_sink, SINK_FRAME_HEAD, &record, LOG_RECORD_HEAD_SIZE);
+		} else if (_fd != -1) {
+			/*
+			 * The record is written and synced before the operation is
+			 * performed, with room for the value, which is written in
+			 * place after. Records are stamped and given their room in
+			 * file order under the lock, which is released before the
+			 * operation, so threads never wait for each other's.
+			 */
+			pthread_mutex_lock(&output_mutex);
+			record.time = time(NULL);
+			head = iofuzzer_format_head(buffer, &record, variates, length);
+			size = head + iofuzzer_format_value(buffer + head, NULL);
+			offset = _offset;
+			_offset += size;
+			if (_index != NULL && iteration % index_interval == 0) {
+				entry.offset = offset;
+				entry.iteration = iteration;
+				entry.time = record.time;
+				entry.thread = thread_num;
+				fwrite(&entry, sizeof(entry), 1, _index);
+				fflush(_index);
+			}
+
+			pthread_mutex_unlock(&output_mutex);
+			if (pwrite(_fd, buffer, size, offset) != (ssize_t)size)
+				perror("pwrite");
+
+			if (_trace != NULL)
+				trace_begin(_trace, thread_num, TRACE_PHASE_SYNC);
+
+			fsync(_fd);
+			if (_trace != NULL)
+				trace_end(_trace, thread_num, TRACE_PHASE_SYNC);
+		} else if (_segment == NULL)
+			memcpy(operands, variates, length * sizeof(*variates));
+
+		if (_trace != NULL)
+			trace_end(_trace, thread_num, TRACE_PHASE_LOG);
+
+		/* Delayed operations are scheduled again by the operations that scheduled them */
+		if (states != NULL && !iofuzzer_is_delayed(state, sizeof(state)))
+			states[num_states++] = *((uint64_t *)state);
+
 		iofuzzer_iterate(fuzzer);
-		funlockfile(stream);
+		/* Input operations are classed by the value they returned, as in iofuzzer-fork */
+		input = record.func < MAXFUNCS && input_widths[record.func] != 0;
+		result = input ? iofuzzer_get_value(fuzzer) : record.data;
+		coverage_add(coverage_thread, record.port, record.func, result, 1UL << (record.func % 3));
+		if (tokens != NULL && input) {
+			/* Values a port only returns when absent are not worth learning */
+			if (result != 0 && result != 0xffffffffUL >> (32 - input_widths[record.func] * 8)) {
+				tokens[num_tokens].port = record.port;
+				tokens[num_tokens++].value = result;
+			}
+		}
+
+		if (replay.data != NULL && ++replay_index == replay.entry.size / sizeof(uint64_t)) {
+			share_release(&replay);
+			iofuzzer_set_random(fuzzer, _random);
+		}
+
+		if (_trace != NULL)
+			trace_begin(_trace, thread_num, TRACE_PHASE_LOG);
+
+		if (_sink != NULL) {
+			value.thread = thread_num;
+			value.value = iofuzzer_get_value(fuzzer);
+			sink_write(_sink, SINK_FRAME_VALUE, &value, sizeof(value));
+		} else if (_segment != NULL) {
+			/* Records are buffered and written by compressed segments */
+			record.value = iofuzzer_get_value(fuzzer);
+			if (segment_add(_segment, &record) == NULL)
+				perror("segment_add");
+		} else if (_fd != -1) {
+			record.value = iofuzzer_get_value(fuzzer);
+			size = iofuzzer_format_value(buffer + head, &record);
+			if (pwrite(_fd, buffer + head, size, offset + head) != (ssize_t)size)
+				perror("pwrite");
+		} else {
+			/*
+			 * Records of outputs that cannot be written in place are
+			 * written whole after the operation, stamped in the order
+			 * they are written.
+			 */
+			flockfile(_stream);
+			record.time = time(NULL);
+			record.value = iofuzzer_get_value(fuzzer);
+			head = iofuzzer_format_head(buffer, &record, operands, length);
+			size = head + iofuzzer_format_value(buffer + head, &record);
+			fwrite(buffer, size, 1, _stream);
+			fflush(_stream);
+			funlockfile(_stream);
+		}
+
+		if (_trace != NULL)
+			trace_end(_trace, thread_num, TRACE_PHASE_LOG);
+
+		for (i = 0; i < array_get_length(divergences); i++) {
+			divergence = &array_index(divergences, struct iofuzzer_divergence, i);
+			fprintf(stderr, "divergence,%d,%d,%#llx,%s,%#lx,%lu,%#lx,%#lx,%#lx\n",
+			    (unsigned int)time(NULL), (unsigned int)thread_num,
+			    *((unsigned long long *)divergence->state),
+			    iofuzzer_get_func_name(divergence->func), divergence->port,
+			    divergence->index, divergence->expected, divergence->actual,
+			    divergence->mask);
+		}
+
+		if (_feedback != NULL && array_get_length(divergences) != 0)
+			feedback_publish(_feedback, accumulator, feedback_divergence, array_get_length(divergences));
+
+		array_set_length(divergences, 0);
+		if (coverage_interval != 0 && (iteration + 1) % coverage_interval == 0)
+			iofuzzer_merge_coverage(thread_num, coverage_thread);
+
+		/* New tuples of the thread are published by batch */
+		if (_feedback != NULL && (iteration + 1) % BATCHSIZE == 0) {
+			feedback_publish(_feedback, accumulator, feedback_coverage, coverage_count(coverage_thread) - events);
+			events = coverage_count(coverage_thread);
+			interesting = feedback_verdict(_feedback, accumulator, &score);
+			stalls = interesting ? 0 : stalls + 1;
+			if (interesting && corpus != NULL && iofuzzer_save_corpus(states, num_states) == -1)
+				perror("iofuzzer_save_corpus");
+
+			if (interesting && num_tokens != 0)
+				iofuzzer_learn(tokens, num_tokens);
+
+			num_states = 0;
+			num_tokens = 0;
+
+			if (_scheduler != NULL) {
+				scheduler_update(_scheduler, arm, BATCHSIZE, (uint64_t)(score + 0.5));
+				arm = scheduler_select(_scheduler);
+				iofuzzer_set_strategy(fuzzer, arm);
+			}
+		}
+
+		/* Shared entries are picked up by batch, and never waited for */
+		if (_share != NULL && (iteration + 1) % BATCHSIZE == 0) {
+			if (generation != dictionary_generation) {
+				pthread_mutex_lock(&dictionary_mutex);
+				iofuzzer_set_dictionary(fuzzer, _dictionary);
+				generation = dictionary_generation;
+				pthread_mutex_unlock(&dictionary_mutex);
+			}
+
+			if (replay.data == NULL && pthread_mutex_trylock(&imports_mutex) == 0) {
+				num_imports = array_get_length(_imports);
+				if (num_imports != 0) {
+					replay = array_index(_imports, struct share_item, num_imports - 1);
+					array_set_length(_imports, num_imports - 1);
+				}
+
+				pthread_mutex_unlock(&imports_mutex);
+				replay_index = 0;
+				if (replay.data != NULL)
+					iofuzzer_set_random(fuzzer, replay_random);
+			}
+		}
+
+		/* Devices are normalized at a cadence, or when the feedback stalls */
+		if (_sequence != NULL && ((normalize_interval != 0 && (iteration + 1) % normalize_interval == 0) || stalls == STALL)) {
+			if (verbose)
+				fprintf(stderr, "normalize,%d,%d,%s\n", (unsigned int)time(NULL),
+				    (unsigned int)thread_num, stalls == STALL ? "stall" : "interval");
+
+			iofuzzer_normalize(fuzzer);
+			stalls = 0;
+		}
 	}
 
+	free(states);
+	free(tokens);
+	random_unref(replay_random);
+	share_release(&replay);
+	coverage_unref(coverage_thread);
 	iofuzzer_unref(fuzzer);
-	fclose(stream);
 
 	pthread_exit((void *)EXIT_SUCCESS);
 
 err:
+	free(states);
+	free(tokens);
+	random_unref(replay_random);
+	coverage_unref(coverage_thread);
 	iofuzzer_unref(fuzzer);
-	fclose(stream);
 
 	pthread_exit((void *)EXIT_FAILURE);
 }
@@ -165,39 +975,97 @@ int
 main(int argc, char *argv[])
 {
 	enum {
-		OPT_DEBUG = CHAR_MAX + 1,
+		OPT_CORPUS = CHAR_MAX + 1,
+		OPT_COVERAGE,
+		OPT_COVERAGE_INTERVAL,
+		OPT_DEBUG,
+		OPT_DELAYS,
+		OPT_FILTER,
+		OPT_FLUSH_INTERVAL,
+		OPT_FORMAT,
 		OPT_HELP,
+		OPT_INDEX_INTERVAL,
+		OPT_MODEL,
+		OPT_NORMALIZE,
+		OPT_NORMALIZE_INTERVAL,
 		OPT_NUM_THREADS,
 		OPT_OUTPUT,
 		OPT_PORTS,
+		OPT_PROFILE,
 		OPT_QUIET,
+		OPT_SHARE,
+		OPT_SHARE_INTERVAL,
 		OPT_SILENT,
+		OPT_SINK,
 		OPT_STACK_SIZE,
 		OPT_STATE,
+		OPT_STRATEGY,
+		OPT_THRESHOLD,
+		OPT_TRACE,
+		OPT_TRAVERSE,
 		OPT_VERBOSE,
 		OPT_VERSION,
 	};
 	static struct option longopts[] = {
-		{"debug",       no_argument,       NULL, 'd'             },
-		{"help",        no_argument,       NULL, 'h'             },
-		{"num-threads", required_argument, NULL, OPT_NUM_THREADS },
-		{"output",      required_argument, NULL, 'o'             },
-		{"ports",       required_argument, NULL, 'p'             },
-		{"quiet",       no_argument,       NULL, 'q'             },
-		{"silent",      no_argument,       NULL, 'q'             },
-		{"stack-size",  required_argument, NULL, OPT_STACK_SIZE  },
-		{"state",       required_argument, NULL, OPT_STATE       },
-		{"verbose",     no_argument,       NULL, 'v'             },
-		{"version",     no_argument,       NULL, OPT_VERSION     },
-		{NULL,          0,                 NULL, 0               }
+		{"corpus",             required_argument, NULL, OPT_CORPUS             },
+		{"coverage",           required_argument, NULL, OPT_COVERAGE           },
+		{"coverage-interval",  required_argument, NULL, OPT_COVERAGE_INTERVAL  },
+		{"debug",              no_argument,       NULL, 'd'                    },
+		{"delays",             required_argument, NULL, OPT_DELAYS             },
+		{"filter",             required_argument, NULL, OPT_FILTER             },
+		{"flush-interval",     required_argument, NULL, OPT_FLUSH_INTERVAL     },
+		{"format",             required_argument, NULL, OPT_FORMAT             },
+		{"help",               no_argument,       NULL, 'h'                    },
+		{"index-interval",     required_argument, NULL, OPT_INDEX_INTERVAL     },
+		{"model",              required_argument, NULL, OPT_MODEL              },
+		{"normalize",          required_argument, NULL, OPT_NORMALIZE          },
+		{"normalize-interval", required_argument, NULL, OPT_NORMALIZE_INTERVAL },
+		{"num-threads",        required_argument, NULL, OPT_NUM_THREADS        },
+		{"output",             required_argument, NULL, 'o'                    },
+		{"ports",              required_argument, NULL, 'p'                    },
+		{"profile",            required_argument, NULL, OPT_PROFILE            },
+		{"quiet",              no_argument,       NULL, 'q'                    },
+		{"share",              required_argument, NULL, OPT_SHARE              },
+		{"share-interval",     required_argument, NULL, OPT_SHARE_INTERVAL     },
+		{"silent",             no_argument,       NULL, 'q'                    },
+		{"sink",               required_argument, NULL, OPT_SINK               },
+		{"stack-size",         required_argument, NULL, OPT_STACK_SIZE         },
+		{"state",              required_argument, NULL, OPT_STATE              },
+		{"strategy",           required_argument, NULL, OPT_STRATEGY           },
+		{"threshold",          required_argument, NULL, OPT_THRESHOLD          },
+		{"trace",              required_argument, NULL, OPT_TRACE              },
+		{"traverse",           required_argument, NULL, OPT_TRAVERSE           },
+		{"verbose",            no_argument,       NULL, 'v'                    },
+		{"version",            no_argument,       NULL, OPT_VERSION            },
+		{NULL,                 0,                 NULL, 0                      }
 	};
 	static int longindex = 0;
 	int c;
-	unsigned long num_threads = 1;
 	size_t stack_size = 0;
 	pthread_attr_t attr;
 	unsigned long thread_num;
 	pthread_t thread;
+	array_t *port_array;
+	const char *name;
+	char agent[HOST_NAME_MAX + PATH_MAX + 2];
+	char path[PATH_MAX];
+	char id[sizeof("0123456789abcdef")];
+	size_t i;
+	int waited;
+	int fd;
+
+	/* The signals are blocked before any thread is created, to inherit the mask */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+#ifdef LOCKSTAT
+	sigaddset(&signals, SIGUSR1);
+#endif
+	errno = pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	if (errno != 0) {
+		perror("pthread_sigmask");
+		exit(EXIT_FAILURE);
+	}
 
 	while ((c = getopt_long(argc, argv, "dho:p:qv", longopts, &longindex)) != -1) {
 		switch (c) {
@@ -225,10 +1093,80 @@ main(int argc, char *argv[])
 			verbose = 1;
 			break;
 
+		case OPT_CORPUS:
+			corpus = optarg;
+			break;
+
+		case OPT_COVERAGE:
+			coverage = optarg;
+			break;
+
+		case OPT_COVERAGE_INTERVAL:
+			coverage_interval = strtoul(optarg, NULL, 0);
+			break;
+
+		case OPT_DELAYS:
+			delays = strtoul(optarg, NULL, 0);
+			break;
+
+		case OPT_FILTER:
+			filter = strtoul(optarg, NULL, 0);
+			break;
+
+		case OPT_FLUSH_INTERVAL:
+			flush_interval = strtoul(optarg, NULL, 0);
+			break;
+
+		case OPT_FORMAT:
+			if (strcmp(optarg, "binary") == 0)
+				format = LOG_FORMAT_BINARY;
+			else if (strcmp(optarg, "csv") == 0)
+				format = LOG_FORMAT_CSV;
+			else if (strcmp(optarg, "segment") == 0)
+				format = LOG_FORMAT_SEGMENT;
+			else {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+
+			break;
+
+		case OPT_INDEX_INTERVAL:
+			index_interval = strtoul(optarg, NULL, 0);
+			break;
+
+		case OPT_MODEL:
+			model = optarg;
+			break;
+
+		case OPT_NORMALIZE:
+			normalize = optarg;
+			break;
+
+		case OPT_NORMALIZE_INTERVAL:
+			normalize_interval = strtoul(optarg, NULL, 0);
+			break;
+
 		case OPT_NUM_THREADS:
 			num_threads = strtoul(optarg, NULL, 0);
 			break;
 
+		case OPT_PROFILE:
+			profile = strtol(optarg, NULL, 0);
+			break;
+
+		case OPT_SHARE:
+			share = optarg;
+			break;
+
+		case OPT_SHARE_INTERVAL:
+			share_interval = strtoul(optarg, NULL, 0);
+			break;
+
+		case OPT_SINK:
+			sink = optarg;
+			break;
+
 		case OPT_STACK_SIZE:
 			stack_size = strtoul(optarg, NULL, 0);
 			break;
@@ -237,6 +1175,28 @@ main(int argc, char *argv[])
 			*((unsigned long long *)state) = strtoull(optarg, NULL, 0);
 			break;
 
+		case OPT_STRATEGY:
+			if (strcmp(optarg, "auto") == 0)
+				strategy = -1;
+			else if ((strategy = iofuzzer_get_strategy_by_name(optarg)) == -1) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+
+			break;
+
+		case OPT_THRESHOLD:
+			threshold = strtod(optarg, NULL);
+			break;
+
+		case OPT_TRACE:
+			trace = optarg;
+			break;
+
+		case OPT_TRAVERSE:
+			traverse = optarg;
+			break;
+
 		case OPT_VERSION:
 			version();
 			exit(EXIT_FAILURE);
@@ -247,6 +1207,22 @@ main(int argc, char *argv[])
 		}
 	}
 
+	/* Corpus entries are shared from, and imported into, the corpus */
+	if (share != NULL && (corpus == NULL || share_interval == 0)) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 * Threads would interleave their port operations between the native
+	 * operation and the model operation of another thread, and report
+	 * divergences the device never had.
+	 */
+	if (model != NULL && num_threads > 1) {
+		fprintf(stderr, "%s: --model requires a single thread\n", PROGRAM_NAME);
+		exit(EXIT_FAILURE);
+	}
+
 	if (iopl(3) == -1) {
 		perror("iopl");
 		exit(EXIT_FAILURE);
@@ -264,12 +1240,240 @@ main(int argc, char *argv[])
 		} while (secs--);
 	}
 
+	/* Records are streamed to the sink instead of the output if any */
+	if (sink != NULL) {
+		fd = sink_connect(sink);
+		if (fd == -1) {
+			perror(sink);
+			exit(EXIT_FAILURE);
+		}
+
+		_sink = sink_new(fd, SINK_CAPACITY);
+		if (_sink == NULL) {
+			perror("sink_new");
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		_stream = iofuzzer_open_output(output, format);
+		if (_stream == NULL) {
+			perror("fopen");
+			exit(EXIT_FAILURE);
+		}
+
+		if (format == LOG_FORMAT_SEGMENT) {
+			_segment = segment_new(_stream, SEGMENT_CAPACITY);
+			if (_segment == NULL) {
+				perror("segment_new");
+				exit(EXIT_FAILURE);
+			}
+		} else if (output != NULL) {
+			/*
+			 * Records of files are written in place, at offsets they
+			 * are given in order, without the append mode of the
+			 * stream, which would ignore the offsets.
+			 */
+			_fd = open(output, O_WRONLY);
+			if (_fd == -1) {
+				perror(output);
+				exit(EXIT_FAILURE);
+			}
+
+			_offset = lseek(_fd, 0, SEEK_END);
+			if (_offset == -1) {
+				close(_fd);
+				_fd = -1;
+			}
+		}
+	}
+
+	/*
+	 * Records are located by the index, so it is only kept for files.
+	 * Segments are indexed by the segment writer as they are written.
+	 */
+	if ((_fd != -1 || (_segment != NULL && output != NULL)) && index_interval != 0) {
+		_index = iofuzzer_open_index(output, &index_interval);
+		if (_index == NULL) {
+			perror("iofuzzer_open_index");
+			exit(EXIT_FAILURE);
+		}
+
+		if (_segment != NULL)
+			segment_set_index(_segment, _index, index_interval);
+	}
+
 	_random = random_new_with_state(state, sizeof(state));
 	if (_random == NULL) {
 		perror("random_new_with_state");
 		exit(EXIT_FAILURE);
 	}
 
+	/* Every thread traces to a buffer of its own */
+	if (trace != NULL) {
+		_trace = trace_new(trace, num_threads);
+		if (_trace == NULL) {
+			perror(trace);
+			exit(EXIT_FAILURE);
+		}
+
+		trace_set_flush_interval(_trace, flush_interval);
+	}
+
+	/*
+	 * The feedback bus only exists if its verdicts are used. The fuzzer
+	 * registers its own sources with it.
+	 */
+	if (corpus != NULL || strategy == -1) {
+		if (corpus != NULL && mkdir(corpus, 0755) == -1 && errno != EEXIST) {
+			perror(corpus);
+			exit(EXIT_FAILURE);
+		}
+
+		_feedback = feedback_new();
+		if (_feedback == NULL) {
+			perror("feedback_new");
+			exit(EXIT_FAILURE);
+		}
+
+		feedback_set_threshold(_feedback, threshold);
+		feedback_coverage = feedback_add_source(_feedback, "coverage", 1);
+		feedback_divergence = feedback_add_source(_feedback, "divergence", 1);
+	}
+
+	/* Strategies are scheduled in batches by their yield of new tuples */
+	if (strategy == -1) {
+		_scheduler = scheduler_new(IOFUZZER_NUM_STRATEGIES);
+		if (_scheduler == NULL) {
+			perror("scheduler_new");
+			exit(EXIT_FAILURE);
+		}
+
+		strategy = scheduler_select(_scheduler);
+	}
+
+	/* Tuples of a previous run are loaded from the coverage file */
+	port_array = ports != NULL ? iofuzzer_parse_ports(ports) : NULL;
+	_coverage = coverage_new(port_array, iofuzzer_get_num_funcs());
+	array_unref(port_array);
+	if (_coverage == NULL) {
+		perror("coverage_new");
+		exit(EXIT_FAILURE);
+	}
+
+	if (coverage != NULL && coverage_load(_coverage, coverage) == NULL && errno != ENOENT) {
+		perror("coverage_load");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Every thread normalizes the devices with the same sequence */
+	if (normalize != NULL) {
+		_sequence = iofuzzer_parse_sequence(normalize);
+		if (_sequence == NULL) {
+			perror("iofuzzer_parse_sequence");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* Every operation is also performed on the reference model */
+	if (model != NULL) {
+		_model = model_new(model);
+		if (_model == NULL) {
+			perror("model_new");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* Values returned by input operations are covered, and learned */
+	for (i = 0; i < iofuzzer_get_num_funcs() && i < MAXFUNCS; i++) {
+		name = iofuzzer_get_func_name(i);
+		if (strncmp(name, "in", 2) == 0 && strlen(name) == 3)
+			input_widths[i] = name[2] == 'b' ? 1 : name[2] == 'w' ? 2 : 4;
+	}
+
+	/*
+	 * Corpus entries and dictionaries are shared by a thread of their own,
+	 * so the threads fuzzing never wait for the shared directory.
+	 */
+	if (share != NULL) {
+		/* An agent is a corpus on a host, so a restarted agent finds its mark */
+		if (gethostname(agent, HOST_NAME_MAX + 1) == -1 || realpath(corpus, path) == NULL) {
+			perror(corpus);
+			exit(EXIT_FAILURE);
+		}
+
+		agent[HOST_NAME_MAX] = '\0';
+		sprintf(&agent[strlen(agent)], ":%s", path);
+		sprintf(id, "%016llx", (unsigned long long)share_hash(agent, strlen(agent)));
+		_share = share_new(share, id);
+		_imports = array_new(sizeof(struct share_item));
+		if (_share == NULL || _imports == NULL) {
+			perror(share);
+			exit(EXIT_FAILURE);
+		}
+
+		/* The dictionary learned before a restart is drawn from again */
+		if (snprintf(path, sizeof(path), "%s/.dictionary", corpus) >= (int)sizeof(path)) {
+			errno = ENAMETOOLONG;
+			perror(corpus);
+			exit(EXIT_FAILURE);
+		}
+
+		_dictionary = iofuzzer_read_dictionary(path);
+		if (_dictionary == NULL && errno != ENOENT) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+
+		if (_dictionary != NULL)
+			dictionary_generation++;
+
+		/* Imported tokens are only learned for the ports being fuzzed */
+		if (ports != NULL) {
+			port_map = calloc(NUM_PORTS, sizeof(*port_map));
+			port_array = iofuzzer_parse_ports(ports);
+			if (port_map == NULL || port_array == NULL) {
+				perror("iofuzzer_parse_ports");
+				exit(EXIT_FAILURE);
+			}
+
+			for (i = 0; i < array_get_length(port_array); i++) {
+				if (array_index(port_array, unsigned long, i) < NUM_PORTS)
+					port_map[array_index(port_array, unsigned long, i)] = 1;
+			}
+
+			array_unref(port_array);
+		}
+
+		errno = pthread_create(&thread, NULL, &share_thread_start, NULL);
+		if (errno == 0)
+			errno = pthread_detach(thread);
+
+		if (errno != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/*
+	 * The signals are waited for by a thread of their own if records or
+	 * trace events are buffered, or lock statistics reported; otherwise
+	 * they terminate the fuzzer as usual.
+	 */
+	waited = _segment != NULL || _trace != NULL;
+#ifdef LOCKSTAT
+	waited = 1;
+#endif
+	if (waited) {
+		errno = pthread_create(&thread, NULL, &signal_thread_start, NULL);
+		if (errno == 0)
+			errno = pthread_detach(thread);
+	} else
+		errno = pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+	if (errno != 0) {
+		perror("pthread_create");
+		exit(EXIT_FAILURE);
+	}
+
 	errno = pthread_attr_init(&attr);
 	if (errno != 0) {
 		perror("pthread_attr_init");
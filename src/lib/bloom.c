@@ -0,0 +1,278 @@
+/** @file */
+
+#include "bloom.h"
+#include "lockstat.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BITS_PER_KEY 12
+#define BLOCKSIZE 8 /* Words of a block, a 64-byte cache line */
+#define NUM_GENERATIONS 2
+#define NUM_HASHES 4
+
+struct bloom {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	uint64_t *blocks[NUM_GENERATIONS];
+	size_t num_blocks;
+	size_t capacity;
+	size_t count;
+	int current;
+};
+
+static uint64_t _bloom_hash(uint64_t key);
+
+/**
+ * Adds a key to the filter. Keys are added to the current generation.
+ * Once the current generation holds as many keys as the capacity of the
+ * filter, the previous generation is cleared and becomes the current
+ * generation, so the filter forgets keys that were added more than twice
+ * the capacity of the filter ago. Adding is not synchronized; every
+ * thread uses its own filter.
+ *
+ * @param [in] bloom The filter.
+ * @param [in] key The key.
+ * @return The filter.
+ */
+bloom_t *
+bloom_add(bloom_t *bloom, uint64_t key)
+{
+	uint64_t *block;
+	uint64_t hash;
+	uint64_t bits;
+	int i;
+
+	if (bloom == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (bloom->count == bloom->capacity) {
+		bloom->current = (bloom->current + 1) % NUM_GENERATIONS;
+		memset(bloom->blocks[bloom->current], 0, bloom->num_blocks * BLOCKSIZE * sizeof(uint64_t));
+		bloom->count = 0;
+	}
+
+	hash = _bloom_hash(key);
+	block = &bloom->blocks[bloom->current][(hash & (bloom->num_blocks - 1)) * BLOCKSIZE];
+	for (i = 0, bits = hash >> (64 - NUM_HASHES * 9); i < NUM_HASHES; i++, bits >>= 9)
+		block[bits & (BLOCKSIZE - 1)] |= 1ULL << ((bits >> 3) & 63);
+
+	bloom->count++;
+
+	return bloom;
+}
+
+/**
+ * Removes all keys from the filter.
+ *
+ * @param [in] bloom The filter.
+ * @return The filter.
+ */
+bloom_t *
+bloom_clear(bloom_t *bloom)
+{
+	int i;
+
+	if (bloom == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	for (i = 0; i < NUM_GENERATIONS; i++)
+		memset(bloom->blocks[i], 0, bloom->num_blocks * BLOCKSIZE * sizeof(uint64_t));
+
+	bloom->count = 0;
+
+	return bloom;
+}
+
+/**
+ * Tests whether a key was recently added to the filter. False positives
+ * are possible, false negatives are not. A test reads one cache line per
+ * generation.
+ *
+ * @param [in] bloom The filter.
+ * @param [in] key The key.
+ * @return One if the key is in the filter, zero if it is not.
+ */
+int
+bloom_contains(bloom_t *bloom, uint64_t key)
+{
+	const uint64_t *block;
+	uint64_t hash;
+	uint64_t bits;
+	size_t offset;
+	int found;
+	int i;
+	int j;
+
+	if (bloom == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	hash = _bloom_hash(key);
+	offset = (hash & (bloom->num_blocks - 1)) * BLOCKSIZE;
+	for (i = 0; i < NUM_GENERATIONS; i++) {
+		block = &bloom->blocks[i][offset];
+		found = 1;
+		for (j = 0, bits = hash >> (64 - NUM_HASHES * 9); found && j < NUM_HASHES; j++, bits >>= 9)
+			found = (block[bits & (BLOCKSIZE - 1)] >> ((bits >> 3) & 63)) & 1;
+
+		if (found)
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Frees the memory allocated for the filter.
+ *
+ * @param [in] bloom The filter.
+ * @return The filter.
+ */
+bloom_t *
+bloom_free(bloom_t *bloom)
+{
+	int i;
+
+	if (bloom == NULL)
+		return NULL;
+
+	for (i = 0; i < NUM_GENERATIONS; i++)
+		free(bloom->blocks[i]);
+
+	pthread_mutex_destroy(&bloom->mutex);
+	free(bloom);
+
+	return NULL;
+}
+
+/**
+ * Returns the capacity of a generation of the filter.
+ *
+ * @param [in] bloom The filter.
+ * @return The capacity of a generation of the filter.
+ */
+size_t
+bloom_get_capacity(bloom_t *bloom)
+{
+	if (bloom == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return bloom->capacity;
+}
+
+/**
+ * Creates a filter that remembers at least a given number of the most
+ * recently added keys. Every key maps to a single 64-byte block, and the
+ * filter takes about 3 bytes per key, so filters of a few thousand keys
+ * stay in the L1 or L2 cache.
+ *
+ * @param [in] capacity The capacity of a generation of the filter.
+ * @return A filter.
+ */
+bloom_t *
+bloom_new(size_t capacity)
+{
+	bloom_t *bloom;
+	int i;
+
+	if (capacity == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	bloom = calloc(1, sizeof(*bloom));
+	if (bloom == NULL)
+		return NULL;
+
+	errno = pthread_mutex_init(&bloom->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	bloom->num_blocks = 1;
+	while (bloom->num_blocks * BLOCKSIZE * 64 < capacity * BITS_PER_KEY)
+		bloom->num_blocks *= 2;
+
+	for (i = 0; i < NUM_GENERATIONS; i++) {
+		bloom->blocks[i] = aligned_alloc(BLOCKSIZE * sizeof(uint64_t), bloom->num_blocks * BLOCKSIZE * sizeof(uint64_t));
+		if (bloom->blocks[i] == NULL)
+			goto err;
+	}
+
+	bloom->capacity = capacity;
+	bloom_clear(bloom);
+	bloom_ref(bloom);
+
+	return bloom;
+
+err:
+	bloom_free(bloom);
+
+	return NULL;
+}
+
+/**
+ * Increments the reference count of the filter.
+ *
+ * @param [in] bloom The filter.
+ * @return The filter.
+ */
+bloom_t *
+bloom_ref(bloom_t *bloom)
+{
+	if (bloom == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&bloom->mutex);
+	bloom->refcount++;
+	pthread_mutex_unlock(&bloom->mutex);
+
+	return bloom;
+}
+
+/**
+ * Decrements the reference count of the filter.
+ *
+ * @param [in] bloom The filter.
+ */
+void
+bloom_unref(bloom_t *bloom)
+{
+	if (bloom == NULL)
+		return;
+
+	pthread_mutex_lock(&bloom->mutex);
+	bloom->refcount--;
+	if (bloom->refcount > 0) {
+		pthread_mutex_unlock(&bloom->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&bloom->mutex);
+	bloom_free(bloom);
+}
+
+static uint64_t
+_bloom_hash(uint64_t key)
+{
+	/* SplitMix64 finalizer */
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+
+	return key;
+}
@@ -0,0 +1,28 @@
+/** @file */
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct bloom bloom_t; /**< Blocked Bloom filter with generation-based aging. */
+
+bloom_t *bloom_add(bloom_t *bloom, uint64_t key);
+bloom_t *bloom_clear(bloom_t *bloom);
+int bloom_contains(bloom_t *bloom, uint64_t key);
+bloom_t *bloom_free(bloom_t *bloom);
+size_t bloom_get_capacity(bloom_t *bloom);
+bloom_t *bloom_new(size_t capacity);
+bloom_t *bloom_ref(bloom_t *bloom);
+void bloom_unref(bloom_t *bloom);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLOOM_H */
@@ -0,0 +1,449 @@
+/** @file */
+
+#include "array.h"
+#include "coverage.h"
+#include "lockstat.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_PORTS 65536
+
+struct coverage {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	uint64_t *bits;
+	size_t num_words;
+	size_t num_bits;
+	size_t num_funcs;
+	size_t count;
+	array_t *map;
+};
+
+static coverage_t *_coverage_new(array_t *map, size_t num_ports, size_t num_funcs);
+
+/**
+ * Adds a (port, operation, value class) tuple to the coverage map. The
+ * tuple is a single bit, so adding it is a single load and store. Adding
+ * is not synchronized; every thread adds to its own coverage map.
+ *
+ * @param [in] coverage The coverage map.
+ * @param [in] port The I/O port address.
+ * @param [in] func The I/O instruction/operation.
+ * @param [in] value The value.
+ * @param [in] width The width of the operation in bytes.
+ * @return The coverage map.
+ * @see coverage_merge
+ */
+coverage_t *
+coverage_add(coverage_t *coverage, unsigned long port, unsigned long func, unsigned long value, size_t width)
+{
+	uint64_t mask;
+	size_t bit;
+
+	if (coverage == NULL || port >= NUM_PORTS || func >= coverage->num_funcs) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (coverage->map != NULL) {
+		port = array_index(coverage->map, uint32_t, port);
+		if (port-- == 0) {
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+
+	bit = (port * coverage->num_funcs + func) * COVERAGE_NUM_CLASSES + coverage_get_class(value, width);
+	mask = 1ULL << (bit % 64);
+	coverage->count += (coverage->bits[bit / 64] & mask) == 0;
+	coverage->bits[bit / 64] |= mask;
+
+	return coverage;
+}
+
+/**
+ * Removes all tuples from the coverage map.
+ *
+ * @param [in] coverage The coverage map.
+ * @return The coverage map.
+ */
+coverage_t *
+coverage_clear(coverage_t *coverage)
+{
+	if (coverage == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&coverage->mutex);
+	memset(coverage->bits, 0, coverage->num_words * sizeof(*coverage->bits));
+	coverage->count = 0;
+	pthread_mutex_unlock(&coverage->mutex);
+
+	return coverage;
+}
+
+/**
+ * Returns the number of tuples in the coverage map.
+ *
+ * @param [in] coverage The coverage map.
+ * @return The number of tuples in the coverage map.
+ */
+size_t
+coverage_count(coverage_t *coverage)
+{
+	size_t count;
+
+	if (coverage == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&coverage->mutex);
+	count = coverage->count;
+	pthread_mutex_unlock(&coverage->mutex);
+
+	return count;
+}
+
+/**
+ * Frees the memory allocated for the coverage map.
+ *
+ * @param [in] coverage The coverage map.
+ * @return The coverage map.
+ */
+coverage_t *
+coverage_free(coverage_t *coverage)
+{
+	if (coverage == NULL)
+		return NULL;
+
+	free(coverage->bits);
+	array_unref(coverage->map);
+	pthread_mutex_destroy(&coverage->mutex);
+	free(coverage);
+
+	return NULL;
+}
+
+/**
+ * Returns the value class of a given value.
+ *
+ * @param [in] value The value.
+ * @param [in] width The width of the value in bytes.
+ * @return The value class of the value.
+ */
+unsigned long
+coverage_get_class(unsigned long value, size_t width)
+{
+	unsigned long mask;
+
+	mask = 0xffffffffUL >> (32 - (width < 4 ? width : 4) * 8);
+	value &= mask;
+	if (value == 0)
+		return COVERAGE_CLASS_ZERO;
+
+	if (value == 1)
+		return COVERAGE_CLASS_ONE;
+
+	if (value == mask)
+		return COVERAGE_CLASS_ONES;
+
+	if ((value & (value - 1)) == 0)
+		return COVERAGE_CLASS_POWER;
+
+	if ((value & (value + 1)) == 0)
+		return COVERAGE_CLASS_MERSENNE;
+
+	if (((value - 1) & (value - 2)) == 0)
+		return COVERAGE_CLASS_FERMAT;
+
+	if (value < 0x80)
+		return COVERAGE_CLASS_SMALL;
+
+	return COVERAGE_CLASS_OTHER;
+}
+
+/**
+ * Returns the number of possible tuples of the coverage map.
+ *
+ * @param [in] coverage The coverage map.
+ * @return The number of possible tuples of the coverage map.
+ */
+size_t
+coverage_get_size(coverage_t *coverage)
+{
+	if (coverage == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return coverage->num_bits;
+}
+
+/**
+ * Adds the tuples of a coverage map saved to a given file to the coverage
+ * map. Both coverage maps must have the same layout.
+ *
+ * @param [in] coverage The coverage map.
+ * @param [in] path The path of the file.
+ * @return The coverage map.
+ * @see coverage_save
+ */
+coverage_t *
+coverage_load(coverage_t *coverage, const char *path)
+{
+	FILE *stream;
+	char magic[sizeof(COVERAGE_MAGIC) - 1];
+	uint64_t num_bits;
+	uint64_t word;
+	size_t i;
+
+	if (coverage == NULL || path == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	stream = fopen(path, "r");
+	if (stream == NULL)
+		return NULL;
+
+	if (fread(magic, sizeof(magic), 1, stream) != 1 || fread(&num_bits, sizeof(num_bits), 1, stream) != 1 ||
+	    memcmp(magic, COVERAGE_MAGIC, sizeof(magic)) != 0 || num_bits != coverage->num_bits) {
+		fclose(stream);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&coverage->mutex);
+	for (i = 0; i < coverage->num_words && fread(&word, sizeof(word), 1, stream) == 1; i++) {
+		coverage->count += __builtin_popcountll(word & ~coverage->bits[i]);
+		coverage->bits[i] |= word;
+	}
+
+	pthread_mutex_unlock(&coverage->mutex);
+	fclose(stream);
+
+	return coverage;
+}
+
+/**
+ * Merges the tuples of another coverage map into the coverage map. Both
+ * coverage maps must have the same layout.
+ *
+ * @param [in] coverage The coverage map.
+ * @param [in] other The other coverage map.
+ * @return The number of tuples that were not in the coverage map.
+ * @see coverage_new_with_coverage
+ */
+size_t
+coverage_merge(coverage_t *coverage, coverage_t *other)
+{
+	size_t count;
+	size_t i;
+
+	if (coverage == NULL || other == NULL || coverage->num_words != other->num_words) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	/* Plain word loop; vectorized by the compiler */
+	count = 0;
+	pthread_mutex_lock(&coverage->mutex);
+	for (i = 0; i < coverage->num_words; i++) {
+		count += __builtin_popcountll(other->bits[i] & ~coverage->bits[i]);
+		coverage->bits[i] |= other->bits[i];
+	}
+
+	coverage->count += count;
+	pthread_mutex_unlock(&coverage->mutex);
+
+	return count;
+}
+
+/**
+ * Creates a coverage map for given ports.
+ *
+ * @param [in] ports The ports, or NULL for all the I/O address space.
+ * @param [in] num_funcs The number of I/O instructions/operations.
+ * @return A coverage map.
+ * @see iofuzzer_set_ports
+ */
+coverage_t *
+coverage_new(array_t *ports, size_t num_funcs)
+{
+	coverage_t *coverage;
+	array_t *map;
+	unsigned long port;
+	uint32_t num_ports;
+	size_t i;
+
+	if (ports == NULL)
+		return _coverage_new(NULL, NUM_PORTS, num_funcs);
+
+	map = array_new_with_length(sizeof(uint32_t), NUM_PORTS);
+	if (map == NULL)
+		return NULL;
+
+	memset(&array_index(map, uint32_t, 0), 0, NUM_PORTS * sizeof(uint32_t));
+	num_ports = 0;
+	for (i = 0; i < array_get_length(ports); i++) {
+		port = array_index(ports, unsigned long, i);
+		if (port < NUM_PORTS && array_index(map, uint32_t, port) == 0)
+			array_index(map, uint32_t, port) = ++num_ports;
+	}
+
+	coverage = _coverage_new(map, num_ports, num_funcs);
+	array_unref(map);
+
+	return coverage;
+}
+
+/**
+ * Creates an empty coverage map with the same layout as another coverage
+ * map, such as a per-thread coverage map to be merged into a global one.
+ *
+ * @param [in] other The other coverage map.
+ * @return A coverage map.
+ */
+coverage_t *
+coverage_new_with_coverage(coverage_t *other)
+{
+	if (other == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return _coverage_new(other->map, other->num_bits / (other->num_funcs * COVERAGE_NUM_CLASSES), other->num_funcs);
+}
+
+/**
+ * Increments the reference count of the coverage map.
+ *
+ * @param [in] coverage The coverage map.
+ * @return The coverage map.
+ */
+coverage_t *
+coverage_ref(coverage_t *coverage)
+{
+	if (coverage == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&coverage->mutex);
+	coverage->refcount++;
+	pthread_mutex_unlock(&coverage->mutex);
+
+	return coverage;
+}
+
+/**
+ * Saves the coverage map to a given file. The file is replaced
+ * atomically, so it always holds a complete coverage map.
+ *
+ * @param [in] coverage The coverage map.
+ * @param [in] path The path of the file.
+ * @return The coverage map.
+ * @see coverage_load
+ */
+coverage_t *
+coverage_save(coverage_t *coverage, const char *path)
+{
+	FILE *stream;
+	uint64_t num_bits;
+	char *name;
+	int retval;
+
+	if (coverage == NULL || path == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	name = malloc(strlen(path) + sizeof(".tmp"));
+	if (name == NULL)
+		return NULL;
+
+	sprintf(name, "%s.tmp", path);
+	pthread_mutex_lock(&coverage->mutex);
+	stream = fopen(name, "w");
+	if (stream == NULL) {
+		pthread_mutex_unlock(&coverage->mutex);
+		free(name);
+		return NULL;
+	}
+
+	num_bits = coverage->num_bits;
+	fwrite(COVERAGE_MAGIC, sizeof(COVERAGE_MAGIC) - 1, 1, stream);
+	fwrite(&num_bits, sizeof(num_bits), 1, stream);
+	fwrite(coverage->bits, sizeof(*coverage->bits), coverage->num_words, stream);
+	retval = fclose(stream) == EOF ? -1 : rename(name, path);
+	pthread_mutex_unlock(&coverage->mutex);
+	free(name);
+
+	return retval == 0 ? coverage : NULL;
+}
+
+/**
+ * Decrements the reference count of the coverage map.
+ *
+ * @param [in] coverage The coverage map.
+ */
+void
+coverage_unref(coverage_t *coverage)
+{
+	if (coverage == NULL)
+		return;
+
+	pthread_mutex_lock(&coverage->mutex);
+	coverage->refcount--;
+	if (coverage->refcount > 0) {
+		pthread_mutex_unlock(&coverage->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&coverage->mutex);
+	coverage_free(coverage);
+}
+
+static coverage_t *
+_coverage_new(array_t *map, size_t num_ports, size_t num_funcs)
+{
+	coverage_t *coverage;
+
+	if (num_ports == 0 || num_funcs == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	coverage = calloc(1, sizeof(*coverage));
+	if (coverage == NULL)
+		return NULL;
+
+	errno = pthread_mutex_init(&coverage->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	coverage->num_bits = num_ports * num_funcs * COVERAGE_NUM_CLASSES;
+	coverage->num_words = (coverage->num_bits + 63) / 64;
+	coverage->bits = calloc(coverage->num_words, sizeof(*coverage->bits));
+	if (coverage->bits == NULL)
+		goto err;
+
+	coverage->num_funcs = num_funcs;
+	coverage->map = map;
+	array_ref(coverage->map);
+	coverage_ref(coverage);
+
+	return coverage;
+
+err:
+	coverage_free(coverage);
+
+	return NULL;
+}
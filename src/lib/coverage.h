@@ -0,0 +1,52 @@
+/** @file */
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include "array.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#define COVERAGE_MAGIC "IOFZCOV1" /**< Magic number of saved coverage maps. */
+
+/**
+ * Value classes. The value is masked to the width of the operation and
+ * is classified by the first class it belongs to.
+ */
+enum {
+	COVERAGE_CLASS_ZERO,     /**< Zero. */
+	COVERAGE_CLASS_ONE,      /**< One. */
+	COVERAGE_CLASS_ONES,     /**< All ones. */
+	COVERAGE_CLASS_POWER,    /**< Power of two (2^n). */
+	COVERAGE_CLASS_MERSENNE, /**< Mersenne number (2^n-1). */
+	COVERAGE_CLASS_FERMAT,   /**< Fermat number (2^n+1). */
+	COVERAGE_CLASS_SMALL,    /**< Less than 0x80. */
+	COVERAGE_CLASS_OTHER,    /**< Any other value. */
+	COVERAGE_NUM_CLASSES
+};
+
+typedef struct coverage coverage_t; /**< Coverage map of (port, operation, value class) tuples. */
+
+coverage_t *coverage_add(coverage_t *coverage, unsigned long port, unsigned long func, unsigned long value, size_t width);
+coverage_t *coverage_clear(coverage_t *coverage);
+size_t coverage_count(coverage_t *coverage);
+coverage_t *coverage_free(coverage_t *coverage);
+unsigned long coverage_get_class(unsigned long value, size_t width);
+size_t coverage_get_size(coverage_t *coverage);
+coverage_t *coverage_load(coverage_t *coverage, const char *path);
+size_t coverage_merge(coverage_t *coverage, coverage_t *other);
+coverage_t *coverage_new(array_t *ports, size_t num_funcs);
+coverage_t *coverage_new_with_coverage(coverage_t *other);
+coverage_t *coverage_ref(coverage_t *coverage);
+coverage_t *coverage_save(coverage_t *coverage, const char *path);
+void coverage_unref(coverage_t *coverage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COVERAGE_H */
@@ -0,0 +1,379 @@
+/** @file */
+
+#include "feedback.h"
+#include "lockstat.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct source {
+	char *name;
+	double weight;
+	uint64_t events;
+};
+
+struct feedback {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	struct source sources[FEEDBACK_MAXSOURCES];
+	size_t num_sources;
+	double threshold;
+};
+
+/**
+ * Registers a source of feedback events with the feedback bus. The score
+ * of a sequence of operations is the sum of the events published by every
+ * source, weighted by the weight of the source. If a source with the same
+ * name is already registered, that source is returned instead.
+ *
+ * @param [in] feedback The feedback bus.
+ * @param [in] name The name of the source.
+ * @param [in] weight The weight of the events of the source.
+ * @return The source, or -1 on error.
+ */
+int
+feedback_add_source(feedback_t *feedback, const char *name, double weight)
+{
+	size_t source;
+
+	if (feedback == NULL || name == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&feedback->mutex);
+	for (source = 0; source < feedback->num_sources; source++) {
+		if (strcmp(feedback->sources[source].name, name) == 0) {
+			pthread_mutex_unlock(&feedback->mutex);
+			return source;
+		}
+	}
+
+	if (feedback->num_sources == FEEDBACK_MAXSOURCES) {
+		pthread_mutex_unlock(&feedback->mutex);
+		errno = ENOSPC;
+		return -1;
+	}
+
+	feedback->sources[source].name = strdup(name);
+	if (feedback->sources[source].name == NULL) {
+		pthread_mutex_unlock(&feedback->mutex);
+		return -1;
+	}
+
+	feedback->sources[source].weight = weight;
+	__atomic_store_n(&feedback->num_sources, source + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&feedback->mutex);
+
+	return source;
+}
+
+/**
+ * Returns the source of the feedback bus with a given name.
+ *
+ * @param [in] feedback The feedback bus.
+ * @param [in] name The name of the source.
+ * @return The source, or -1 if there is no source with the name.
+ */
+int
+feedback_find_source(feedback_t *feedback, const char *name)
+{
+	int source;
+	size_t i;
+
+	if (feedback == NULL || name == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	source = -1;
+	pthread_mutex_lock(&feedback->mutex);
+	for (i = 0; i < feedback->num_sources; i++) {
+		if (strcmp(feedback->sources[i].name, name) == 0) {
+			source = i;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&feedback->mutex);
+
+	return source;
+}
+
+/**
+ * Frees the memory allocated for the feedback bus.
+ *
+ * @param [in] feedback The feedback bus.
+ * @return The feedback bus.
+ */
+feedback_t *
+feedback_free(feedback_t *feedback)
+{
+	size_t i;
+
+	if (feedback == NULL)
+		return NULL;
+
+	for (i = 0; i < feedback->num_sources; i++)
+		free(feedback->sources[i].name);
+
+	pthread_mutex_destroy(&feedback->mutex);
+	free(feedback);
+
+	return NULL;
+}
+
+/**
+ * Returns the number of events of a source scored by the feedback bus.
+ *
+ * @param [in] feedback The feedback bus.
+ * @param [in] source The source.
+ * @return The number of events of the source.
+ */
+uint64_t
+feedback_get_events(feedback_t *feedback, int source)
+{
+	if (feedback == NULL || source < 0 || source >= FEEDBACK_MAXSOURCES) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return __atomic_load_n(&feedback->sources[source].events, __ATOMIC_RELAXED);
+}
+
+/**
+ * Returns the number of sources of the feedback bus.
+ *
+ * @param [in] feedback The feedback bus.
+ * @return The number of sources of the feedback bus.
+ */
+size_t
+feedback_get_num_sources(feedback_t *feedback)
+{
+	size_t num_sources;
+
+	if (feedback == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&feedback->mutex);
+	num_sources = feedback->num_sources;
+	pthread_mutex_unlock(&feedback->mutex);
+
+	return num_sources;
+}
+
+/**
+ * Returns the name of a source of the feedback bus.
+ *
+ * @param [in] feedback The feedback bus.
+ * @param [in] source The source.
+ * @return The name of the source.
+ */
+const char *
+feedback_get_source_name(feedback_t *feedback, int source)
+{
+	const char *name;
+
+	if (feedback == NULL || source < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	name = NULL;
+	pthread_mutex_lock(&feedback->mutex);
+	if ((size_t)source < feedback->num_sources)
+		name = feedback->sources[source].name;
+
+	pthread_mutex_unlock(&feedback->mutex);
+
+	return name;
+}
+
+/**
+ * Returns the threshold of the feedback bus.
+ *
+ * @param [in] feedback The feedback bus.
+ * @return The threshold of the feedback bus.
+ * @see feedback_verdict
+ */
+double
+feedback_get_threshold(feedback_t *feedback)
+{
+	double threshold;
+
+	if (feedback == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&feedback->mutex);
+	threshold = feedback->threshold;
+	pthread_mutex_unlock(&feedback->mutex);
+
+	return threshold;
+}
+
+/**
+ * Creates a feedback bus without sources and with a threshold of one.
+ *
+ * @return A feedback bus.
+ */
+feedback_t *
+feedback_new(void)
+{
+	feedback_t *feedback;
+
+	feedback = calloc(1, sizeof(*feedback));
+	if (feedback == NULL)
+		return NULL;
+
+	errno = pthread_mutex_init(&feedback->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	feedback->threshold = 1;
+	feedback_ref(feedback);
+
+	return feedback;
+
+err:
+	feedback_free(feedback);
+
+	return NULL;
+}
+
+/**
+ * Publishes events of a source into an accumulator. Publishing is not
+ * synchronized; every thread publishes into its own accumulator.
+ *
+ * @param [in] feedback The feedback bus.
+ * @param [in] accumulator The accumulator.
+ * @param [in] source The source.
+ * @param [in] count The number of events.
+ * @return The feedback bus.
+ */
+feedback_t *
+feedback_publish(feedback_t *feedback, struct feedback_accumulator *accumulator, int source, uint64_t count)
+{
+	if (feedback == NULL || accumulator == NULL || source < 0 || source >= FEEDBACK_MAXSOURCES) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	accumulator->events[source] += count;
+
+	return feedback;
+}
+
+/**
+ * Increments the reference count of the feedback bus.
+ *
+ * @param [in] feedback The feedback bus.
+ * @return The feedback bus.
+ */
+feedback_t *
+feedback_ref(feedback_t *feedback)
+{
+	if (feedback == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&feedback->mutex);
+	feedback->refcount++;
+	pthread_mutex_unlock(&feedback->mutex);
+
+	return feedback;
+}
+
+/**
+ * Sets the threshold of the feedback bus.
+ *
+ * @param [in] feedback The feedback bus.
+ * @param [in] threshold The threshold of the feedback bus.
+ * @return The feedback bus.
+ * @see feedback_verdict
+ */
+feedback_t *
+feedback_set_threshold(feedback_t *feedback, double threshold)
+{
+	if (feedback == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&feedback->mutex);
+	feedback->threshold = threshold;
+	pthread_mutex_unlock(&feedback->mutex);
+
+	return feedback;
+}
+
+/**
+ * Decrements the reference count of the feedback bus.
+ *
+ * @param [in] feedback The feedback bus.
+ */
+void
+feedback_unref(feedback_t *feedback)
+{
+	if (feedback == NULL)
+		return;
+
+	pthread_mutex_lock(&feedback->mutex);
+	feedback->refcount--;
+	if (feedback->refcount > 0) {
+		pthread_mutex_unlock(&feedback->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&feedback->mutex);
+	feedback_free(feedback);
+}
+
+/**
+ * Scores the events of a sequence of operations published into an
+ * accumulator, and clears the accumulator. The events are added to the
+ * totals of the feedback bus with atomic additions, so scoring is
+ * lock-free. The sequence is interesting if its score is at least the
+ * threshold of the feedback bus.
+ *
+ * @param [in] feedback The feedback bus.
+ * @param [in] accumulator The accumulator.
+ * @param [out] score The score of the sequence, or NULL.
+ * @return One if the sequence is interesting, zero if it is not.
+ */
+int
+feedback_verdict(feedback_t *feedback, struct feedback_accumulator *accumulator, double *score)
+{
+	double sum;
+	size_t num_sources;
+	size_t i;
+
+	if (feedback == NULL || accumulator == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	/* Sources are only appended, so the first num_sources are stable */
+	sum = 0;
+	num_sources = __atomic_load_n(&feedback->num_sources, __ATOMIC_ACQUIRE);
+	for (i = 0; i < num_sources; i++) {
+		if (accumulator->events[i] == 0)
+			continue;
+
+		sum += feedback->sources[i].weight * accumulator->events[i];
+		__atomic_add_fetch(&feedback->sources[i].events, accumulator->events[i], __ATOMIC_RELAXED);
+		accumulator->events[i] = 0;
+	}
+
+	if (score != NULL)
+		*score = sum;
+
+	return sum > 0 && sum >= feedback->threshold;
+}
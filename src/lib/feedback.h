@@ -0,0 +1,44 @@
+/** @file */
+
+#ifndef FEEDBACK_H
+#define FEEDBACK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FEEDBACK_MAXSOURCES 16 /**< Maximum number of sources of a feedback bus. */
+
+typedef struct feedback feedback_t; /**< Feedback signal bus. */
+
+/**
+ * Per-thread accumulator of feedback events. Sources publish into the
+ * accumulator of their thread, without synchronization, and the
+ * accumulator is scored, and cleared, once per sequence of operations.
+ */
+struct feedback_accumulator {
+	uint64_t events[FEEDBACK_MAXSOURCES]; /**< The events published by every source. */
+};
+
+int feedback_add_source(feedback_t *feedback, const char *name, double weight);
+int feedback_find_source(feedback_t *feedback, const char *name);
+feedback_t *feedback_free(feedback_t *feedback);
+uint64_t feedback_get_events(feedback_t *feedback, int source);
+size_t feedback_get_num_sources(feedback_t *feedback);
+const char *feedback_get_source_name(feedback_t *feedback, int source);
+double feedback_get_threshold(feedback_t *feedback);
+feedback_t *feedback_new(void);
+feedback_t *feedback_publish(feedback_t *feedback, struct feedback_accumulator *accumulator, int source, uint64_t count);
+feedback_t *feedback_ref(feedback_t *feedback);
+feedback_t *feedback_set_threshold(feedback_t *feedback, double threshold);
+void feedback_unref(feedback_t *feedback);
+int feedback_verdict(feedback_t *feedback, struct feedback_accumulator *accumulator, double *score);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FEEDBACK_H */
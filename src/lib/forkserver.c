@@ -0,0 +1,373 @@
+/** @file */
+
+#include "forkserver.h"
+#include "lockstat.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct slot {
+	pid_t pid;
+	int fd;
+	uint64_t id;
+	char *buffer; /* The size of the result, then the result */
+	size_t length;
+};
+
+struct forkserver {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	struct slot *slots;
+	struct pollfd *pollfds;
+	size_t num_slots;
+	size_t num_running;
+	size_t result_size;
+};
+
+static void _forkserver_child(forkserver_t *server, struct slot *slot, int fd, forkserver_func_t func, void *data);
+
+/**
+ * Forks a child from the current state of the process. The child runs a
+ * given function on a copy-on-write snapshot of the process, sends its
+ * result to the fork server over a pipe, and exits; the process itself is
+ * left as is. Up to the number of slots of children run at once.
+ *
+ * @param [in] server The fork server.
+ * @param [in] id The identifier of the child, returned with its result.
+ * @param [in] func The function run by the child.
+ * @param [in] data The data the function is called with.
+ * @return The fork server, or NULL with errno set to EAGAIN if all the
+ *   slots are taken.
+ * @see forkserver_reap
+ */
+forkserver_t *
+forkserver_fork(forkserver_t *server, uint64_t id, forkserver_func_t func, void *data)
+{
+	struct slot *slot;
+	int fds[2];
+	size_t i;
+
+	if (server == NULL || func == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&server->mutex);
+	if (server->num_running == server->num_slots) {
+		pthread_mutex_unlock(&server->mutex);
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	for (i = 0; server->slots[i].pid != 0; i++)
+		;
+
+	slot = &server->slots[i];
+	if (pipe(fds) == -1) {
+		pthread_mutex_unlock(&server->mutex);
+		return NULL;
+	}
+
+	slot->pid = fork();
+	if (slot->pid == -1) {
+		slot->pid = 0;
+		close(fds[0]);
+		close(fds[1]);
+		pthread_mutex_unlock(&server->mutex);
+		return NULL;
+	}
+
+	if (slot->pid == 0) {
+		close(fds[0]);
+		_forkserver_child(server, slot, fds[1], func, data);
+	}
+
+	close(fds[1]);
+	slot->fd = fds[0];
+	slot->id = id;
+	slot->length = 0;
+	server->num_running++;
+	pthread_mutex_unlock(&server->mutex);
+
+	return server;
+}
+
+/**
+ * Frees the memory allocated for the fork server. The children still
+ * running are killed.
+ *
+ * @param [in] server The fork server.
+ * @return The fork server.
+ */
+forkserver_t *
+forkserver_free(forkserver_t *server)
+{
+	size_t i;
+
+	if (server == NULL)
+		return NULL;
+
+	for (i = 0; server->slots != NULL && i < server->num_slots; i++) {
+		if (server->slots[i].pid != 0) {
+			kill(server->slots[i].pid, SIGKILL);
+			waitpid(server->slots[i].pid, NULL, 0);
+			close(server->slots[i].fd);
+		}
+
+		free(server->slots[i].buffer);
+	}
+
+	free(server->slots);
+	free(server->pollfds);
+	pthread_mutex_destroy(&server->mutex);
+	free(server);
+
+	return NULL;
+}
+
+/**
+ * Returns the number of children of the fork server that were not reaped.
+ *
+ * @param [in] server The fork server.
+ * @return The number of children running.
+ */
+size_t
+forkserver_get_num_running(forkserver_t *server)
+{
+	size_t num_running;
+
+	if (server == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&server->mutex);
+	num_running = server->num_running;
+	pthread_mutex_unlock(&server->mutex);
+
+	return num_running;
+}
+
+/**
+ * Creates a fork server. The process is snapshotted at every fork, so the
+ * fork server is created, and children forked, once the process is set
+ * up, such as after the devices are brought to their initial state.
+ *
+ * @param [in] num_slots The maximum number of children running at once.
+ * @param [in] result_size The maximum size of the result of a child.
+ * @return A fork server.
+ */
+forkserver_t *
+forkserver_new(size_t num_slots, size_t result_size)
+{
+	forkserver_t *server;
+	size_t i;
+
+	if (num_slots == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	server = calloc(1, sizeof(*server));
+	if (server == NULL)
+		return NULL;
+
+	errno = pthread_mutex_init(&server->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	server->slots = calloc(num_slots, sizeof(*server->slots));
+	server->pollfds = calloc(num_slots, sizeof(*server->pollfds));
+	if (server->slots == NULL || server->pollfds == NULL)
+		goto err;
+
+	server->num_slots = num_slots;
+	server->result_size = result_size;
+	for (i = 0; i < num_slots; i++) {
+		server->slots[i].buffer = malloc(sizeof(uint64_t) + result_size);
+		if (server->slots[i].buffer == NULL)
+			goto err;
+	}
+
+	forkserver_ref(server);
+
+	return server;
+
+err:
+	forkserver_free(server);
+
+	return NULL;
+}
+
+/**
+ * Waits for a child of the fork server to exit and returns its result.
+ * The results of the children are read as they are sent, so children
+ * never block on the pipe. A child that crashed, or exited before sending
+ * its whole result, is returned as incomplete.
+ *
+ * @param [in] server The fork server.
+ * @param [out] result The result; its data must point to a buffer of the
+ *   size of the results.
+ * @return The fork server, or NULL with errno set to ECHILD if no child is
+ *   running.
+ * @see forkserver_fork
+ */
+forkserver_t *
+forkserver_reap(forkserver_t *server, struct forkserver_result *result)
+{
+	struct slot *slot;
+	char discard[4096];
+	uint64_t size;
+	size_t capacity;
+	ssize_t length;
+	size_t i;
+
+	if (server == NULL || result == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&server->mutex);
+	if (server->num_running == 0) {
+		pthread_mutex_unlock(&server->mutex);
+		errno = ECHILD;
+		return NULL;
+	}
+
+	for (;;) {
+		/* Free slots are polled as negative descriptors, which poll ignores */
+		for (i = 0; i < server->num_slots; i++) {
+			server->pollfds[i].fd = server->slots[i].pid != 0 ? server->slots[i].fd : -1;
+			server->pollfds[i].events = POLLIN;
+		}
+
+		if (poll(server->pollfds, server->num_slots, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+
+			pthread_mutex_unlock(&server->mutex);
+			return NULL;
+		}
+
+		for (i = 0; i < server->num_slots; i++) {
+			slot = &server->slots[i];
+			if (slot->pid == 0 || server->pollfds[i].revents == 0)
+				continue;
+
+			/* Results larger than the buffer are truncated */
+			capacity = sizeof(uint64_t) + server->result_size - slot->length;
+			if (capacity != 0)
+				length = read(slot->fd, slot->buffer + slot->length, capacity);
+			else
+				length = read(slot->fd, discard, sizeof(discard));
+
+			if (length == -1 && (errno == EINTR || errno == EAGAIN))
+				continue;
+
+			if (length > 0) {
+				slot->length += capacity != 0 ? length : 0;
+				continue;
+			}
+
+			close(slot->fd);
+			while (waitpid(slot->pid, &result->status, 0) == -1 && errno == EINTR)
+				;
+
+			size = 0;
+			if (slot->length >= sizeof(size))
+				memcpy(&size, slot->buffer, sizeof(size));
+
+			result->id = slot->id;
+			result->complete = slot->length >= sizeof(size) && slot->length - sizeof(size) == size;
+			result->size = slot->length >= sizeof(size) ? slot->length - sizeof(size) : 0;
+			if (result->data != NULL)
+				memcpy(result->data, slot->buffer + sizeof(size), result->size);
+
+			slot->pid = 0;
+			server->num_running--;
+			pthread_mutex_unlock(&server->mutex);
+
+			return server;
+		}
+	}
+}
+
+/**
+ * Increments the reference count of the fork server.
+ *
+ * @param [in] server The fork server.
+ * @return The fork server.
+ */
+forkserver_t *
+forkserver_ref(forkserver_t *server)
+{
+	if (server == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&server->mutex);
+	server->refcount++;
+	pthread_mutex_unlock(&server->mutex);
+
+	return server;
+}
+
+/**
+ * Decrements the reference count of the fork server.
+ *
+ * @param [in] server The fork server.
+ */
+void
+forkserver_unref(forkserver_t *server)
+{
+	if (server == NULL)
+		return;
+
+	pthread_mutex_lock(&server->mutex);
+	server->refcount--;
+	if (server->refcount > 0) {
+		pthread_mutex_unlock(&server->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&server->mutex);
+	forkserver_free(server);
+}
+
+/*
+ * The child writes its result into its copy of the buffer of its slot,
+ * after the size of the result, and exits without flushing the streams of
+ * the process, which still hold what the parent buffered.
+ */
+static void
+_forkserver_child(forkserver_t *server, struct slot *slot, int fd, forkserver_func_t func, void *data)
+{
+	uint64_t size;
+	ssize_t length;
+	size_t offset;
+
+	size = func(data, slot->buffer + sizeof(size), server->result_size);
+	if (size > server->result_size)
+		size = server->result_size;
+
+	memcpy(slot->buffer, &size, sizeof(size));
+	for (offset = 0; offset < sizeof(size) + size; offset += length) {
+		length = write(fd, slot->buffer + offset, sizeof(size) + size - offset);
+		if (length == -1 && errno == EINTR)
+			length = 0;
+		else if (length == -1)
+			_exit(EXIT_FAILURE);
+	}
+
+	_exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,50 @@
+/** @file */
+
+#ifndef FORKSERVER_H
+#define FORKSERVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct forkserver forkserver_t; /**< Copy-on-write fork server. */
+
+/**
+ * Function run by a child of the fork server. The child starts from a
+ * copy-on-write snapshot of the process at the time of the fork, so
+ * whatever the function changes is discarded when the child exits.
+ *
+ * @param [in] data The data the child was forked with.
+ * @param [out] result The result buffer of the child.
+ * @param [in] size The size of the result buffer.
+ * @return The size of the result.
+ */
+typedef size_t (*forkserver_func_t)(void *data, void *result, size_t size);
+
+/**
+ * Result of a child of the fork server.
+ */
+struct forkserver_result {
+	uint64_t id;  /**< The identifier the child was forked with. */
+	int status;   /**< The status of the child, as returned by waitpid. */
+	int complete; /**< Whether the child sent its whole result before exiting. */
+	void *data;   /**< The result, in a buffer of the size of the results. */
+	size_t size;  /**< The size of the result. */
+};
+
+forkserver_t *forkserver_fork(forkserver_t *server, uint64_t id, forkserver_func_t func, void *data);
+forkserver_t *forkserver_free(forkserver_t *server);
+size_t forkserver_get_num_running(forkserver_t *server);
+forkserver_t *forkserver_new(size_t num_slots, size_t result_size);
+forkserver_t *forkserver_reap(forkserver_t *server, struct forkserver_result *result);
+forkserver_t *forkserver_ref(forkserver_t *server);
+void forkserver_unref(forkserver_t *server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FORKSERVER_H */
@@ -8,18 +8,25 @@ static inline void \
 _iofuzzer_in##a(iofuzzer_t *fuzzer) \
 { \
 	uintptr_t *variates; \
+	uintptr_t value; \
 \
 	variates = &array_index(fuzzer->variates, uintptr_t, 0); \
-	asm volatile("in" #a " %w3, %" #b "0" :: "a" (variates[1]), "b" (variates[2]), "c" (variates[3]), "d" (variates[4]), "S" (variates[5]), "D" (variates[6])); \
+	value = variates[1]; \
+	asm volatile("in" #a " %w3, %" #b "0" : "+a" (value) : "b" (variates[2]), "c" (variates[3]), "d" (variates[4]), "S" (variates[5]), "D" (variates[6])); \
+	fuzzer->value = value; \
 } \
 \
 static inline void \
 _iofuzzer_ins##a(iofuzzer_t *fuzzer) \
 { \
 	uintptr_t *variates; \
+	uintptr_t count; \
+	uintptr_t destination; \
 \
 	variates = &array_index(fuzzer->variates, uintptr_t, 0); \
-	asm volatile("rep; ins" #a :: "a" (variates[1]), "b" (variates[2]), "c" (variates[3]), "d" (variates[4]), "S" (variates[5]), "D" (variates[6])); \
+	count = variates[3]; \
+	destination = variates[6]; \
+	asm volatile("rep; ins" #a : "+c" (count), "+D" (destination) : "a" (variates[1]), "b" (variates[2]), "d" (variates[4]), "S" (variates[5]) : "memory"); \
 } \
 \
 static inline void \
@@ -35,9 +42,13 @@ static inline void \
 _iofuzzer_outs##a(iofuzzer_t *fuzzer) \
 { \
 	uintptr_t *variates; \
+	uintptr_t count; \
+	uintptr_t source; \
 \
 	variates = &array_index(fuzzer->variates, uintptr_t, 0); \
-	asm volatile("rep; outs" #a :: "a" (variates[1]), "b" (variates[2]), "c" (variates[3]), "d" (variates[4]), "S" (variates[5]), "D" (variates[6])); \
+	count = variates[3]; \
+	source = variates[5]; \
+	asm volatile("rep; outs" #a : "+c" (count), "+S" (source) : "a" (variates[1]), "b" (variates[2]), "d" (variates[4]), "D" (variates[6]) : "memory"); \
 }
 
 A(b, b)
@@ -45,6 +56,68 @@ A(w, w)
 A(l,)
 #undef A
 
+/*
+ * Bursts perform an operation count times on the same port, unrolled, so
+ * the port is hit as fast as the CPU can trap. Output bursts write the
+ * data in the buffer of variate 5, and input bursts read into the buffer
+ * of variate 6.
+ */
+#define B(a, b, c) \
+static inline void \
+_iofuzzer_inburst##a(iofuzzer_t *fuzzer) \
+{ \
+	uintptr_t *variates; \
+	c *data; \
+	uint16_t port; \
+	size_t count; \
+	size_t i; \
+\
+	variates = &array_index(fuzzer->variates, uintptr_t, 0); \
+	data = (c *)variates[6]; \
+	port = variates[4]; \
+	count = variates[3]; \
+	for (i = 0; i + 4 <= count; i += 4) { \
+		asm volatile("in" #a " %w1, %" #b "0" : "=a" (data[i]) : "d" (port)); \
+		asm volatile("in" #a " %w1, %" #b "0" : "=a" (data[i + 1]) : "d" (port)); \
+		asm volatile("in" #a " %w1, %" #b "0" : "=a" (data[i + 2]) : "d" (port)); \
+		asm volatile("in" #a " %w1, %" #b "0" : "=a" (data[i + 3]) : "d" (port)); \
+	} \
+\
+	for (; i < count; i++) \
+		asm volatile("in" #a " %w1, %" #b "0" : "=a" (data[i]) : "d" (port)); \
+\
+	fuzzer->value = count > 0 ? data[count - 1] : 0; \
+} \
+\
+static inline void \
+_iofuzzer_outburst##a(iofuzzer_t *fuzzer) \
+{ \
+	uintptr_t *variates; \
+	const c *data; \
+	uint16_t port; \
+	size_t count; \
+	size_t i; \
+\
+	variates = &array_index(fuzzer->variates, uintptr_t, 0); \
+	data = (const c *)variates[5]; \
+	port = variates[4]; \
+	count = variates[3]; \
+	for (i = 0; i + 4 <= count; i += 4) { \
+		asm volatile("out" #a " %" #b "0, %w1" :: "a" (data[i]), "d" (port)); \
+		asm volatile("out" #a " %" #b "0, %w1" :: "a" (data[i + 1]), "d" (port)); \
+		asm volatile("out" #a " %" #b "0, %w1" :: "a" (data[i + 2]), "d" (port)); \
+		asm volatile("out" #a " %" #b "0, %w1" :: "a" (data[i + 3]), "d" (port)); \
+	} \
+\
+	for (; i < count; i++) \
+		asm volatile("out" #a " %" #b "0, %w1" :: "a" (data[i]), "d" (port)); \
+}
+
+B(b, b, uint8_t)
+B(w, w, uint16_t)
+B(l,, uint32_t)
+#undef B
+
 #define FUNCS \
 	X(inb) \
 	X(inw) \
@@ -57,6 +130,12 @@ A(l,)
 	X(outl) \
 	X(outsb) \
 	X(outsw) \
-	X(outsl)
+	X(outsl) \
+	X(inburstb) \
+	X(inburstw) \
+	X(inburstl) \
+	X(outburstb) \
+	X(outburstw) \
+	X(outburstl)
 
 #endif /* IO_H */
@@ -1,8 +1,16 @@
 /** @file */
 
 #include "array.h"
+#include "bloom.h"
+#include "feedback.h"
 #include "iofuzzer.h"
+#include "lockstat.h"
+#include "model.h"
+#include "permutation.h"
+#include "profile.h"
 #include "random.h"
+#include "trace.h"
+#include "wheel.h"
 
 #include <errno.h>
 #include <pthread.h>
@@ -11,19 +19,121 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define BATCHSIZE 256
+#define DELAY_RATE 8 /* One in DELAY_RATE writes schedules a delayed read */
+#define MAXDELAY 100000 /* Nanoseconds */
 #define MAXPORT 0xffff
+#define MAXREDRAWS 8
 #define MAXSIZE 256
+#define NUM_DRAWN func_inburstb /* Operations drawn; bursts are drawn by the burst strategy */
+#define NUM_HASHES 4096 /* Hashes of the tokens of the dictionary, one per possible token */
+#define NUM_SLOTS 256 /* Slots of the last values read, by port */
 #define NUM_VARIATES 7
+#define SWEEPSIZE 8192 /* Values swept before the sweep starts over */
+#define DELAYED 0xe000 /* Tag of the state of a delayed operation, past the tags of the strategies */
+#define TOKEN 0x1000 /* Operand of a dictionary draw of a token, with the hash of the token */
+#define VALUE_WEIGHT 0.01 /* Weight of the events of the value source */
+
+#define _iofuzzer_func_is_burst(func) \
+	((func) >= func_inburstb)
+
+#define _iofuzzer_func_is_input(func) \
+	((func) < func_outb || ((func) >= func_inburstb && (func) < func_outburstb))
+
+#define _iofuzzer_func_is_string(func) \
+	((func) < func_inburstb && ((func) / 3) % 2)
+
+#define _iofuzzer_func_width(func) \
+	(1UL << ((func) % 3))
+
+/*
+ * The generator only uses the first 6 bytes of a state, so the last 2
+ * hold the tag of the operation drawn: the strategy, plus one, and the
+ * operand of the strategy. A state without a tag was logged before
+ * operations had one.
+ */
+#define _iofuzzer_get_tag(state) \
+	((unsigned char)(state)[6] | (unsigned int)(unsigned char)(state)[7] << 8)
+
+#define _iofuzzer_set_tag(state, tag) \
+	((state)[6] = (tag) & 0xff, (state)[7] = ((tag) >> 8) & 0xff)
+
+#define _iofuzzer_tag(strategy, operand) \
+	(((unsigned int)(strategy) + 1) << 13 | ((operand) & 0x1fff))
+
+#define _iofuzzer_tag_operand(tag) \
+	((tag) & 0x1fff)
+
+#define _iofuzzer_tag_strategy(tag) \
+	((int)((tag) >> 13) - 1)
+
+#define _iofuzzer_token_hash(token) \
+	(((token)->port * 0x9e3779b1U ^ (token)->value * 0x85ebca6bU) >> 20)
+
+struct hook {
+	iofuzzer_hook_t func;
+	void *data;
+};
+
+struct block_op {
+	unsigned char func;
+	unsigned short port;
+	unsigned char data;
+	uint32_t delay;
+};
+
+struct block {
+	const char *name;
+	const struct block_op *ops;
+	size_t num_ops;
+};
 
 struct iofuzzer {
 	pthread_mutex_t mutex;
 	size_t refcount;
+	int backend;
+	array_t *dictionary;
+	uint32_t *hashes;
+	array_t *divergences;
+	feedback_t *feedback;
+	int feedback_value;
+	struct feedback_accumulator accumulator;
+	uint32_t values[NUM_SLOTS];
+	bloom_t *filter;
+	model_t *model;
 	array_t *ports;
+	profile_t *profile;
 	random_t *random;
+	array_t *sequence;
+	trace_t *trace;
+	unsigned long trace_thread;
 	char state[8];
+	permutation_t *permutation;
+	unsigned long traversal_key;
+	size_t traversal_part;
+	size_t traversal_num_parts;
+	uint64_t position;
+	uint64_t begin;
+	uint64_t end;
+	array_t *hooks[IOFUZZER_NUM_HOOKS];
+	const struct hook *dispatch[IOFUZZER_NUM_HOOKS];
+	size_t num_dispatch[IOFUZZER_NUM_HOOKS];
+	int strategy;
+	uint64_t step;
+	size_t port_index;
+	random_t *paired_random;
+	int paired;
+	unsigned long value;
 	char *variate5;
 	char *variate6;
 	array_t *variates;
+	wheel_t *wheel;
+	int delayed;
+	size_t batch_length;
+	uint32_t batch_actual[BATCHSIZE];
+	uint32_t batch_expected[BATCHSIZE];
+	uint32_t batch_mask[BATCHSIZE];
+	struct iofuzzer_divergence batch_context[BATCHSIZE];
 };
 
 #include "io.h"
@@ -32,10 +142,183 @@ struct iofuzzer {
 enum { FUNCS NUM_FUNCS };
 #undef X
 
+#define X(a) #a,
+static const char *names[] = { FUNCS };
+#undef X
+
+/* Values that commonly hit boundaries of device registers */
+static const unsigned long dictionary[] = {
+	0x00000000, 0x00000001, 0x00000002, 0x0000007f,
+	0x00000080, 0x000000ff, 0x00000100, 0x00007fff,
+	0x00008000, 0x0000ffff, 0x00010000, 0x55555555,
+	0x7fffffff, 0x80000000, 0xaaaaaaaa, 0xffffffff,
+};
+
+#define NUM_VALUES (sizeof(dictionary) / sizeof(dictionary[0]))
+
+static const char *strategies[] = { "uniform", "dictionary", "paired", "sweep", "burst" };
+
+/*
+ * Normalization blocks of the legacy devices of a PC. Every block brings
+ * a device class back to the state firmware leaves it in. Operations with
+ * a delay, in nanoseconds, wait for the device to settle.
+ */
+static const struct block_op dma_ops[] = {
+	{ func_outb, 0x0d, 0x00 }, /* Master clear */
+	{ func_outb, 0xda, 0x00 },
+	{ func_outb, 0x08, 0x00 }, /* Command: controller enabled */
+	{ func_outb, 0xd0, 0x00 },
+	{ func_outb, 0x0c, 0x00 }, /* Clear byte pointer flip-flop */
+	{ func_outb, 0xd8, 0x00 },
+	{ func_outb, 0xd4, 0x04 }, /* Unmask the cascade channel */
+};
+
+static const struct block_op ide_ops[] = {
+	{ func_outb, 0x3f6, 0x04 }, /* Software reset */
+	{ func_outb, 0x376, 0x04 },
+	{ func_outb, 0x3f6, 0x00, 5000 }, /* Reset released after 5 us, interrupts enabled */
+	{ func_outb, 0x376, 0x00, 5000 },
+	{ func_inb,  0x1f7, 0x00, 2000000 }, /* Status after 2 ms, which acknowledges interrupts */
+	{ func_inb,  0x177, 0x00, 2000000 },
+};
+
+static const struct block_op pic_ops[] = {
+	{ func_outb, 0x20, 0x11 }, /* ICW1: edge triggered, cascade, ICW4 */
+	{ func_outb, 0xa0, 0x11 },
+	{ func_outb, 0x21, 0x30 }, /* ICW2: vector bases */
+	{ func_outb, 0xa1, 0x38 },
+	{ func_outb, 0x21, 0x04 }, /* ICW3: slave on IRQ 2 */
+	{ func_outb, 0xa1, 0x02 },
+	{ func_outb, 0x21, 0x01 }, /* ICW4: 8086 mode */
+	{ func_outb, 0xa1, 0x01 },
+	{ func_outb, 0x21, 0x00 }, /* OCW1: all unmasked */
+	{ func_outb, 0xa1, 0x00 },
+	{ func_outb, 0x20, 0x20 }, /* OCW2: end of interrupt */
+	{ func_outb, 0xa0, 0x20 },
+};
+
+static const struct block_op pit_ops[] = {
+	{ func_outb, 0x43, 0x34 }, /* Counter 0: low then high byte, rate generator */
+	{ func_outb, 0x40, 0x9c }, /* 100 Hz */
+	{ func_outb, 0x40, 0x2e },
+	{ func_outb, 0x43, 0xb6 }, /* Counter 2: low then high byte, square wave */
+	{ func_outb, 0x42, 0x00 },
+	{ func_outb, 0x42, 0x00 },
+};
+
+static const struct block_op uart_ops[] = {
+	{ func_outb, 0x3fb, 0x80 }, /* Divisor latch access */
+	{ func_outb, 0x3f8, 0x01 }, /* 115200 baud */
+	{ func_outb, 0x3f9, 0x00 },
+	{ func_outb, 0x3fb, 0x03 }, /* 8N1 */
+	{ func_outb, 0x3f9, 0x00 }, /* Interrupts disabled */
+	{ func_outb, 0x3fa, 0x07 }, /* FIFOs enabled and cleared */
+	{ func_outb, 0x3fc, 0x03 }, /* DTR and RTS */
+	{ func_inb,  0x3fd, 0x00 }, /* Line status */
+	{ func_inb,  0x3fe, 0x00 }, /* Modem status */
+	{ func_inb,  0x3f8, 0x00 }, /* Receive buffer */
+	{ func_inb,  0x3fa, 0x00 }, /* Interrupt identification */
+};
+
+#define BLOCK(a) { #a, a##_ops, sizeof(a##_ops) / sizeof(a##_ops[0]) }
+static const struct block blocks[] = { BLOCK(dma), BLOCK(ide), BLOCK(pic), BLOCK(pit), BLOCK(uart) };
+#undef BLOCK
+
+#define NUM_BLOCKS (sizeof(blocks) / sizeof(blocks[0]))
+
+/* The fuzzer the thread is iterating, whose hooks are called with its mutex held */
+static __thread iofuzzer_t *_iofuzzer_hooked = NULL;
+
+static unsigned int _iofuzzer_apply_strategy(iofuzzer_t *fuzzer, int strategy, unsigned int operand, int replay);
+static iofuzzer_t *_iofuzzer_compare(iofuzzer_t *fuzzer);
+static iofuzzer_t *_iofuzzer_compile_hooks(iofuzzer_t *fuzzer, int type);
+static iofuzzer_t *_iofuzzer_differ(iofuzzer_t *fuzzer);
+static iofuzzer_t *_iofuzzer_draw(iofuzzer_t *fuzzer, unsigned int tag, int replay);
+static iofuzzer_t *_iofuzzer_fill_burst(iofuzzer_t *fuzzer);
 static iofuzzer_t *_iofuzzer_iterate(iofuzzer_t *fuzzer);
 static unsigned long _iofuzzer_random_number(iofuzzer_t *fuzzer);
 static iofuzzer_t *_iofuzzer_randomize(iofuzzer_t *fuzzer);
+static iofuzzer_t *_iofuzzer_schedule(iofuzzer_t *fuzzer, uint64_t delay, const uintptr_t *variates);
 static iofuzzer_t *_iofuzzer_set_state(iofuzzer_t *fuzzer, const char *state, size_t size);
+static iofuzzer_t *_iofuzzer_set_traversal(iofuzzer_t *fuzzer);
+static iofuzzer_t *_iofuzzer_simulate(iofuzzer_t *fuzzer);
+static iofuzzer_t *_iofuzzer_traverse(iofuzzer_t *fuzzer);
+
+/**
+ * Adds a hook to the fuzzer. Hooks of a type are called in the order
+ * they were added:
+ *
+ * - IOFUZZER_HOOK_GENERATE hooks are called before the next operation is
+ *   drawn. If a hook returns IOFUZZER_HOOK_SKIP, the operation is not
+ *   drawn, and the hook is expected to have set the variates.
+ * - IOFUZZER_HOOK_EXECUTE hooks are called before the operation is
+ *   performed, and may modify its variates. If a hook returns
+ *   IOFUZZER_HOOK_SKIP, the operation is not performed.
+ * - IOFUZZER_HOOK_COMPLETE hooks are called after the operation is
+ *   performed, with the value it returned.
+ *
+ * The hooks of every type are compiled into an array when they are added
+ * or removed, so a fuzzer without hooks pays nothing for them, and a
+ * fuzzer with hooks pays one indirect call per hook.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [in] type The type of the hook.
+ * @param [in] hook The hook.
+ * @param [in] data The data to call the hook with.
+ * @return The fuzzer.
+ * @see iofuzzer_remove_hook
+ */
+iofuzzer_t *
+iofuzzer_add_hook(iofuzzer_t *fuzzer, int type, iofuzzer_hook_t hook, void *data)
+{
+	struct hook entry;
+
+	if (fuzzer == NULL || type < 0 || type >= IOFUZZER_NUM_HOOKS || hook == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	if (fuzzer->hooks[type] == NULL) {
+		fuzzer->hooks[type] = array_new(sizeof(struct hook));
+		if (fuzzer->hooks[type] == NULL) {
+			pthread_mutex_unlock(&fuzzer->mutex);
+			return NULL;
+		}
+	}
+
+	entry.func = hook;
+	entry.data = data;
+	array_append_val(fuzzer->hooks[type], &entry);
+	_iofuzzer_compile_hooks(fuzzer, type);
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return fuzzer;
+}
+
+/**
+ * Compares the pending values returned by the native backend with the
+ * values returned by the reference model, and appends the divergences to
+ * the divergences of the fuzzer.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @return The fuzzer.
+ * @see iofuzzer_get_divergences
+ */
+iofuzzer_t *
+iofuzzer_flush(iofuzzer_t *fuzzer)
+{
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	_iofuzzer_compare(fuzzer);
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return fuzzer;
+}
 
 /**
  * Frees the memory allocated for the fuzzer.
@@ -46,14 +329,31 @@ static iofuzzer_t *_iofuzzer_set_state(iofuzzer_t *fuzzer, const char *state, si
 iofuzzer_t *
 iofuzzer_free(iofuzzer_t *fuzzer)
 {
+	int i;
+
 	if (fuzzer == NULL)
 		return NULL;
 
+	for (i = 0; i < IOFUZZER_NUM_HOOKS; i++)
+		array_unref(fuzzer->hooks[i]);
+
+	array_unref(fuzzer->dictionary);
+	free(fuzzer->hashes);
+	array_unref(fuzzer->divergences);
+	feedback_unref(fuzzer->feedback);
+	bloom_unref(fuzzer->filter);
+	model_unref(fuzzer->model);
+	permutation_unref(fuzzer->permutation);
 	array_unref(fuzzer->ports);
+	profile_unref(fuzzer->profile);
+	random_unref(fuzzer->paired_random);
 	random_unref(fuzzer->random);
+	array_unref(fuzzer->sequence);
+	trace_unref(fuzzer->trace);
 	free(fuzzer->variate5);
 	free(fuzzer->variate6);
 	array_unref(fuzzer->variates);
+	wheel_unref(fuzzer->wheel);
 	pthread_mutex_destroy(&fuzzer->mutex);
 	free(fuzzer);
 
@@ -61,38 +361,85 @@ iofuzzer_free(iofuzzer_t *fuzzer)
 }
 
 /**
- * Returns the ports of the fuzzer.
+ * Returns the feedback accumulator of the fuzzer, for sources outside the
+ * fuzzer to publish into. The accumulator is not synchronized, so it must
+ * only be used by the thread of the fuzzer.
  *
  * @param [in] fuzzer The fuzzer.
- * @return The ports of the fuzzer.
+ * @return The feedback accumulator of the fuzzer.
+ * @see feedback_publish
+ */
+struct feedback_accumulator *
+iofuzzer_get_accumulator(iofuzzer_t *fuzzer)
+{
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return &fuzzer->accumulator;
+}
+
+/**
+ * Returns the backend of the fuzzer.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @return The backend of the fuzzer.
+ */
+int
+iofuzzer_get_backend(iofuzzer_t *fuzzer)
+{
+	int backend;
+
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	backend = fuzzer->backend;
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return backend;
+}
+
+/**
+ * Returns the dictionary of the fuzzer.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @return The dictionary of the fuzzer.
+ * @see iofuzzer_set_dictionary
  */
 array_t *
-iofuzzer_get_ports(iofuzzer_t *fuzzer)
+iofuzzer_get_dictionary(iofuzzer_t *fuzzer)
 {
-	array_t *ports;
+	array_t *dictionary;
 
 	if (fuzzer == NULL) {
 		errno = EINVAL;
-		return 0;
+		return NULL;
 	}
 
 	pthread_mutex_lock(&fuzzer->mutex);
-	ports = fuzzer->ports;
+	dictionary = fuzzer->dictionary;
 	pthread_mutex_unlock(&fuzzer->mutex);
 
-	return ports;
+	return dictionary;
 }
 
 /**
- * Returns the pseudo-random number generator of the fuzzer.
+ * Returns the divergences found by the fuzzer. The divergences are
+ * appended as struct iofuzzer_divergence elements, in batches, when the
+ * pending values are compared, and are never removed by the fuzzer.
  *
  * @param [in] fuzzer The fuzzer.
- * @return The pseudo-random number generator of the fuzzer.
+ * @return The divergences found by the fuzzer.
+ * @see iofuzzer_flush
  */
-random_t *
-iofuzzer_get_random(iofuzzer_t *fuzzer)
+array_t *
+iofuzzer_get_divergences(iofuzzer_t *fuzzer)
 {
-	random_t *random;
+	array_t *divergences;
 
 	if (fuzzer == NULL) {
 		errno = EINVAL;
@@ -100,68 +447,116 @@ iofuzzer_get_random(iofuzzer_t *fuzzer)
 	}
 
 	pthread_mutex_lock(&fuzzer->mutex);
-	random = fuzzer->random;
+	divergences = fuzzer->divergences;
 	pthread_mutex_unlock(&fuzzer->mutex);
 
-	return random;
+	return divergences;
 }
 
 /**
- * Returns the state of the fuzzer.
+ * Returns the feedback bus of the fuzzer.
  *
  * @param [in] fuzzer The fuzzer.
- * @param [out] state The state of the fuzzer.
- * @param [in] size The size of the state.
- * @return The fuzzer.
+ * @return The feedback bus of the fuzzer.
+ * @see iofuzzer_set_feedback
  */
-iofuzzer_t *
-iofuzzer_get_state(iofuzzer_t *fuzzer, char *state, size_t size)
+feedback_t *
+iofuzzer_get_feedback(iofuzzer_t *fuzzer)
 {
-	if (fuzzer == NULL || state == NULL) {
+	feedback_t *feedback;
+
+	if (fuzzer == NULL) {
 		errno = EINVAL;
 		return NULL;
 	}
 
 	pthread_mutex_lock(&fuzzer->mutex);
-	memcpy(state, fuzzer->state, sizeof(fuzzer->state));
+	feedback = fuzzer->feedback;
 	pthread_mutex_unlock(&fuzzer->mutex);
 
-	return fuzzer;
+	return feedback;
 }
 
 /**
- * Returns the variates of the fuzzer. The variates are:
+ * Returns the filter of the fuzzer.
  *
- *   1. I/O instruction/operation
- *   2. Data
- *   3. Implementation specific
- *   4. Counter for string operations
- *   5. I/O port address
- *   6. Source pointer for string operations
- *   7. Destination pointer for string operations
+ * @param [in] fuzzer The fuzzer.
+ * @return The filter of the fuzzer.
+ * @see iofuzzer_set_filter
+ */
+bloom_t *
+iofuzzer_get_filter(iofuzzer_t *fuzzer)
+{
+	bloom_t *filter;
+
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	filter = fuzzer->filter;
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return filter;
+}
+
+/**
+ * Returns the I/O instruction/operation with a given name.
  *
- * The I/O instructions/operations are:
+ * @param [in] name The name of the I/O instruction/operation.
+ * @param [in] length The length of the name.
+ * @return The I/O instruction/operation, or -1 if there is none.
+ * @see iofuzzer_get_variates
+ */
+int
+iofuzzer_get_func_by_name(const char *name, size_t length)
+{
+	int i;
+
+	if (name == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < NUM_FUNCS; i++) {
+		if (strncmp(names[i], name, length) == 0 && names[i][length] == '\0')
+			return i;
+	}
+
+	errno = EINVAL;
+
+	return -1;
+}
+
+/**
+ * Returns the name of a given I/O instruction/operation.
  *
- *   1. inb (input byte from port)
- *   2. inw (input word from port)
- *   3. inl (input doubleword from port)
- *   4. insb (input byte string from port)
- *   5. insw (input word string from port)
- *   6. insl (input doubleword string from port)
- *   7. outb (output byte to port)
- *   8. outw (output word to port)
- *   9. outl (output doubleword to port)
- *   10. outsb (output byte string to port)
- *   11. outsw (output word string to port)
- *   12. outsl (output doubleword string to port)
+ * @param [in] func The I/O instruction/operation.
+ * @return The name of the I/O instruction/operation.
+ * @see iofuzzer_get_variates
+ */
+const char *
+iofuzzer_get_func_name(unsigned long func)
+{
+	if (func >= NUM_FUNCS) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return names[func];
+}
+
+/**
+ * Returns the reference model of the fuzzer.
  *
  * @param [in] fuzzer The fuzzer.
- * @return The variates of the fuzzer.
+ * @return The reference model of the fuzzer.
  */
-array_t *
-iofuzzer_get_variates(iofuzzer_t *fuzzer)
+model_t *
+iofuzzer_get_model(iofuzzer_t *fuzzer)
 {
-	array_t *variates;
+	model_t *model;
 
 	if (fuzzer == NULL) {
 		errno = EINVAL;
@@ -169,191 +564,1212 @@ iofuzzer_get_variates(iofuzzer_t *fuzzer)
 	}
 
 	pthread_mutex_lock(&fuzzer->mutex);
-	variates = fuzzer->variates;
+	model = fuzzer->model;
 	pthread_mutex_unlock(&fuzzer->mutex);
 
-	return variates;
+	return model;
 }
 
 /**
- * Performs an iteration.
+ * Returns the number of I/O instructions/operations.
+ *
+ * @return The number of I/O instructions/operations.
+ */
+size_t
+iofuzzer_get_num_funcs(void)
+{
+	return NUM_FUNCS;
+}
+
+/**
+ * Returns the ports of the fuzzer.
  *
  * @param [in] fuzzer The fuzzer.
- * @return The fuzzer.
+ * @return The ports of the fuzzer.
  */
-iofuzzer_t *
-iofuzzer_iterate(iofuzzer_t *fuzzer)
+array_t *
+iofuzzer_get_ports(iofuzzer_t *fuzzer)
 {
+	array_t *ports;
+
 	if (fuzzer == NULL) {
 		errno = EINVAL;
-		return NULL;
+		return 0;
 	}
 
 	pthread_mutex_lock(&fuzzer->mutex);
-	_iofuzzer_iterate(fuzzer);
+	ports = fuzzer->ports;
 	pthread_mutex_unlock(&fuzzer->mutex);
 
-	return fuzzer;
+	return ports;
 }
 
 /**
- * Performs an iteration with a given state.
+ * Returns the profile of the fuzzer.
  *
  * @param [in] fuzzer The fuzzer.
- * @param [in] state The state of the fuzzer.
- * @param [in] size The size of the state.
- * @return The fuzzer.
+ * @return The profile of the fuzzer.
+ * @see iofuzzer_set_profile
  */
-iofuzzer_t *
-iofuzzer_iterate_with_state(iofuzzer_t *fuzzer, const char *state, size_t size)
+profile_t *
+iofuzzer_get_profile(iofuzzer_t *fuzzer)
 {
+	profile_t *profile;
+
 	if (fuzzer == NULL) {
 		errno = EINVAL;
 		return NULL;
 	}
 
 	pthread_mutex_lock(&fuzzer->mutex);
-	if (_iofuzzer_set_state(fuzzer, state, size) == NULL) {
-		pthread_mutex_unlock(&fuzzer->mutex);
-		return NULL;
-	}
-
-	_iofuzzer_iterate(fuzzer);
+	profile = fuzzer->profile;
 	pthread_mutex_unlock(&fuzzer->mutex);
 
-	return fuzzer;
+	return profile;
 }
 
 /**
- * Creates a fuzzer.
+ * Returns the pseudo-random number generator of the fuzzer.
  *
- * @return A fuzzer.
+ * @param [in] fuzzer The fuzzer.
+ * @return The pseudo-random number generator of the fuzzer.
  */
-iofuzzer_t *
-iofuzzer_new(void)
+random_t *
+iofuzzer_get_random(iofuzzer_t *fuzzer)
 {
-	iofuzzer_t *fuzzer;
-	uintptr_t *variates;
+	random_t *random;
 
-	fuzzer = calloc(1, sizeof(*fuzzer));
-	if (fuzzer == NULL)
-		return NULL;
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
 
-	errno = pthread_mutex_init(&fuzzer->mutex, NULL);
-	if (errno != 0)
-		goto err;
+	pthread_mutex_lock(&fuzzer->mutex);
+	random = fuzzer->random;
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return random;
+}
+
+/**
+ * Returns the normalization sequence of the fuzzer.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @return The normalization sequence of the fuzzer.
+ * @see iofuzzer_set_sequence
+ */
+array_t *
+iofuzzer_get_sequence(iofuzzer_t *fuzzer)
+{
+	array_t *sequence;
+
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	sequence = fuzzer->sequence;
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return sequence;
+}
+
+/**
+ * Returns the state of the fuzzer.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [out] state The state of the fuzzer.
+ * @param [in] size The size of the state.
+ * @return The fuzzer.
+ */
+iofuzzer_t *
+iofuzzer_get_state(iofuzzer_t *fuzzer, char *state, size_t size)
+{
+	if (fuzzer == NULL || state == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	memcpy(state, fuzzer->state, sizeof(fuzzer->state));
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return fuzzer;
+}
+
+/**
+ * Returns the strategy of the fuzzer.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @return The strategy of the fuzzer.
+ * @see iofuzzer_set_strategy
+ */
+int
+iofuzzer_get_strategy(iofuzzer_t *fuzzer)
+{
+	int strategy;
+
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	strategy = fuzzer->strategy;
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return strategy;
+}
+
+/**
+ * Returns the strategy with a given name.
+ *
+ * @param [in] name The name of the strategy.
+ * @return The strategy, or -1 if there is no strategy with the name.
+ */
+int
+iofuzzer_get_strategy_by_name(const char *name)
+{
+	int i;
+
+	if (name == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < IOFUZZER_NUM_STRATEGIES; i++) {
+		if (strcmp(strategies[i], name) == 0)
+			return i;
+	}
+
+	errno = EINVAL;
+
+	return -1;
+}
+
+/**
+ * Returns the name of a given strategy.
+ *
+ * @param [in] strategy The strategy.
+ * @return The name of the strategy.
+ */
+const char *
+iofuzzer_get_strategy_name(int strategy)
+{
+	if (strategy < 0 || strategy >= IOFUZZER_NUM_STRATEGIES) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return strategies[strategy];
+}
+
+/**
+ * Returns the trace of the fuzzer.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @return The trace of the fuzzer.
+ * @see iofuzzer_set_trace
+ */
+trace_t *
+iofuzzer_get_trace(iofuzzer_t *fuzzer)
+{
+	trace_t *trace;
+
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	trace = fuzzer->trace;
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return trace;
+}
+
+/**
+ * Returns the value returned by the last operation of the fuzzer, or zero
+ * if the last operation was not an input operation. The data read by
+ * string operations is stored at the destination pointer.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @return The value returned by the last operation of the fuzzer.
+ */
+unsigned long
+iofuzzer_get_value(iofuzzer_t *fuzzer)
+{
+	unsigned long value;
+
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	value = fuzzer->value;
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return value;
+}
+
+/**
+ * Returns the variates of the fuzzer. The variates are:
+ *
+ *   1. I/O instruction/operation
+ *   2. Data
+ *   3. Implementation specific
+ *   4. Counter for string operations
+ *   5. I/O port address
+ *   6. Source pointer for string operations
+ *   7. Destination pointer for string operations
+ *
+ * The I/O instructions/operations are:
+ *
+ *   1. inb (input byte from port)
+ *   2. inw (input word from port)
+ *   3. inl (input doubleword from port)
+ *   4. insb (input byte string from port)
+ *   5. insw (input word string from port)
+ *   6. insl (input doubleword string from port)
+ *   7. outb (output byte to port)
+ *   8. outw (output word to port)
+ *   9. outl (output doubleword to port)
+ *   10. outsb (output byte string to port)
+ *   11. outsw (output word string to port)
+ *   12. outsl (output doubleword string to port)
+ *   13. inburstb (input byte from port, count times)
+ *   14. inburstw (input word from port, count times)
+ *   15. inburstl (input doubleword from port, count times)
+ *   16. outburstb (output byte to port, count times)
+ *   17. outburstw (output word to port, count times)
+ *   18. outburstl (output doubleword to port, count times)
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @return The variates of the fuzzer.
+ */
+array_t *
+iofuzzer_get_variates(iofuzzer_t *fuzzer)
+{
+	array_t *variates;
+
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	variates = fuzzer->variates;
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return variates;
+}
+
+/**
+ * Returns the timing wheel of the fuzzer.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @return The timing wheel of the fuzzer.
+ * @see iofuzzer_set_wheel
+ */
+wheel_t *
+iofuzzer_get_wheel(iofuzzer_t *fuzzer)
+{
+	wheel_t *wheel;
+
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	wheel = fuzzer->wheel;
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return wheel;
+}
+
+/**
+ * Returns whether a state is the state of a delayed operation, which is
+ * the state of the operation that scheduled it, tagged as delayed.
+ *
+ * @param [in] state The state of the fuzzer.
+ * @param [in] size The size of the state.
+ * @return 1 if the state is the state of a delayed operation, 0 otherwise.
+ * @see iofuzzer_schedule
+ */
+int
+iofuzzer_is_delayed(const char *state, size_t size)
+{
+	if (state == NULL || size < 8) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return _iofuzzer_get_tag(state) == DELAYED;
+}
+
+/**
+ * Performs an iteration.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @return The fuzzer.
+ */
+iofuzzer_t *
+iofuzzer_iterate(iofuzzer_t *fuzzer)
+{
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	_iofuzzer_iterate(fuzzer);
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return fuzzer;
+}
+
+/**
+ * Performs an iteration with a given state.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [in] state The state of the fuzzer.
+ * @param [in] size The size of the state.
+ * @return The fuzzer.
+ */
+iofuzzer_t *
+iofuzzer_iterate_with_state(iofuzzer_t *fuzzer, const char *state, size_t size)
+{
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	if (_iofuzzer_set_state(fuzzer, state, size) == NULL) {
+		pthread_mutex_unlock(&fuzzer->mutex);
+		return NULL;
+	}
+
+	_iofuzzer_iterate(fuzzer);
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return fuzzer;
+}
+
+/**
+ * Creates a fuzzer.
+ *
+ * @return A fuzzer.
+ */
+iofuzzer_t *
+iofuzzer_new(void)
+{
+	iofuzzer_t *fuzzer;
+	uintptr_t *variates;
+
+	fuzzer = calloc(1, sizeof(*fuzzer));
+	if (fuzzer == NULL)
+		return NULL;
+
+	errno = pthread_mutex_init(&fuzzer->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	fuzzer->divergences = array_new(sizeof(struct iofuzzer_divergence));
+	if (fuzzer->divergences == NULL)
+		goto err;
+
+	fuzzer->random = random_new();
+	fuzzer->paired_random = random_new();
+	if (fuzzer->random == NULL || fuzzer->paired_random == NULL)
+		goto err;
+
+	fuzzer->variate5 = calloc(MAXSIZE, sizeof(char));
+	if (fuzzer->variate5 == NULL)
+		goto err;
+
+	fuzzer->variate6 = calloc(MAXSIZE, sizeof(char));
+	if (fuzzer->variate6 == NULL)
+		goto err;
+
+	fuzzer->variates = array_new_with_length(sizeof(uintptr_t), NUM_VARIATES);
+	if (fuzzer->variates == NULL)
+		goto err;
+
+	variates = &array_index(fuzzer->variates, uintptr_t, 0);
+	variates[5] = (uintptr_t)fuzzer->variate5;
+	variates[6] = (uintptr_t)fuzzer->variate6;
+
+	_iofuzzer_randomize(fuzzer);
+	iofuzzer_ref(fuzzer);
+
+	return fuzzer;
+
+err:
+	iofuzzer_free(fuzzer);
+
+	return NULL;
+}
+
+/**
+ * Creates a fuzzer with a given state.
+ *
+ * @param [in] state The state of the fuzzer.
+ * @param [in] size The size of the state.
+ * @return A fuzzer.
+ */
+iofuzzer_t *
+iofuzzer_new_with_state(const char *state, size_t size)
+{
+	iofuzzer_t *fuzzer;
+
+	fuzzer = iofuzzer_new();
+	if (fuzzer == NULL)
+		return NULL;
+
+	if (iofuzzer_set_state(fuzzer, state, size) == NULL) {
+		iofuzzer_unref(fuzzer);
+		return NULL;
+	}
+
+	return fuzzer;
+}
+
+/**
+ * Performs the normalization sequence of the fuzzer, bringing the devices
+ * back to a known state after drifting into states where most operations
+ * are wasted, such as a masked interrupt controller. The operations are
+ * performed directly, without hooks, and on the reference model as well,
+ * if any, so it stays in sync. With IOFUZZER_BACKEND_MODEL, they are only
+ * performed on the model. Operations with a delay are scheduled instead
+ * if the fuzzer has a timing wheel, and performed as delayed operations.
+ * The variates of the fuzzer are preserved.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @return The fuzzer.
+ * @see iofuzzer_parse_sequence
+ */
+iofuzzer_t *
+iofuzzer_normalize(iofuzzer_t *fuzzer)
+{
+	const struct iofuzzer_op *ops;
+	uintptr_t *variates;
+	uintptr_t saved[5];
+	unsigned long value;
+	unsigned long mask;
+	size_t width;
+	size_t i;
+
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	if (fuzzer->sequence == NULL || fuzzer->backend == IOFUZZER_BACKEND_NONE) {
+		pthread_mutex_unlock(&fuzzer->mutex);
+		return fuzzer;
+	}
+
+	variates = &array_index(fuzzer->variates, uintptr_t, 0);
+	value = fuzzer->value;
+	memcpy(saved, variates, sizeof(saved));
+	ops = &array_index(fuzzer->sequence, struct iofuzzer_op, 0);
+	for (i = 0; i < array_get_length(fuzzer->sequence); i++) {
+		if (ops[i].delay != 0 && fuzzer->wheel != NULL) {
+			_iofuzzer_schedule(fuzzer, ops[i].delay, ops[i].variates);
+			continue;
+		}
+
+		memcpy(variates, ops[i].variates, sizeof(ops[i].variates));
+		if (fuzzer->backend == IOFUZZER_BACKEND_MODEL) {
+			_iofuzzer_simulate(fuzzer);
+			continue;
+		}
+
+		#define X(a) case func_##a: _iofuzzer_##a(fuzzer); break;
+		switch (variates[0]) { FUNCS }
+		#undef X
+
+		if (fuzzer->model == NULL || _iofuzzer_func_is_string(variates[0]))
+			continue;
+
+		width = _iofuzzer_func_width(variates[0]);
+		if (_iofuzzer_func_is_input(variates[0]))
+			model_in(fuzzer->model, variates[4], width, &mask);
+		else
+			model_out(fuzzer->model, variates[4], width, variates[1]);
+	}
+
+	memcpy(variates, saved, sizeof(saved));
+	fuzzer->value = value;
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return fuzzer;
+}
+
+/**
+ * Parses a comma-separated list of I/O port addresses and ranges of I/O
+ * port addresses (e.g., 0x60,0x64,0x70-0x71) into ports for the fuzzer.
+ *
+ * @param [in] string The list of I/O port addresses.
+ * @return The ports.
+ * @see iofuzzer_set_ports
+ */
+array_t *
+iofuzzer_parse_ports(const char *string)
+{
+	array_t *ports;
+	char *str;
+	char *ptr = NULL;
+	char *last;
 
-	fuzzer->random = random_new();
-	if (fuzzer->random == NULL)
-		goto err;
+	if (string == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
 
-	fuzzer->variate5 = calloc(MAXSIZE, sizeof(char));
-	if (fuzzer->variate5 == NULL)
+	ports = array_new(sizeof(unsigned long));
+	if (ports == NULL)
 		goto err;
 
-	fuzzer->variate6 = calloc(MAXSIZE, sizeof(char));
-	if (fuzzer->variate6 == NULL)
-		goto err;
+	str = strdup(string);
+	ptr = str;
+	for (str = strtok_r(str, ",", &last); str != NULL; str = strtok_r(NULL, ",", &last)) {
+		char *substr;
+		char *ptr;
+		char *last;
+		unsigned long begin;
+		unsigned long end;
+		unsigned long port;
+
+		substr = strdup(str);
+		ptr = substr;
+		substr = strtok_r(substr, "-", &last);
+		if (substr != NULL) {
+			errno = 0;
+			begin = strtoul(substr, NULL, 0);
+			if (errno == EINVAL) {
+				free(ptr);
+				goto err;
+			}
+
+			end = begin;
+			substr = strtok_r(NULL, "-", &last);
+			if (substr != NULL) {
+				errno = 0;
+				end = strtoul(substr, NULL, 0);
+				if (errno == EINVAL) {
+					free(ptr);
+					goto err;
+				}
+
+				if (end > MAXPORT)
+					end = MAXPORT;
+			}
+
+			for (port = begin; port <= end; port++)
+				array_append_val(ports, &port);
+		}
+
+		free(ptr);
+	}
+
+	free(ptr);
+
+	return ports;
+
+err:
+	free(ptr);
+	array_unref(ports);
+
+	return NULL;
+}
+
+/**
+ * Parses a comma-separated list of device classes into a normalization
+ * sequence. The device classes are:
+ *
+ *   - dma (8237 DMA controllers)
+ *   - ide (primary and secondary IDE controllers)
+ *   - pic (8259 interrupt controllers)
+ *   - pit (8254 interval timer)
+ *   - uart (16550 UART of the first serial port)
+ *
+ * The blocks of operations of the device classes are precompiled, so the
+ * sequence is a flat array of operations, in the order of the list.
+ *
+ * @param [in] string The comma-separated list of device classes.
+ * @return An array of struct iofuzzer_op.
+ * @see iofuzzer_set_sequence
+ */
+array_t *
+iofuzzer_parse_sequence(const char *string)
+{
+	array_t *sequence;
+	struct iofuzzer_op op;
+	const struct block *block;
+	const char *name;
+	size_t length;
+	size_t i;
+
+	if (string == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	sequence = array_new(sizeof(struct iofuzzer_op));
+	if (sequence == NULL)
+		return NULL;
+
+	memset(&op, 0, sizeof(op));
+	op.variates[3] = 1;
+	for (name = string; *name != '\0'; name += length + (name[length] == ',')) {
+		length = strcspn(name, ",");
+		for (block = NULL, i = 0; i < NUM_BLOCKS; i++) {
+			if (strncmp(blocks[i].name, name, length) == 0 && blocks[i].name[length] == '\0')
+				block = &blocks[i];
+		}
+
+		if (block == NULL) {
+			array_unref(sequence);
+			errno = EINVAL;
+			return NULL;
+		}
+
+		for (i = 0; i < block->num_ops; i++) {
+			op.variates[0] = block->ops[i].func;
+			op.variates[1] = block->ops[i].data;
+			op.variates[4] = block->ops[i].port;
+			op.delay = block->ops[i].delay;
+			array_append_val(sequence, &op);
+		}
+	}
+
+	return sequence;
+}
+
+/**
+ * Reads a dictionary saved as an array of struct iofuzzer_token, in host
+ * byte order.
+ *
+ * @param [in] path The path of the dictionary.
+ * @return The dictionary.
+ * @see iofuzzer_set_dictionary
+ */
+array_t *
+iofuzzer_read_dictionary(const char *path)
+{
+	array_t *dictionary;
+	struct iofuzzer_token token;
+	FILE *stream;
+	size_t n;
+
+	if (path == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	stream = fopen(path, "r");
+	if (stream == NULL)
+		return NULL;
+
+	dictionary = array_new(sizeof(struct iofuzzer_token));
+	if (dictionary == NULL) {
+		fclose(stream);
+		return NULL;
+	}
+
+	while ((n = fread(&token, 1, sizeof(token), stream)) == sizeof(token))
+		array_append_val(dictionary, &token);
+
+	if (n != 0 || ferror(stream)) {
+		if (n != 0)
+			errno = EINVAL;
+
+		fclose(stream);
+		array_unref(dictionary);
+		return NULL;
+	}
+
+	fclose(stream);
+
+	return dictionary;
+}
+
+/**
+ * Increments the reference count of the fuzzer.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @return The fuzzer.
+ */
+iofuzzer_t *
+iofuzzer_ref(iofuzzer_t *fuzzer)
+{
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	fuzzer->refcount++;
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return fuzzer;
+}
+
+/**
+ * Removes a hook from the fuzzer. The first hook of the type added with
+ * the same function and data is removed.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [in] type The type of the hook.
+ * @param [in] hook The hook.
+ * @param [in] data The data the hook was added with.
+ * @return The fuzzer, or NULL if there is no such hook.
+ * @see iofuzzer_add_hook
+ */
+iofuzzer_t *
+iofuzzer_remove_hook(iofuzzer_t *fuzzer, int type, iofuzzer_hook_t hook, void *data)
+{
+	struct hook *entries;
+	size_t length;
+	size_t i;
+
+	if (fuzzer == NULL || type < 0 || type >= IOFUZZER_NUM_HOOKS) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	length = fuzzer->hooks[type] != NULL ? array_get_length(fuzzer->hooks[type]) : 0;
+	for (i = 0; i < length; i++) {
+		entries = &array_index(fuzzer->hooks[type], struct hook, 0);
+		if (entries[i].func == hook && entries[i].data == data) {
+			memmove(&entries[i], &entries[i + 1], (length - i - 1) * sizeof(*entries));
+			array_set_length(fuzzer->hooks[type], length - 1);
+			_iofuzzer_compile_hooks(fuzzer, type);
+			pthread_mutex_unlock(&fuzzer->mutex);
+			return fuzzer;
+		}
+	}
+
+	pthread_mutex_unlock(&fuzzer->mutex);
+	errno = ENOENT;
+
+	return NULL;
+}
+
+/**
+ * Schedules an operation to be performed once a given delay has elapsed.
+ * Delayed operations are interleaved with the operations drawn by the
+ * fuzzer: once due, a delayed operation is performed instead of drawing
+ * the next operation. The state of a delayed operation is the state of
+ * the fuzzer when it was scheduled, tagged as delayed, so it is not
+ * drawn again; replaying the operation that scheduled it schedules it
+ * again. Unlike the other functions of the fuzzer, this function may be
+ * called by the hooks of the fuzzer.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [in] delay The delay in nanoseconds.
+ * @param [in] variates The variates of the operation, but the strings.
+ * @return The fuzzer, or NULL if there is no timing wheel or it is full.
+ * @see iofuzzer_is_delayed
+ * @see iofuzzer_set_wheel
+ */
+iofuzzer_t *
+iofuzzer_schedule(iofuzzer_t *fuzzer, uint64_t delay, const uintptr_t *variates)
+{
+	iofuzzer_t *retval;
+
+	if (fuzzer == NULL || variates == NULL || variates[0] >= NUM_FUNCS) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Hooks are called with the mutex held, so they schedule without it */
+	if (_iofuzzer_hooked == fuzzer)
+		return _iofuzzer_schedule(fuzzer, delay, variates);
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	retval = _iofuzzer_schedule(fuzzer, delay, variates);
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return retval;
+}
+
+/**
+ * Sets the backend of the fuzzer. With IOFUZZER_BACKEND_NONE, the fuzzer
+ * generates the same operations it would perform with the native
+ * backend, as a dry run, without privileges. With IOFUZZER_BACKEND_MODEL,
+ * the operations are performed on the model of the fuzzer instead, which
+ * simulates the device, also without privileges.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [in] backend The backend of the fuzzer.
+ * @return The fuzzer.
+ */
+iofuzzer_t *
+iofuzzer_set_backend(iofuzzer_t *fuzzer, int backend)
+{
+	if (fuzzer == NULL || (backend != IOFUZZER_BACKEND_NATIVE && backend != IOFUZZER_BACKEND_NONE && backend != IOFUZZER_BACKEND_MODEL)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	fuzzer->backend = backend;
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return fuzzer;
+}
+
+/**
+ * Sets the dictionary of the fuzzer. The dictionary strategy draws the
+ * tokens of the dictionary, on their port, as often as every built-in
+ * value. The dictionary is not copied, so it must not be modified while
+ * it is set; a new dictionary is set instead. A state drawn with a token
+ * holds the hash of the token, so it replays the first token of the
+ * dictionary with that hash, or a built-in value if there is none.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [in] dictionary An array of struct iofuzzer_token, or NULL for none.
+ * @return The fuzzer.
+ */
+iofuzzer_t *
+iofuzzer_set_dictionary(iofuzzer_t *fuzzer, array_t *dictionary)
+{
+	struct iofuzzer_token *token;
+	uint32_t *hashes;
+	size_t i;
+
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Tokens with the same hash are drawn as the first of them */
+	hashes = NULL;
+	if (dictionary != NULL) {
+		hashes = calloc(NUM_HASHES, sizeof(*hashes));
+		if (hashes == NULL)
+			return NULL;
+
+		for (i = 0; i < array_get_length(dictionary); i++) {
+			token = &array_index(dictionary, struct iofuzzer_token, i);
+			if (hashes[_iofuzzer_token_hash(token)] == 0)
+				hashes[_iofuzzer_token_hash(token)] = i + 1;
+		}
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	array_unref(fuzzer->dictionary);
+	free(fuzzer->hashes);
+	fuzzer->dictionary = dictionary;
+	fuzzer->hashes = hashes;
+	array_ref(fuzzer->dictionary);
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return fuzzer;
+}
+
+/**
+ * Sets the feedback bus of the fuzzer. The fuzzer registers the "value"
+ * source with the feedback bus and publishes an event into its
+ * accumulator whenever a read from a port returns a value other than the
+ * last value read from it. Without a feedback bus, the fuzzer does no
+ * feedback work.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [in] feedback The feedback bus of the fuzzer, or NULL for none.
+ * @return The fuzzer.
+ * @see iofuzzer_get_accumulator
+ */
+iofuzzer_t *
+iofuzzer_set_feedback(iofuzzer_t *fuzzer, feedback_t *feedback)
+{
+	int source;
+
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	source = -1;
+	if (feedback != NULL) {
+		source = feedback_add_source(feedback, "value", VALUE_WEIGHT);
+		if (source == -1)
+			return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	feedback_unref(fuzzer->feedback);
+	fuzzer->feedback = feedback;
+	feedback_ref(fuzzer->feedback);
+	fuzzer->feedback_value = source;
+	memset(&fuzzer->accumulator, 0, sizeof(fuzzer->accumulator));
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return fuzzer;
+}
+
+/**
+ * Sets the filter of the fuzzer. With a filter, an operation drawn again
+ * while it is still in the filter is redrawn, up to a bound, so recently
+ * performed operations are not repeated. The filter is not synchronized,
+ * so it must not be shared between threads.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [in] filter The filter of the fuzzer, or NULL for none.
+ * @return The fuzzer.
+ * @see bloom_new
+ */
+iofuzzer_t *
+iofuzzer_set_filter(iofuzzer_t *fuzzer, bloom_t *filter)
+{
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	bloom_unref(fuzzer->filter);
+	fuzzer->filter = filter;
+	bloom_ref(fuzzer->filter);
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return fuzzer;
+}
+
+/**
+ * Sets the reference model of the fuzzer. If set, every operation is also
+ * performed on the reference model, and the values returned by input
+ * operations are compared with the values returned by the reference
+ * model. With IOFUZZER_BACKEND_MODEL, the model is the device itself.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [in] model The reference model of the fuzzer.
+ * @return The fuzzer.
+ * @see iofuzzer_get_divergences
+ */
+iofuzzer_t *
+iofuzzer_set_model(iofuzzer_t *fuzzer, model_t *model)
+{
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	_iofuzzer_compare(fuzzer);
+	model_unref(fuzzer->model);
+	fuzzer->model = model;
+	model_ref(fuzzer->model);
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return fuzzer;
+}
+
+/**
+ * Sets the ports of the fuzzer.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [in] ports The ports of the fuzzer.
+ * @return The fuzzer.
+ */
+iofuzzer_t *
+iofuzzer_set_ports(iofuzzer_t *fuzzer, array_t *ports)
+{
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	array_unref(fuzzer->ports);
+	fuzzer->ports = ports;
+	array_ref(fuzzer->ports);
+	if (fuzzer->traversal_num_parts != 0 && _iofuzzer_set_traversal(fuzzer) == NULL) {
+		pthread_mutex_unlock(&fuzzer->mutex);
+		return NULL;
+	}
+
+	_iofuzzer_set_state(fuzzer, fuzzer->state, sizeof(fuzzer->state));
+	_iofuzzer_randomize(fuzzer);
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return fuzzer;
+}
+
+/**
+ * Sets the profile of the fuzzer. With a profile, the latency and the
+ * value of every operation performed are added to the profile, and, once
+ * the profiling phase is over, operations are drawn with per-port weights
+ * conditioned on the profile, so widths and directions a port does not
+ * decode are drawn less often. Operations rejected by the profile are
+ * redrawn like operations rejected by the filter. The profile is not
+ * synchronized, so it must not be shared between threads.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [in] profile The profile of the fuzzer, or NULL for none.
+ * @return The fuzzer.
+ * @see profile_new
+ */
+iofuzzer_t *
+iofuzzer_set_profile(iofuzzer_t *fuzzer, profile_t *profile)
+{
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	profile_unref(fuzzer->profile);
+	fuzzer->profile = profile;
+	profile_ref(fuzzer->profile);
+	pthread_mutex_unlock(&fuzzer->mutex);
 
-	fuzzer->variates = array_new_with_length(sizeof(uintptr_t), NUM_VARIATES);
-	if (fuzzer->variates == NULL)
-		goto err;
+	return fuzzer;
+}
 
-	variates = &array_index(fuzzer->variates, uintptr_t, 0);
-	variates[5] = (uintptr_t)fuzzer->variate5;
-	variates[6] = (uintptr_t)fuzzer->variate6;
+/**
+ * Sets the pseudo-random number generator of the fuzzer.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [in] variates The pseudo-random number generator of the fuzzer.
+ * @return The fuzzer.
+ */
+iofuzzer_t *
+iofuzzer_set_random(iofuzzer_t *fuzzer, random_t *random)
+{
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
 
+	pthread_mutex_lock(&fuzzer->mutex);
+	random_unref(fuzzer->random);
+	fuzzer->random = random;
+	random_ref(fuzzer->random);
 	_iofuzzer_randomize(fuzzer);
-	iofuzzer_ref(fuzzer);
+	pthread_mutex_unlock(&fuzzer->mutex);
 
 	return fuzzer;
-
-err:
-	iofuzzer_free(fuzzer);
-
-	return NULL;
 }
 
 /**
- * Creates a fuzzer with a given state.
+ * Sets the normalization sequence of the fuzzer.
  *
- * @param [in] state The state of the fuzzer.
- * @param [in] size The size of the state.
- * @return A fuzzer.
+ * @param [in] fuzzer The fuzzer.
+ * @param [in] sequence An array of struct iofuzzer_op, or NULL for none.
+ * @return The fuzzer.
+ * @see iofuzzer_normalize
+ * @see iofuzzer_parse_sequence
  */
 iofuzzer_t *
-iofuzzer_new_with_state(const char *state, size_t size)
+iofuzzer_set_sequence(iofuzzer_t *fuzzer, array_t *sequence)
 {
-	iofuzzer_t *fuzzer;
-
-	fuzzer = iofuzzer_new();
-	if (fuzzer == NULL)
-		return NULL;
-
-	if (iofuzzer_set_state(fuzzer, state, size) == NULL) {
-		iofuzzer_unref(fuzzer);
+	if (fuzzer == NULL) {
+		errno = EINVAL;
 		return NULL;
 	}
 
+	pthread_mutex_lock(&fuzzer->mutex);
+	array_unref(fuzzer->sequence);
+	fuzzer->sequence = sequence;
+	array_ref(fuzzer->sequence);
+	pthread_mutex_unlock(&fuzzer->mutex);
+
 	return fuzzer;
 }
 
 /**
- * Increments the reference count of the fuzzer.
+ * Sets the state of the fuzzer, and draws the operation of the state. A
+ * state of an operation drawn with a strategy draws the same operation
+ * whatever the strategy of the fuzzer. The state of a delayed operation
+ * is not drawn.
  *
  * @param [in] fuzzer The fuzzer.
- * @return The fuzzer.
+ * @param [in] state The state of the fuzzer.
+ * @param [in] size The size of the state.
+ * @return The fuzzer, or NULL if the state is the state of a delayed
+ *   operation.
+ * @see iofuzzer_is_delayed
+ * @see iofuzzer_set_strategy
  */
 iofuzzer_t *
-iofuzzer_ref(iofuzzer_t *fuzzer)
+iofuzzer_set_state(iofuzzer_t *fuzzer, const char *state, size_t size)
 {
-	if (fuzzer == NULL) {
+	if (fuzzer == NULL || state == NULL) {
 		errno = EINVAL;
 		return NULL;
 	}
 
 	pthread_mutex_lock(&fuzzer->mutex);
-	fuzzer->refcount++;
+	if (_iofuzzer_set_state(fuzzer, state, size) == NULL) {
+		pthread_mutex_unlock(&fuzzer->mutex);
+		return NULL;
+	}
+
 	pthread_mutex_unlock(&fuzzer->mutex);
 
 	return fuzzer;
 }
 
 /**
- * Sets the ports of the fuzzer.
+ * Sets the strategy of the fuzzer. The strategies other than
+ * IOFUZZER_STRATEGY_UNIFORM derive the data, and for paired operations
+ * the operation and the port, from the variates drawn, so every strategy
+ * draws the same pseudo-random numbers per operation. The rest of what
+ * they derive it from, the position of the sweep, the half of the pair
+ * and the token drawn, is kept with the strategy in the top 16 bits of
+ * the state of the operation. Setting a logged state thus performs the
+ * same operation whatever the strategy of the fuzzer, but for a state
+ * logged before states had them, which is drawn with the strategy of the
+ * fuzzer. The second half of a pair is drawn again from the state of the
+ * first. The strategy applies from the next operation drawn.
  *
  * @param [in] fuzzer The fuzzer.
- * @param [in] ports The ports of the fuzzer.
+ * @param [in] strategy The strategy of the fuzzer.
  * @return The fuzzer.
  */
 iofuzzer_t *
-iofuzzer_set_ports(iofuzzer_t *fuzzer, array_t *ports)
+iofuzzer_set_strategy(iofuzzer_t *fuzzer, int strategy)
 {
-	if (fuzzer == NULL) {
+	if (fuzzer == NULL || strategy < 0 || strategy >= IOFUZZER_NUM_STRATEGIES) {
 		errno = EINVAL;
 		return NULL;
 	}
 
 	pthread_mutex_lock(&fuzzer->mutex);
-	array_unref(fuzzer->ports);
-	fuzzer->ports = ports;
-	array_ref(fuzzer->ports);
-	_iofuzzer_set_state(fuzzer, fuzzer->state, sizeof(fuzzer->state));
-	_iofuzzer_randomize(fuzzer);
+	if (fuzzer->strategy != strategy) {
+		/* The step of the next operation drawn is zero, and pairs start over */
+		fuzzer->strategy = strategy;
+		fuzzer->step = (uint64_t)-1;
+		fuzzer->paired = 0;
+	}
+
 	pthread_mutex_unlock(&fuzzer->mutex);
 
 	return fuzzer;
 }
 
 /**
- * Sets the pseudo-random number generator of the fuzzer.
+ * Sets the trace of the fuzzer. With a trace, the fuzzer adds the
+ * execution of every operation, and the drawing of the next, to the
+ * timeline of a given thread of the trace.
  *
  * @param [in] fuzzer The fuzzer.
- * @param [in] variates The pseudo-random number generator of the fuzzer.
+ * @param [in] trace The trace of the fuzzer, or NULL for none.
+ * @param [in] thread The thread of the trace the fuzzer runs on.
  * @return The fuzzer.
+ * @see trace_new
  */
 iofuzzer_t *
-iofuzzer_set_random(iofuzzer_t *fuzzer, random_t *random)
+iofuzzer_set_trace(iofuzzer_t *fuzzer, trace_t *trace, unsigned long thread)
 {
 	if (fuzzer == NULL) {
 		errno = EINVAL;
@@ -361,37 +1777,56 @@ iofuzzer_set_random(iofuzzer_t *fuzzer, random_t *random)
 	}
 
 	pthread_mutex_lock(&fuzzer->mutex);
-	random_unref(fuzzer->random);
-	fuzzer->random = random;
-	random_ref(fuzzer->random);
-	_iofuzzer_randomize(fuzzer);
+	trace_unref(fuzzer->trace);
+	fuzzer->trace = trace;
+	fuzzer->trace_thread = thread;
+	trace_ref(fuzzer->trace);
 	pthread_mutex_unlock(&fuzzer->mutex);
 
 	return fuzzer;
 }
 
 /**
- * Sets the state of the fuzzer.
+ * Sets the traversal of the fuzzer. Instead of being drawn at random,
+ * the operation, the data (from a built-in dictionary of values) and the
+ * port of every operation walk the space of (port, operation, value)
+ * tuples in a pseudo-random order selected by a given key, without
+ * repeats. The space is split into a given number of contiguous parts of
+ * the permutation, and the fuzzer walks one of them, so fuzzers with the
+ * same key and different parts never perform the same tuple. The walk
+ * starts over when the part is exhausted. The other variates are still
+ * drawn at random.
+ *
+ * The position of the walk is not part of the state of the fuzzer, so
+ * setting a logged state, as iofuzzer-repro and iofuzzer-cmin do, draws
+ * the operation of that state at random instead of the tuple the walk
+ * performed.
  *
  * @param [in] fuzzer The fuzzer.
- * @param [in] state The state of the fuzzer.
- * @param [in] size The size of the state.
+ * @param [in] key The key of the permutation of the space.
+ * @param [in] part The part of the space walked by the fuzzer.
+ * @param [in] num_parts The number of parts of the space, or zero to
+ *   disable the traversal. There cannot be more parts than tuples.
  * @return The fuzzer.
  */
 iofuzzer_t *
-iofuzzer_set_state(iofuzzer_t *fuzzer, const char *state, size_t size)
+iofuzzer_set_traversal(iofuzzer_t *fuzzer, unsigned long key, size_t part, size_t num_parts)
 {
-	if (fuzzer == NULL || state == NULL) {
+	if (fuzzer == NULL || (num_parts != 0 && part >= num_parts)) {
 		errno = EINVAL;
 		return NULL;
 	}
 
 	pthread_mutex_lock(&fuzzer->mutex);
-	if (_iofuzzer_set_state(fuzzer, state, size) == NULL) {
+	fuzzer->traversal_key = key;
+	fuzzer->traversal_part = part;
+	fuzzer->traversal_num_parts = num_parts;
+	if (_iofuzzer_set_traversal(fuzzer) == NULL) {
 		pthread_mutex_unlock(&fuzzer->mutex);
 		return NULL;
 	}
 
+	_iofuzzer_randomize(fuzzer);
 	pthread_mutex_unlock(&fuzzer->mutex);
 
 	return fuzzer;
@@ -422,6 +1857,39 @@ iofuzzer_set_variates(iofuzzer_t *fuzzer, array_t *variates)
 	return fuzzer;
 }
 
+/**
+ * Sets the timing wheel of the fuzzer. With a timing wheel, one in eight
+ * writes schedules an operation after a delay of up to 100 microseconds,
+ * both drawn from the variates of the write: a read of the port, of any
+ * width, a read of a port of its block of eight, or the write again, so
+ * timer-driven device logic is exercised without the thread sleeping.
+ * The timing wheel must have been created for elements of type struct
+ * iofuzzer_op, and is not synchronized, so it must not be shared between
+ * threads.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [in] wheel The timing wheel of the fuzzer, or NULL for none.
+ * @return The fuzzer.
+ * @see iofuzzer_schedule
+ * @see wheel_new
+ */
+iofuzzer_t *
+iofuzzer_set_wheel(iofuzzer_t *fuzzer, wheel_t *wheel)
+{
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&fuzzer->mutex);
+	wheel_unref(fuzzer->wheel);
+	fuzzer->wheel = wheel;
+	wheel_ref(fuzzer->wheel);
+	pthread_mutex_unlock(&fuzzer->mutex);
+
+	return fuzzer;
+}
+
 /**
  * Decrements the reference count of the fuzzer.
  *
@@ -444,22 +1912,432 @@ iofuzzer_unref(iofuzzer_t *fuzzer)
 	iofuzzer_free(fuzzer);
 }
 
+/*
+ * Returns the operand of the strategy for the operation drawn. An
+ * operation replayed from its state is given the operand it was drawn
+ * with, instead of the one of the fuzzer.
+ */
+static unsigned int
+_iofuzzer_apply_strategy(iofuzzer_t *fuzzer, int strategy, unsigned int operand, int replay)
+{
+	struct iofuzzer_token *token;
+	uintptr_t *variates;
+	unsigned long *ports;
+	size_t length;
+	size_t n;
+
+	variates = &array_index(fuzzer->variates, uintptr_t, 0);
+	switch (strategy) {
+	case IOFUZZER_STRATEGY_DICTIONARY:
+		/* Learned tokens are drawn like built-in values, on their own port */
+		if (!replay) {
+			n = fuzzer->dictionary != NULL ? array_get_length(fuzzer->dictionary) : 0;
+			n = variates[2] % (NUM_VALUES + n);
+			if (n < NUM_VALUES)
+				operand = n;
+			else
+				operand = TOKEN | _iofuzzer_token_hash(&array_index(fuzzer->dictionary, struct iofuzzer_token, n - NUM_VALUES));
+		}
+
+		n = (operand & TOKEN) && fuzzer->hashes != NULL ? fuzzer->hashes[operand & (NUM_HASHES - 1)] : 0;
+		if (n == 0)
+			variates[1] = dictionary[operand % NUM_VALUES];
+		else {
+			token = &array_index(fuzzer->dictionary, struct iofuzzer_token, n - 1);
+			variates[1] = token->value;
+			variates[4] = token->port;
+		}
+
+		break;
+
+	case IOFUZZER_STRATEGY_PAIRED:
+		/*
+		 * An index register write, then an operation on its data
+		 * register, the next port, drawn again from the same state.
+		 * Within a set of ports, the index register is moved back one
+		 * port if the next port is not in the set, and a port without
+		 * neighbors is paired with itself.
+		 */
+		if (fuzzer->ports != NULL) {
+			ports = &array_index(fuzzer->ports, unsigned long, 0);
+			length = array_get_length(fuzzer->ports);
+			n = fuzzer->port_index;
+			if ((n + 1 == length || ports[n + 1] != ports[n] + 1) && n > 0 && ports[n - 1] + 1 == ports[n])
+				n--;
+
+			if (operand % 2 == 1 && n + 1 < length && ports[n + 1] == ports[n] + 1)
+				n++;
+
+			fuzzer->port_index = n;
+			variates[4] = ports[n];
+		} else if (operand % 2 == 1)
+			variates[4] = (variates[4] + 1) & MAXPORT;
+
+		if (operand % 2 == 0) {
+			variates[0] = func_outb;
+			variates[1] = variates[2] & 0xff;
+		}
+
+		break;
+
+	case IOFUZZER_STRATEGY_SWEEP:
+		variates[1] = operand;
+		break;
+
+	case IOFUZZER_STRATEGY_BURST:
+		/* The operation is repeated count times, with the same width and direction */
+		variates[0] = (_iofuzzer_func_is_input(variates[0]) ? func_inburstb : func_outburstb) + variates[0] % 3;
+		break;
+
+	default:
+		break;
+	}
+
+	return operand;
+}
+
+static iofuzzer_t *
+_iofuzzer_compare(iofuzzer_t *fuzzer)
+{
+	uint32_t diff;
+	size_t i;
+
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Branch-free reduction over the whole batch; vectorized by the compiler */
+	diff = 0;
+	for (i = 0; i < fuzzer->batch_length; i++)
+		diff |= (fuzzer->batch_actual[i] ^ fuzzer->batch_expected[i]) & fuzzer->batch_mask[i];
+
+	if (diff != 0) {
+		for (i = 0; i < fuzzer->batch_length; i++) {
+			if (((fuzzer->batch_actual[i] ^ fuzzer->batch_expected[i]) & fuzzer->batch_mask[i]) == 0)
+				continue;
+
+			fuzzer->batch_context[i].expected = fuzzer->batch_expected[i];
+			fuzzer->batch_context[i].actual = fuzzer->batch_actual[i];
+			fuzzer->batch_context[i].mask = fuzzer->batch_mask[i];
+			array_append_val(fuzzer->divergences, &fuzzer->batch_context[i]);
+		}
+	}
+
+	fuzzer->batch_length = 0;
+
+	return fuzzer;
+}
+
+static iofuzzer_t *
+_iofuzzer_compile_hooks(iofuzzer_t *fuzzer, int type)
+{
+	/* The array of hooks only moves when hooks are added or removed */
+	fuzzer->num_dispatch[type] = array_get_length(fuzzer->hooks[type]);
+	fuzzer->dispatch[type] = NULL;
+	if (fuzzer->num_dispatch[type] != 0)
+		fuzzer->dispatch[type] = &array_index(fuzzer->hooks[type], struct hook, 0);
+
+	return fuzzer;
+}
+
+static iofuzzer_t *
+_iofuzzer_differ(iofuzzer_t *fuzzer)
+{
+	uintptr_t *variates;
+	unsigned long func;
+	unsigned long count;
+	unsigned long width;
+	unsigned long value;
+	unsigned long mask;
+	unsigned long i;
+	size_t n;
+
+	if (fuzzer == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	variates = &array_index(fuzzer->variates, uintptr_t, 0);
+	func = variates[0];
+	width = _iofuzzer_func_width(func);
+	count = _iofuzzer_func_is_string(func) || _iofuzzer_func_is_burst(func) ? variates[3] : 1;
+	if (!_iofuzzer_func_is_input(func)) {
+		for (i = 0; i < count; i++) {
+			value = variates[1];
+			if (_iofuzzer_func_is_string(func) || _iofuzzer_func_is_burst(func)) {
+				value = 0;
+				memcpy(&value, (char *)variates[5] + i * width, width);
+			}
+
+			model_out(fuzzer->model, variates[4], width, value);
+		}
+
+		return fuzzer;
+	}
+
+	if (fuzzer->batch_length + count > BATCHSIZE)
+		_iofuzzer_compare(fuzzer);
+
+	for (i = 0; i < count; i++) {
+		value = fuzzer->value;
+		if (_iofuzzer_func_is_string(func) || _iofuzzer_func_is_burst(func)) {
+			value = 0;
+			memcpy(&value, (char *)variates[6] + i * width, width);
+		}
+
+		n = fuzzer->batch_length++;
+		fuzzer->batch_actual[n] = value;
+		fuzzer->batch_expected[n] = model_in(fuzzer->model, variates[4], width, &mask);
+		fuzzer->batch_mask[n] = mask;
+		memcpy(fuzzer->batch_context[n].state, fuzzer->state, sizeof(fuzzer->state));
+		fuzzer->batch_context[n].func = func;
+		fuzzer->batch_context[n].port = variates[4];
+		fuzzer->batch_context[n].index = i;
+	}
+
+	if (fuzzer->batch_length == BATCHSIZE)
+		_iofuzzer_compare(fuzzer);
+
+	return fuzzer;
+}
+
+/*
+ * The data of an output burst is correlated, so it drives the FIFO of the
+ * device the way a driver would: a constant, a ramp up, a ramp down, or
+ * the data alternating with its complement, as selected by variate 2.
+ */
+/*
+ * Draws an operation with the strategy and the operand of a tag. An
+ * operation replayed from its state is drawn once; otherwise, operations
+ * recently drawn, or unlikely to be useful on their port, are redrawn, up
+ * to a bound, if there is a filter or a profile. The state is the state
+ * of the accepted draw, tagged with the strategy and the operand it was
+ * drawn with, so replaying it without the filter or the profile performs
+ * the same operation. Redraws neither advance the step nor change the
+ * operand.
+ */
+static iofuzzer_t *
+_iofuzzer_draw(iofuzzer_t *fuzzer, unsigned int tag, int replay)
+{
+	uintptr_t *variates;
+	unsigned long *ports;
+	unsigned int operand;
+	uint64_t signature;
+	int strategy;
+	int i;
+
+	strategy = _iofuzzer_tag_strategy(tag);
+	variates = &array_index(fuzzer->variates, uintptr_t, 0);
+	for (i = 0; ; i++) {
+		random_get_state(fuzzer->random, fuzzer->state, sizeof(fuzzer->state));
+		variates[0] = random_number_with_range(fuzzer->random, 0, NUM_DRAWN - 1);
+		variates[1] = _iofuzzer_random_number(fuzzer);
+		variates[2] = _iofuzzer_random_number(fuzzer);
+		variates[3] = random_number_with_range(fuzzer->random, 1, MAXSIZE / 4);
+		if (fuzzer->ports != NULL) {
+			ports = &array_index(fuzzer->ports, unsigned long, 0);
+			fuzzer->port_index = random_number_with_range(fuzzer->random, 0, array_get_length(fuzzer->ports) - 1);
+			variates[4] = ports[fuzzer->port_index];
+		} else
+			variates[4] = random_number_with_range(fuzzer->random, 0, MAXPORT);
+
+		operand = _iofuzzer_tag_operand(tag);
+		if (strategy != IOFUZZER_STRATEGY_UNIFORM)
+			operand = _iofuzzer_apply_strategy(fuzzer, strategy, operand, replay);
+
+		_iofuzzer_set_tag(fuzzer->state, _iofuzzer_tag(strategy, operand));
+		if (fuzzer->permutation != NULL || replay)
+			break;
+
+		if (i < MAXREDRAWS && fuzzer->profile != NULL &&
+		    !profile_accept(fuzzer->profile, variates[4], variates[0], (uint64_t)variates[2] * 0xc2b2ae3d27d4eb4fULL))
+			continue;
+
+		if (fuzzer->filter == NULL)
+			break;
+
+		signature = ((uint64_t)variates[0] << 56) ^ ((uint64_t)variates[4] << 40) ^ (uint32_t)variates[1];
+		if (_iofuzzer_func_is_string(variates[0]) || _iofuzzer_func_is_burst(variates[0]))
+			signature ^= (uint64_t)variates[3] << 32;
+
+		if (i == MAXREDRAWS || !bloom_contains(fuzzer->filter, signature)) {
+			bloom_add(fuzzer->filter, signature);
+			break;
+		}
+	}
+
+	variates[5] = (uintptr_t)random_string(fuzzer->random, (char *)variates[5], MAXSIZE);
+	variates[6] = (uintptr_t)random_string(fuzzer->random, (char *)variates[6], MAXSIZE);
+	if (fuzzer->permutation != NULL)
+		_iofuzzer_traverse(fuzzer);
+
+	if (_iofuzzer_func_is_burst(variates[0]) && !_iofuzzer_func_is_input(variates[0]))
+		_iofuzzer_fill_burst(fuzzer);
+
+	return fuzzer;
+}
+
+static iofuzzer_t *
+_iofuzzer_fill_burst(iofuzzer_t *fuzzer)
+{
+	uintptr_t *variates;
+	unsigned long width;
+	unsigned long value;
+	unsigned long i;
+
+	variates = &array_index(fuzzer->variates, uintptr_t, 0);
+	width = _iofuzzer_func_width(variates[0]);
+	for (i = 0; i < variates[3]; i++) {
+		switch (variates[2] % 4) {
+		case 0:
+			value = variates[1];
+			break;
+
+		case 1:
+			value = variates[1] + i;
+			break;
+
+		case 2:
+			value = variates[1] - i;
+			break;
+
+		default:
+			value = i % 2 ? ~variates[1] : variates[1];
+			break;
+		}
+
+		memcpy((char *)variates[5] + i * width, &value, width);
+	}
+
+	return fuzzer;
+}
+
 static iofuzzer_t *
 _iofuzzer_iterate(iofuzzer_t *fuzzer)
 {
 	uintptr_t *variates;
+	struct iofuzzer_op op;
+	const struct hook *hook;
+	unsigned long value;
+	uint64_t cycles;
+	uint64_t hash;
+	int skip;
+	size_t i;
 
 	if (fuzzer == NULL) {
 		errno = EINVAL;
 		return NULL;
 	}
 
+	_iofuzzer_hooked = fuzzer;
 	variates = &array_index(fuzzer->variates, uintptr_t, 0);
-	#define X(a) case func_##a: _iofuzzer_##a(fuzzer); break;
-	switch (variates[0]) { FUNCS }
-	#undef X
+	if (fuzzer->trace != NULL)
+		trace_begin(fuzzer->trace, fuzzer->trace_thread, TRACE_PHASE_EXECUTE);
+
+	fuzzer->value = 0;
+	skip = 0;
+	for (i = 0, hook = fuzzer->dispatch[IOFUZZER_HOOK_EXECUTE]; i < fuzzer->num_dispatch[IOFUZZER_HOOK_EXECUTE]; i++)
+		skip |= hook[i].func(fuzzer, variates, 0, hook[i].data) == IOFUZZER_HOOK_SKIP;
+
+	if (!skip && fuzzer->backend != IOFUZZER_BACKEND_NONE) {
+		cycles = fuzzer->profile != NULL ? __builtin_ia32_rdtsc() : 0;
+		if (fuzzer->backend == IOFUZZER_BACKEND_MODEL)
+			_iofuzzer_simulate(fuzzer);
+		else {
+			#define X(a) case func_##a: _iofuzzer_##a(fuzzer); break;
+			switch (variates[0]) { FUNCS }
+			#undef X
+		}
+
+		if (_iofuzzer_func_is_input(variates[0]) && !_iofuzzer_func_is_string(variates[0])) {
+			fuzzer->value &= 0xffffffffUL >> (32 - _iofuzzer_func_width(variates[0]) * 8);
+			if (fuzzer->feedback != NULL && fuzzer->values[variates[4] % NUM_SLOTS] != fuzzer->value) {
+				fuzzer->values[variates[4] % NUM_SLOTS] = fuzzer->value;
+				fuzzer->accumulator.events[fuzzer->feedback_value]++;
+			}
+		}
+
+		if (fuzzer->profile != NULL) {
+			cycles = __builtin_ia32_rdtsc() - cycles;
+			value = _iofuzzer_func_is_input(variates[0]) && !_iofuzzer_func_is_string(variates[0]) ? fuzzer->value : ~0UL;
+			profile_add(fuzzer->profile, variates[4], variates[0], value, _iofuzzer_func_width(variates[0]), cycles);
+		}
+
+		if (fuzzer->model != NULL && fuzzer->backend == IOFUZZER_BACKEND_NATIVE)
+			_iofuzzer_differ(fuzzer);
+	}
 
-	_iofuzzer_randomize(fuzzer);
+	for (i = 0, hook = fuzzer->dispatch[IOFUZZER_HOOK_COMPLETE]; !skip && i < fuzzer->num_dispatch[IOFUZZER_HOOK_COMPLETE]; i++)
+		hook[i].func(fuzzer, variates, fuzzer->value, hook[i].data);
+
+	if (fuzzer->trace != NULL) {
+		trace_end(fuzzer->trace, fuzzer->trace_thread, TRACE_PHASE_EXECUTE);
+		trace_begin(fuzzer->trace, fuzzer->trace_thread, TRACE_PHASE_GENERATE);
+	}
+
+	/* Delayed operations are outside of the traversal and the strategy */
+	if (!fuzzer->delayed) {
+		/* The extra variate is hashed, so writes schedule without a draw */
+		hash = (uint64_t)variates[2] * 0x9e3779b97f4a7c15ULL;
+		if (!skip && fuzzer->wheel != NULL && !_iofuzzer_func_is_input(variates[0]) && (hash >> 32) % DELAY_RATE == 0) {
+			memcpy(op.variates, variates, sizeof(op.variates));
+			switch ((hash >> 16) % 4) {
+			case 0:
+				/* A read of the width of the write */
+				op.variates[0] = variates[0] % 3;
+				break;
+
+			case 1:
+				/* A read of any width */
+				op.variates[0] = (hash >> 18) % 3;
+				break;
+
+			case 2:
+				/* A read of a port of the block, such as a status register */
+				op.variates[0] = variates[0] % 3;
+				op.variates[4] = (variates[4] & ~7UL) | ((hash >> 18) & 7);
+				break;
+
+			case 3:
+				/* The write again; buffers are not kept, so strings and bursts are read back */
+				if (_iofuzzer_func_is_string(variates[0]) || _iofuzzer_func_is_burst(variates[0]))
+					op.variates[0] = variates[0] % 3;
+
+				break;
+			}
+
+			if (_iofuzzer_func_is_input(op.variates[0])) {
+				op.variates[1] = 0;
+				op.variates[3] = 1;
+			}
+
+			_iofuzzer_schedule(fuzzer, (hash >> 40) % MAXDELAY, op.variates);
+		}
+
+		if (fuzzer->permutation != NULL && ++fuzzer->position == fuzzer->end)
+			fuzzer->position = fuzzer->begin;
+
+		fuzzer->step++;
+	}
+
+	fuzzer->delayed = 0;
+	skip = 0;
+	for (i = 0, hook = fuzzer->dispatch[IOFUZZER_HOOK_GENERATE]; i < fuzzer->num_dispatch[IOFUZZER_HOOK_GENERATE]; i++)
+		skip |= hook[i].func(fuzzer, variates, 0, hook[i].data) == IOFUZZER_HOOK_SKIP;
+
+	/* The state of a delayed operation is tagged, so it is told from a draw */
+	if (!skip && fuzzer->wheel != NULL && wheel_poll(fuzzer->wheel, &op)) {
+		memcpy(fuzzer->state, op.state, sizeof(fuzzer->state));
+		memcpy(variates, op.variates, sizeof(op.variates));
+		fuzzer->delayed = 1;
+	} else if (!skip)
+		_iofuzzer_randomize(fuzzer);
+
+	if (fuzzer->trace != NULL)
+		trace_end(fuzzer->trace, fuzzer->trace_thread, TRACE_PHASE_GENERATE);
+
+	_iofuzzer_hooked = NULL;
 
 	return fuzzer;
 }
@@ -479,31 +2357,57 @@ _iofuzzer_random_number(iofuzzer_t *fuzzer)
 	}
 }
 
+/*
+ * Draws the next operation with the strategy of the fuzzer. The second
+ * half of a pair is replayed from the state of the first, by a generator
+ * of its own, so the generator of the fuzzer, which may be shared, only
+ * advances once per pair.
+ */
 static iofuzzer_t *
 _iofuzzer_randomize(iofuzzer_t *fuzzer)
 {
-	uintptr_t *variates;
-	unsigned long *ports;
+	random_t *random;
 
 	if (fuzzer == NULL) {
 		errno = EINVAL;
 		return NULL;
 	}
 
-	random_get_state(fuzzer->random, fuzzer->state, sizeof(fuzzer->state));
-	variates = &array_index(fuzzer->variates, uintptr_t, 0);
-	variates[0] = random_number_with_range(fuzzer->random, 0, NUM_FUNCS - 1);
-	variates[1] = _iofuzzer_random_number(fuzzer);
-	variates[2] = _iofuzzer_random_number(fuzzer);
-	variates[3] = random_number_with_range(fuzzer->random, 1, MAXSIZE / 4);
-	if (fuzzer->ports != NULL) {
-		ports = &array_index(fuzzer->ports, unsigned long, 0);
-		variates[4] = ports[random_number_with_range(fuzzer->random, 0, array_get_length(fuzzer->ports) - 1)];
-	} else
-		variates[4] = random_number_with_range(fuzzer->random, 0, MAXPORT);
+	fuzzer->delayed = 0;
+	if (fuzzer->strategy == IOFUZZER_STRATEGY_PAIRED && fuzzer->paired) {
+		random = fuzzer->random;
+		fuzzer->random = fuzzer->paired_random;
+		_iofuzzer_draw(fuzzer, _iofuzzer_tag(IOFUZZER_STRATEGY_PAIRED, 1), 1);
+		fuzzer->random = random;
+		fuzzer->paired = 0;
+		return fuzzer;
+	}
 
-	variates[5] = (uintptr_t)random_string(fuzzer->random, (char *)variates[5], MAXSIZE);
-	variates[6] = (uintptr_t)random_string(fuzzer->random, (char *)variates[6], MAXSIZE);
+	_iofuzzer_draw(fuzzer, _iofuzzer_tag(fuzzer->strategy, fuzzer->strategy == IOFUZZER_STRATEGY_SWEEP ? fuzzer->step % SWEEPSIZE : 0), 0);
+	if (fuzzer->strategy == IOFUZZER_STRATEGY_PAIRED) {
+		random_set_state(fuzzer->paired_random, fuzzer->state, sizeof(fuzzer->state));
+		fuzzer->paired = 1;
+	}
+
+	return fuzzer;
+}
+
+static iofuzzer_t *
+_iofuzzer_schedule(iofuzzer_t *fuzzer, uint64_t delay, const uintptr_t *variates)
+{
+	struct iofuzzer_op op;
+
+	if (fuzzer->wheel == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	memcpy(op.state, fuzzer->state, sizeof(op.state));
+	_iofuzzer_set_tag(op.state, DELAYED);
+	memcpy(op.variates, variates, sizeof(op.variates));
+	op.delay = 0;
+	if (wheel_add(fuzzer->wheel, delay, &op) == NULL)
+		return NULL;
 
 	return fuzzer;
 }
@@ -511,15 +2415,129 @@ _iofuzzer_randomize(iofuzzer_t *fuzzer)
 static iofuzzer_t *
 _iofuzzer_set_state(iofuzzer_t *fuzzer, const char *state, size_t size)
 {
+	unsigned int operand;
+	unsigned int tag;
+
 	if (fuzzer == NULL || state == NULL) {
 		errno = EINVAL;
 		return NULL;
 	}
 
+	/* Delayed operations are scheduled again by the operations that scheduled them */
+	tag = size >= sizeof(fuzzer->state) ? _iofuzzer_get_tag(state) : 0;
+	if (tag == DELAYED) {
+		errno = EINVAL;
+		return NULL;
+	}
+
 	if (random_set_state(fuzzer->random, state, size) == NULL)
 		return NULL;
 
-	_iofuzzer_randomize(fuzzer);
+	fuzzer->delayed = 0;
+
+	/* States without a tag are drawn with the strategy and the step of the fuzzer */
+	if (_iofuzzer_tag_strategy(tag) < 0 || _iofuzzer_tag_strategy(tag) >= IOFUZZER_NUM_STRATEGIES) {
+		operand = fuzzer->strategy == IOFUZZER_STRATEGY_SWEEP ? fuzzer->step % SWEEPSIZE : fuzzer->step % 2;
+		return _iofuzzer_draw(fuzzer, _iofuzzer_tag(fuzzer->strategy, operand), 0);
+	}
+
+	return _iofuzzer_draw(fuzzer, tag, 1);
+}
+
+static iofuzzer_t *
+_iofuzzer_set_traversal(iofuzzer_t *fuzzer)
+{
+	permutation_t *permutation;
+	uint64_t size;
+
+	permutation_unref(fuzzer->permutation);
+	fuzzer->permutation = NULL;
+	if (fuzzer->traversal_num_parts == 0)
+		return fuzzer;
+
+	/* Every part holds at least a tuple, so no tuple is walked by two parts */
+	size = fuzzer->ports != NULL ? array_get_length(fuzzer->ports) : MAXPORT + 1;
+	size *= NUM_DRAWN * NUM_VALUES;
+	if (fuzzer->traversal_num_parts > size) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	permutation = permutation_new(size, fuzzer->traversal_key);
+	if (permutation == NULL)
+		return NULL;
+
+	fuzzer->permutation = permutation;
+	fuzzer->begin = size * fuzzer->traversal_part / fuzzer->traversal_num_parts;
+	fuzzer->end = size * (fuzzer->traversal_part + 1) / fuzzer->traversal_num_parts;
+	fuzzer->position = fuzzer->begin;
+
+	return fuzzer;
+}
+
+/*
+ * Performs the operation on the model, as the device would: string and
+ * burst inputs fill the input buffer, and string and burst outputs drain
+ * the output buffer, an element at a time.
+ */
+static iofuzzer_t *
+_iofuzzer_simulate(iofuzzer_t *fuzzer)
+{
+	uintptr_t *variates;
+	unsigned long func;
+	unsigned long count;
+	unsigned long width;
+	unsigned long value;
+	unsigned long mask;
+	unsigned long i;
+	int multiple;
+
+	if (fuzzer->model == NULL)
+		return fuzzer;
+
+	variates = &array_index(fuzzer->variates, uintptr_t, 0);
+	func = variates[0];
+	width = _iofuzzer_func_width(func);
+	multiple = _iofuzzer_func_is_string(func) || _iofuzzer_func_is_burst(func);
+	count = multiple ? variates[3] : 1;
+	for (i = 0; i < count && (i + 1) * width <= MAXSIZE; i++) {
+		if (_iofuzzer_func_is_input(func)) {
+			value = model_in(fuzzer->model, variates[4], width, &mask);
+			if (multiple)
+				memcpy((char *)variates[6] + i * width, &value, width);
+			else
+				fuzzer->value = value;
+		} else {
+			value = variates[1];
+			if (multiple) {
+				value = 0;
+				memcpy(&value, (char *)variates[5] + i * width, width);
+			}
+
+			model_out(fuzzer->model, variates[4], width, value);
+		}
+	}
+
+	return fuzzer;
+}
+
+static iofuzzer_t *
+_iofuzzer_traverse(iofuzzer_t *fuzzer)
+{
+	uintptr_t *variates;
+	uint64_t index;
+
+	/* Mixed-radix index: operation, then value, then port */
+	index = permutation_map(fuzzer->permutation, fuzzer->position);
+	variates = &array_index(fuzzer->variates, uintptr_t, 0);
+	variates[0] = index % NUM_DRAWN;
+	index /= NUM_DRAWN;
+	variates[1] = dictionary[index % NUM_VALUES];
+	index /= NUM_VALUES;
+	if (fuzzer->ports != NULL)
+		variates[4] = array_index(fuzzer->ports, unsigned long, index);
+	else
+		variates[4] = index;
 
 	return fuzzer;
 }
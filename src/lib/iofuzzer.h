@@ -4,30 +4,149 @@
 #define IOFUZZER_H
 
 #include "array.h"
+#include "bloom.h"
+#include "feedback.h"
+#include "model.h"
+#include "profile.h"
 #include "random.h"
+#include "trace.h"
+#include "wheel.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 
 typedef struct iofuzzer iofuzzer_t; /**< I/O address space fuzzer. */
 
+/**
+ * Hook of the fuzzer. Hooks are called with the mutex of the fuzzer held,
+ * so they must not call the functions of the fuzzer, but iofuzzer_schedule.
+ *
+ * @param [in] fuzzer The fuzzer.
+ * @param [in,out] variates The variates of the operation.
+ * @param [in] value The value returned by the operation, for
+ *   IOFUZZER_HOOK_COMPLETE hooks, or zero.
+ * @param [in] data The data the hook was added with.
+ * @return IOFUZZER_HOOK_CONTINUE or IOFUZZER_HOOK_SKIP.
+ */
+typedef int (*iofuzzer_hook_t)(iofuzzer_t *fuzzer, uintptr_t *variates, unsigned long value, void *data);
+
+enum {
+	IOFUZZER_BACKEND_NATIVE, /**< Operations are performed on the I/O address space. */
+	IOFUZZER_BACKEND_NONE,   /**< Operations are generated but not performed. */
+	IOFUZZER_BACKEND_MODEL,  /**< Operations are performed on the model of the device. */
+};
+
+enum {
+	IOFUZZER_HOOK_GENERATE, /**< Called before an operation is drawn. */
+	IOFUZZER_HOOK_EXECUTE,  /**< Called before an operation is performed. */
+	IOFUZZER_HOOK_COMPLETE, /**< Called after an operation is performed. */
+	IOFUZZER_NUM_HOOKS
+};
+
+enum {
+	IOFUZZER_HOOK_CONTINUE, /**< Continue with the operation. */
+	IOFUZZER_HOOK_SKIP,     /**< Skip drawing, or performing, the operation. */
+};
+
+enum {
+	IOFUZZER_STRATEGY_UNIFORM,    /**< Operations are drawn uniformly. */
+	IOFUZZER_STRATEGY_DICTIONARY, /**< The data is drawn from a dictionary of values. */
+	IOFUZZER_STRATEGY_PAIRED,     /**< Index writes alternate with operations on the next port. */
+	IOFUZZER_STRATEGY_SWEEP,      /**< The data sweeps the values below 8192 in order. */
+	IOFUZZER_STRATEGY_BURST,      /**< Operations are repeated on the same port with correlated data. */
+	IOFUZZER_NUM_STRATEGIES
+};
+
+/**
+ * Divergence between the value returned by the native backend and the
+ * value returned by the reference model.
+ */
+struct iofuzzer_divergence {
+	char state[8];          /**< The state of the fuzzer. */
+	unsigned long func;     /**< The I/O instruction/operation. */
+	unsigned long port;     /**< The I/O port address. */
+	unsigned long index;    /**< The index of the element for string operations. */
+	unsigned long expected; /**< The value returned by the reference model. */
+	unsigned long actual;   /**< The value returned by the native backend. */
+	unsigned long mask;     /**< The bits defined by the reference model. */
+};
+
+/**
+ * Value learned on a port, such as a value the port returned, drawn by the
+ * dictionary strategy along with the built-in values.
+ */
+struct iofuzzer_token {
+	uint32_t port;  /**< The I/O port address. */
+	uint32_t value; /**< The value. */
+};
+
+/**
+ * Operation of the fuzzer outside of its draws, such as the delayed
+ * operations of the timing wheel of the fuzzer and the operations of its
+ * normalization sequence.
+ */
+struct iofuzzer_op {
+	char state[8];         /**< The state of the fuzzer the operation was scheduled from. */
+	uintptr_t variates[5]; /**< The variates of the operation, but the strings. */
+	uint32_t delay;        /**< The delay in nanoseconds of an operation of a sequence. */
+};
+
+iofuzzer_t *iofuzzer_add_hook(iofuzzer_t *fuzzer, int type, iofuzzer_hook_t hook, void *data);
+iofuzzer_t *iofuzzer_flush(iofuzzer_t *fuzzer);
 iofuzzer_t *iofuzzer_free(iofuzzer_t *fuzzer);
+struct feedback_accumulator *iofuzzer_get_accumulator(iofuzzer_t *fuzzer);
+int iofuzzer_get_backend(iofuzzer_t *fuzzer);
+array_t *iofuzzer_get_dictionary(iofuzzer_t *fuzzer);
+array_t *iofuzzer_get_divergences(iofuzzer_t *fuzzer);
+feedback_t *iofuzzer_get_feedback(iofuzzer_t *fuzzer);
+bloom_t *iofuzzer_get_filter(iofuzzer_t *fuzzer);
+int iofuzzer_get_func_by_name(const char *name, size_t length);
+const char *iofuzzer_get_func_name(unsigned long func);
+model_t *iofuzzer_get_model(iofuzzer_t *fuzzer);
+size_t iofuzzer_get_num_funcs(void);
 array_t *iofuzzer_get_ports(iofuzzer_t *fuzzer);
+profile_t *iofuzzer_get_profile(iofuzzer_t *fuzzer);
 random_t *iofuzzer_get_random(iofuzzer_t *fuzzer);
+array_t *iofuzzer_get_sequence(iofuzzer_t *fuzzer);
 iofuzzer_t *iofuzzer_get_state(iofuzzer_t *fuzzer, char *state, size_t size);
+int iofuzzer_get_strategy(iofuzzer_t *fuzzer);
+int iofuzzer_get_strategy_by_name(const char *name);
+const char *iofuzzer_get_strategy_name(int strategy);
+trace_t *iofuzzer_get_trace(iofuzzer_t *fuzzer);
+unsigned long iofuzzer_get_value(iofuzzer_t *fuzzer);
 array_t *iofuzzer_get_variates(iofuzzer_t *fuzzer);
+wheel_t *iofuzzer_get_wheel(iofuzzer_t *fuzzer);
+int iofuzzer_is_delayed(const char *state, size_t size);
 iofuzzer_t *iofuzzer_iterate(iofuzzer_t *fuzzer);
 iofuzzer_t *iofuzzer_iterate_with_state(iofuzzer_t *fuzzer, const char *state, size_t size);
 iofuzzer_t *iofuzzer_new(void);
 iofuzzer_t *iofuzzer_new_with_state(const char *state, size_t size);
+iofuzzer_t *iofuzzer_normalize(iofuzzer_t *fuzzer);
+array_t *iofuzzer_parse_ports(const char *string);
+array_t *iofuzzer_parse_sequence(const char *string);
+array_t *iofuzzer_read_dictionary(const char *path);
 iofuzzer_t *iofuzzer_ref(iofuzzer_t *fuzzer);
+iofuzzer_t *iofuzzer_remove_hook(iofuzzer_t *fuzzer, int type, iofuzzer_hook_t hook, void *data);
+iofuzzer_t *iofuzzer_schedule(iofuzzer_t *fuzzer, uint64_t delay, const uintptr_t *variates);
+iofuzzer_t *iofuzzer_set_backend(iofuzzer_t *fuzzer, int backend);
+iofuzzer_t *iofuzzer_set_dictionary(iofuzzer_t *fuzzer, array_t *dictionary);
+iofuzzer_t *iofuzzer_set_feedback(iofuzzer_t *fuzzer, feedback_t *feedback);
+iofuzzer_t *iofuzzer_set_filter(iofuzzer_t *fuzzer, bloom_t *filter);
+iofuzzer_t *iofuzzer_set_model(iofuzzer_t *fuzzer, model_t *model);
 iofuzzer_t *iofuzzer_set_ports(iofuzzer_t *fuzzer, array_t *ports);
+iofuzzer_t *iofuzzer_set_profile(iofuzzer_t *fuzzer, profile_t *profile);
 iofuzzer_t *iofuzzer_set_random(iofuzzer_t *fuzzer, random_t *random);
+iofuzzer_t *iofuzzer_set_sequence(iofuzzer_t *fuzzer, array_t *sequence);
 iofuzzer_t *iofuzzer_set_state(iofuzzer_t *fuzzer, const char *state, size_t size);
+iofuzzer_t *iofuzzer_set_strategy(iofuzzer_t *fuzzer, int strategy);
+iofuzzer_t *iofuzzer_set_trace(iofuzzer_t *fuzzer, trace_t *trace, unsigned long thread);
+iofuzzer_t *iofuzzer_set_traversal(iofuzzer_t *fuzzer, unsigned long key, size_t part, size_t num_parts);
 iofuzzer_t *iofuzzer_set_variates(iofuzzer_t *fuzzer, array_t *variates);
+iofuzzer_t *iofuzzer_set_wheel(iofuzzer_t *fuzzer, wheel_t *wheel);
 void iofuzzer_unref(iofuzzer_t *fuzzer);
 
 #ifdef __cplusplus
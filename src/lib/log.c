@@ -0,0 +1,994 @@
+/** @file */
+
+#include "array.h"
+#include "iofuzzer.h"
+#include "lockstat.h"
+#include "log.h"
+#include "segment.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHECKPOINT 4096 /* Number of records between the counters kept for logs without iterations */
+#define MAXTHREADS 4096 /* Number of threads whose iterations are counted in logs without iterations */
+#define NUM_FIELDS 12
+#define NUM_LEGACY_FIELDS 10 /* Number of fields of logs without iterations and values */
+
+struct log {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	char *data;
+	int format;
+	size_t size;
+	size_t start;
+	array_t *segments;
+	size_t num_records;
+	unsigned long serial;
+	int legacy;
+	array_t *checkpoints;
+	array_t *counts;
+};
+
+/* Segment of a segmented log */
+struct log_segment {
+	size_t position; /* The offset of the segment in the file */
+	size_t first;    /* The number of the first record of the segment */
+};
+
+/* Counters of the iterations of the threads at a record of a log without iterations */
+struct log_checkpoint {
+	size_t offset;      /* The offset of the record */
+	size_t index;       /* The index of the first counter */
+	size_t num_threads; /* The number of counters */
+};
+
+/*
+ * Decoded segment of a log, or counters of the iterations of the threads
+ * of a log without iterations, one per log and thread
+ */
+struct log_cursor {
+	struct log_cursor *next;
+	unsigned long serial;
+	array_t *records;
+	size_t first;
+	size_t end;
+	size_t num_records;
+	uint64_t *counts;
+	size_t offset;
+};
+
+static pthread_key_t cursors;
+static int cursors_error = 0;
+static pthread_once_t cursors_once = PTHREAD_ONCE_INIT;
+static unsigned long num_logs = 0;
+
+static size_t _log_find_segment(log_t *log, size_t offset);
+static void _log_free_cursor(struct log_cursor *cursor);
+static void _log_free_cursors(void *arg);
+static struct log_cursor *_log_get_cursor(log_t *log);
+static int _log_index_csv(log_t *log);
+static int _log_index_legacy(log_t *log);
+static int _log_index_segments(log_t *log);
+static void _log_init_cursors(void);
+static void _log_load_segment(log_t *log, struct log_cursor *cursor, size_t offset);
+static const char *_log_next_line(log_t *log, size_t *offset, const char **end);
+static const char *_log_parse_number(const char *ptr, const char *end, uint64_t *number);
+static int _log_parse_line(const char *ptr, const char *end, struct log_record *record, int legacy);
+static log_t *_log_read_legacy(log_t *log, size_t *offset, struct log_record *record);
+static int _log_set_serial(log_t *log);
+static void _log_sync_legacy(log_t *log, struct log_cursor *cursor, size_t offset);
+
+/**
+ * Returns the offset of the first record boundary at or after a given
+ * offset. Used to split the log into chunks that can be read
+ * independently.
+ *
+ * @param [in] log The log.
+ * @param [in] offset The offset.
+ * @return The offset of the first record boundary at or after the offset.
+ */
+size_t
+log_align(log_t *log, size_t offset)
+{
+	const char *ptr;
+
+	if (log == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (offset <= log->start)
+		return log->start;
+
+	if (log->format == LOG_FORMAT_SEGMENT)
+		return offset < log->num_records ? offset : log->num_records;
+
+	if (offset >= log->size)
+		return log->size;
+
+	if (log->format == LOG_FORMAT_BINARY) {
+		offset = log->start + (((offset - log->start) + sizeof(struct log_record) - 1) / sizeof(struct log_record)) * sizeof(struct log_record);
+		return offset < log->size ? offset : log->size;
+	}
+
+	if (log->data[offset - 1] == '\n')
+		return offset;
+
+	ptr = memchr(&log->data[offset], '\n', log->size - offset);
+	if (ptr == NULL)
+		return log->size;
+
+	return (ptr - log->data) + 1;
+}
+
+/**
+ * Frees the memory allocated for the log.
+ *
+ * @param [in] log The log.
+ * @return The log.
+ */
+log_t *
+log_free(log_t *log)
+{
+	struct log_cursor **link;
+	struct log_cursor *cursor;
+	struct log_cursor *head;
+
+	if (log == NULL)
+		return NULL;
+
+	/* The cursors of the log in other threads are freed when they exit */
+	if (log->serial != 0) {
+		head = pthread_getspecific(cursors);
+		for (link = &head; *link != NULL; link = &(*link)->next) {
+			if ((*link)->serial == log->serial) {
+				cursor = *link;
+				*link = cursor->next;
+				_log_free_cursor(cursor);
+				pthread_setspecific(cursors, head);
+				break;
+			}
+		}
+	}
+
+	array_unref(log->segments);
+	array_unref(log->checkpoints);
+	array_unref(log->counts);
+	if (log->data != NULL && log->data != MAP_FAILED)
+		munmap(log->data, log->size);
+
+	pthread_mutex_destroy(&log->mutex);
+	free(log);
+
+	return NULL;
+}
+
+/**
+ * Returns the contents of the log.
+ *
+ * @param [in] log The log.
+ * @return The contents of the log.
+ */
+const char *
+log_get_data(log_t *log)
+{
+	if (log == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return log->data;
+}
+
+/**
+ * Returns the format of the log.
+ *
+ * @param [in] log The log.
+ * @return The format of the log.
+ */
+int
+log_get_format(log_t *log)
+{
+	if (log == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return log->format;
+}
+
+/**
+ * Returns the offset of the record at a given offset of the log in the
+ * file, which is the offset itself unless the log is segmented, and that
+ * of the segment of the record if it is.
+ *
+ * @param [in] log The log.
+ * @param [in] offset The offset.
+ * @return The offset of the record, or of its segment, in the file.
+ * @see log_seek
+ */
+size_t
+log_get_position(log_t *log, size_t offset)
+{
+	if (log == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (log->format != LOG_FORMAT_SEGMENT)
+		return offset;
+
+	if (offset >= log->num_records)
+		return log->size;
+
+	return array_index(log->segments, struct log_segment, _log_find_segment(log, offset)).position;
+}
+
+/**
+ * Returns the size of the log. The size of a segmented log is its number
+ * of records, as its offsets are record numbers.
+ *
+ * @param [in] log The log.
+ * @return The size of the log.
+ */
+size_t
+log_get_size(log_t *log)
+{
+	if (log == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (log->format == LOG_FORMAT_SEGMENT)
+		return log->num_records;
+
+	return log->size;
+}
+
+/**
+ * Returns the offset of the first record of the log.
+ *
+ * @param [in] log The log.
+ * @return The offset of the first record of the log.
+ */
+size_t
+log_get_start(log_t *log)
+{
+	if (log == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return log->start;
+}
+
+/**
+ * Creates a log from a given file. The file is mapped read-only into
+ * memory and its format is detected from its contents. The offsets of a
+ * segmented log are record numbers, and the segments are decoded one at a
+ * time as they are read; a truncated last segment, as left by a crash, is
+ * ignored. CSV logs written before records had iterations and values are
+ * read too: the iteration of a record is counted by thread, and its value
+ * is zero. A CSV log none of whose lines are records is invalid.
+ *
+ * @param [in] path The path of the file.
+ * @return A log.
+ */
+log_t *
+log_new(const char *path)
+{
+	log_t *log;
+	struct stat st;
+	int fd;
+
+	if (path == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	log = calloc(1, sizeof(*log));
+	if (log == NULL)
+		return NULL;
+
+	errno = pthread_mutex_init(&log->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		goto err;
+
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		goto err;
+	}
+
+	log->size = st.st_size;
+	if (log->size > 0) {
+		log->data = mmap(NULL, log->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (log->data == MAP_FAILED) {
+			close(fd);
+			goto err;
+		}
+
+		madvise(log->data, log->size, MADV_SEQUENTIAL);
+	}
+
+	close(fd);
+	log->format = LOG_FORMAT_CSV;
+	if (log->size >= sizeof(LOG_MAGIC) - 1 && memcmp(log->data, LOG_MAGIC, sizeof(LOG_MAGIC) - 1) == 0) {
+		log->format = LOG_FORMAT_BINARY;
+		log->start = sizeof(LOG_MAGIC) - 1;
+	} else if (log->size >= sizeof(SEGMENT_MAGIC) - 1 && memcmp(log->data, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC) - 1) == 0) {
+		log->format = LOG_FORMAT_SEGMENT;
+		if (_log_index_segments(log) == -1)
+			goto err;
+	} else if (_log_index_csv(log) == -1)
+		goto err;
+
+	log_ref(log);
+
+	return log;
+
+err:
+	log_free(log);
+
+	return NULL;
+}
+
+/**
+ * Returns the offset of the record before a given offset of the log.
+ *
+ * @param [in] log The log.
+ * @param [in] offset The offset.
+ * @return The offset of the previous record, or that of the first record
+ *   if there is none.
+ */
+size_t
+log_previous(log_t *log, size_t offset)
+{
+	if (log == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (offset <= log->start)
+		return log->start;
+
+	if (log->format == LOG_FORMAT_SEGMENT)
+		return offset - 1;
+
+	if (log->format == LOG_FORMAT_BINARY)
+		return offset - sizeof(struct log_record);
+
+	for (offset--; offset > log->start && log->data[offset - 1] != '\n'; offset--)
+		;
+
+	return offset;
+}
+
+/**
+ * Prints a record in a compact, human-readable format. The fields are
+ * printed in the order of the CSV log format, without the pointers.
+ *
+ * @param [in] stream The stream.
+ * @param [in] record The record.
+ * @return The number of characters printed, or a negative value on error.
+ */
+int
+log_print_record(FILE *stream, const struct log_record *record)
+{
+	if (stream == NULL || record == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return fprintf(stream, "%u,%u,%llu,%#llx,%s,%#x,%#x,%#x,%#x,%#x\n",
+	    record->time, record->thread, (unsigned long long)record->iteration,
+	    (unsigned long long)record->state, iofuzzer_get_func_name(record->func),
+	    record->data, record->extra, record->count, record->port, record->value);
+}
+
+/**
+ * Reads the record at a given offset of the log and advances the offset
+ * to the next record. Malformed records, and segments that fail to
+ * decode, are skipped. The value of a record whose operation did not
+ * complete is zero, as is that of a record of a CSV log without values.
+ *
+ * @param [in] log The log.
+ * @param [in,out] offset The offset.
+ * @param [out] record The record.
+ * @return The log, or NULL if there are no more records.
+ */
+log_t *
+log_read(log_t *log, size_t *offset, struct log_record *record)
+{
+	struct log_cursor *cursor;
+	const char *ptr;
+	const char *end;
+
+	if (log == NULL || offset == NULL || record == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (log->format == LOG_FORMAT_SEGMENT) {
+		cursor = _log_get_cursor(log);
+		if (cursor == NULL)
+			return NULL;
+
+		while (*offset < log->num_records) {
+			if (*offset - cursor->first >= cursor->num_records)
+				_log_load_segment(log, cursor, *offset);
+
+			if (*offset - cursor->first >= cursor->num_records) {
+				*offset = cursor->end;
+				continue;
+			}
+
+			*record = array_index(cursor->records, struct log_record, *offset - cursor->first);
+			(*offset)++;
+			return log;
+		}
+
+		return NULL;
+	}
+
+	if (log->format == LOG_FORMAT_BINARY) {
+		if (*offset + LOG_RECORD_HEAD_SIZE > log->size)
+			return NULL;
+
+		if (*offset + sizeof(*record) > log->size) {
+			memset(record, 0, sizeof(*record));
+			memcpy(record, &log->data[*offset], LOG_RECORD_HEAD_SIZE);
+			*offset = log->size;
+			return log;
+		}
+
+		memcpy(record, &log->data[*offset], sizeof(*record));
+		*offset += sizeof(*record);
+		return log;
+	}
+
+	if (log->legacy)
+		return _log_read_legacy(log, offset, record);
+
+	while ((ptr = _log_next_line(log, offset, &end)) != NULL) {
+		if (_log_parse_line(ptr, end, record, 0) == 0)
+			return log;
+	}
+
+	return NULL;
+}
+
+/**
+ * Increments the reference count of the log.
+ *
+ * @param [in] log The log.
+ * @return The log.
+ */
+log_t *
+log_ref(log_t *log)
+{
+	if (log == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&log->mutex);
+	log->refcount++;
+	pthread_mutex_unlock(&log->mutex);
+
+	return log;
+}
+
+/**
+ * Returns the offset of the first record at or after a given offset in
+ * the file, such as an offset found in the index of the log.
+ *
+ * @param [in] log The log.
+ * @param [in] position The offset in the file.
+ * @return The offset of the first record at or after the offset in the
+ *   file.
+ * @see log_get_position
+ */
+size_t
+log_seek(log_t *log, size_t position)
+{
+	size_t begin;
+	size_t end;
+	size_t mid;
+
+	if (log == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (log->format != LOG_FORMAT_SEGMENT)
+		return log_align(log, position);
+
+	begin = 0;
+	end = array_get_length(log->segments);
+	while (begin < end) {
+		mid = begin + (end - begin) / 2;
+		if (array_index(log->segments, struct log_segment, mid).position < position)
+			begin = mid + 1;
+		else
+			end = mid;
+	}
+
+	if (begin == array_get_length(log->segments))
+		return log->num_records;
+
+	return array_index(log->segments, struct log_segment, begin).first;
+}
+
+/**
+ * Decrements the reference count of the log.
+ *
+ * @param [in] log The log.
+ */
+void
+log_unref(log_t *log)
+{
+	if (log == NULL)
+		return;
+
+	pthread_mutex_lock(&log->mutex);
+	log->refcount--;
+	if (log->refcount > 0) {
+		pthread_mutex_unlock(&log->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&log->mutex);
+	log_free(log);
+}
+
+/* Returns the index of the segment of the record at a given offset */
+static size_t
+_log_find_segment(log_t *log, size_t offset)
+{
+	size_t begin;
+	size_t end;
+	size_t mid;
+
+	begin = 0;
+	end = array_get_length(log->segments);
+	while (end - begin > 1) {
+		mid = begin + (end - begin) / 2;
+		if (array_index(log->segments, struct log_segment, mid).first <= offset)
+			begin = mid;
+		else
+			end = mid;
+	}
+
+	return begin;
+}
+
+static void
+_log_free_cursor(struct log_cursor *cursor)
+{
+	array_unref(cursor->records);
+	free(cursor->counts);
+	free(cursor);
+}
+
+static void
+_log_free_cursors(void *arg)
+{
+	struct log_cursor *cursor;
+	struct log_cursor *next;
+
+	for (cursor = arg; cursor != NULL; cursor = next) {
+		next = cursor->next;
+		_log_free_cursor(cursor);
+	}
+}
+
+static struct log_cursor *
+_log_get_cursor(log_t *log)
+{
+	struct log_cursor *cursor;
+	struct log_cursor *head;
+
+	head = pthread_getspecific(cursors);
+	for (cursor = head; cursor != NULL; cursor = cursor->next) {
+		if (cursor->serial == log->serial)
+			return cursor;
+	}
+
+	cursor = calloc(1, sizeof(*cursor));
+	if (cursor == NULL)
+		return NULL;
+
+	if (log->legacy)
+		cursor->counts = calloc(MAXTHREADS, sizeof(*cursor->counts));
+	else
+		cursor->records = array_new(sizeof(struct log_record));
+
+	if (cursor->records == NULL && cursor->counts == NULL) {
+		free(cursor);
+		return NULL;
+	}
+
+	/* The counters are set from a checkpoint by the first read */
+	cursor->serial = log->serial;
+	cursor->offset = SIZE_MAX;
+	cursor->next = head;
+	errno = pthread_setspecific(cursors, cursor);
+	if (errno != 0) {
+		_log_free_cursor(cursor);
+		return NULL;
+	}
+
+	return cursor;
+}
+
+/*
+ * A CSV log is in the layout of logs without iterations if its first
+ * record only parses in it.
+ */
+static int
+_log_index_csv(log_t *log)
+{
+	struct log_record record;
+	const char *ptr;
+	const char *end;
+	size_t offset;
+
+	offset = log->start;
+	while ((ptr = _log_next_line(log, &offset, &end)) != NULL) {
+		if (_log_parse_line(ptr, end, &record, 0) == 0)
+			return 0;
+
+		if (_log_parse_line(ptr, end, &record, 1) == 0) {
+			log->legacy = 1;
+			return _log_index_legacy(log);
+		}
+	}
+
+	if (log->size != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * The counters of the iterations of the threads are kept every
+ * CHECKPOINT records, so a record read at any offset only needs the
+ * records since the last checkpoint counted.
+ */
+static int
+_log_index_legacy(log_t *log)
+{
+	struct log_checkpoint checkpoint;
+	struct log_record record;
+	uint64_t *counts;
+	const char *ptr;
+	const char *end;
+	size_t num_records;
+	size_t num_threads;
+	size_t offset;
+
+	if (_log_set_serial(log) == -1)
+		return -1;
+
+	log->checkpoints = array_new(sizeof(struct log_checkpoint));
+	log->counts = array_new(sizeof(uint64_t));
+	counts = calloc(MAXTHREADS, sizeof(*counts));
+	if (log->checkpoints == NULL || log->counts == NULL || counts == NULL) {
+		free(counts);
+		return -1;
+	}
+
+	num_records = 0;
+	num_threads = 0;
+	offset = log->start;
+	for (;;) {
+		if (num_records % CHECKPOINT == 0) {
+			checkpoint.offset = offset;
+			checkpoint.index = array_get_length(log->counts);
+			checkpoint.num_threads = num_threads;
+			if (array_append_val(log->checkpoints, &checkpoint) == NULL ||
+			    (num_threads != 0 && array_append_vals(log->counts, counts, num_threads) == NULL)) {
+				free(counts);
+				return -1;
+			}
+		}
+
+		do
+			ptr = _log_next_line(log, &offset, &end);
+		while (ptr != NULL && _log_parse_line(ptr, end, &record, 1) == -1);
+
+		if (ptr == NULL)
+			break;
+
+		num_records++;
+		if (record.thread < MAXTHREADS) {
+			counts[record.thread]++;
+			if (record.thread >= num_threads)
+				num_threads = record.thread + 1;
+		}
+	}
+
+	free(counts);
+
+	return 0;
+}
+
+/*
+ * Only the headers of the segments are read, to locate them; the records
+ * of a segment are decoded when they are first read.
+ */
+static int
+_log_index_segments(log_t *log)
+{
+	struct segment_header header;
+	struct log_segment segment;
+	size_t position;
+
+	if (_log_set_serial(log) == -1)
+		return -1;
+
+	log->segments = array_new(sizeof(struct log_segment));
+	if (log->segments == NULL)
+		return -1;
+
+	log->start = 0;
+	for (position = sizeof(SEGMENT_MAGIC) - 1; log->size - position >= sizeof(header); position += sizeof(header) + header.size) {
+		memcpy(&header, &log->data[position], sizeof(header));
+		if (log->size - position - sizeof(header) < header.size)
+			break;
+
+		if (header.num_records == 0)
+			continue;
+
+		segment.position = position;
+		segment.first = log->num_records;
+		if (array_append_val(log->segments, &segment) == NULL)
+			return -1;
+
+		log->num_records += header.num_records;
+	}
+
+	return 0;
+}
+
+static void
+_log_init_cursors(void)
+{
+	cursors_error = pthread_key_create(&cursors, _log_free_cursors);
+}
+
+static void
+_log_load_segment(log_t *log, struct log_cursor *cursor, size_t offset)
+{
+	struct log_segment *segment;
+	size_t i;
+
+	i = _log_find_segment(log, offset);
+	segment = &array_index(log->segments, struct log_segment, i);
+	cursor->first = segment->first;
+	cursor->end = i + 1 < array_get_length(log->segments) ?
+	    array_index(log->segments, struct log_segment, i + 1).first : log->num_records;
+	array_set_length(cursor->records, 0);
+	cursor->num_records = 0;
+	if (segment_decode(&log->data[segment->position], log->size - segment->position, cursor->records) != 0)
+		cursor->num_records = cursor->end - cursor->first;
+}
+
+/* Returns the line at a given offset, and advances the offset past it */
+static const char *
+_log_next_line(log_t *log, size_t *offset, const char **end)
+{
+	const char *ptr;
+
+	if (*offset >= log->size)
+		return NULL;
+
+	ptr = &log->data[*offset];
+	*end = memchr(ptr, '\n', log->size - *offset);
+	if (*end == NULL)
+		*end = &log->data[log->size];
+
+	*offset = (*end - log->data) + (*end < &log->data[log->size]);
+
+	return ptr;
+}
+
+static const char *
+_log_parse_number(const char *ptr, const char *end, uint64_t *number)
+{
+	const char *begin;
+	int base;
+	int digit;
+
+	base = 10;
+	if (end - ptr > 2 && ptr[0] == '0' && (ptr[1] == 'x' || ptr[1] == 'X')) {
+		base = 16;
+		ptr += 2;
+	}
+
+	*number = 0;
+	for (begin = ptr; ptr < end; ptr++) {
+		if (*ptr >= '0' && *ptr <= '9')
+			digit = *ptr - '0';
+		else if (base == 16 && *ptr >= 'a' && *ptr <= 'f')
+			digit = *ptr - 'a' + 10;
+		else if (base == 16 && *ptr >= 'A' && *ptr <= 'F')
+			digit = *ptr - 'A' + 10;
+		else
+			break;
+
+		*number = *number * base + digit;
+	}
+
+	return ptr == begin ? NULL : ptr;
+}
+
+/*
+ * Records of logs without iterations have neither the iteration, before
+ * the state, nor the value.
+ */
+static int
+_log_parse_line(const char *ptr, const char *end, struct log_record *record, int legacy)
+{
+	uint64_t fields[NUM_FIELDS];
+	const char *next;
+	int func;
+	int i;
+	int n;
+
+	/*
+	 * Values are padded to the room reserved for them, which is blank
+	 * until the operation completes, and a record whose room was reserved
+	 * but never written leaves zeros before the next.
+	 */
+	while (ptr < end && *ptr == '\0')
+		ptr++;
+
+	while (end > ptr && end[-1] == ' ')
+		end--;
+
+	memset(fields, 0, sizeof(fields));
+	n = legacy ? NUM_LEGACY_FIELDS : NUM_FIELDS;
+	for (i = 0; i < n && ptr < end; i++) {
+		if (i == 4 - legacy) {
+			next = memchr(ptr, ',', end - ptr);
+			if (next == NULL)
+				return -1;
+
+			func = iofuzzer_get_func_by_name(ptr, next - ptr);
+			if (func == -1)
+				return -1;
+
+			fields[i] = func;
+		} else {
+			next = _log_parse_number(ptr, end, &fields[i]);
+			if (next == NULL)
+				return -1;
+		}
+
+		if (next < end && *next != ',')
+			return -1;
+
+		ptr = next + 1;
+	}
+
+	/* The value is missing if the operation did not complete */
+	if (i < n - !legacy)
+		return -1;
+
+	if (legacy) {
+		memmove(&fields[3], &fields[2], (NUM_LEGACY_FIELDS - 2) * sizeof(fields[0]));
+		fields[2] = 0;
+	}
+
+	record->time = fields[0];
+	record->thread = fields[1];
+	record->iteration = fields[2];
+	record->state = fields[3];
+	record->func = fields[4];
+	record->data = fields[5];
+	record->extra = fields[6];
+	record->count = fields[7];
+	record->port = fields[8];
+	record->value = fields[11];
+
+	return 0;
+}
+
+static log_t *
+_log_read_legacy(log_t *log, size_t *offset, struct log_record *record)
+{
+	struct log_cursor *cursor;
+	const char *ptr;
+	const char *end;
+
+	cursor = _log_get_cursor(log);
+	if (cursor == NULL)
+		return NULL;
+
+	if (cursor->offset != *offset)
+		_log_sync_legacy(log, cursor, *offset);
+
+	while ((ptr = _log_next_line(log, offset, &end)) != NULL) {
+		if (_log_parse_line(ptr, end, record, 1) == -1)
+			continue;
+
+		if (record->thread < MAXTHREADS)
+			record->iteration = cursor->counts[record->thread]++;
+
+		cursor->offset = *offset;
+		return log;
+	}
+
+	cursor->offset = *offset;
+
+	return NULL;
+}
+
+/* Cursors are told apart from those of logs freed before by the serial */
+static int
+_log_set_serial(log_t *log)
+{
+	pthread_once(&cursors_once, _log_init_cursors);
+	if (cursors_error != 0) {
+		errno = cursors_error;
+		return -1;
+	}
+
+	log->serial = __sync_add_and_fetch(&num_logs, 1);
+
+	return 0;
+}
+
+/*
+ * Sets the counters of a cursor to those at a given offset, from the
+ * last checkpoint before it.
+ */
+static void
+_log_sync_legacy(log_t *log, struct log_cursor *cursor, size_t offset)
+{
+	struct log_checkpoint *checkpoint;
+	struct log_record record;
+	const char *ptr;
+	const char *end;
+	size_t begin;
+	size_t middle;
+	size_t end_index;
+	size_t position;
+
+	begin = 0;
+	end_index = array_get_length(log->checkpoints);
+	while (end_index - begin > 1) {
+		middle = begin + (end_index - begin) / 2;
+		if (array_index(log->checkpoints, struct log_checkpoint, middle).offset <= offset)
+			begin = middle;
+		else
+			end_index = middle;
+	}
+
+	checkpoint = &array_index(log->checkpoints, struct log_checkpoint, begin);
+	memset(cursor->counts, 0, MAXTHREADS * sizeof(*cursor->counts));
+	if (checkpoint->num_threads != 0)
+		memcpy(cursor->counts, &array_index(log->counts, uint64_t, checkpoint->index), checkpoint->num_threads * sizeof(*cursor->counts));
+
+	position = checkpoint->offset;
+	while (position < offset && (ptr = _log_next_line(log, &position, &end)) != NULL) {
+		if (_log_parse_line(ptr, end, &record, 1) == 0 && record.thread < MAXTHREADS)
+			cursor->counts[record.thread]++;
+	}
+
+	cursor->offset = offset;
+}
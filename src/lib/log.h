@@ -0,0 +1,66 @@
+/** @file */
+
+#ifndef LOG_H
+#define LOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LOG_MAGIC "IOFZLOG1" /**< Magic number of binary logs. */
+
+/**
+ * Size of the part of a binary record written before the operation is
+ * performed. The value is written after the operation is performed.
+ */
+#define LOG_RECORD_HEAD_SIZE (offsetof(struct log_record, value))
+
+enum {
+	LOG_FORMAT_CSV,     /**< Comma-separated values, one record per line. */
+	LOG_FORMAT_BINARY,  /**< LOG_MAGIC followed by struct log_record records. */
+	LOG_FORMAT_SEGMENT, /**< SEGMENT_MAGIC followed by compressed segments of records. */
+};
+
+/**
+ * Log record. The binary log format is a sequence of log records in host
+ * byte order.
+ */
+struct log_record {
+	uint64_t state;     /**< The state of the fuzzer. */
+	uint64_t iteration; /**< The iteration of the thread. */
+	uint32_t time;      /**< The time in seconds since the Epoch. */
+	uint32_t thread;    /**< The thread number. */
+	uint32_t data;      /**< The data (variate 1). */
+	uint32_t extra;     /**< The implementation specific variate (variate 2). */
+	uint16_t port;      /**< The I/O port address (variate 4). */
+	uint8_t count;      /**< The counter for string operations (variate 3). */
+	uint8_t func;       /**< The I/O instruction/operation (variate 0). */
+	uint32_t value;     /**< The value returned by the operation. */
+};
+
+typedef struct log log_t; /**< Memory-mapped log. */
+
+size_t log_align(log_t *log, size_t offset);
+log_t *log_free(log_t *log);
+const char *log_get_data(log_t *log);
+int log_get_format(log_t *log);
+size_t log_get_position(log_t *log, size_t offset);
+size_t log_get_size(log_t *log);
+size_t log_get_start(log_t *log);
+log_t *log_new(const char *path);
+size_t log_previous(log_t *log, size_t offset);
+int log_print_record(FILE *stream, const struct log_record *record);
+log_t *log_read(log_t *log, size_t *offset, struct log_record *record);
+log_t *log_ref(log_t *log);
+size_t log_seek(log_t *log, size_t position);
+void log_unref(log_t *log);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOG_H */
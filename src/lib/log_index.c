@@ -0,0 +1,329 @@
+/** @file */
+
+#include "array.h"
+#include "lockstat.h"
+#include "log_index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Entry of a thread at an iteration, sorted by thread and iteration */
+struct log_index_slot {
+	uint64_t iteration;
+	uint64_t offset;
+	uint32_t thread;
+};
+
+struct log_index {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	char *data;
+	size_t size;
+	const struct log_index_entry *entries;
+	size_t num_entries;
+	uint64_t interval;
+	array_t *slots;
+	size_t num_slots;
+};
+
+static int _log_index_compare_slot(const void *a, const void *b);
+static log_index_t *_log_index_sort_slots(log_index_t *index);
+
+/**
+ * Returns the offset of the indexed record of a given thread closest to,
+ * and at or before, a given iteration. The entries are sorted by thread
+ * and iteration when the log index is loaded, so the lookup is a binary
+ * search and the memory is bounded by the number of entries, whatever the
+ * thread numbers and iterations. If an iteration was recorded more than
+ * once, such as when runs are appended to the same log, the first one is
+ * returned.
+ *
+ * @param [in] index The log index.
+ * @param [in] thread The thread number.
+ * @param [in] iteration The iteration.
+ * @return The offset of the record, or zero if there is none.
+ */
+size_t
+log_index_find_iteration(log_index_t *index, uint32_t thread, uint64_t iteration)
+{
+	const struct log_index_slot *slot;
+	size_t begin;
+	size_t end;
+	size_t middle;
+
+	if (index == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	/* Find the first slot past the thread and iteration */
+	begin = 0;
+	end = index->num_slots;
+	while (begin < end) {
+		middle = begin + (end - begin) / 2;
+		slot = &array_index(index->slots, struct log_index_slot, middle);
+		if (slot->thread < thread || (slot->thread == thread && slot->iteration <= iteration))
+			begin = middle + 1;
+		else
+			end = middle;
+	}
+
+	if (begin == 0)
+		return 0;
+
+	slot = &array_index(index->slots, struct log_index_slot, begin - 1);
+	if (slot->thread != thread)
+		return 0;
+
+	return slot->offset;
+}
+
+/**
+ * Returns the offset of the indexed record closest to, and before, the
+ * first record at or after a given time. Records are in time order, so the
+ * lookup is a binary search over the entries.
+ *
+ * @param [in] index The log index.
+ * @param [in] time The time in seconds since the Epoch.
+ * @return The offset of the record, or zero if there is none.
+ */
+size_t
+log_index_find_time(log_index_t *index, uint32_t time)
+{
+	size_t begin;
+	size_t end;
+	size_t middle;
+
+	if (index == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	begin = 0;
+	end = index->num_entries;
+	while (begin < end) {
+		middle = begin + (end - begin) / 2;
+		if (index->entries[middle].time < time)
+			begin = middle + 1;
+		else
+			end = middle;
+	}
+
+	if (begin == 0)
+		return 0;
+
+	return index->entries[begin - 1].offset;
+}
+
+/**
+ * Frees the memory allocated for the log index.
+ *
+ * @param [in] index The log index.
+ * @return The log index.
+ */
+log_index_t *
+log_index_free(log_index_t *index)
+{
+	if (index == NULL)
+		return NULL;
+
+	array_unref(index->slots);
+
+	if (index->data != NULL && index->data != MAP_FAILED)
+		munmap(index->data, index->size);
+
+	pthread_mutex_destroy(&index->mutex);
+	free(index);
+
+	return NULL;
+}
+
+/**
+ * Returns the number of iterations between entries of a thread.
+ *
+ * @param [in] index The log index.
+ * @return The number of iterations between entries of a thread.
+ */
+uint64_t
+log_index_get_interval(log_index_t *index)
+{
+	if (index == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return index->interval;
+}
+
+/**
+ * Creates a log index from a given file.
+ *
+ * @param [in] path The path of the file.
+ * @return A log index.
+ */
+log_index_t *
+log_index_new(const char *path)
+{
+	log_index_t *index;
+	const struct log_index_header *header;
+	struct stat st;
+	int fd;
+
+	if (path == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	index = calloc(1, sizeof(*index));
+	if (index == NULL)
+		return NULL;
+
+	errno = pthread_mutex_init(&index->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		goto err;
+
+	if (fstat(fd, &st) == -1 || st.st_size < sizeof(*header)) {
+		close(fd);
+		errno = EINVAL;
+		goto err;
+	}
+
+	index->size = st.st_size;
+	index->data = mmap(NULL, index->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (index->data == MAP_FAILED)
+		goto err;
+
+	header = (const struct log_index_header *)index->data;
+	if (memcmp(header->magic, LOG_INDEX_MAGIC, sizeof(header->magic)) != 0 || header->interval == 0) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	index->interval = header->interval;
+	index->entries = (const struct log_index_entry *)&index->data[sizeof(*header)];
+	index->num_entries = (index->size - sizeof(*header)) / sizeof(*index->entries);
+	if (_log_index_sort_slots(index) == NULL)
+		goto err;
+
+	log_index_ref(index);
+
+	return index;
+
+err:
+	log_index_free(index);
+
+	return NULL;
+}
+
+/**
+ * Increments the reference count of the log index.
+ *
+ * @param [in] index The log index.
+ * @return The log index.
+ */
+log_index_t *
+log_index_ref(log_index_t *index)
+{
+	if (index == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&index->mutex);
+	index->refcount++;
+	pthread_mutex_unlock(&index->mutex);
+
+	return index;
+}
+
+/**
+ * Decrements the reference count of the log index.
+ *
+ * @param [in] index The log index.
+ */
+void
+log_index_unref(log_index_t *index)
+{
+	if (index == NULL)
+		return;
+
+	pthread_mutex_lock(&index->mutex);
+	index->refcount--;
+	if (index->refcount > 0) {
+		pthread_mutex_unlock(&index->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&index->mutex);
+	log_index_free(index);
+}
+
+static int
+_log_index_compare_slot(const void *a, const void *b)
+{
+	const struct log_index_slot *x = a;
+	const struct log_index_slot *y = b;
+
+	if (x->thread != y->thread)
+		return x->thread < y->thread ? -1 : 1;
+
+	if (x->iteration != y->iteration)
+		return x->iteration < y->iteration ? -1 : 1;
+
+	/* Entries are in offset order, so the first one recorded sorts first */
+	return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+static log_index_t *
+_log_index_sort_slots(log_index_t *index)
+{
+	struct log_index_slot slot;
+	struct log_index_slot *slots;
+	size_t num_slots;
+	size_t i;
+
+	index->slots = array_new(sizeof(struct log_index_slot));
+	if (index->slots == NULL)
+		return NULL;
+
+	for (i = 0; i < index->num_entries; i++) {
+		if (index->entries[i].iteration % index->interval != 0)
+			continue;
+
+		slot.iteration = index->entries[i].iteration;
+		slot.offset = index->entries[i].offset;
+		slot.thread = index->entries[i].thread;
+		array_append_val(index->slots, &slot);
+	}
+
+	num_slots = array_get_length(index->slots);
+	if (num_slots == 0)
+		return index;
+
+	slots = &array_index(index->slots, struct log_index_slot, 0);
+	qsort(slots, num_slots, sizeof(*slots), _log_index_compare_slot);
+
+	/* Keep the first record of an iteration recorded more than once */
+	index->num_slots = 1;
+	for (i = 1; i < num_slots; i++) {
+		if (slots[i].thread == slots[index->num_slots - 1].thread &&
+		    slots[i].iteration == slots[index->num_slots - 1].iteration)
+			continue;
+
+		slots[index->num_slots++] = slots[i];
+	}
+
+	return index;
+}
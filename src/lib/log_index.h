@@ -0,0 +1,50 @@
+/** @file */
+
+#ifndef LOG_INDEX_H
+#define LOG_INDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOG_INDEX_INTERVAL 4096 /**< Default number of iterations between entries. */
+#define LOG_INDEX_MAGIC "IOFZIDX1" /**< Magic number of log indexes. */
+
+/**
+ * Log index header. A log index is a log index header followed by log
+ * index entries, in host byte order, sorted by offset.
+ */
+struct log_index_header {
+	char magic[8];     /**< The magic number. */
+	uint64_t interval; /**< The number of iterations between entries of a thread. */
+};
+
+/**
+ * Log index entry. An entry is written for every record whose iteration
+ * is a multiple of the interval.
+ */
+struct log_index_entry {
+	uint64_t offset;    /**< The offset of the record, or of its segment, in the log. */
+	uint64_t iteration; /**< The iteration of the record. */
+	uint32_t time;      /**< The time of the record. */
+	uint32_t thread;    /**< The thread number of the record. */
+};
+
+typedef struct log_index log_index_t; /**< Memory-mapped log index. */
+
+size_t log_index_find_iteration(log_index_t *index, uint32_t thread, uint64_t iteration);
+size_t log_index_find_time(log_index_t *index, uint32_t time);
+log_index_t *log_index_free(log_index_t *index);
+uint64_t log_index_get_interval(log_index_t *index);
+log_index_t *log_index_new(const char *path);
+log_index_t *log_index_ref(log_index_t *index);
+void log_index_unref(log_index_t *index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOG_INDEX_H */
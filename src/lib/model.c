@@ -0,0 +1,297 @@
+/** @file */
+
+#include "lockstat.h"
+#include "model.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CMOS_DATA 0x71
+#define CMOS_INDEX 0x70
+#define CMOS_MINNVRAM 0x0e /* Registers below are clock and status registers */
+#define CMOS_SIZE 128
+
+struct model_class {
+	const char *name;
+	unsigned char (*read)(model_t *model, unsigned long port, unsigned char *mask);
+	void (*write)(model_t *model, unsigned long port, unsigned char value);
+};
+
+struct model {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	const struct model_class *class;
+	unsigned char index;
+	unsigned char known[CMOS_SIZE];
+	unsigned char nvram[CMOS_SIZE];
+};
+
+static unsigned char _model_cmos_read(model_t *model, unsigned long port, unsigned char *mask);
+static void _model_cmos_write(model_t *model, unsigned long port, unsigned char value);
+static unsigned char _model_floating_read(model_t *model, unsigned long port, unsigned char *mask);
+static void _model_floating_write(model_t *model, unsigned long port, unsigned char value);
+
+static const struct model_class classes[] = {
+	{ "cmos",     _model_cmos_read,     _model_cmos_write     },
+	{ "floating", _model_floating_read, _model_floating_write },
+};
+
+/**
+ * Frees the memory allocated for the model.
+ *
+ * @param [in] model The model.
+ * @return The model.
+ */
+model_t *
+model_free(model_t *model)
+{
+	if (model == NULL)
+		return NULL;
+
+	pthread_mutex_destroy(&model->mutex);
+	free(model);
+
+	return NULL;
+}
+
+/**
+ * Returns the name of the device class of the model.
+ *
+ * @param [in] model The model.
+ * @return The name of the device class of the model.
+ */
+const char *
+model_get_name(model_t *model)
+{
+	if (model == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return model->class->name;
+}
+
+/**
+ * Returns the value a spec-compliant device would return for an input
+ * operation of a given width. Accesses wider than a byte are decomposed
+ * into byte accesses to consecutive ports, as done by the bus.
+ *
+ * @param [in] model The model.
+ * @param [in] port The I/O port address.
+ * @param [in] width The width of the access in bytes.
+ * @param [out] mask The bits of the value that are defined by the model.
+ * @return The value a spec-compliant device would return.
+ */
+unsigned long
+model_in(model_t *model, unsigned long port, size_t width, unsigned long *mask)
+{
+	unsigned long value;
+	unsigned char byte_mask;
+	size_t i;
+
+	if (model == NULL || mask == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	value = 0;
+	*mask = 0;
+	pthread_mutex_lock(&model->mutex);
+	for (i = 0; i < width; i++) {
+		value |= (unsigned long)model->class->read(model, (port + i) & 0xffff, &byte_mask) << (i * 8);
+		*mask |= (unsigned long)byte_mask << (i * 8);
+	}
+
+	pthread_mutex_unlock(&model->mutex);
+
+	return value & *mask;
+}
+
+/**
+ * Creates a model of a given device class. The device classes are:
+ *
+ *   1. cmos (MC146818 RTC/NVRAM index and data ports)
+ *   2. floating (unclaimed ports, reads return all ones)
+ *
+ * @param [in] name The name of the device class.
+ * @return A model.
+ */
+model_t *
+model_new(const char *name)
+{
+	model_t *model;
+	size_t i;
+
+	if (name == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	for (i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+		if (strcmp(classes[i].name, name) == 0)
+			break;
+	}
+
+	if (i == sizeof(classes) / sizeof(classes[0])) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	model = calloc(1, sizeof(*model));
+	if (model == NULL)
+		return NULL;
+
+	errno = pthread_mutex_init(&model->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	model->class = &classes[i];
+	model_ref(model);
+
+	return model;
+
+err:
+	model_free(model);
+
+	return NULL;
+}
+
+/**
+ * Performs an output operation of a given width on the model.
+ *
+ * @param [in] model The model.
+ * @param [in] port The I/O port address.
+ * @param [in] width The width of the access in bytes.
+ * @param [in] value The value.
+ * @return The model.
+ */
+model_t *
+model_out(model_t *model, unsigned long port, size_t width, unsigned long value)
+{
+	size_t i;
+
+	if (model == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&model->mutex);
+	for (i = 0; i < width; i++)
+		model->class->write(model, (port + i) & 0xffff, (value >> (i * 8)) & 0xff);
+
+	pthread_mutex_unlock(&model->mutex);
+
+	return model;
+}
+
+/**
+ * Increments the reference count of the model.
+ *
+ * @param [in] model The model.
+ * @return The model.
+ */
+model_t *
+model_ref(model_t *model)
+{
+	if (model == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&model->mutex);
+	model->refcount++;
+	pthread_mutex_unlock(&model->mutex);
+
+	return model;
+}
+
+/**
+ * Resets the model to its power-on state.
+ *
+ * @param [in] model The model.
+ * @return The model.
+ */
+model_t *
+model_reset(model_t *model)
+{
+	if (model == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&model->mutex);
+	model->index = 0;
+	memset(model->known, 0, sizeof(model->known));
+	memset(model->nvram, 0, sizeof(model->nvram));
+	pthread_mutex_unlock(&model->mutex);
+
+	return model;
+}
+
+/**
+ * Decrements the reference count of the model.
+ *
+ * @param [in] model The model.
+ */
+void
+model_unref(model_t *model)
+{
+	if (model == NULL)
+		return;
+
+	pthread_mutex_lock(&model->mutex);
+	model->refcount--;
+	if (model->refcount > 0) {
+		pthread_mutex_unlock(&model->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&model->mutex);
+	model_free(model);
+}
+
+static unsigned char
+_model_cmos_read(model_t *model, unsigned long port, unsigned char *mask)
+{
+	*mask = 0;
+	if (port != CMOS_DATA)
+		return 0;
+
+	if (model->index < CMOS_MINNVRAM || !model->known[model->index])
+		return 0;
+
+	*mask = 0xff;
+
+	return model->nvram[model->index];
+}
+
+static void
+_model_cmos_write(model_t *model, unsigned long port, unsigned char value)
+{
+	switch (port) {
+	case CMOS_INDEX:
+		model->index = value & (CMOS_SIZE - 1);
+		break;
+
+	case CMOS_DATA:
+		model->nvram[model->index] = value;
+		model->known[model->index] = 1;
+		break;
+	}
+}
+
+static unsigned char
+_model_floating_read(model_t *model, unsigned long port, unsigned char *mask)
+{
+	*mask = 0xff;
+
+	return 0xff;
+}
+
+static void
+_model_floating_write(model_t *model, unsigned long port, unsigned char value)
+{
+}
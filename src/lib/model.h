@@ -0,0 +1,27 @@
+/** @file */
+
+#ifndef MODEL_H
+#define MODEL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+typedef struct model model_t; /**< Reference device model. */
+
+model_t *model_free(model_t *model);
+const char *model_get_name(model_t *model);
+unsigned long model_in(model_t *model, unsigned long port, size_t width, unsigned long *mask);
+model_t *model_new(const char *name);
+model_t *model_out(model_t *model, unsigned long port, size_t width, unsigned long value);
+model_t *model_ref(model_t *model);
+model_t *model_reset(model_t *model);
+void model_unref(model_t *model);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODEL_H */
@@ -0,0 +1,213 @@
+/** @file */
+
+#include "lockstat.h"
+#include "permutation.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_ROUNDS 6
+
+struct permutation {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	uint64_t size;
+	unsigned int half_bits;
+	uint64_t half_mask;
+	uint64_t keys[NUM_ROUNDS];
+};
+
+static uint64_t _permutation_encrypt(permutation_t *permutation, uint64_t value);
+static uint64_t _permutation_mix(uint64_t value);
+
+/**
+ * Frees the memory allocated for the permutation.
+ *
+ * @param [in] permutation The permutation.
+ * @return The permutation.
+ */
+permutation_t *
+permutation_free(permutation_t *permutation)
+{
+	if (permutation == NULL)
+		return NULL;
+
+	pthread_mutex_destroy(&permutation->mutex);
+	free(permutation);
+
+	return NULL;
+}
+
+/**
+ * Returns the size of the domain of the permutation.
+ *
+ * @param [in] permutation The permutation.
+ * @return The size of the domain of the permutation.
+ */
+uint64_t
+permutation_get_size(permutation_t *permutation)
+{
+	if (permutation == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return permutation->size;
+}
+
+/**
+ * Maps an index to its position in the permutation. Every index in the
+ * range given by the interval [0,size) is mapped to a distinct index in
+ * the same range, so walking the indexes in order visits the whole domain
+ * in a pseudo-random order without repeats.
+ *
+ * The indexes are encrypted by a balanced Feistel network over the
+ * smallest even number of bits that holds the size, and encrypted again
+ * while the result is out of the domain (cycle-walking). The domain is at
+ * least a quarter of the Feistel network, so a mapping takes less than
+ * four encryptions on average. The permutation is immutable, so mapping
+ * is not synchronized.
+ *
+ * @param [in] permutation The permutation.
+ * @param [in] index The index.
+ * @return The mapped index.
+ */
+uint64_t
+permutation_map(permutation_t *permutation, uint64_t index)
+{
+	if (permutation == NULL || index >= permutation->size) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	do {
+		index = _permutation_encrypt(permutation, index);
+	} while (index >= permutation->size);
+
+	return index;
+}
+
+/**
+ * Creates a permutation of the range given by the interval [0,size)
+ * selected by a given key.
+ *
+ * @param [in] size The size of the domain of the permutation.
+ * @param [in] key The key of the permutation.
+ * @return A permutation.
+ */
+permutation_t *
+permutation_new(uint64_t size, uint64_t key)
+{
+	permutation_t *permutation;
+	unsigned int bits;
+	int i;
+
+	if (size == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	permutation = calloc(1, sizeof(*permutation));
+	if (permutation == NULL)
+		return NULL;
+
+	errno = pthread_mutex_init(&permutation->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	bits = size == 1 ? 1 : 64 - __builtin_clzll(size - 1);
+	permutation->size = size;
+	permutation->half_bits = bits < 2 ? 1 : (bits + 1) / 2;
+	permutation->half_mask = (1ULL << permutation->half_bits) - 1;
+	for (i = 0; i < NUM_ROUNDS; i++) {
+		key += 0x9e3779b97f4a7c15ULL;
+		permutation->keys[i] = _permutation_mix(key);
+	}
+
+	permutation_ref(permutation);
+
+	return permutation;
+
+err:
+	permutation_free(permutation);
+
+	return NULL;
+}
+
+/**
+ * Increments the reference count of the permutation.
+ *
+ * @param [in] permutation The permutation.
+ * @return The permutation.
+ */
+permutation_t *
+permutation_ref(permutation_t *permutation)
+{
+	if (permutation == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&permutation->mutex);
+	permutation->refcount++;
+	pthread_mutex_unlock(&permutation->mutex);
+
+	return permutation;
+}
+
+/**
+ * Decrements the reference count of the permutation.
+ *
+ * @param [in] permutation The permutation.
+ */
+void
+permutation_unref(permutation_t *permutation)
+{
+	if (permutation == NULL)
+		return;
+
+	pthread_mutex_lock(&permutation->mutex);
+	permutation->refcount--;
+	if (permutation->refcount > 0) {
+		pthread_mutex_unlock(&permutation->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&permutation->mutex);
+	permutation_free(permutation);
+}
+
+static uint64_t
+_permutation_encrypt(permutation_t *permutation, uint64_t value)
+{
+	uint64_t left;
+	uint64_t right;
+	uint64_t tmp;
+	int i;
+
+	left = value >> permutation->half_bits;
+	right = value & permutation->half_mask;
+	for (i = 0; i < NUM_ROUNDS; i++) {
+		tmp = right;
+		right = (left ^ _permutation_mix(right ^ permutation->keys[i])) & permutation->half_mask;
+		left = tmp;
+	}
+
+	return (left << permutation->half_bits) | right;
+}
+
+static uint64_t
+_permutation_mix(uint64_t value)
+{
+	/* SplitMix64 finalizer */
+	value ^= value >> 30;
+	value *= 0xbf58476d1ce4e5b9ULL;
+	value ^= value >> 27;
+	value *= 0x94d049bb133111ebULL;
+	value ^= value >> 31;
+
+	return value;
+}
@@ -0,0 +1,26 @@
+/** @file */
+
+#ifndef PERMUTATION_H
+#define PERMUTATION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct permutation permutation_t; /**< Keyed pseudo-random permutation. */
+
+permutation_t *permutation_free(permutation_t *permutation);
+uint64_t permutation_get_size(permutation_t *permutation);
+uint64_t permutation_map(permutation_t *permutation, uint64_t index);
+permutation_t *permutation_new(uint64_t size, uint64_t key);
+permutation_t *permutation_ref(permutation_t *permutation);
+void permutation_unref(permutation_t *permutation);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERMUTATION_H */
@@ -0,0 +1,310 @@
+/** @file */
+
+#include "lockstat.h"
+#include "profile.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MINWEIGHT (1.0 / 16) /* Weight of the operations never seen useful */
+#define NUM_PORTS 65536
+#define SLOW 2 /* Operations slower than SLOW times the baseline are useful */
+
+struct cell {
+	uint16_t count;
+	uint16_t useful;
+};
+
+struct profile {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	struct cell *cells;
+	size_t num_funcs;
+	uint64_t warmup;
+	uint64_t count;
+	uint64_t baseline;
+};
+
+static double _profile_get_weight(const struct cell *cell);
+
+/**
+ * Returns whether an operation drawn is to be kept. Operations are kept
+ * with a probability proportional to the weight of the operation among
+ * the operations on the same port, so every port gets the widths and
+ * directions it decodes. All operations are kept during the profiling
+ * phase. The decision is a function of a given hash, so it does not
+ * consume random numbers.
+ *
+ * @param [in] profile The profile.
+ * @param [in] port The I/O port address.
+ * @param [in] func The I/O instruction/operation.
+ * @param [in] hash A hash of the operation.
+ * @return 1 if the operation is to be kept, 0 otherwise.
+ */
+int
+profile_accept(profile_t *profile, unsigned long port, unsigned long func, uint64_t hash)
+{
+	const struct cell *cells;
+	double weight;
+	double max;
+	size_t i;
+
+	if (profile == NULL || port >= NUM_PORTS || func >= profile->num_funcs) {
+		errno = EINVAL;
+		return 1;
+	}
+
+	if (profile->count < profile->warmup)
+		return 1;
+
+	cells = &profile->cells[port * profile->num_funcs];
+	max = 0;
+	for (i = 0; i < profile->num_funcs; i++) {
+		weight = _profile_get_weight(&cells[i]);
+		if (weight > max)
+			max = weight;
+	}
+
+	return (double)(hash >> 32) < _profile_get_weight(&cells[func]) / max * 4294967296.0;
+}
+
+/**
+ * Adds an operation performed to the profile. An operation is useful if
+ * it took at least twice the baseline latency, the latency of operations
+ * the VMM discards, or if it read a value other than all ones, the value
+ * of the floating bus. The baseline follows the fastest operations, and
+ * drifts up slowly so it tracks changes in the host. The counts of an
+ * operation are halved when they saturate, so the profile forgets old
+ * behavior. Adding is not synchronized; every thread uses its own
+ * profile.
+ *
+ * @param [in] profile The profile.
+ * @param [in] port The I/O port address.
+ * @param [in] func The I/O instruction/operation.
+ * @param [in] value The value read, or the mask of the width for
+ *   operations that do not read a value.
+ * @param [in] width The width of the operation in bytes.
+ * @param [in] cycles The latency of the operation in cycles.
+ * @return The profile.
+ */
+profile_t *
+profile_add(profile_t *profile, unsigned long port, unsigned long func, unsigned long value, size_t width, uint64_t cycles)
+{
+	struct cell *cell;
+	unsigned long mask;
+
+	if (profile == NULL || port >= NUM_PORTS || func >= profile->num_funcs) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (cycles < profile->baseline)
+		profile->baseline = cycles;
+	else
+		profile->baseline += profile->baseline >> 10;
+
+	cell = &profile->cells[port * profile->num_funcs + func];
+	if (cell->count == UINT16_MAX) {
+		cell->count /= 2;
+		cell->useful /= 2;
+	}
+
+	mask = 0xffffffffUL >> (32 - (width < 4 ? width : 4) * 8);
+	cell->count++;
+	cell->useful += cycles >= profile->baseline * SLOW || (value & mask) != mask;
+	profile->count++;
+
+	return profile;
+}
+
+/**
+ * Removes all operations from the profile, and restarts the profiling
+ * phase.
+ *
+ * @param [in] profile The profile.
+ * @return The profile.
+ */
+profile_t *
+profile_clear(profile_t *profile)
+{
+	if (profile == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&profile->mutex);
+	memset(profile->cells, 0, NUM_PORTS * profile->num_funcs * sizeof(*profile->cells));
+	profile->count = 0;
+	profile->baseline = UINT64_MAX;
+	pthread_mutex_unlock(&profile->mutex);
+
+	return profile;
+}
+
+/**
+ * Frees the memory allocated for the profile.
+ *
+ * @param [in] profile The profile.
+ * @return The profile.
+ */
+profile_t *
+profile_free(profile_t *profile)
+{
+	if (profile == NULL)
+		return NULL;
+
+	free(profile->cells);
+	pthread_mutex_destroy(&profile->mutex);
+	free(profile);
+
+	return NULL;
+}
+
+/**
+ * Returns the number of operations added to the profile.
+ *
+ * @param [in] profile The profile.
+ * @return The number of operations added to the profile.
+ */
+uint64_t
+profile_get_count(profile_t *profile)
+{
+	uint64_t count;
+
+	if (profile == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&profile->mutex);
+	count = profile->count;
+	pthread_mutex_unlock(&profile->mutex);
+
+	return count;
+}
+
+/**
+ * Returns the weight of an operation on a port, the estimated
+ * probability of the operation being useful, with a floor so operations
+ * never seen useful are still drawn sometimes.
+ *
+ * @param [in] profile The profile.
+ * @param [in] port The I/O port address.
+ * @param [in] func The I/O instruction/operation.
+ * @return The weight of the operation.
+ */
+double
+profile_get_weight(profile_t *profile, unsigned long port, unsigned long func)
+{
+	double weight;
+
+	if (profile == NULL || port >= NUM_PORTS || func >= profile->num_funcs) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&profile->mutex);
+	weight = _profile_get_weight(&profile->cells[port * profile->num_funcs + func]);
+	pthread_mutex_unlock(&profile->mutex);
+
+	return weight;
+}
+
+/**
+ * Creates a profile.
+ *
+ * @param [in] num_funcs The number of I/O instructions/operations.
+ * @param [in] warmup The number of operations of the profiling phase.
+ * @return A profile.
+ */
+profile_t *
+profile_new(size_t num_funcs, uint64_t warmup)
+{
+	profile_t *profile;
+
+	if (num_funcs == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	profile = calloc(1, sizeof(*profile));
+	if (profile == NULL)
+		return NULL;
+
+	errno = pthread_mutex_init(&profile->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	profile->cells = calloc(NUM_PORTS * num_funcs, sizeof(*profile->cells));
+	if (profile->cells == NULL)
+		goto err;
+
+	profile->num_funcs = num_funcs;
+	profile->warmup = warmup;
+	profile_clear(profile);
+	profile_ref(profile);
+
+	return profile;
+
+err:
+	profile_free(profile);
+
+	return NULL;
+}
+
+/**
+ * Increments the reference count of the profile.
+ *
+ * @param [in] profile The profile.
+ * @return The profile.
+ */
+profile_t *
+profile_ref(profile_t *profile)
+{
+	if (profile == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&profile->mutex);
+	profile->refcount++;
+	pthread_mutex_unlock(&profile->mutex);
+
+	return profile;
+}
+
+/**
+ * Decrements the reference count of the profile.
+ *
+ * @param [in] profile The profile.
+ */
+void
+profile_unref(profile_t *profile)
+{
+	if (profile == NULL)
+		return;
+
+	pthread_mutex_lock(&profile->mutex);
+	profile->refcount--;
+	if (profile->refcount > 0) {
+		pthread_mutex_unlock(&profile->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&profile->mutex);
+	profile_free(profile);
+}
+
+static double
+_profile_get_weight(const struct cell *cell)
+{
+	double weight;
+
+	weight = (cell->useful + 1.0) / (cell->count + 2.0);
+
+	return weight > MINWEIGHT ? weight : MINWEIGHT;
+}
@@ -0,0 +1,29 @@
+/** @file */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct profile profile_t; /**< Per-port access-width and direction profile. */
+
+int profile_accept(profile_t *profile, unsigned long port, unsigned long func, uint64_t hash);
+profile_t *profile_add(profile_t *profile, unsigned long port, unsigned long func, unsigned long value, size_t width, uint64_t cycles);
+profile_t *profile_clear(profile_t *profile);
+profile_t *profile_free(profile_t *profile);
+uint64_t profile_get_count(profile_t *profile);
+double profile_get_weight(profile_t *profile, unsigned long port, unsigned long func);
+profile_t *profile_new(size_t num_funcs, uint64_t warmup);
+profile_t *profile_ref(profile_t *profile);
+void profile_unref(profile_t *profile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROFILE_H */
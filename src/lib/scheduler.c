@@ -0,0 +1,267 @@
+/** @file */
+
+#include "lockstat.h"
+#include "scheduler.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXARMS 64
+
+struct arm {
+	uint64_t batches;
+	uint64_t ops;
+	uint64_t events;
+} __attribute__((aligned(64)));
+
+struct scheduler {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	struct arm *arms;
+	size_t num_arms;
+};
+
+/**
+ * Frees the memory allocated for the scheduler.
+ *
+ * @param [in] scheduler The scheduler.
+ * @return The scheduler.
+ */
+scheduler_t *
+scheduler_free(scheduler_t *scheduler)
+{
+	if (scheduler == NULL)
+		return NULL;
+
+	free(scheduler->arms);
+	pthread_mutex_destroy(&scheduler->mutex);
+	free(scheduler);
+
+	return NULL;
+}
+
+/**
+ * Returns the number of feedback events reported for an arm of the
+ * scheduler.
+ *
+ * @param [in] scheduler The scheduler.
+ * @param [in] arm The arm.
+ * @return The number of feedback events reported for the arm.
+ */
+uint64_t
+scheduler_get_events(scheduler_t *scheduler, size_t arm)
+{
+	if (scheduler == NULL || arm >= scheduler->num_arms) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return __atomic_load_n(&scheduler->arms[arm].events, __ATOMIC_RELAXED);
+}
+
+/**
+ * Returns the number of arms of the scheduler.
+ *
+ * @param [in] scheduler The scheduler.
+ * @return The number of arms of the scheduler.
+ */
+size_t
+scheduler_get_num_arms(scheduler_t *scheduler)
+{
+	if (scheduler == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return scheduler->num_arms;
+}
+
+/**
+ * Returns the number of operations reported for an arm of the scheduler.
+ *
+ * @param [in] scheduler The scheduler.
+ * @param [in] arm The arm.
+ * @return The number of operations reported for the arm.
+ */
+uint64_t
+scheduler_get_ops(scheduler_t *scheduler, size_t arm)
+{
+	if (scheduler == NULL || arm >= scheduler->num_arms) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return __atomic_load_n(&scheduler->arms[arm].ops, __ATOMIC_RELAXED);
+}
+
+/**
+ * Creates a scheduler with a given number of arms, such as fuzzing
+ * strategies. A scheduler has at most 64 arms.
+ *
+ * @param [in] num_arms The number of arms.
+ * @return A scheduler.
+ */
+scheduler_t *
+scheduler_new(size_t num_arms)
+{
+	scheduler_t *scheduler;
+
+	if (num_arms == 0 || num_arms > MAXARMS) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	scheduler = calloc(1, sizeof(*scheduler));
+	if (scheduler == NULL)
+		return NULL;
+
+	errno = pthread_mutex_init(&scheduler->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	scheduler->arms = aligned_alloc(sizeof(*scheduler->arms), num_arms * sizeof(*scheduler->arms));
+	if (scheduler->arms == NULL)
+		goto err;
+
+	memset(scheduler->arms, 0, num_arms * sizeof(*scheduler->arms));
+	scheduler->num_arms = num_arms;
+	scheduler_ref(scheduler);
+
+	return scheduler;
+
+err:
+	scheduler_free(scheduler);
+
+	return NULL;
+}
+
+/**
+ * Increments the reference count of the scheduler.
+ *
+ * @param [in] scheduler The scheduler.
+ * @return The scheduler.
+ */
+scheduler_t *
+scheduler_ref(scheduler_t *scheduler)
+{
+	if (scheduler == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&scheduler->mutex);
+	scheduler->refcount++;
+	pthread_mutex_unlock(&scheduler->mutex);
+
+	return scheduler;
+}
+
+/**
+ * Selects the arm to run the next batch with, using the UCB1 policy. Arms
+ * that were never run are selected first. Otherwise, the arm with the
+ * highest yield, in feedback events per operation relative to the best
+ * arm, plus an exploration bonus that shrinks as the arm is run, is
+ * selected. Selecting is lock-free, so the counters of other threads may
+ * be read mid-update.
+ *
+ * @param [in] scheduler The scheduler.
+ * @return The arm.
+ */
+size_t
+scheduler_select(scheduler_t *scheduler)
+{
+	struct arm arm;
+	double rates[MAXARMS];
+	double max_rate;
+	double score;
+	double best;
+	uint64_t total;
+	size_t selected;
+	size_t i;
+
+	if (scheduler == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	total = 0;
+	max_rate = 0;
+	for (i = 0; i < scheduler->num_arms; i++) {
+		arm.batches = __atomic_load_n(&scheduler->arms[i].batches, __ATOMIC_RELAXED);
+		arm.ops = __atomic_load_n(&scheduler->arms[i].ops, __ATOMIC_RELAXED);
+		arm.events = __atomic_load_n(&scheduler->arms[i].events, __ATOMIC_RELAXED);
+		if (arm.batches == 0 || arm.ops == 0)
+			return i;
+
+		total += arm.batches;
+		rates[i] = (double)arm.events / arm.ops;
+		if (rates[i] > max_rate)
+			max_rate = rates[i];
+	}
+
+	selected = 0;
+	best = -1;
+	for (i = 0; i < scheduler->num_arms; i++) {
+		score = (max_rate > 0 ? rates[i] / max_rate : 0) +
+		    sqrt(2 * log(total) / __atomic_load_n(&scheduler->arms[i].batches, __ATOMIC_RELAXED));
+		if (score > best) {
+			best = score;
+			selected = i;
+		}
+	}
+
+	return selected;
+}
+
+/**
+ * Decrements the reference count of the scheduler.
+ *
+ * @param [in] scheduler The scheduler.
+ */
+void
+scheduler_unref(scheduler_t *scheduler)
+{
+	if (scheduler == NULL)
+		return;
+
+	pthread_mutex_lock(&scheduler->mutex);
+	scheduler->refcount--;
+	if (scheduler->refcount > 0) {
+		pthread_mutex_unlock(&scheduler->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&scheduler->mutex);
+	scheduler_free(scheduler);
+}
+
+/**
+ * Reports the result of a batch run with an arm of the scheduler. Every
+ * thread accumulates the operations and feedback events of its batch and
+ * reports them once per batch with atomic additions, so reporting is
+ * lock-free.
+ *
+ * @param [in] scheduler The scheduler.
+ * @param [in] arm The arm.
+ * @param [in] ops The number of operations of the batch.
+ * @param [in] events The number of feedback events of the batch.
+ * @return The scheduler.
+ */
+scheduler_t *
+scheduler_update(scheduler_t *scheduler, size_t arm, uint64_t ops, uint64_t events)
+{
+	if (scheduler == NULL || arm >= scheduler->num_arms) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	__atomic_add_fetch(&scheduler->arms[arm].batches, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&scheduler->arms[arm].ops, ops, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&scheduler->arms[arm].events, events, __ATOMIC_RELAXED);
+
+	return scheduler;
+}
@@ -0,0 +1,29 @@
+/** @file */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct scheduler scheduler_t; /**< Multi-armed bandit scheduler. */
+
+scheduler_t *scheduler_free(scheduler_t *scheduler);
+uint64_t scheduler_get_events(scheduler_t *scheduler, size_t arm);
+size_t scheduler_get_num_arms(scheduler_t *scheduler);
+uint64_t scheduler_get_ops(scheduler_t *scheduler, size_t arm);
+scheduler_t *scheduler_new(size_t num_arms);
+scheduler_t *scheduler_ref(scheduler_t *scheduler);
+size_t scheduler_select(scheduler_t *scheduler);
+void scheduler_unref(scheduler_t *scheduler);
+scheduler_t *scheduler_update(scheduler_t *scheduler, size_t arm, uint64_t ops, uint64_t events);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCHEDULER_H */
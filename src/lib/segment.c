@@ -0,0 +1,763 @@
+/** @file */
+
+#include "array.h"
+#include "lockstat.h"
+#include "log.h"
+#include "log_index.h"
+#include "segment.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define HASH_ORDER 14 /* Order of the match table of the compressor */
+#define MAXRECORDSIZE 64 /* Maximum size of an encoded record */
+#define MAXWINDOW 65535 /* Maximum offset of a match */
+#define MINMATCH 4 /* Minimum length of a match */
+#define NUM_LANES 64 /* Number of threads whose iterations are tracked */
+#define SLACK 16 /* Size of the slack of buffers for wide copies */
+
+/* Generator of the state, that of erand48() and jrand48() */
+#define LCG_A 0x5deece66dULL
+#define LCG_BITS 48
+#define LCG_C 0xbULL
+#define LCG_MASK 0xffffffffffffULL
+
+struct segment {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	FILE *stream;
+	FILE *index;
+	uint64_t interval;
+	struct log_record *records;
+	size_t num_records;
+	size_t capacity;
+	uint8_t *raw;
+	uint8_t *out;
+};
+
+struct context {
+	uint64_t multipliers[LCG_BITS];
+	uint64_t increments[LCG_BITS];
+	uint64_t state;
+	uint64_t iterations[NUM_LANES];
+	uint32_t time;
+	uint16_t port;
+};
+
+static uint32_t _segment_checksum(const uint8_t *data, size_t size);
+static size_t _segment_compress(const uint8_t *src, size_t size, uint8_t *dest);
+static size_t _segment_decompress(const uint8_t *src, size_t size, uint8_t *dest, size_t capacity);
+static int _segment_flush(segment_t *segment);
+static const uint8_t *_segment_get(const uint8_t *ptr, const uint8_t *end, uint64_t *value);
+static void _segment_init(struct context *context);
+static uint64_t _segment_jump(const struct context *context, uint64_t state, uint64_t steps);
+static uint8_t *_segment_put(uint8_t *ptr, uint64_t value);
+static uint64_t _segment_steps(const struct context *context, uint64_t from, uint64_t to);
+
+/**
+ * Adds a record to the segment writer. The segment is encoded and written
+ * to the stream once it is full, so the records of the last segment are
+ * lost if the process is killed before the writer is flushed.
+ *
+ * @param [in] segment The segment writer.
+ * @param [in] record The record.
+ * @return The segment writer, or NULL if a full segment could not be
+ *   written.
+ * @see segment_flush
+ */
+segment_t *
+segment_add(segment_t *segment, const struct log_record *record)
+{
+	int retval;
+
+	if (segment == NULL || record == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	retval = 0;
+	pthread_mutex_lock(&segment->mutex);
+	segment->records[segment->num_records++] = *record;
+	if (segment->num_records == segment->capacity)
+		retval = _segment_flush(segment);
+
+	pthread_mutex_unlock(&segment->mutex);
+
+	return retval == 0 ? segment : NULL;
+}
+
+/**
+ * Decodes the segment at the beginning of a buffer and appends its
+ * records to an array.
+ *
+ * The columns of a segment are, in order: the state, as the number of
+ * generator steps from the previous state; the iteration, as the delta
+ * from the previous iteration of the same thread; the time and the port,
+ * as deltas from the previous record; and the thread, data, extra,
+ * count, function and value as they are. Deltas are zigzag-encoded and
+ * all numbers are varints, so a column of repeating or slowly changing
+ * fields is a run of identical bytes, which the compressor folds.
+ *
+ * @param [in] data The buffer.
+ * @param [in] size The size of the buffer.
+ * @param [in] records The array of struct log_record.
+ * @return The size of the segment, or 0 if the buffer does not hold a
+ *   complete and valid segment.
+ */
+size_t
+segment_decode(const char *data, size_t size, array_t *records)
+{
+	struct segment_header header;
+	struct context context;
+	struct log_record *record;
+	const uint8_t *ptr;
+	const uint8_t *end;
+	uint8_t *raw;
+	uint64_t value;
+	size_t length;
+	size_t lane;
+	size_t i;
+
+	if (data == NULL || records == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (size < sizeof(header))
+		return 0;
+
+	memcpy(&header, data, sizeof(header));
+	if (size - sizeof(header) < header.size || header.raw_size > (size_t)header.num_records * MAXRECORDSIZE) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	raw = malloc(header.raw_size + SLACK);
+	if (raw == NULL)
+		return 0;
+
+	if (_segment_checksum((const uint8_t *)data + sizeof(header), header.size) != header.checksum ||
+	    _segment_decompress((const uint8_t *)data + sizeof(header), header.size, raw, header.raw_size) != header.raw_size) {
+		free(raw);
+		errno = EINVAL;
+		return 0;
+	}
+
+	length = array_get_length(records);
+	if (array_set_length(records, length + header.num_records) == NULL) {
+		free(raw);
+		return 0;
+	}
+
+	/* Columns are decoded one at a time, in tight loops */
+	record = &array_index(records, struct log_record, length);
+	memset(record, 0, header.num_records * sizeof(*record));
+	_segment_init(&context);
+	ptr = raw;
+	end = raw + header.raw_size;
+	for (i = 0; i < header.num_records && ptr != NULL; i++) {
+		ptr = _segment_get(ptr, end, &value);
+		if (ptr != NULL && value == 0) {
+			if (end - ptr < sizeof(context.state)) {
+				ptr = NULL;
+				break;
+			}
+
+			memcpy(&context.state, ptr, sizeof(context.state));
+			ptr += sizeof(context.state);
+		} else if (ptr != NULL)
+			context.state = _segment_jump(&context, context.state, value - 1);
+
+		record[i].state = context.state;
+	}
+
+	for (i = 0; i < header.num_records && ptr != NULL; i++) {
+		ptr = _segment_get(ptr, end, &value);
+		record[i].iteration = value;
+	}
+
+	for (i = 0; i < header.num_records && ptr != NULL; i++) {
+		ptr = _segment_get(ptr, end, &value);
+		context.time += (uint32_t)((value >> 1) ^ -(value & 1));
+		record[i].time = context.time;
+	}
+
+	for (i = 0; i < header.num_records && ptr != NULL; i++) {
+		ptr = _segment_get(ptr, end, &value);
+		record[i].thread = value;
+		lane = value % NUM_LANES;
+		context.iterations[lane] += (record[i].iteration >> 1) ^ -(record[i].iteration & 1);
+		record[i].iteration = context.iterations[lane];
+	}
+
+	for (i = 0; i < header.num_records && ptr != NULL; i++) {
+		ptr = _segment_get(ptr, end, &value);
+		record[i].data = value;
+	}
+
+	for (i = 0; i < header.num_records && ptr != NULL; i++) {
+		ptr = _segment_get(ptr, end, &value);
+		record[i].extra = value;
+	}
+
+	for (i = 0; i < header.num_records && ptr != NULL; i++) {
+		ptr = _segment_get(ptr, end, &value);
+		context.port += (uint16_t)((value >> 1) ^ -(value & 1));
+		record[i].port = context.port;
+	}
+
+	for (i = 0; i < header.num_records && ptr != NULL; i++) {
+		ptr = _segment_get(ptr, end, &value);
+		record[i].count = value;
+	}
+
+	for (i = 0; i < header.num_records && ptr != NULL; i++) {
+		ptr = _segment_get(ptr, end, &value);
+		record[i].func = value;
+	}
+
+	for (i = 0; i < header.num_records && ptr != NULL; i++) {
+		ptr = _segment_get(ptr, end, &value);
+		record[i].value = value;
+	}
+
+	free(raw);
+	if (ptr != end) {
+		array_set_length(records, length);
+		errno = EINVAL;
+		return 0;
+	}
+
+	return sizeof(header) + header.size;
+}
+
+/**
+ * Encodes the records added to the segment writer, if any, as a segment
+ * and writes it to the stream.
+ *
+ * @param [in] segment The segment writer.
+ * @return The segment writer.
+ */
+segment_t *
+segment_flush(segment_t *segment)
+{
+	int retval;
+
+	if (segment == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&segment->mutex);
+	retval = _segment_flush(segment);
+	pthread_mutex_unlock(&segment->mutex);
+
+	return retval == 0 ? segment : NULL;
+}
+
+/**
+ * Frees the memory allocated for the segment writer. The records added
+ * to the segment writer are written first. The stream is not closed.
+ *
+ * @param [in] segment The segment writer.
+ * @return The segment writer.
+ */
+segment_t *
+segment_free(segment_t *segment)
+{
+	if (segment == NULL)
+		return NULL;
+
+	if (segment->records != NULL && segment->raw != NULL && segment->out != NULL)
+		_segment_flush(segment);
+
+	free(segment->records);
+	free(segment->raw);
+	free(segment->out);
+	pthread_mutex_destroy(&segment->mutex);
+	free(segment);
+
+	return NULL;
+}
+
+/**
+ * Creates a segment writer. Records are buffered, transposed into columns,
+ * delta- and varint-encoded and compressed by segments of a given number
+ * of records. The stream must be positioned after SEGMENT_MAGIC.
+ *
+ * @param [in] stream The stream.
+ * @param [in] capacity The number of records of a segment.
+ * @return A segment writer.
+ * @see segment_decode
+ */
+segment_t *
+segment_new(FILE *stream, size_t capacity)
+{
+	segment_t *segment;
+
+	if (stream == NULL || capacity == 0 || capacity > UINT32_MAX / MAXRECORDSIZE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	segment = calloc(1, sizeof(*segment));
+	if (segment == NULL)
+		return NULL;
+
+	errno = pthread_mutex_init(&segment->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	/* The compressor expands incompressible columns by 1/255 at most */
+	segment->records = calloc(capacity, sizeof(*segment->records));
+	segment->raw = malloc(capacity * MAXRECORDSIZE);
+	segment->out = malloc(capacity * MAXRECORDSIZE + capacity * MAXRECORDSIZE / 255 + SLACK);
+	if (segment->records == NULL || segment->raw == NULL || segment->out == NULL)
+		goto err;
+
+	segment->stream = stream;
+	segment->capacity = capacity;
+	segment_ref(segment);
+
+	return segment;
+
+err:
+	segment_free(segment);
+
+	return NULL;
+}
+
+/**
+ * Sets the index the segment writer adds entries to. Records are indexed
+ * by the offset of their segment, as the segment is written.
+ *
+ * @param [in] segment The segment writer.
+ * @param [in] index The stream of the index, or NULL.
+ * @param [in] interval The number of iterations between entries.
+ * @return The segment writer.
+ */
+segment_t *
+segment_set_index(segment_t *segment, FILE *index, uint64_t interval)
+{
+	if (segment == NULL || (index != NULL && interval == 0)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&segment->mutex);
+	segment->index = index;
+	segment->interval = interval;
+	pthread_mutex_unlock(&segment->mutex);
+
+	return segment;
+}
+
+/**
+ * Increments the reference count of the segment writer.
+ *
+ * @param [in] segment The segment writer.
+ * @return The segment writer.
+ */
+segment_t *
+segment_ref(segment_t *segment)
+{
+	if (segment == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&segment->mutex);
+	segment->refcount++;
+	pthread_mutex_unlock(&segment->mutex);
+
+	return segment;
+}
+
+/**
+ * Decrements the reference count of the segment writer.
+ *
+ * @param [in] segment The segment writer.
+ */
+void
+segment_unref(segment_t *segment)
+{
+	if (segment == NULL)
+		return;
+
+	pthread_mutex_lock(&segment->mutex);
+	segment->refcount--;
+	if (segment->refcount > 0) {
+		pthread_mutex_unlock(&segment->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&segment->mutex);
+	segment_free(segment);
+}
+
+static uint32_t
+_segment_checksum(const uint8_t *data, size_t size)
+{
+	uint32_t hash;
+	size_t i;
+
+	hash = 0x811c9dc5;
+	for (i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+/*
+ * Compresses a buffer as a sequence of literal runs and matches within a
+ * 64 KiB window. Every sequence starts with a token whose high and low
+ * nibbles are the length of the literals and the length of the match
+ * minus MINMATCH, extended by bytes of 255 if 15; then come the literals
+ * and the 16-bit offset of the match. The last sequence has no match.
+ */
+static size_t
+_segment_compress(const uint8_t *src, size_t size, uint8_t *dest)
+{
+	uint32_t table[1 << HASH_ORDER];
+	const uint8_t *anchor;
+	const uint8_t *ptr;
+	const uint8_t *match;
+	const uint8_t *limit;
+	const uint8_t *end;
+	uint8_t *out;
+	uint8_t *token;
+	uint32_t word;
+	uint32_t hash;
+	size_t literals;
+	size_t length;
+
+	memset(table, 0, sizeof(table));
+	out = dest;
+	anchor = src;
+	ptr = src;
+	end = src + size;
+	limit = size > MINMATCH + 8 ? end - (MINMATCH + 8) : src;
+	while (ptr < limit) {
+		memcpy(&word, ptr, sizeof(word));
+		hash = (word * 2654435761U) >> (32 - HASH_ORDER);
+		match = src + table[hash];
+		table[hash] = ptr - src;
+		if (match >= ptr || ptr - match > MAXWINDOW || memcmp(match, ptr, MINMATCH) != 0) {
+			/* Runs of incompressible bytes are skipped faster and faster */
+			ptr += 1 + ((ptr - anchor) >> 6);
+			continue;
+		}
+
+		for (length = MINMATCH; ptr + length < end && match[length] == ptr[length]; length++)
+			;
+
+		literals = ptr - anchor;
+		token = out++;
+		*token = (literals < 15 ? literals : 15) << 4;
+		if (literals >= 15) {
+			for (literals -= 15; literals >= 255; literals -= 255)
+				*out++ = 255;
+
+			*out++ = literals;
+		}
+
+		memcpy(out, anchor, ptr - anchor);
+		out += ptr - anchor;
+		*out++ = (ptr - match) & 0xff;
+		*out++ = (ptr - match) >> 8;
+		ptr += length;
+		anchor = ptr;
+		length -= MINMATCH;
+		*token |= length < 15 ? length : 15;
+		if (length >= 15) {
+			for (length -= 15; length >= 255; length -= 255)
+				*out++ = 255;
+
+			*out++ = length;
+		}
+	}
+
+	literals = end - anchor;
+	*out++ = (literals < 15 ? literals : 15) << 4;
+	if (literals >= 15) {
+		for (literals -= 15; literals >= 255; literals -= 255)
+			*out++ = 255;
+
+		*out++ = literals;
+	}
+
+	memcpy(out, anchor, end - anchor);
+	out += end - anchor;
+
+	return out - dest;
+}
+
+/*
+ * The destination has SLACK bytes past its capacity, so matches that do
+ * not overlap their source are copied 8 bytes at a time.
+ */
+static size_t
+_segment_decompress(const uint8_t *src, size_t size, uint8_t *dest, size_t capacity)
+{
+	const uint8_t *end;
+	const uint8_t *match;
+	uint8_t *out;
+	uint8_t *limit;
+	size_t literals;
+	size_t length;
+	size_t offset;
+	uint8_t token;
+	size_t i;
+
+	end = src + size;
+	out = dest;
+	limit = dest + capacity;
+	while (src < end) {
+		token = *src++;
+		literals = token >> 4;
+		if (literals == 15) {
+			do {
+				if (src == end)
+					return 0;
+
+				literals += *src;
+			} while (*src++ == 255);
+		}
+
+		if (literals > end - src || literals > limit - out)
+			return 0;
+
+		memcpy(out, src, literals);
+		out += literals;
+		src += literals;
+		if (src == end)
+			break;
+
+		if (end - src < 2)
+			return 0;
+
+		offset = src[0] | (src[1] << 8);
+		src += 2;
+		length = (token & 15) + MINMATCH;
+		if ((token & 15) == 15) {
+			do {
+				if (src == end)
+					return 0;
+
+				length += *src;
+			} while (*src++ == 255);
+		}
+
+		if (offset == 0 || offset > out - dest || length > limit - out)
+			return 0;
+
+		match = out - offset;
+		if (offset >= 8) {
+			for (i = 0; i < length; i += 8)
+				memcpy(out + i, match + i, 8);
+		} else {
+			for (i = 0; i < length; i++)
+				out[i] = match[i];
+		}
+
+		out += length;
+	}
+
+	return out - dest;
+}
+
+static int
+_segment_flush(segment_t *segment)
+{
+	struct segment_header header;
+	struct log_index_entry entry;
+	struct context context;
+	struct log_record *record;
+	uint64_t value;
+	off_t position;
+	uint8_t *ptr;
+	size_t lane;
+	size_t n;
+	size_t i;
+
+	n = segment->num_records;
+	if (n == 0)
+		return 0;
+
+	record = segment->records;
+	_segment_init(&context);
+	ptr = segment->raw;
+	/* States are drawn from the same generator, some steps apart */
+	for (i = 0; i < n; i++) {
+		if ((context.state & ~LCG_MASK) == (record[i].state & ~LCG_MASK))
+			ptr = _segment_put(ptr, _segment_steps(&context, context.state, record[i].state) + 1);
+		else {
+			ptr = _segment_put(ptr, 0);
+			memcpy(ptr, &record[i].state, sizeof(record[i].state));
+			ptr += sizeof(record[i].state);
+		}
+
+		context.state = record[i].state;
+	}
+
+	for (i = 0; i < n; i++) {
+		lane = record[i].thread % NUM_LANES;
+		value = record[i].iteration - context.iterations[lane];
+		ptr = _segment_put(ptr, (value << 1) ^ -(value >> 63));
+		context.iterations[lane] = record[i].iteration;
+	}
+
+	for (i = 0; i < n; i++) {
+		value = (int64_t)(int32_t)(record[i].time - context.time);
+		ptr = _segment_put(ptr, (value << 1) ^ -(value >> 63));
+		context.time = record[i].time;
+	}
+
+	for (i = 0; i < n; i++)
+		ptr = _segment_put(ptr, record[i].thread);
+
+	for (i = 0; i < n; i++)
+		ptr = _segment_put(ptr, record[i].data);
+
+	for (i = 0; i < n; i++)
+		ptr = _segment_put(ptr, record[i].extra);
+
+	for (i = 0; i < n; i++) {
+		value = (int64_t)(int16_t)(record[i].port - context.port);
+		ptr = _segment_put(ptr, (value << 1) ^ -(value >> 63));
+		context.port = record[i].port;
+	}
+
+	for (i = 0; i < n; i++)
+		ptr = _segment_put(ptr, record[i].count);
+
+	for (i = 0; i < n; i++)
+		ptr = _segment_put(ptr, record[i].func);
+
+	for (i = 0; i < n; i++)
+		ptr = _segment_put(ptr, record[i].value);
+
+	header.num_records = n;
+	header.raw_size = ptr - segment->raw;
+	header.size = _segment_compress(segment->raw, header.raw_size, segment->out);
+	header.checksum = _segment_checksum(segment->out, header.size);
+	segment->num_records = 0;
+	/* The stream may be in append mode, whose position is only known at the end */
+	position = -1;
+	if (segment->index != NULL && fseeko(segment->stream, 0, SEEK_END) == 0)
+		position = ftello(segment->stream);
+
+	if (fwrite(&header, sizeof(header), 1, segment->stream) != 1 ||
+	    fwrite(segment->out, header.size, 1, segment->stream) != 1 ||
+	    fflush(segment->stream) == EOF)
+		return -1;
+
+	if (position == -1)
+		return 0;
+
+	entry.offset = position;
+	for (i = 0; i < n; i++) {
+		if (record[i].iteration % segment->interval != 0)
+			continue;
+
+		entry.iteration = record[i].iteration;
+		entry.time = record[i].time;
+		entry.thread = record[i].thread;
+		fwrite(&entry, sizeof(entry), 1, segment->index);
+	}
+
+	return fflush(segment->index) == EOF ? -1 : 0;
+}
+
+static const uint8_t *
+_segment_get(const uint8_t *ptr, const uint8_t *end, uint64_t *value)
+{
+	unsigned int shift;
+
+	*value = 0;
+	for (shift = 0; ptr < end && shift < 64; shift += 7) {
+		*value |= (uint64_t)(*ptr & 0x7f) << shift;
+		if ((*ptr++ & 0x80) == 0)
+			return ptr;
+	}
+
+	return NULL;
+}
+
+static void
+_segment_init(struct context *context)
+{
+	size_t i;
+
+	memset(context, 0, sizeof(*context));
+	context->multipliers[0] = LCG_A;
+	context->increments[0] = LCG_C;
+	for (i = 1; i < LCG_BITS; i++) {
+		context->multipliers[i] = (context->multipliers[i - 1] * context->multipliers[i - 1]) & LCG_MASK;
+		context->increments[i] = (context->increments[i - 1] * (context->multipliers[i - 1] + 1)) & LCG_MASK;
+	}
+}
+
+/* Advances the generator by a number of steps, in a step per bit */
+static uint64_t
+_segment_jump(const struct context *context, uint64_t state, uint64_t steps)
+{
+	uint64_t x;
+	size_t i;
+
+	x = state & LCG_MASK;
+	for (i = 0; i < LCG_BITS && steps != 0; i++, steps >>= 1) {
+		if (steps & 1)
+			x = (x * context->multipliers[i] + context->increments[i]) & LCG_MASK;
+	}
+
+	return (state & ~LCG_MASK) | x;
+}
+
+static uint8_t *
+_segment_put(uint8_t *ptr, uint64_t value)
+{
+	while (value >= 0x80) {
+		*ptr++ = value | 0x80;
+		value >>= 7;
+	}
+
+	*ptr++ = value;
+
+	return ptr;
+}
+
+/*
+ * Returns the number of steps from a state to another. The generator has
+ * full period, so the low i bits of a state repeat every 2^i steps, and
+ * the number of steps is found bit by bit: a jump of 2^i steps flips bit
+ * i of the state and leaves the bits below it as they are.
+ */
+static uint64_t
+_segment_steps(const struct context *context, uint64_t from, uint64_t to)
+{
+	uint64_t steps;
+	uint64_t bit;
+	uint64_t x;
+	uint64_t y;
+	size_t i;
+
+	/* Both sides are computed, so the bits of the states do not mispredict branches */
+	steps = 0;
+	x = from & LCG_MASK;
+	for (i = 0; i < LCG_BITS; i++) {
+		bit = ((x ^ to) >> i) & 1;
+		y = (x * context->multipliers[i] + context->increments[i]) & LCG_MASK;
+		x = bit ? y : x;
+		steps |= bit << i;
+	}
+
+	return steps;
+}
@@ -0,0 +1,47 @@
+/** @file */
+
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include "array.h"
+#include "log.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SEGMENT_CAPACITY 65536 /**< Default number of records of a segment. */
+#define SEGMENT_MAGIC "IOFZSEG1" /**< Magic number of segmented logs. */
+
+/**
+ * Segment header. A segmented log is SEGMENT_MAGIC followed by segments,
+ * a segment header followed by the compressed columns of its records, in
+ * host byte order.
+ */
+struct segment_header {
+	uint32_t num_records; /**< The number of records. */
+	uint32_t raw_size;    /**< The size of the columns before compression. */
+	uint32_t size;        /**< The size of the compressed columns. */
+	uint32_t checksum;    /**< The FNV-1a hash of the compressed columns. */
+};
+
+typedef struct segment segment_t; /**< Log segment writer. */
+
+segment_t *segment_add(segment_t *segment, const struct log_record *record);
+size_t segment_decode(const char *data, size_t size, array_t *records);
+segment_t *segment_flush(segment_t *segment);
+segment_t *segment_free(segment_t *segment);
+segment_t *segment_new(FILE *stream, size_t capacity);
+segment_t *segment_ref(segment_t *segment);
+segment_t *segment_set_index(segment_t *segment, FILE *index, uint64_t interval);
+void segment_unref(segment_t *segment);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SEGMENT_H */
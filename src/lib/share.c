@@ -0,0 +1,628 @@
+/** @file */
+
+#include "array.h"
+#include "lockstat.h"
+#include "share.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NUM_ENTRIES 256 /* Number of manifest entries read at once */
+
+struct share {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	char *directory;
+	int manifest;
+	char *mark_path;
+	uint64_t mark;
+	uint64_t *hashes;
+	size_t num_hashes;
+	size_t capacity;
+};
+
+static const char *types[] = { "corpus", "dictionary" };
+
+static share_t *_share_add(share_t *share, uint64_t hash);
+static int _share_contains(share_t *share, uint64_t hash);
+static share_t *_share_load_mark(share_t *share);
+static char *_share_path(share_t *share, int type, const char *name);
+static void _share_save_mark(share_t *share);
+
+/**
+ * Adds a hash to the known hashes of the shared directory, such as the
+ * hash of a local corpus entry, so the entry is neither published nor
+ * imported.
+ *
+ * @param [in] share The shared directory.
+ * @param [in] hash The hash.
+ * @return The shared directory.
+ * @see share_hash
+ */
+share_t *
+share_add(share_t *share, uint64_t hash)
+{
+	share_t *retval;
+
+	if (share == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&share->mutex);
+	retval = _share_add(share, hash);
+	pthread_mutex_unlock(&share->mutex);
+
+	return retval;
+}
+
+/**
+ * Returns whether a hash is known to the shared directory, because its
+ * entry was added, published or imported.
+ *
+ * @param [in] share The shared directory.
+ * @param [in] hash The hash.
+ * @return 1 if the hash is known, 0 otherwise.
+ */
+int
+share_contains(share_t *share, uint64_t hash)
+{
+	int retval;
+
+	if (share == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&share->mutex);
+	retval = _share_contains(share, hash);
+	pthread_mutex_unlock(&share->mutex);
+
+	return retval;
+}
+
+/**
+ * Frees the memory allocated for the shared directory. The shared
+ * directory itself is left as is.
+ *
+ * @param [in] share The shared directory.
+ * @return The shared directory.
+ */
+share_t *
+share_free(share_t *share)
+{
+	if (share == NULL)
+		return NULL;
+
+	if (share->manifest != -1)
+		close(share->manifest);
+
+	free(share->directory);
+	free(share->mark_path);
+	free(share->hashes);
+	pthread_mutex_destroy(&share->mutex);
+	free(share);
+
+	return NULL;
+}
+
+/**
+ * Returns the high-water mark of the shared directory, the offset in the
+ * manifest up to which entries were imported.
+ *
+ * @param [in] share The shared directory.
+ * @return The high-water mark.
+ * @see share_import
+ */
+uint64_t
+share_get_mark(share_t *share)
+{
+	uint64_t mark;
+
+	if (share == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&share->mutex);
+	mark = share->mark;
+	pthread_mutex_unlock(&share->mutex);
+
+	return mark;
+}
+
+/**
+ * Returns the FNV-1a hash of given contents. Entries are named after the
+ * hash of their contents, as are corpus entries.
+ *
+ * @param [in] data The contents.
+ * @param [in] size The size of the contents.
+ * @return The hash.
+ */
+uint64_t
+share_hash(const void *data, size_t size)
+{
+	uint64_t hash;
+	size_t i;
+
+	hash = 0xcbf29ce484222325ULL;
+	for (i = 0; i < size; i++)
+		hash = (hash ^ ((const unsigned char *)data)[i]) * 0x100000001b3ULL;
+
+	return hash;
+}
+
+/**
+ * Imports the entries published to the shared directory since the last
+ * import. The manifest is read from the high-water mark; entries with a
+ * known hash, such as the entries published by the caller, are skipped,
+ * and the others are mapped in memory, checked against their hash and
+ * appended to the items. Nothing is copied, and nobody waits on the
+ * publishers. The high-water mark of an agent is saved once the entries
+ * are read.
+ *
+ * @param [in] share The shared directory.
+ * @param [in,out] items An array of struct share_item.
+ * @param [in] count The maximum number of entries to import.
+ * @return The number of entries imported.
+ * @see share_release
+ */
+size_t
+share_import(share_t *share, array_t *items, size_t count)
+{
+	struct share_entry entries[NUM_ENTRIES];
+	struct share_item item;
+	struct stat st;
+	char name[sizeof("0123456789abcdef")];
+	char *path;
+	void *data;
+	uint64_t mark;
+	ssize_t size;
+	size_t num_imported;
+	size_t i;
+	int fd;
+
+	if (share == NULL || items == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	num_imported = 0;
+	pthread_mutex_lock(&share->mutex);
+	mark = share->mark;
+	while (num_imported < count) {
+		/* A partially appended entry is left for the next import */
+		size = pread(share->manifest, entries, sizeof(entries), share->mark);
+		if (size < (ssize_t)sizeof(entries[0]))
+			break;
+
+		for (i = 0; i < size / sizeof(entries[0]) && num_imported < count; i++) {
+			share->mark += sizeof(entries[0]);
+			if (entries[i].type >= SHARE_NUM_TYPES || entries[i].size == 0 || _share_contains(share, entries[i].hash))
+				continue;
+
+			sprintf(name, "%016llx", (unsigned long long)entries[i].hash);
+			path = _share_path(share, entries[i].type, name);
+			fd = path != NULL ? open(path, O_RDONLY) : -1;
+			free(path);
+			if (fd == -1)
+				continue;
+
+			data = MAP_FAILED;
+			if (fstat(fd, &st) == 0 && st.st_size == entries[i].size)
+				data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+			close(fd);
+			if (data == MAP_FAILED)
+				continue;
+
+			if (share_hash(data, entries[i].size) != entries[i].hash) {
+				munmap(data, entries[i].size);
+				continue;
+			}
+
+			item.entry = entries[i];
+			item.data = data;
+			if (array_append_val(items, &item) == NULL) {
+				munmap(data, entries[i].size);
+				share->mark -= sizeof(entries[0]);
+				goto out;
+			}
+
+			_share_add(share, entries[i].hash);
+			num_imported++;
+		}
+	}
+
+out:
+	if (share->mark != mark)
+		_share_save_mark(share);
+
+	pthread_mutex_unlock(&share->mutex);
+
+	return num_imported;
+}
+
+/**
+ * Opens a shared directory, and creates it if it does not exist. A shared
+ * directory holds a directory per type of entry, with the entries named
+ * after the hash of their contents, the manifest, and the high-water mark
+ * of every agent, in .mark-<id>. An agent picks up where it left off: its
+ * mark is loaded, and the hashes of the manifest entries before it are
+ * known again, so those entries are neither imported nor published again.
+ *
+ * @param [in] directory The path of the shared directory.
+ * @param [in] id The identifier of the agent, or NULL for a mark kept
+ *   only in memory.
+ * @return A shared directory.
+ */
+share_t *
+share_new(const char *directory, const char *id)
+{
+	share_t *share;
+	char *path;
+	int i;
+
+	if (directory == NULL || (id != NULL && (*id == '\0' || strchr(id, '/') != NULL))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	share = calloc(1, sizeof(*share));
+	if (share == NULL)
+		return NULL;
+
+	share->manifest = -1;
+	errno = pthread_mutex_init(&share->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	share->directory = strdup(directory);
+	if (share->directory == NULL)
+		goto err;
+
+	if (mkdir(directory, 0755) == -1 && errno != EEXIST)
+		goto err;
+
+	for (i = 0; i < SHARE_NUM_TYPES; i++) {
+		path = _share_path(share, i, NULL);
+		if (path == NULL)
+			goto err;
+
+		if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+			free(path);
+			goto err;
+		}
+
+		free(path);
+	}
+
+	path = _share_path(share, -1, SHARE_MANIFEST);
+	if (path == NULL)
+		goto err;
+
+	/* Entries are small enough for appends never to interleave */
+	share->manifest = open(path, O_RDWR | O_APPEND | O_CREAT, 0644);
+	free(path);
+	if (share->manifest == -1)
+		goto err;
+
+	if (id != NULL) {
+		share->mark_path = malloc(strlen(directory) + strlen(id) + sizeof("/.mark-"));
+		if (share->mark_path == NULL)
+			goto err;
+
+		sprintf(share->mark_path, "%s/.mark-%s", directory, id);
+		if (_share_load_mark(share) == NULL)
+			goto err;
+	}
+
+	share_ref(share);
+
+	return share;
+
+err:
+	share_free(share);
+
+	return NULL;
+}
+
+/**
+ * Publishes an entry to the shared directory. The contents are written
+ * under their hash, then appended to the manifest, so an entry in the
+ * manifest is always complete. Entries with a known hash are not
+ * published again.
+ *
+ * @param [in] share The shared directory.
+ * @param [in] type The type of the entry.
+ * @param [in] data The contents of the entry.
+ * @param [in] size The size of the contents.
+ * @return The shared directory.
+ */
+share_t *
+share_publish(share_t *share, int type, const void *data, size_t size)
+{
+	struct share_entry entry;
+	char name[sizeof("0123456789abcdef")];
+	char *tmp;
+	char *path;
+	int retval;
+	int fd;
+
+	if (share == NULL || type < 0 || type >= SHARE_NUM_TYPES || data == NULL || size == 0 || size > UINT32_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	memset(&entry, 0, sizeof(entry));
+	entry.hash = share_hash(data, size);
+	entry.type = type;
+	entry.size = size;
+	pthread_mutex_lock(&share->mutex);
+	if (_share_contains(share, entry.hash)) {
+		pthread_mutex_unlock(&share->mutex);
+		return share;
+	}
+
+	sprintf(name, "%016llx", (unsigned long long)entry.hash);
+	tmp = _share_path(share, type, ".tmp-XXXXXX");
+	path = _share_path(share, type, name);
+	retval = -1;
+	fd = tmp != NULL && path != NULL ? mkstemp(tmp) : -1;
+	if (fd != -1) {
+		if (write(fd, data, size) == (ssize_t)size && close(fd) == 0)
+			retval = rename(tmp, path);
+		else
+			close(fd);
+
+		if (retval == -1)
+			unlink(tmp);
+	}
+
+	if (retval == 0 && write(share->manifest, &entry, sizeof(entry)) != sizeof(entry))
+		retval = -1;
+
+	if (retval == 0 && _share_add(share, entry.hash) == NULL)
+		retval = -1;
+
+	pthread_mutex_unlock(&share->mutex);
+	free(tmp);
+	free(path);
+
+	return retval == 0 ? share : NULL;
+}
+
+/**
+ * Increments the reference count of the shared directory.
+ *
+ * @param [in] share The shared directory.
+ * @return The shared directory.
+ */
+share_t *
+share_ref(share_t *share)
+{
+	if (share == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&share->mutex);
+	share->refcount++;
+	pthread_mutex_unlock(&share->mutex);
+
+	return share;
+}
+
+/**
+ * Unmaps an imported entry.
+ *
+ * @param [in] item The imported entry.
+ * @see share_import
+ */
+void
+share_release(struct share_item *item)
+{
+	if (item == NULL || item->data == NULL)
+		return;
+
+	munmap((void *)item->data, item->entry.size);
+	item->data = NULL;
+}
+
+/**
+ * Decrements the reference count of the shared directory.
+ *
+ * @param [in] share The shared directory.
+ */
+void
+share_unref(share_t *share)
+{
+	if (share == NULL)
+		return;
+
+	pthread_mutex_lock(&share->mutex);
+	share->refcount--;
+	if (share->refcount > 0) {
+		pthread_mutex_unlock(&share->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&share->mutex);
+	share_free(share);
+}
+
+/*
+ * Known hashes are kept in an open addressing table, doubled when half
+ * full. Zero marks an empty slot, so the hash zero is kept as one.
+ */
+static share_t *
+_share_add(share_t *share, uint64_t hash)
+{
+	uint64_t *hashes;
+	size_t capacity;
+	size_t i;
+	size_t j;
+
+	hash += hash == 0;
+	if (_share_contains(share, hash))
+		return share;
+
+	if ((share->num_hashes + 1) * 2 > share->capacity) {
+		capacity = share->capacity != 0 ? share->capacity * 2 : 1024;
+		hashes = calloc(capacity, sizeof(*hashes));
+		if (hashes == NULL)
+			return NULL;
+
+		for (i = 0; i < share->capacity; i++) {
+			if (share->hashes[i] == 0)
+				continue;
+
+			for (j = share->hashes[i] & (capacity - 1); hashes[j] != 0; j = (j + 1) & (capacity - 1))
+				;
+
+			hashes[j] = share->hashes[i];
+		}
+
+		free(share->hashes);
+		share->hashes = hashes;
+		share->capacity = capacity;
+	}
+
+	for (i = hash & (share->capacity - 1); share->hashes[i] != 0; i = (i + 1) & (share->capacity - 1))
+		;
+
+	share->hashes[i] = hash;
+	share->num_hashes++;
+
+	return share;
+}
+
+static int
+_share_contains(share_t *share, uint64_t hash)
+{
+	size_t i;
+
+	if (share->capacity == 0)
+		return 0;
+
+	hash += hash == 0;
+	for (i = hash & (share->capacity - 1); share->hashes[i] != 0; i = (i + 1) & (share->capacity - 1)) {
+		if (share->hashes[i] == hash)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * A mark past the end of the manifest, as left by a manifest removed
+ * since, starts over.
+ */
+static share_t *
+_share_load_mark(share_t *share)
+{
+	struct share_entry entries[NUM_ENTRIES];
+	struct stat st;
+	char buffer[32];
+	uint64_t offset;
+	ssize_t size;
+	size_t i;
+	int fd;
+
+	fd = open(share->mark_path, O_RDONLY);
+	if (fd == -1)
+		return errno == ENOENT ? share : NULL;
+
+	size = read(fd, buffer, sizeof(buffer) - 1);
+	close(fd);
+	if (size == -1)
+		return NULL;
+
+	buffer[size] = '\0';
+	share->mark = strtoull(buffer, NULL, 10);
+	share->mark -= share->mark % sizeof(entries[0]);
+	if (fstat(share->manifest, &st) == -1)
+		return NULL;
+
+	if (share->mark > (uint64_t)st.st_size)
+		share->mark = 0;
+
+	for (offset = 0; offset < share->mark; offset += size) {
+		size = pread(share->manifest, entries, sizeof(entries), offset);
+		if (size < (ssize_t)sizeof(entries[0]))
+			return NULL;
+
+		size -= size % sizeof(entries[0]);
+		for (i = 0; i < size / sizeof(entries[0]) && offset + i * sizeof(entries[0]) < share->mark; i++) {
+			if (_share_add(share, entries[i].hash) == NULL)
+				return NULL;
+		}
+	}
+
+	return share;
+}
+
+static char *
+_share_path(share_t *share, int type, const char *name)
+{
+	char *path;
+
+	path = malloc(strlen(share->directory) + sizeof("/dictionary/") + (name != NULL ? strlen(name) : 0));
+	if (path == NULL)
+		return NULL;
+
+	if (type == -1)
+		sprintf(path, "%s/%s", share->directory, name);
+	else if (name == NULL)
+		sprintf(path, "%s/%s", share->directory, types[type]);
+	else
+		sprintf(path, "%s/%s/%s", share->directory, types[type], name);
+
+	return path;
+}
+
+/*
+ * The mark is written to a temporary file renamed over the last one, so
+ * it is never seen half written. A mark that fails to be saved is only
+ * saved again at the next import.
+ */
+static void
+_share_save_mark(share_t *share)
+{
+	char buffer[32];
+	char *tmp;
+	int retval;
+	int length;
+	int fd;
+
+	if (share->mark_path == NULL)
+		return;
+
+	tmp = malloc(strlen(share->mark_path) + sizeof(".tmp"));
+	if (tmp == NULL)
+		return;
+
+	sprintf(tmp, "%s.tmp", share->mark_path);
+	retval = -1;
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd != -1) {
+		length = sprintf(buffer, "%llu\n", (unsigned long long)share->mark);
+		if (write(fd, buffer, length) == length && close(fd) == 0)
+			retval = rename(tmp, share->mark_path);
+		else
+			close(fd);
+
+		if (retval == -1)
+			unlink(tmp);
+	}
+
+	free(tmp);
+}
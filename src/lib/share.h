@@ -0,0 +1,59 @@
+/** @file */
+
+#ifndef SHARE_H
+#define SHARE_H
+
+#include "array.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHARE_MANIFEST "MANIFEST" /**< Name of the manifest of a shared directory. */
+
+enum {
+	SHARE_TYPE_CORPUS,     /**< A corpus entry, an array of states. */
+	SHARE_TYPE_DICTIONARY, /**< A dictionary, an array of struct iofuzzer_token. */
+	SHARE_NUM_TYPES
+};
+
+/**
+ * Entry of the manifest. The manifest is the sequence of the entries
+ * published to a shared directory, in the order they were published.
+ */
+struct share_entry {
+	uint64_t hash; /**< The FNV-1a hash of the contents, and the name of the file. */
+	uint32_t type; /**< The type of the entry. */
+	uint32_t size; /**< The size of the contents. */
+};
+
+/**
+ * Entry imported from a shared directory, mapped in memory.
+ */
+struct share_item {
+	struct share_entry entry; /**< The entry of the manifest. */
+	const void *data;         /**< The contents of the entry. */
+};
+
+typedef struct share share_t; /**< Shared directory of corpus entries and dictionaries. */
+
+share_t *share_add(share_t *share, uint64_t hash);
+int share_contains(share_t *share, uint64_t hash);
+share_t *share_free(share_t *share);
+uint64_t share_get_mark(share_t *share);
+uint64_t share_hash(const void *data, size_t size);
+size_t share_import(share_t *share, array_t *items, size_t count);
+share_t *share_new(const char *directory, const char *id);
+share_t *share_publish(share_t *share, int type, const void *data, size_t size);
+share_t *share_ref(share_t *share);
+void share_release(struct share_item *item);
+void share_unref(share_t *share);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHARE_H */
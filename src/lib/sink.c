@@ -0,0 +1,623 @@
+/** @file */
+
+#include "lockstat.h"
+#include "sink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/vm_sockets.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+struct sink {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	pthread_cond_t pending;
+	pthread_cond_t drained;
+	pthread_t thread;
+	int started;
+	int stop;
+	int error;
+	int fd;
+	char *ring;
+	size_t capacity;
+	uint64_t head;
+	uint64_t tail;
+	uint64_t stalls;
+	uint64_t dropped;
+};
+
+static int _sink_address(const char *address, struct sockaddr_storage *addr, socklen_t *addrlen);
+static uint32_t _sink_checksum(const char *data, size_t length);
+static void _sink_copy(sink_t *sink, const void *data, size_t length);
+static void *_sink_drain(void *arg);
+static int _sink_open(const char *address, int flags);
+static int _sink_write_all(int fd, const char *data, size_t length);
+
+/**
+ * Opens the receiving end of a sink. An address is "unix:PATH" or
+ * "vsock:CID:PORT", to accept a single connection on a Unix or vsock
+ * socket, or the path of a device, such as the host end of a serial or
+ * hvc console or a pty, which is put in raw mode.
+ *
+ * @param [in] address The address.
+ * @return A file descriptor, or -1 on error.
+ * @see sink_connect
+ */
+int
+sink_accept(const char *address)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int listener;
+	int fd;
+
+	if (address == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	switch (_sink_address(address, &addr, &addrlen)) {
+	case -1:
+		return -1;
+
+	case 1:
+		return _sink_open(address, O_RDONLY);
+	}
+
+	if (addr.ss_family == AF_UNIX)
+		unlink(((struct sockaddr_un *)&addr)->sun_path);
+
+	listener = socket(addr.ss_family, SOCK_STREAM, 0);
+	if (listener == -1)
+		return -1;
+
+	if (bind(listener, (struct sockaddr *)&addr, addrlen) == -1 || listen(listener, 1) == -1) {
+		close(listener);
+		return -1;
+	}
+
+	fd = accept(listener, NULL, NULL);
+	close(listener);
+
+	return fd;
+}
+
+/**
+ * Opens the sending end of a sink, connecting to a Unix or vsock socket
+ * or opening a device.
+ *
+ * @param [in] address The address.
+ * @return A file descriptor, or -1 on error.
+ * @see sink_accept
+ */
+int
+sink_connect(const char *address)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int fd;
+
+	if (address == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	switch (_sink_address(address, &addr, &addrlen)) {
+	case -1:
+		return -1;
+
+	case 1:
+		return _sink_open(address, O_WRONLY);
+	}
+
+	fd = socket(addr.ss_family, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *)&addr, addrlen) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Decodes the next frame of a stream. Bytes that are not the start of a
+ * valid frame, such as the noise of a serial line or the tail of a frame
+ * cut by a crash, are skipped as a frame of type SINK_FRAME_NONE, so the
+ * decoder resynchronizes on the next valid frame.
+ *
+ * @param [in] buffer The buffer.
+ * @param [in] size The size of the buffer.
+ * @param [out] frame The frame.
+ * @return The number of bytes decoded, or 0 if the buffer does not hold a
+ *   complete frame yet.
+ */
+size_t
+sink_decode(const char *buffer, size_t size, struct sink_frame *frame)
+{
+	struct sink_frame_header header;
+	uint32_t magic = SINK_MAGIC;
+	size_t i;
+
+	if (buffer == NULL || frame == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (size < sizeof(header))
+		return 0;
+
+	memcpy(&header, buffer, sizeof(header));
+	if (header.magic != SINK_MAGIC) {
+		for (i = 1; i + sizeof(magic) <= size && memcmp(&buffer[i], &magic, sizeof(magic)) != 0; i++)
+			;
+
+		frame->type = SINK_FRAME_NONE;
+		frame->data = buffer;
+		frame->length = i;
+		return i;
+	}
+
+	if (size - sizeof(header) < header.length)
+		return 0;
+
+	frame->data = buffer + sizeof(header);
+	if (header.type == SINK_FRAME_NONE || _sink_checksum(frame->data, header.length) != header.checksum) {
+		frame->type = SINK_FRAME_NONE;
+		frame->data = buffer;
+		frame->length = 1;
+		return 1;
+	}
+
+	frame->type = header.type;
+	frame->length = header.length;
+
+	return sizeof(header) + header.length;
+}
+
+/**
+ * Waits until all the frames written to the sink have been written to its
+ * file descriptor, or dropped.
+ *
+ * @param [in] sink The sink.
+ * @return The sink.
+ */
+sink_t *
+sink_flush(sink_t *sink)
+{
+	if (sink == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&sink->mutex);
+	while (sink->tail != sink->head)
+		pthread_cond_wait(&sink->drained, &sink->mutex);
+
+	pthread_mutex_unlock(&sink->mutex);
+
+	return sink;
+}
+
+/**
+ * Frees the memory allocated for the sink. The frames written to the sink
+ * are written to its file descriptor first, and the file descriptor is
+ * closed.
+ *
+ * @param [in] sink The sink.
+ * @return The sink.
+ */
+sink_t *
+sink_free(sink_t *sink)
+{
+	if (sink == NULL)
+		return NULL;
+
+	if (sink->started) {
+		pthread_mutex_lock(&sink->mutex);
+		sink->stop = 1;
+		pthread_cond_signal(&sink->pending);
+		pthread_mutex_unlock(&sink->mutex);
+		pthread_join(sink->thread, NULL);
+	}
+
+	if (sink->fd != -1)
+		close(sink->fd);
+
+	free(sink->ring);
+	pthread_cond_destroy(&sink->pending);
+	pthread_cond_destroy(&sink->drained);
+	pthread_mutex_destroy(&sink->mutex);
+	free(sink);
+
+	return NULL;
+}
+
+/**
+ * Returns the number of bytes of frames dropped because the file
+ * descriptor of the sink failed.
+ *
+ * @param [in] sink The sink.
+ * @return The number of bytes dropped.
+ */
+uint64_t
+sink_get_dropped(sink_t *sink)
+{
+	uint64_t dropped;
+
+	if (sink == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&sink->mutex);
+	dropped = sink->dropped;
+	pthread_mutex_unlock(&sink->mutex);
+
+	return dropped;
+}
+
+/**
+ * Returns the number of times a writer waited for room in the ring buffer
+ * of the sink.
+ *
+ * @param [in] sink The sink.
+ * @return The number of times a writer waited.
+ */
+uint64_t
+sink_get_stalls(sink_t *sink)
+{
+	uint64_t stalls;
+
+	if (sink == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&sink->mutex);
+	stalls = sink->stalls;
+	pthread_mutex_unlock(&sink->mutex);
+
+	return stalls;
+}
+
+/**
+ * Creates a sink streaming frames to a file descriptor, such as a serial
+ * or hvc console, a vsock or Unix socket, or one end of a pty or a socket
+ * pair. Frames are written to a ring buffer, and a thread writes whatever
+ * the ring buffer holds to the file descriptor as one batch, so batches
+ * grow and shrink with the bandwidth of the device, and no frame is
+ * synced on its own. The sink takes ownership of the file descriptor.
+ *
+ * @param [in] fd The file descriptor.
+ * @param [in] capacity The size of the ring buffer in bytes.
+ * @return A sink.
+ */
+sink_t *
+sink_new(int fd, size_t capacity)
+{
+	sink_t *sink;
+
+	if (fd < 0 || capacity < sizeof(struct sink_frame_header) + SINK_MAXLENGTH) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	sink = calloc(1, sizeof(*sink));
+	if (sink == NULL)
+		return NULL;
+
+	sink->fd = -1;
+	errno = pthread_mutex_init(&sink->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	errno = pthread_cond_init(&sink->pending, NULL);
+	if (errno != 0)
+		goto err;
+
+	errno = pthread_cond_init(&sink->drained, NULL);
+	if (errno != 0)
+		goto err;
+
+	sink->ring = malloc(capacity);
+	if (sink->ring == NULL)
+		goto err;
+
+	sink->capacity = capacity;
+	sink->fd = fd;
+	errno = pthread_create(&sink->thread, NULL, &_sink_drain, sink);
+	if (errno != 0) {
+		sink->fd = -1;
+		goto err;
+	}
+
+	sink->started = 1;
+	sink_ref(sink);
+
+	return sink;
+
+err:
+	sink_free(sink);
+
+	return NULL;
+}
+
+/**
+ * Increments the reference count of the sink.
+ *
+ * @param [in] sink The sink.
+ * @return The sink.
+ */
+sink_t *
+sink_ref(sink_t *sink)
+{
+	if (sink == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&sink->mutex);
+	sink->refcount++;
+	pthread_mutex_unlock(&sink->mutex);
+
+	return sink;
+}
+
+/**
+ * Decrements the reference count of the sink.
+ *
+ * @param [in] sink The sink.
+ */
+void
+sink_unref(sink_t *sink)
+{
+	if (sink == NULL)
+		return;
+
+	pthread_mutex_lock(&sink->mutex);
+	sink->refcount--;
+	if (sink->refcount > 0) {
+		pthread_mutex_unlock(&sink->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&sink->mutex);
+	sink_free(sink);
+}
+
+/**
+ * Writes a frame to the sink. The frame is copied to the ring buffer of
+ * the sink, so the writer only waits when the ring buffer is full, which
+ * applies backpressure when the device cannot keep up. Once the file
+ * descriptor has failed, frames are dropped instead.
+ *
+ * @param [in] sink The sink.
+ * @param [in] type The type of the frame.
+ * @param [in] data The payload of the frame.
+ * @param [in] length The length of the payload.
+ * @return The sink, or NULL if the frame was dropped.
+ */
+sink_t *
+sink_write(sink_t *sink, int type, const void *data, size_t length)
+{
+	struct sink_frame_header header;
+	size_t size;
+
+	if (sink == NULL || type <= SINK_FRAME_NONE || type > UINT16_MAX || (data == NULL && length != 0) || length > SINK_MAXLENGTH) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	header.magic = SINK_MAGIC;
+	header.type = type;
+	header.length = length;
+	header.checksum = _sink_checksum(data, length);
+	size = sizeof(header) + length;
+	pthread_mutex_lock(&sink->mutex);
+	while (!sink->error && sink->capacity - (sink->head - sink->tail) < size) {
+		sink->stalls++;
+		pthread_cond_wait(&sink->drained, &sink->mutex);
+	}
+
+	if (sink->error) {
+		sink->dropped += size;
+		pthread_mutex_unlock(&sink->mutex);
+		errno = EPIPE;
+		return NULL;
+	}
+
+	_sink_copy(sink, &header, sizeof(header));
+	_sink_copy(sink, data, length);
+	pthread_cond_signal(&sink->pending);
+	pthread_mutex_unlock(&sink->mutex);
+
+	return sink;
+}
+
+static int
+_sink_address(const char *address, struct sockaddr_storage *addr, socklen_t *addrlen)
+{
+	struct sockaddr_un *un = (struct sockaddr_un *)addr;
+	struct sockaddr_vm *vm = (struct sockaddr_vm *)addr;
+	unsigned long cid;
+	unsigned long port;
+	char *end;
+
+	memset(addr, 0, sizeof(*addr));
+	if (strncmp(address, "unix:", 5) == 0) {
+		if (strlen(address + 5) >= sizeof(un->sun_path))
+			goto err;
+
+		un->sun_family = AF_UNIX;
+		strcpy(un->sun_path, address + 5);
+		*addrlen = sizeof(*un);
+		return 0;
+	}
+
+	if (strncmp(address, "vsock:", 6) == 0) {
+		cid = strtoul(address + 6, &end, 0);
+		if (*end != ':')
+			goto err;
+
+		port = strtoul(end + 1, &end, 0);
+		if (*end != '\0')
+			goto err;
+
+		vm->svm_family = AF_VSOCK;
+		vm->svm_cid = cid;
+		vm->svm_port = port;
+		*addrlen = sizeof(*vm);
+		return 0;
+	}
+
+	return 1;
+
+err:
+	errno = EINVAL;
+
+	return -1;
+}
+
+static uint32_t
+_sink_checksum(const char *data, size_t length)
+{
+	uint32_t hash;
+	size_t i;
+
+	hash = 0x811c9dc5;
+	for (i = 0; i < length; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+static void
+_sink_copy(sink_t *sink, const void *data, size_t length)
+{
+	size_t offset;
+	size_t n;
+
+	offset = sink->head % sink->capacity;
+	n = sink->capacity - offset < length ? sink->capacity - offset : length;
+	memcpy(&sink->ring[offset], data, n);
+	memcpy(sink->ring, (const char *)data + n, length - n);
+	sink->head += length;
+}
+
+/*
+ * Writes the ring buffer to the file descriptor until the sink is freed.
+ * The lock is only held to take the bytes pending, so writers append to
+ * the ring buffer while a batch is being written.
+ */
+static void *
+_sink_drain(void *arg)
+{
+	sink_t *sink = arg;
+	sigset_t set;
+	size_t offset;
+	size_t length;
+	int retval;
+
+	/* A closed socket fails the write with EPIPE instead of killing the process */
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	pthread_mutex_lock(&sink->mutex);
+	for (;;) {
+		while (sink->head == sink->tail && !sink->stop)
+			pthread_cond_wait(&sink->pending, &sink->mutex);
+
+		if (sink->head == sink->tail)
+			break;
+
+		offset = sink->tail % sink->capacity;
+		length = sink->head - sink->tail;
+		if (length > sink->capacity - offset)
+			length = sink->capacity - offset;
+
+		pthread_mutex_unlock(&sink->mutex);
+		retval = _sink_write_all(sink->fd, &sink->ring[offset], length);
+		pthread_mutex_lock(&sink->mutex);
+		if (retval == -1 && !sink->error) {
+			perror("sink");
+			sink->error = 1;
+		}
+
+		if (sink->error) {
+			sink->dropped += sink->head - sink->tail;
+			sink->tail = sink->head;
+		} else
+			sink->tail += length;
+
+		pthread_cond_broadcast(&sink->drained);
+	}
+
+	pthread_mutex_unlock(&sink->mutex);
+
+	return NULL;
+}
+
+static int
+_sink_open(const char *address, int flags)
+{
+	struct termios termios;
+	int fd;
+
+	fd = open(address, flags | O_NOCTTY);
+	if (fd == -1)
+		return -1;
+
+	/* Consoles must not translate or echo the frames */
+	if (isatty(fd) && tcgetattr(fd, &termios) == 0) {
+		cfmakeraw(&termios);
+		tcsetattr(fd, TCSANOW, &termios);
+	}
+
+	return fd;
+}
+
+static int
+_sink_write_all(int fd, const char *data, size_t length)
+{
+	struct pollfd pollfd;
+	ssize_t n;
+
+	while (length > 0) {
+		n = write(fd, data, length);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return -1;
+
+			/* Non-blocking devices are waited on until they drain */
+			pollfd.fd = fd;
+			pollfd.events = POLLOUT;
+			if (poll(&pollfd, 1, -1) == -1 && errno != EINTR)
+				return -1;
+
+			continue;
+		}
+
+		data += n;
+		length -= n;
+	}
+
+	return 0;
+}
@@ -0,0 +1,69 @@
+/** @file */
+
+#ifndef SINK_H
+#define SINK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SINK_CAPACITY (1 << 20) /**< Default size of the ring buffer of a sink. */
+#define SINK_MAGIC 0x5a464f49 /**< Magic number of frames, "IOFZ" in little endian. */
+#define SINK_MAXLENGTH 65535 /**< Maximum length of the payload of a frame. */
+
+enum {
+	SINK_FRAME_NONE,  /**< Bytes skipped to resynchronize on the next frame. */
+	SINK_FRAME_HEAD,  /**< The part of a log record written before the operation is performed. */
+	SINK_FRAME_VALUE, /**< The thread number and the value returned by the operation. */
+};
+
+/**
+ * Frame header. A stream is a sequence of frames, a frame header followed
+ * by its payload, in host byte order.
+ */
+struct sink_frame_header {
+	uint32_t magic;    /**< The magic number. */
+	uint16_t type;     /**< The type of the frame. */
+	uint16_t length;   /**< The length of the payload. */
+	uint32_t checksum; /**< The FNV-1a hash of the payload. */
+};
+
+/**
+ * Frame decoded from a stream.
+ */
+struct sink_frame {
+	int type;         /**< The type of the frame. */
+	const char *data; /**< The payload of the frame. */
+	size_t length;    /**< The length of the payload. */
+};
+
+/**
+ * Payload of a value frame.
+ */
+struct sink_value {
+	uint32_t thread; /**< The thread number. */
+	uint32_t value;  /**< The value returned by the operation. */
+};
+
+typedef struct sink sink_t; /**< Streaming log sink. */
+
+int sink_accept(const char *address);
+int sink_connect(const char *address);
+size_t sink_decode(const char *buffer, size_t size, struct sink_frame *frame);
+sink_t *sink_flush(sink_t *sink);
+sink_t *sink_free(sink_t *sink);
+uint64_t sink_get_dropped(sink_t *sink);
+uint64_t sink_get_stalls(sink_t *sink);
+sink_t *sink_new(int fd, size_t capacity);
+sink_t *sink_ref(sink_t *sink);
+void sink_unref(sink_t *sink);
+sink_t *sink_write(sink_t *sink, int type, const void *data, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SINK_H */
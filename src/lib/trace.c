@@ -0,0 +1,374 @@
+/** @file */
+
+#include "lockstat.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHELINE 64
+#define CALIBRATION 10000000 /* Nanoseconds the time stamp counter is calibrated for */
+
+/*
+ * Every thread appends to a buffer of its own, padded to a cache line so
+ * threads never share the line they append to. The events before written
+ * were already written, by another thread flushing the buffer.
+ */
+struct buffer {
+	struct trace_event *events;
+	size_t length;
+	size_t written;
+	char padding[CACHELINE - sizeof(struct trace_event *) - 2 * sizeof(size_t)];
+};
+
+struct trace {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	int fd;
+	struct buffer *buffers;
+	size_t num_threads;
+	uint64_t frequency;
+	uint64_t interval;
+};
+
+static trace_t *_trace_add(trace_t *trace, unsigned long thread, int phase, int type);
+static uint64_t _trace_calibrate(void);
+static uint64_t _trace_now(clockid_t clock);
+static int _trace_write(trace_t *trace, struct buffer *buffer);
+
+static const char *phase_names[] = {
+	"execute",
+	"generate",
+	"log",
+	"sync"
+};
+
+/**
+ * Adds the beginning of a phase to the buffer of a thread.
+ *
+ * @param [in] trace The trace.
+ * @param [in] thread The thread.
+ * @param [in] phase The phase.
+ * @return The trace.
+ * @see trace_end
+ */
+trace_t *
+trace_begin(trace_t *trace, unsigned long thread, int phase)
+{
+	return _trace_add(trace, thread, phase, TRACE_TYPE_BEGIN);
+}
+
+/**
+ * Adds the end of a phase to the buffer of a thread.
+ *
+ * @param [in] trace The trace.
+ * @param [in] thread The thread.
+ * @param [in] phase The phase.
+ * @return The trace.
+ * @see trace_begin
+ */
+trace_t *
+trace_end(trace_t *trace, unsigned long thread, int phase)
+{
+	return _trace_add(trace, thread, phase, TRACE_TYPE_END);
+}
+
+/**
+ * Writes the events of the buffer of a thread not written yet to the
+ * trace, by a single append, so the buffers of the threads never
+ * interleave within each other. Any thread may flush the buffer of a
+ * thread, such as before the process exits; the buffer is only emptied
+ * by its thread, once full or once its oldest event is older than the
+ * flush interval.
+ *
+ * @param [in] trace The trace.
+ * @param [in] thread The thread.
+ * @return The trace.
+ * @see trace_set_flush_interval
+ */
+trace_t *
+trace_flush(trace_t *trace, unsigned long thread)
+{
+	int retval;
+
+	if (trace == NULL || thread >= trace->num_threads) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&trace->mutex);
+	retval = _trace_write(trace, &trace->buffers[thread]);
+	pthread_mutex_unlock(&trace->mutex);
+
+	return retval == 0 ? trace : NULL;
+}
+
+/**
+ * Frees the memory allocated for the trace. The buffers of the threads are
+ * written first.
+ *
+ * @param [in] trace The trace.
+ * @return The trace.
+ */
+trace_t *
+trace_free(trace_t *trace)
+{
+	size_t i;
+
+	if (trace == NULL)
+		return NULL;
+
+	for (i = 0; trace->buffers != NULL && i < trace->num_threads; i++) {
+		if (trace->fd != -1)
+			trace_flush(trace, i);
+
+		free(trace->buffers[i].events);
+	}
+
+	if (trace->fd != -1)
+		close(trace->fd);
+
+	free(trace->buffers);
+	pthread_mutex_destroy(&trace->mutex);
+	free(trace);
+
+	return NULL;
+}
+
+/**
+ * Returns the name of a phase.
+ *
+ * @param [in] phase The phase.
+ * @return The name of the phase.
+ */
+const char *
+trace_get_phase_name(int phase)
+{
+	if (phase < 0 || phase >= TRACE_NUM_PHASES) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return phase_names[phase];
+}
+
+/**
+ * Creates a trace. The trace is written to a file, starting with a header
+ * that relates the time stamp counter to time, and followed by the events
+ * of the threads. The time stamp counter is calibrated when the trace is
+ * created. Buffers are flushed every second by default.
+ *
+ * @param [in] path The path of the file of the trace.
+ * @param [in] num_threads The number of threads.
+ * @return A trace.
+ * @see struct trace_header
+ */
+trace_t *
+trace_new(const char *path, size_t num_threads)
+{
+	struct trace_header header;
+	trace_t *trace;
+	size_t i;
+
+	if (path == NULL || num_threads == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	trace = calloc(1, sizeof(*trace));
+	if (trace == NULL)
+		return NULL;
+
+	trace->fd = -1;
+	errno = pthread_mutex_init(&trace->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	errno = posix_memalign((void **)&trace->buffers, CACHELINE, num_threads * sizeof(*trace->buffers));
+	if (errno != 0) {
+		trace->buffers = NULL;
+		goto err;
+	}
+
+	memset(trace->buffers, 0, num_threads * sizeof(*trace->buffers));
+	trace->num_threads = num_threads;
+	for (i = 0; i < num_threads; i++) {
+		trace->buffers[i].events = malloc(TRACE_BUFSIZE * sizeof(*trace->buffers[i].events));
+		if (trace->buffers[i].events == NULL)
+			goto err;
+	}
+
+	/* Buffers are written by single appends, so they never interleave */
+	trace->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (trace->fd == -1)
+		goto err;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	header.frequency = _trace_calibrate();
+	trace->frequency = header.frequency;
+	trace->interval = header.frequency;
+	header.tsc = __builtin_ia32_rdtsc();
+	header.time = _trace_now(CLOCK_REALTIME);
+	if (write(trace->fd, &header, sizeof(header)) != sizeof(header))
+		goto err;
+
+	trace_ref(trace);
+
+	return trace;
+
+err:
+	trace_free(trace);
+
+	return NULL;
+}
+
+/**
+ * Increments the reference count of the trace.
+ *
+ * @param [in] trace The trace.
+ * @return The trace.
+ */
+trace_t *
+trace_ref(trace_t *trace)
+{
+	if (trace == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&trace->mutex);
+	trace->refcount++;
+	pthread_mutex_unlock(&trace->mutex);
+
+	return trace;
+}
+
+/**
+ * Sets the flush interval of the trace, the time after which the events
+ * buffered by a thread are written even if its buffer is not full.
+ *
+ * @param [in] trace The trace.
+ * @param [in] interval The interval in seconds, or 0 to only write full
+ *   buffers.
+ * @return The trace.
+ */
+trace_t *
+trace_set_flush_interval(trace_t *trace, unsigned long interval)
+{
+	if (trace == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	trace->interval = interval != 0 ? trace->frequency * interval : UINT64_MAX;
+
+	return trace;
+}
+
+/**
+ * Decrements the reference count of the trace.
+ *
+ * @param [in] trace The trace.
+ */
+void
+trace_unref(trace_t *trace)
+{
+	if (trace == NULL)
+		return;
+
+	pthread_mutex_lock(&trace->mutex);
+	trace->refcount--;
+	if (trace->refcount > 0) {
+		pthread_mutex_unlock(&trace->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&trace->mutex);
+	trace_free(trace);
+}
+
+/*
+ * Events are only stamped and appended, and the buffer written when full
+ * or old, so tracing costs a few cycles per phase and can be left on. An
+ * event is published by the length, for the threads flushing the buffer.
+ */
+static trace_t *
+_trace_add(trace_t *trace, unsigned long thread, int phase, int type)
+{
+	struct buffer *buffer;
+	struct trace_event *event;
+	int retval;
+
+	if (trace == NULL || thread >= trace->num_threads) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	buffer = &trace->buffers[thread];
+	event = &buffer->events[buffer->length];
+	event->tsc = __builtin_ia32_rdtsc();
+	event->thread = thread;
+	event->phase = phase;
+	event->type = type;
+	__atomic_store_n(&buffer->length, buffer->length + 1, __ATOMIC_RELEASE);
+	if (buffer->length < TRACE_BUFSIZE && event->tsc - buffer->events[0].tsc < trace->interval)
+		return trace;
+
+	pthread_mutex_lock(&trace->mutex);
+	retval = _trace_write(trace, buffer);
+	buffer->length = 0;
+	buffer->written = 0;
+	pthread_mutex_unlock(&trace->mutex);
+
+	return retval == 0 ? trace : NULL;
+}
+
+static uint64_t
+_trace_calibrate(void)
+{
+	uint64_t begin;
+	uint64_t tsc;
+	uint64_t now;
+
+	begin = _trace_now(CLOCK_MONOTONIC);
+	tsc = __builtin_ia32_rdtsc();
+	do
+		now = _trace_now(CLOCK_MONOTONIC);
+	while (now - begin < CALIBRATION);
+
+	return (__builtin_ia32_rdtsc() - tsc) * 1000000000ULL / (now - begin);
+}
+
+static uint64_t
+_trace_now(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+_trace_write(trace_t *trace, struct buffer *buffer)
+{
+	size_t length;
+	ssize_t n;
+
+	length = __atomic_load_n(&buffer->length, __ATOMIC_ACQUIRE);
+	if (length == buffer->written)
+		return 0;
+
+	n = write(trace->fd, &buffer->events[buffer->written], (length - buffer->written) * sizeof(*buffer->events));
+	buffer->written = length;
+
+	return n == -1 ? -1 : 0;
+}
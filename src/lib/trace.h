@@ -0,0 +1,68 @@
+/** @file */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_BUFSIZE 4096    /**< Number of events buffered by every thread. */
+#define TRACE_MAGIC "IOTRACE" /**< Magic of a trace, with its terminating NUL. */
+
+enum {
+	TRACE_PHASE_EXECUTE,  /**< The operation is performed. */
+	TRACE_PHASE_GENERATE, /**< The next operation is drawn. */
+	TRACE_PHASE_LOG,      /**< The operation is written to the log. */
+	TRACE_PHASE_SYNC,     /**< The log is flushed and synced. */
+	TRACE_NUM_PHASES
+};
+
+enum {
+	TRACE_TYPE_BEGIN, /**< A phase begins. */
+	TRACE_TYPE_END    /**< A phase ends. */
+};
+
+/**
+ * Header of a trace. The time stamp counter of the events is converted to
+ * time with the counter and the time the trace was created at, and the
+ * frequency of the counter.
+ */
+struct trace_header {
+	char magic[8];      /**< The magic, TRACE_MAGIC. */
+	uint64_t tsc;       /**< The time stamp counter when the trace was created. */
+	uint64_t time;      /**< The time when the trace was created, in nanoseconds since the epoch. */
+	uint64_t frequency; /**< The frequency of the time stamp counter, in hertz. */
+};
+
+/**
+ * Event of a trace. The events of a thread are written in the order they
+ * occurred, by buffer, and the buffers of the threads are interleaved.
+ */
+struct trace_event {
+	uint64_t tsc;    /**< The time stamp counter. */
+	uint32_t thread; /**< The thread. */
+	uint16_t phase;  /**< The phase. */
+	uint16_t type;   /**< The type of the event. */
+};
+
+typedef struct trace trace_t; /**< Per-thread timeline of the phases of the operations. */
+
+trace_t *trace_begin(trace_t *trace, unsigned long thread, int phase);
+trace_t *trace_end(trace_t *trace, unsigned long thread, int phase);
+trace_t *trace_flush(trace_t *trace, unsigned long thread);
+trace_t *trace_free(trace_t *trace);
+const char *trace_get_phase_name(int phase);
+trace_t *trace_new(const char *path, size_t num_threads);
+trace_t *trace_ref(trace_t *trace);
+trace_t *trace_set_flush_interval(trace_t *trace, unsigned long interval);
+void trace_unref(trace_t *trace);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H */
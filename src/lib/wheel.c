@@ -0,0 +1,413 @@
+/** @file */
+
+#include "lockstat.h"
+#include "wheel.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CALIBRATION 10000000 /* Nanoseconds the time-stamp counter is calibrated for */
+#define LEVEL_BITS 6
+#define NIL UINT32_MAX
+#define NUM_LEVELS 4
+#define NUM_SLOTS (1 << LEVEL_BITS)
+
+struct wheel {
+	pthread_mutex_t mutex;
+	size_t refcount;
+	char *elements;
+	size_t element_size;
+	uint64_t *deadlines;
+	uint32_t *next;
+	uint32_t slots[NUM_LEVELS][NUM_SLOTS];
+	size_t counts[NUM_LEVELS];
+	uint32_t due;
+	uint32_t free;
+	size_t capacity;
+	size_t length;
+	unsigned int shift;
+	uint64_t now;
+};
+
+static double cycles_per_ns = 0.0;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static void _wheel_calibrate(void);
+static void _wheel_cascade(wheel_t *wheel, int level);
+static void _wheel_insert(wheel_t *wheel, uint32_t index);
+static uint64_t _wheel_now(wheel_t *wheel);
+static void _wheel_tick(wheel_t *wheel);
+
+/**
+ * Adds an element to the wheel, to be returned by wheel_poll once a given
+ * delay has elapsed. Delays are rounded down to the resolution of the
+ * wheel, and delays beyond the span of the wheel are clamped. Adding is
+ * not synchronized; every thread uses its own wheel.
+ *
+ * @param [in] wheel The wheel.
+ * @param [in] delay The delay in nanoseconds.
+ * @param [in] element The element, which is copied.
+ * @return The wheel, or NULL if the wheel is full.
+ * @see wheel_poll
+ */
+wheel_t *
+wheel_add(wheel_t *wheel, uint64_t delay, const void *element)
+{
+	uint64_t now;
+	uint32_t index;
+
+	if (wheel == NULL || element == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (wheel->free == NIL) {
+		errno = ENOBUFS;
+		return NULL;
+	}
+
+	/* An empty wheel is not advanced by wheel_poll, so it catches up here */
+	now = _wheel_now(wheel);
+	if (wheel->length == 0)
+		wheel->now = now;
+
+	index = wheel->free;
+	wheel->free = wheel->next[index];
+	memcpy(&wheel->elements[index * wheel->element_size], element, wheel->element_size);
+	wheel->deadlines[index] = now + (uint64_t)(delay * cycles_per_ns) / (1ULL << wheel->shift);
+	wheel->length++;
+	_wheel_insert(wheel, index);
+
+	return wheel;
+}
+
+/**
+ * Removes all elements from the wheel.
+ *
+ * @param [in] wheel The wheel.
+ * @return The wheel.
+ */
+wheel_t *
+wheel_clear(wheel_t *wheel)
+{
+	size_t i;
+
+	if (wheel == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&wheel->mutex);
+	memset(wheel->slots, 0xff, sizeof(wheel->slots));
+	memset(wheel->counts, 0, sizeof(wheel->counts));
+	for (i = 0; i < wheel->capacity; i++)
+		wheel->next[i] = i + 1 < wheel->capacity ? i + 1 : NIL;
+
+	wheel->due = NIL;
+	wheel->free = 0;
+	wheel->length = 0;
+	wheel->now = _wheel_now(wheel);
+	pthread_mutex_unlock(&wheel->mutex);
+
+	return wheel;
+}
+
+/**
+ * Frees the memory allocated for the wheel.
+ *
+ * @param [in] wheel The wheel.
+ * @return The wheel.
+ */
+wheel_t *
+wheel_free(wheel_t *wheel)
+{
+	if (wheel == NULL)
+		return NULL;
+
+	free(wheel->elements);
+	free(wheel->deadlines);
+	free(wheel->next);
+	pthread_mutex_destroy(&wheel->mutex);
+	free(wheel);
+
+	return NULL;
+}
+
+/**
+ * Returns the maximum number of elements of the wheel.
+ *
+ * @param [in] wheel The wheel.
+ * @return The maximum number of elements of the wheel.
+ */
+size_t
+wheel_get_capacity(wheel_t *wheel)
+{
+	if (wheel == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return wheel->capacity;
+}
+
+/**
+ * Returns the number of elements of the wheel, due or not.
+ *
+ * @param [in] wheel The wheel.
+ * @return The number of elements of the wheel.
+ */
+size_t
+wheel_get_length(wheel_t *wheel)
+{
+	size_t length;
+
+	if (wheel == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	pthread_mutex_lock(&wheel->mutex);
+	length = wheel->length;
+	pthread_mutex_unlock(&wheel->mutex);
+
+	return length;
+}
+
+/**
+ * Creates a timing wheel. The wheel has four levels of 64 slots, so it
+ * spans 2^24 ticks of the given resolution, and is driven by the
+ * time-stamp counter, which is calibrated once per process. Elements are
+ * kept in a pool allocated up front, so adding and polling never
+ * allocate.
+ *
+ * @param [in] element_size The size of an element in bytes.
+ * @param [in] capacity The maximum number of elements.
+ * @param [in] resolution The resolution of the wheel in nanoseconds.
+ * @return A wheel.
+ */
+wheel_t *
+wheel_new(size_t element_size, size_t capacity, uint64_t resolution)
+{
+	wheel_t *wheel;
+
+	if (element_size == 0 || capacity == 0 || capacity >= NIL || resolution == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_once(&once, _wheel_calibrate);
+	wheel = calloc(1, sizeof(*wheel));
+	if (wheel == NULL)
+		return NULL;
+
+	errno = pthread_mutex_init(&wheel->mutex, NULL);
+	if (errno != 0)
+		goto err;
+
+	wheel->elements = calloc(capacity, element_size);
+	wheel->deadlines = calloc(capacity, sizeof(*wheel->deadlines));
+	wheel->next = calloc(capacity, sizeof(*wheel->next));
+	if (wheel->elements == NULL || wheel->deadlines == NULL || wheel->next == NULL)
+		goto err;
+
+	while (wheel->shift < 63 && (double)(2ULL << wheel->shift) <= resolution * cycles_per_ns)
+		wheel->shift++;
+
+	wheel->element_size = element_size;
+	wheel->capacity = capacity;
+	wheel_clear(wheel);
+	wheel_ref(wheel);
+
+	return wheel;
+
+err:
+	wheel_free(wheel);
+
+	return NULL;
+}
+
+/**
+ * Removes an element whose delay has elapsed from the wheel. The wheel
+ * advances to the current time first, a slot at a time, skipping the
+ * slots of empty levels, and stops as soon as an element is due, so a
+ * poll does a bounded amount of work and never waits.
+ *
+ * @param [in] wheel The wheel.
+ * @param [out] element The element.
+ * @return 1 if an element was due, 0 otherwise.
+ * @see wheel_add
+ */
+int
+wheel_poll(wheel_t *wheel, void *element)
+{
+	uint64_t target;
+	uint64_t mask;
+	uint32_t index;
+	int level;
+
+	if (wheel == NULL || element == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (wheel->due == NIL && wheel->length > 0) {
+		target = _wheel_now(wheel);
+		while (wheel->due == NIL && wheel->now < target) {
+			/* Levels below the first non-empty level have nothing to visit */
+			for (level = 0; level < NUM_LEVELS - 1 && wheel->counts[level] == 0; level++)
+				;
+
+			mask = (1ULL << (LEVEL_BITS * level)) - 1;
+			if ((wheel->now | mask) < target)
+				wheel->now |= mask;
+			else
+				wheel->now = target - 1;
+
+			_wheel_tick(wheel);
+		}
+	}
+
+	if (wheel->due == NIL)
+		return 0;
+
+	index = wheel->due;
+	wheel->due = wheel->next[index];
+	memcpy(element, &wheel->elements[index * wheel->element_size], wheel->element_size);
+	wheel->next[index] = wheel->free;
+	wheel->free = index;
+	wheel->length--;
+
+	return 1;
+}
+
+/**
+ * Increments the reference count of the wheel.
+ *
+ * @param [in] wheel The wheel.
+ * @return The wheel.
+ */
+wheel_t *
+wheel_ref(wheel_t *wheel)
+{
+	if (wheel == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&wheel->mutex);
+	wheel->refcount++;
+	pthread_mutex_unlock(&wheel->mutex);
+
+	return wheel;
+}
+
+/**
+ * Decrements the reference count of the wheel.
+ *
+ * @param [in] wheel The wheel.
+ */
+void
+wheel_unref(wheel_t *wheel)
+{
+	if (wheel == NULL)
+		return;
+
+	pthread_mutex_lock(&wheel->mutex);
+	wheel->refcount--;
+	if (wheel->refcount > 0) {
+		pthread_mutex_unlock(&wheel->mutex);
+		return;
+	}
+
+	pthread_mutex_unlock(&wheel->mutex);
+	wheel_free(wheel);
+}
+
+static void
+_wheel_calibrate(void)
+{
+	struct timespec begin;
+	struct timespec end;
+	uint64_t cycles;
+	uint64_t elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	cycles = __builtin_ia32_rdtsc();
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		elapsed = (end.tv_sec - begin.tv_sec) * 1000000000ULL + end.tv_nsec - begin.tv_nsec;
+	} while (elapsed < CALIBRATION);
+
+	cycles_per_ns = (double)(__builtin_ia32_rdtsc() - cycles) / elapsed;
+}
+
+static void
+_wheel_cascade(wheel_t *wheel, int level)
+{
+	uint32_t *slot;
+	uint32_t index;
+
+	slot = &wheel->slots[level][(wheel->now >> (LEVEL_BITS * level)) % NUM_SLOTS];
+	while (*slot != NIL) {
+		index = *slot;
+		*slot = wheel->next[index];
+		wheel->counts[level]--;
+		_wheel_insert(wheel, index);
+	}
+}
+
+static void
+_wheel_insert(wheel_t *wheel, uint32_t index)
+{
+	uint64_t deadline;
+	uint32_t *slot;
+	int level;
+
+	deadline = wheel->deadlines[index];
+	if (deadline <= wheel->now) {
+		wheel->next[index] = wheel->due;
+		wheel->due = index;
+		return;
+	}
+
+	if (deadline - wheel->now >= 1ULL << (LEVEL_BITS * NUM_LEVELS)) {
+		deadline = wheel->now + (1ULL << (LEVEL_BITS * NUM_LEVELS)) - 1;
+		wheel->deadlines[index] = deadline;
+	}
+
+	for (level = 0; level < NUM_LEVELS - 1 && deadline - wheel->now >= 1ULL << (LEVEL_BITS * (level + 1)); level++)
+		;
+
+	slot = &wheel->slots[level][(deadline >> (LEVEL_BITS * level)) % NUM_SLOTS];
+	wheel->next[index] = *slot;
+	*slot = index;
+	wheel->counts[level]++;
+}
+
+static uint64_t
+_wheel_now(wheel_t *wheel)
+{
+	return __builtin_ia32_rdtsc() >> wheel->shift;
+}
+
+/*
+ * Advances the wheel by a tick. Higher levels are cascaded into lower
+ * levels when the lower levels wrap around, then the elements of the
+ * current slot of the first level become due.
+ */
+static void
+_wheel_tick(wheel_t *wheel)
+{
+	int level;
+
+	wheel->now++;
+	for (level = 1; level < NUM_LEVELS && (wheel->now & ((1ULL << (LEVEL_BITS * level)) - 1)) == 0; level++)
+		_wheel_cascade(wheel, level);
+
+	_wheel_cascade(wheel, 0);
+}
@@ -0,0 +1,29 @@
+/** @file */
+
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct wheel wheel_t; /**< Hierarchical timing wheel driven by the time-stamp counter. */
+
+wheel_t *wheel_add(wheel_t *wheel, uint64_t delay, const void *element);
+wheel_t *wheel_clear(wheel_t *wheel);
+wheel_t *wheel_free(wheel_t *wheel);
+size_t wheel_get_capacity(wheel_t *wheel);
+size_t wheel_get_length(wheel_t *wheel);
+wheel_t *wheel_new(size_t element_size, size_t capacity, uint64_t resolution);
+int wheel_poll(wheel_t *wheel, void *element);
+wheel_t *wheel_ref(wheel_t *wheel);
+void wheel_unref(wheel_t *wheel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WHEEL_H */